@@ -26,7 +26,8 @@ The sequence is as described below :
  * Connection request on TCP socket (message with C_CONNECT)
  * When C_CONNECTOK received, with server parameters, create the
    raw socket, the tun and initialize a rohc_tunnel
- * Answer keepalive message of the server with a keepalive message.
+ * Answer keepalive message of the server with a keepalive message, or
+   with an acknowledgement if both peers support the data liveness
 
 Returns :
  * 0 : Finished successfully (SIG*)
@@ -36,6 +37,7 @@ Returns :
 
 #include "client_session.h"
 #include "tun_helpers.h"
+#include "bpf_filter.h"
 #include "messages.h"
 #include "tls.h"
 #include "log.h"
@@ -66,6 +68,36 @@ Returns :
 int log_max_priority = LOG_INFO;
 bool iprohc_log_stderr = true;
 
+/** The minimum delay (in seconds) before reconnecting to the server */
+#define IPROHC_CLIENT_RECONNECT_MIN  1
+/** The maximum delay (in seconds) before reconnecting to the server */
+#define IPROHC_CLIENT_RECONNECT_MAX  30
+
+
+static int iprohc_client_connect(const char *const serv_addr,
+                                 const char *const port,
+                                 const int fwmark,
+                                 struct sockaddr_in *const local_addr,
+                                 struct sockaddr_in *const remote_addr)
+	__attribute__((warn_unused_result, nonnull(1, 2, 4, 5)));
+
+static bool iprohc_client_run_session(struct iprohc_client_session *const client,
+                                      const int ctrl_sock,
+                                      const struct sockaddr_in local_addr,
+                                      const struct sockaddr_in remote_addr,
+                                      const int pollfd,
+                                      const int signal_fd,
+                                      bool *const is_client_alive)
+	__attribute__((warn_unused_result, nonnull(1, 7)));
+
+static bool iprohc_client_wait(const int pollfd,
+                               const int signal_fd,
+                               const int timeout)
+	__attribute__((warn_unused_result));
+
+static bool iprohc_client_handle_signal(const int signal_fd)
+	__attribute__((warn_unused_result));
+
 
 static void usage(void)
 {
@@ -92,6 +124,12 @@ static void usage(void)
 	       "  -m, --mark NUM      Set the netfilter fwmark for outgoing traffic\n"
 	       "  -k, --packing NUM   Override packing level sent by server\n"
 	       "  -p, --port NUM      The port of the remote server\n"
+	       "  -R, --reconnect     Reconnect to the server when the session\n"
+	       "                      is lost, and resume the ROHC contexts of\n"
+	       "                      the lost session if the server kept them\n"
+	       "  -s, --session PATH  Save the TLS session in the given file to\n"
+	       "                      resume it on next run, it is always\n"
+	       "                      resumed on reconnection\n"
 	       "  -u, --up PATH       Path to a shell script that will be run\n"
 	       "                      when tunnel is ready\n"
 	       "  -v, --version       Print the software version\n"
@@ -129,14 +167,12 @@ int main(int argc, char *argv[])
 	char pkcs12_f[PATH_MAX + 1];
 
 	struct sockaddr_in local_addr;
-	socklen_t local_addr_len;
 	struct sockaddr_in remote_addr;
-	int ctrl_sock = -1;
 
 	struct epoll_event poll_signal;
-	const size_t max_events_nr = 1;
-	struct epoll_event events[max_events_nr];
 	int pollfd;
+	int reconnect_delay;
+	bool is_session_run = false;
 
 	int ret;
 
@@ -149,8 +185,16 @@ int main(int argc, char *argv[])
 	memset(client.tun_name, 0, IFNAMSIZ);
 	memset(client.basedev, 0, IFNAMSIZ);
 	memset(client.up_script_path, 0, PATH_MAX + 1);
+	memset(client.tls_session_path, 0, PATH_MAX + 1);
+	client.tls_session_data.data = NULL;
+	client.tls_session_data.size = 0;
 	client.fwmark = 0; /* no netfilter fwmark by default */
 	client.packing = 0;
+	client.is_reconnect = false;
+	client.tun_addr = 0;
+	client.tun_netmask = 0;
+	client.has_token = false;
+	client.has_parked = false;
 	serv_addr[0] = '\0';
 	pkcs12_f[0] = '\0';
 
@@ -171,6 +215,8 @@ int main(int argc, char *argv[])
 		{ "p12",     required_argument, NULL, 'P' },
 		{ "packing", required_argument, NULL, 'k' },
 		{ "up",      required_argument, NULL, 'u' },
+		{ "session", required_argument, NULL, 's' },
+		{ "reconnect", no_argument, NULL, 'R' },
 		{ "debug",   no_argument, NULL, 'd' },
 		{ "help",    no_argument, NULL, 'h' },
 		{ "version", no_argument, NULL, 'v' },
@@ -179,7 +225,7 @@ int main(int argc, char *argv[])
 
 	do
 	{
-		c = getopt_long(argc, argv, "i:b:r:m:p:u:P:hvk:d", options, NULL);
+		c = getopt_long(argc, argv, "i:b:r:m:p:u:s:P:hvk:dR", options, NULL);
 		switch(c)
 		{
 			case 'd':
@@ -193,7 +239,7 @@ int main(int argc, char *argv[])
 	optind = 1;
 	do
 	{
-		c = getopt_long(argc, argv, "i:b:r:m:p:u:P:hvk:d", options, NULL);
+		c = getopt_long(argc, argv, "i:b:r:m:p:u:s:P:hvk:dR", options, NULL);
 		switch(c)
 		{
 			case 'i':
@@ -264,6 +310,19 @@ int main(int argc, char *argv[])
 				}
 				strncpy(client.up_script_path, optarg, PATH_MAX);
 				break;
+			case 's':
+				trace(LOG_DEBUG, "TLS session file: %s", optarg);
+				if(strlen(optarg) > PATH_MAX)
+				{
+					trace(LOG_ERR, "TLS session file path too long");
+					goto error;
+				}
+				strncpy(client.tls_session_path, optarg, PATH_MAX);
+				break;
+			case 'R':
+				trace(LOG_DEBUG, "reconnect when session is lost");
+				client.is_reconnect = true;
+				break;
 			case 'k':
 			{
 				const int num = atoi(optarg);
@@ -347,6 +406,13 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
+	/* write traces from the logger thread from now on */
+	if(!iprohc_log_start(NULL))
+	{
+		trace(LOG_ERR, "failed to start the logger thread");
+		goto close_signal_fd;
+	}
+
 
 	/*
 	 * Initialize client context
@@ -355,6 +421,16 @@ int main(int argc, char *argv[])
 	/* load certificates and key for TLS session */
 	gnutls_global_init();
 	gnutls_certificate_allocate_credentials(&(client.tls_cred));
+	ret = gnutls_priority_init(&(client.priority_cache),
+	                           IPROHC_TLS_PRIORITY_DEFAULT, NULL);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_ERR, "failed to init TLS priorities: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		gnutls_certificate_free_credentials(client.tls_cred);
+		gnutls_global_deinit();
+		goto close_signal_fd;
+	}
 	ret = load_p12(client.tls_cred, pkcs12_f, NULL);
 	if(ret < 0)
 	{
@@ -386,12 +462,133 @@ int main(int argc, char *argv[])
 	}
 
 
+	/* we want to monitor some fds */
+	pollfd = epoll_create(1);
+	if(pollfd < 0)
+	{
+		trace(LOG_ERR, "[main] failed to create epoll context: %s (%d)",
+		      strerror(errno), errno);
+		goto delete_raw;
+	}
+
+	/* will monitor the signal fd */
+	poll_signal.events = EPOLLIN;
+	memset(&poll_signal.data, 0, sizeof(poll_signal.data));
+	poll_signal.data.fd = signal_fd;
+	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, signal_fd, &poll_signal);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to add signal to epoll context: %s (%d)",
+		      strerror(errno), errno);
+		goto close_pollfd;
+	}
+
+
 	/*
-	 * DNS query
+	 * Main loop: run one session with the server, then a new one each time
+	 * it is lost if the client shall reconnect
 	 */
 
+	is_client_alive = true;
+	reconnect_delay = IPROHC_CLIENT_RECONNECT_MIN;
+	while(is_client_alive)
+	{
+		const int ctrl_sock = iprohc_client_connect(serv_addr, port, client.fwmark,
+		                                            &local_addr, &remote_addr);
+		is_session_run = false;
+		if(ctrl_sock >= 0)
+		{
+			is_session_run =
+				iprohc_client_run_session(&client, ctrl_sock, local_addr, remote_addr,
+				                          pollfd, signal_fd, &is_client_alive);
+		}
+		if(!client.is_reconnect || !is_client_alive)
+		{
+			break;
+		}
+
+		/* wait a little before reconnecting, longer and longer while the
+		 * server cannot be reached */
+		if(is_session_run)
+		{
+			reconnect_delay = IPROHC_CLIENT_RECONNECT_MIN;
+		}
+		trace(LOG_NOTICE, "[main] session lost, reconnect in %d seconds",
+		      reconnect_delay);
+		if(!iprohc_client_wait(pollfd, signal_fd, reconnect_delay * 1000))
+		{
+			is_client_alive = false;
+			break;
+		}
+		reconnect_delay *= 2;
+		if(reconnect_delay > IPROHC_CLIENT_RECONNECT_MAX)
+		{
+			reconnect_delay = IPROHC_CLIENT_RECONNECT_MAX;
+		}
+	}
+	if(client.has_parked)
+	{
+		iprohc_tunnel_contexts_free(&(client.parked));
+		client.has_parked = false;
+	}
+	gnutls_free(client.tls_session_data.data);
+	client.tls_session_data.data = NULL;
+	client.tls_session_data.size = 0;
+
+	trace(LOG_INFO, "client interrupted, interrupt established session");
+
+	if(is_session_run || client.is_reconnect)
+	{
+		exit_status = 0;
+	}
+
+close_pollfd:
+	close(pollfd);
+delete_raw:
+	close(client.raw);
+delete_tun:
+	close(client.tun);
+tls_deinit:
+	trace(LOG_INFO, "free TLS resources");
+	gnutls_certificate_free_credentials(client.tls_cred);
+	gnutls_priority_deinit(client.priority_cache);
+	gnutls_global_deinit();
+close_signal_fd:
+	close(signal_fd);
+error:
+	iprohc_log_stop();
+	closelog();
+	return exit_status;
+}
+
+
+/**
+ * @brief Connect to the server
+ *
+ * @param serv_addr         The name or address of the server
+ * @param port              The port of the server
+ * @param fwmark            The netfilter firewall mark (no mark if 0)
+ * @param[out] local_addr   The local address and port used to contact the server
+ * @param[out] remote_addr  The address and port of the server
+ * @return                  The TCP socket connected to the server,
+ *                          -1 if no connection was established
+ */
+static int iprohc_client_connect(const char *const serv_addr,
+                                 const char *const port,
+                                 const int fwmark,
+                                 struct sockaddr_in *const local_addr,
+                                 struct sockaddr_in *const remote_addr)
+{
 	struct addrinfo *result, *rp;
 	struct addrinfo hints;
+	socklen_t local_addr_len;
+	int ctrl_sock = -1;
+	int ret;
+
+
+	/*
+	 * DNS query
+	 */
 
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = AF_INET;    /* Allow IPv4 */
@@ -404,7 +601,7 @@ int main(int argc, char *argv[])
 	{
 		trace(LOG_ERR, "Unable to connect to %s: %s (%d)", serv_addr,
 		      gai_strerror(ret), ret);
-		goto delete_raw;
+		goto error;
 	}
 
 
@@ -439,15 +636,14 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		if(client.fwmark > 0)
+		if(fwmark > 0)
 		{
-			ret = setsockopt(ctrl_sock, SOL_SOCKET, SO_MARK, &client.fwmark,
-			                 sizeof(int));
+			ret = setsockopt(ctrl_sock, SOL_SOCKET, SO_MARK, &fwmark, sizeof(int));
 			if(ret != 0)
 			{
 				trace(LOG_DEBUG, "failed to set netfilter firewall mark %d on "
 				      "socket to connect to server with " IPV4_ADDR_FMT ": %s (%d)",
-				      client.fwmark, IPV4_ADDR(raddr), strerror(errno), errno);
+				      fwmark, IPV4_ADDR(raddr), strerror(errno), errno);
 			}
 		}
 
@@ -467,13 +663,13 @@ int main(int argc, char *argv[])
 				strerror(errno), errno);
 		goto free_addrinfo;
 	}
-	memcpy(&remote_addr, rp->ai_addr, sizeof(struct sockaddr_in));
+	memcpy(remote_addr, rp->ai_addr, sizeof(struct sockaddr_in));
 
 	/* retrieve the local address and port used to contact the server
 	 * (will be used to filter ingress data traffic later on) */
 	local_addr_len = sizeof(struct sockaddr_in);
-	memset(&local_addr, 0, local_addr_len);
-	ret = getsockname(ctrl_sock, (struct sockaddr *) &local_addr, &local_addr_len);
+	memset(local_addr, 0, local_addr_len);
+	ret = getsockname(ctrl_sock, (struct sockaddr *) local_addr, &local_addr_len);
 	if(ret != 0)
 	{
 		trace(LOG_ERR, "failed to determine the local IP address used to "
@@ -481,26 +677,83 @@ int main(int argc, char *argv[])
 		goto close_tcp;
 	}
 	trace(LOG_INFO, "local address %u.%u.%u.%u:%u is used to contact server",
-			(ntohl(local_addr.sin_addr.s_addr) >> 24) & 0xff,
-			(ntohl(local_addr.sin_addr.s_addr) >> 16) & 0xff,
-			(ntohl(local_addr.sin_addr.s_addr) >>  8) & 0xff,
-			(ntohl(local_addr.sin_addr.s_addr) >>  0) & 0xff,
-			ntohs(local_addr.sin_port));
+			(ntohl(local_addr->sin_addr.s_addr) >> 24) & 0xff,
+			(ntohl(local_addr->sin_addr.s_addr) >> 16) & 0xff,
+			(ntohl(local_addr->sin_addr.s_addr) >>  8) & 0xff,
+			(ntohl(local_addr->sin_addr.s_addr) >>  0) & 0xff,
+			ntohs(local_addr->sin_port));
+
+	freeaddrinfo(result);
+	return ctrl_sock;
+
+close_tcp:
+	close(ctrl_sock);
+free_addrinfo:
+	freeaddrinfo(result);
+error:
+	return -1;
+}
+
+
+/**
+ * @brief Run one session with the server until it is lost or interrupted
+ *
+ * If the client shall reconnect, the ROHC contexts of the session are kept
+ * when the session is lost, so that the next session may resume them.
+ *
+ * @param client               The context of the client
+ * @param ctrl_sock            The TCP socket connected to the server
+ * @param local_addr           The local address used to contact the server
+ * @param remote_addr          The address of the server
+ * @param pollfd               The epoll context that monitors the signal fd
+ * @param signal_fd            The fd that receives the UNIX signals
+ * @param[out] is_client_alive false if the client was asked to shutdown
+ * @return                     true if the session was started,
+ *                             false if a problem occurred before
+ */
+static bool iprohc_client_run_session(struct iprohc_client_session *const client,
+                                      const int ctrl_sock,
+                                      const struct sockaddr_in local_addr,
+                                      const struct sockaddr_in remote_addr,
+                                      const int pollfd,
+                                      const int signal_fd,
+                                      bool *const is_client_alive)
+{
+	bool is_session_alive;
+
+	/* let the kernel drop the IP/ROHC traffic that is not exchanged with the
+	 * server on the addresses used for the control channel */
+	if(!iprohc_bpf_filter_attach(client->raw, false, local_addr.sin_addr.s_addr,
+	                             &remote_addr.sin_addr.s_addr, 1))
+	{
+		trace(LOG_ERR, "failed to filter ingress traffic on RAW socket");
+		goto close_tcp;
+	}
 
 	/*
 	 * Initialize session context
 	 */
 
-	if(!iprohc_session_new(&(client.session), iprohc_client_send_conn_request,
-	                       handle_message, client_send_disconnect_msg, &client,
-	                       GNUTLS_CLIENT, client.tls_cred, NULL,
+	if(!iprohc_session_new(&(client->session), iprohc_client_send_conn_request,
+	                       handle_message, client_send_disconnect_msg, client,
+	                       GNUTLS_CLIENT, client->tls_cred, client->priority_cache,
 	                       ctrl_sock, local_addr.sin_addr, remote_addr,
-	                       client.raw, client.tun, 0))
+	                       client->raw, client->tun, 0))
 	{
 		trace(LOG_ERR, "failed to init session context");
 		goto close_tcp;
 	}
-	ctrl_sock = -1; /* avoid double close() */
+
+	/* resume the TLS session of the previous connection if any: the one kept
+	 * in memory on reconnection, the one saved in file on startup */
+	if(client->tls_session_data.size == 0 &&
+	   strcmp(client->tls_session_path, "") != 0 &&
+	   !tls_load_session(client->tls_session_path, &(client->tls_session_data)))
+	{
+		trace(LOG_ERR, "failed to load TLS session");
+		goto free_session;
+	}
+	tls_resume_session(client->session.tls_session, &(client->tls_session_data));
 
 	/* stop writing logs on stderr */
 	iprohc_log_stderr = false;
@@ -510,47 +763,23 @@ int main(int argc, char *argv[])
 	 * Start client thread
 	 */
 
-	if(!iprohc_session_start(&(client.session)))
+	if(!iprohc_session_start(&(client->session)))
 	{
 		trace(LOG_ERR, "failed to start tunnel thread");
 		goto free_session;
 	}
 	trace(LOG_INFO, "tunnel thread started");
 
-
-	/*
-	 * Main loop
-	 */
-
-	/* we want to monitor some fds */
-	pollfd = epoll_create(1);
-	if(pollfd < 0)
-	{
-		trace(LOG_ERR, "[main] failed to create epoll context: %s (%d)",
-		      strerror(errno), errno);
-		goto stop_session;
-	}
-
-	/* will monitor the signal fd */
-	poll_signal.events = EPOLLIN;
-	memset(&poll_signal.data, 0, sizeof(poll_signal.data));
-	poll_signal.data.fd = signal_fd;
-	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, signal_fd, &poll_signal);
-	if(ret != 0)
-	{
-		trace(LOG_ERR, "[main] failed to add signal to epoll context: %s (%d)",
-		      strerror(errno), errno);
-		goto close_pollfd;
-	}
-
 	/* wait for the client to be stopped */
-	is_client_alive = true;
-	while(is_client_alive)
+	is_session_alive = true;
+	while(is_session_alive && (*is_client_alive))
 	{
-		const int timeout = 10 * 1000; /* in milliseconds */
+		const int timeout = 1000; /* in milliseconds */
+		struct epoll_event event;
+		int ret;
 
 		/* wait for events */
-		ret = epoll_wait(pollfd, events, max_events_nr, timeout);
+		ret = epoll_wait(pollfd, &event, 1, timeout);
 		if(ret < 0)
 		{
 			if(errno == EINTR)
@@ -559,126 +788,170 @@ int main(int argc, char *argv[])
 				continue;
 			}
 			trace(LOG_ERR, "epoll_wait failed: %s (%d)", strerror(errno), errno);
-			goto stop_session;
+			*is_client_alive = false;
 		}
 		else if(ret == 0)
 		{
 			/* check that client thread is still running */
-			if(AO_load_acquire_read(&(client.session.is_thread_running)))
+			if(AO_load_acquire_read(&(client->session.is_thread_running)))
 			{
 				/* still running */
 				continue;
 			}
 
 			/* client is not running any more, we can check its status */
-			if(client.session.status == IPROHC_SESSION_PENDING_DELETE)
+			if(client->session.status == IPROHC_SESSION_PENDING_DELETE)
 			{
-				/* stop client session */
-				trace(LOG_INFO, "[main] stop session");
-				if(!iprohc_session_stop(&(client.session)))
-				{
-					trace(LOG_ERR, "[main] failed to stop session");
-				}
-				is_client_alive = false;
+				is_session_alive = false;
 			}
-
-			continue;
 		}
-
-		/* UNIX signal received? */
-		if(events[0].data.fd == signal_fd)
+		else if(event.data.fd == signal_fd)
 		{
-	   	struct signalfd_siginfo signal_infos;
-
-			ret = read(signal_fd, &signal_infos, sizeof(struct signalfd_siginfo));
-			if(ret < 0)
-			{
-				trace(LOG_ERR, "failed to retrieve information about the received "
-				      "UNIX signal: %s (%d)", strerror(errno), errno);
-				continue;
-			}
-			else if(ret != sizeof(struct signalfd_siginfo))
-			{
-				trace(LOG_ERR, "failed to retrieve information about the received "
-				      "UNIX signal: only %d bytes expected while %zu bytes received",
-				      ret, sizeof(struct signalfd_siginfo));
-				continue;
-			}
-
-			switch(signal_infos.ssi_signo)
-			{
-				case SIGINT:
-				case SIGTERM:
-				case SIGQUIT:
-				{
-					if(signal_infos.ssi_pid > 0)
-					{
-						/* killed by known process */
-						trace(LOG_NOTICE, "process with PID %d run by user with UID "
-						      "%d asked the IP/ROHC client to shutdown",
-						      signal_infos.ssi_pid, signal_infos.ssi_uid);
-					}
-					else
-					{
-						/* killed by unknown process */
-						trace(LOG_NOTICE, "user with UID %d asked the IP/ROHC client "
-						      "to shutdown", signal_infos.ssi_uid);
-					}
-					is_client_alive = false;
-					continue;
-				}
-				default:
-				{
-					trace(LOG_NOTICE, "ignore unexpected signal %d",
-					      signal_infos.ssi_signo);
-					break;
-				}
-			}
+			/* UNIX signal received */
+			*is_client_alive = iprohc_client_handle_signal(signal_fd);
 		}
 	}
 
-	trace(LOG_INFO, "client interrupted, interrupt established session");
-
-	exit_status = 0;
-
-close_pollfd:
-	close(pollfd);
-stop_session:
 	trace(LOG_INFO, "stop session");
-	if(!iprohc_session_stop(&(client.session)))
+	if(!iprohc_session_stop(&(client->session)))
 	{
 		trace(LOG_ERR, "failed to stop session");
 	}
-	if(!iprohc_tunnel_free(&(client.session.tunnel)))
+
+	/* keep the ROHC contexts of the lost session for the next one */
+	if((*is_client_alive) && client->is_reconnect && client->has_token &&
+	   client->session.tunnel.is_init)
+	{
+		trace(LOG_INFO, "keep ROHC contexts for the next session");
+		iprohc_tunnel_detach_contexts(&(client->session.tunnel), &(client->parked));
+		client->has_parked = true;
+	}
+	client->has_token = false;
+
+	if(!iprohc_tunnel_free(&(client->session.tunnel)))
 	{
 		trace(LOG_ERR, "failed to reset tunnel context");
 	}
+	trace(LOG_INFO, "close session");
+	if(!iprohc_session_free(&(client->session)))
+	{
+		trace(LOG_ERR, "failed to reset session context");
+	}
+
+	return true;
+
 free_session:
 	trace(LOG_INFO, "close session");
-	if(!iprohc_session_free(&(client.session)))
+	if(!iprohc_session_free(&(client->session)))
 	{
 		trace(LOG_ERR, "failed to reset session context");
 	}
+	return false;
 close_tcp:
-	if(ctrl_sock >= 0)
+	trace(LOG_INFO, "close TCP connection");
+	close(ctrl_sock);
+	return false;
+}
+
+
+/**
+ * @brief Wait for the given time, unless the client is asked to shutdown
+ *
+ * @param pollfd     The epoll context that monitors the signal fd
+ * @param signal_fd  The fd that receives the UNIX signals
+ * @param timeout    The time to wait (in milliseconds)
+ * @return           true if the time elapsed,
+ *                   false if the client was asked to shutdown
+ */
+static bool iprohc_client_wait(const int pollfd,
+                               const int signal_fd,
+                               const int timeout)
+{
+	struct timespec start;
+	struct timespec now;
+	int remaining = timeout;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(remaining > 0)
 	{
-		trace(LOG_INFO, "close TCP connection");
-		close(ctrl_sock);
+		struct epoll_event event;
+		int ret;
+
+		ret = epoll_wait(pollfd, &event, 1, remaining);
+		if(ret < 0 && errno != EINTR)
+		{
+			trace(LOG_ERR, "epoll_wait failed: %s (%d)", strerror(errno), errno);
+			return false;
+		}
+		else if(ret > 0 && event.data.fd == signal_fd &&
+		        !iprohc_client_handle_signal(signal_fd))
+		{
+			return false;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		remaining = timeout - ((now.tv_sec - start.tv_sec) * 1000 +
+		                       (now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Handle the UNIX signal received on the signal fd
+ *
+ * @param signal_fd  The fd that receives the UNIX signals
+ * @return           false if the client was asked to shutdown,
+ *                   true otherwise
+ */
+static bool iprohc_client_handle_signal(const int signal_fd)
+{
+	struct signalfd_siginfo signal_infos;
+	int ret;
+
+	ret = read(signal_fd, &signal_infos, sizeof(struct signalfd_siginfo));
+	if(ret < 0)
+	{
+		trace(LOG_ERR, "failed to retrieve information about the received "
+		      "UNIX signal: %s (%d)", strerror(errno), errno);
+		return true;
+	}
+	else if(ret != sizeof(struct signalfd_siginfo))
+	{
+		trace(LOG_ERR, "failed to retrieve information about the received "
+		      "UNIX signal: only %d bytes expected while %zu bytes received",
+		      ret, sizeof(struct signalfd_siginfo));
+		return true;
+	}
+
+	switch(signal_infos.ssi_signo)
+	{
+		case SIGINT:
+		case SIGTERM:
+		case SIGQUIT:
+		{
+			if(signal_infos.ssi_pid > 0)
+			{
+				/* killed by known process */
+				trace(LOG_NOTICE, "process with PID %d run by user with UID "
+				      "%d asked the IP/ROHC client to shutdown",
+				      signal_infos.ssi_pid, signal_infos.ssi_uid);
+			}
+			else
+			{
+				/* killed by unknown process */
+				trace(LOG_NOTICE, "user with UID %d asked the IP/ROHC client "
+				      "to shutdown", signal_infos.ssi_uid);
+			}
+			return false;
+		}
+		default:
+		{
+			trace(LOG_NOTICE, "ignore unexpected signal %d",
+			      signal_infos.ssi_signo);
+			return true;
+		}
 	}
-free_addrinfo:
-	freeaddrinfo(result);
-delete_raw:
-	close(client.raw);
-delete_tun:
-	close(client.tun);
-tls_deinit:
-	trace(LOG_INFO, "free TLS resources");
-	gnutls_certificate_free_credentials(client.tls_cred);
-	gnutls_global_deinit();
-/*close_signal_fd:*/
-	close(signal_fd);
-error:
-	closelog();
-	return exit_status;
 }
 
@@ -25,6 +25,7 @@
 #define IPROHC_CLIENT_SESSION__H
 
 #include "session.h"
+#include "tlv.h"
 
 #include <limits.h>
 #include <net/if.h>
@@ -33,6 +34,13 @@
 struct iprohc_client_session
 {
 	gnutls_certificate_credentials_t tls_cred;
+	gnutls_priority_t priority_cache;
+
+	/** The path to the file that saves the TLS session between connections */
+	char tls_session_path[PATH_MAX + 1];
+	/** The TLS session of the last connection, resumed by the next one, empty
+	 *  if none */
+	gnutls_datum_t tls_session_data;
 
 	struct iprohc_session session; /**< The generic session context */
 
@@ -53,6 +61,21 @@ struct iprohc_client_session
 	size_t basedev_mtu;                /** The MTU of the base interface */
 
 	char up_script_path[PATH_MAX + 1]; /**< The path to the UP script */
+
+	/** Whether to reconnect to the server when the session is lost */
+	bool is_reconnect;
+	/** The address of the TUN interface, 0 if not set yet */
+	uint32_t tun_addr;
+	/** The length of the network mask of the TUN interface */
+	uint8_t tun_netmask;
+
+	/** Whether the server gave a token to resume the session */
+	bool has_token;
+	uint8_t token[IPROHC_SESSION_TOKEN_LEN]; /**< The session token */
+
+	/** Whether ROHC contexts of the lost session are kept for the next one */
+	bool has_parked;
+	struct iprohc_tunnel_contexts parked;    /**< The kept ROHC contexts */
 };
 
 #endif
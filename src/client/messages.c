@@ -16,6 +16,7 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -26,6 +27,7 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include "rohc_tunnel.h"
 #include "tun_helpers.h"
 #include "messages.h"
+#include "tls.h"
 #include "log.h"
 
 
@@ -52,7 +54,9 @@ bool iprohc_client_send_conn_request(struct iprohc_session *const session)
 	command_len = 1;
 
 	trace(LOG_INFO, "send connect message to remote peer");
-	is_ok = gen_connrequest(client->packing, command + 1, &tlv_len);
+	is_ok = gen_connrequest(client->packing,
+	                        client->has_parked ? client->token : NULL,
+	                        command + 1, &tlv_len);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to generate the connect messsage for remote peer");
@@ -127,18 +131,57 @@ bool handle_message(struct iprohc_session *const session,
 
 			case C_KEEPALIVE:
 			{
-				const char command[1] = { C_KEEPALIVE };
+				char command[1] = { C_KEEPALIVE };
 
 				trace(LOG_DEBUG, "Received keepalive");
 				parsed_len++;
 
-				/* send keepalive */
+				/* answer the keepalive: a server that supports it expects an
+				 * acknowledgement, the older ones expect a keepalive */
+				if(session->tunnel.params.capabilities & IPROHC_CAP_DATA_LIVENESS)
+				{
+					command[0] = C_KEEPALIVE_ACK;
+				}
 				trace(LOG_DEBUG, "Keepalive !");
 				gnutls_record_send(session->tls_session, command, 1);
 
 				break;
 			}
 
+			case C_KEEPALIVE_ACK:
+			{
+				trace(LOG_DEBUG, "Keepalive answered by server");
+				parsed_len++;
+				break;
+			}
+
+			case C_PARAMS_UPDATE:
+			{
+				struct tunnel_params tp;
+				size_t tlv_len;
+
+				parsed_len++;
+
+				/* the session thread applies the new parameters once the
+				 * message is handled */
+				if(!parse_params_update(buf + i + 1, length - i - 1, &tp, &tlv_len))
+				{
+					trace(LOG_ERR, "failed to parse PARAMS_UPDATE message from "
+					      "server, abort");
+					goto error;
+				}
+				parsed_len += tlv_len;
+				trace(LOG_INFO, "server changed the tunnel parameters: packing %d, "
+				      "keepalive %zu seconds", tp.packing, tp.keepalive_timeout);
+				if(!iprohc_session_update_params(session, tp.packing,
+				                                 tp.keepalive_timeout, false))
+				{
+					goto error;
+				}
+
+				break;
+			}
+
 			case C_CONNECT_KO:
 			{
 				trace(LOG_ERR, "Wrong protocol version, please update client or server");
@@ -171,6 +214,10 @@ static bool handle_okconnect(struct iprohc_client_session *const client,
 	struct in_addr debug_addr;
 	struct tunnel_params tp;
 	char message[1] = { C_CONNECT_DONE };
+	uint8_t token[IPROHC_SESSION_TOKEN_LEN];
+	bool has_token;
+	bool is_resumed;
+	bool is_addr_changed = false;
 
 	int pid;
 	int status;
@@ -183,7 +230,8 @@ static bool handle_okconnect(struct iprohc_client_session *const client,
 	*parsed_len = 0;
 
 	/* Parse options received in tlv form from the server */
-	is_ok = parse_connect(data, data_len, &tp, parsed_len);
+	is_ok = parse_connect(data, data_len, &tp, token, &has_token, &is_resumed,
+	                      parsed_len);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to parse connect message received from the server");
@@ -220,6 +268,39 @@ static bool handle_okconnect(struct iprohc_client_session *const client,
 		goto error;
 	}
 
+	/* resume the ROHC contexts of the lost session if the server resumed its
+	 * own ones, start with the new contexts otherwise */
+	if(client->has_parked)
+	{
+		if(!is_resumed)
+		{
+			trace(LOG_INFO, "server did not resume the ROHC contexts of the "
+			      "previous session, start with new contexts");
+			iprohc_tunnel_contexts_free(&(client->parked));
+		}
+		else if(tp.local_address != client->tun_addr ||
+		        !iprohc_tunnel_can_resume(&(client->session.tunnel),
+		                                  &(client->parked)))
+		{
+			trace(LOG_WARNING, "server resumed the ROHC contexts of the previous "
+			      "session, but the tunnel parameters changed meanwhile, start "
+			      "with new contexts");
+			iprohc_tunnel_contexts_free(&(client->parked));
+		}
+		else
+		{
+			iprohc_tunnel_attach_contexts(&(client->session.tunnel),
+			                              &(client->parked));
+			trace(LOG_INFO, "ROHC contexts of previous session resumed");
+		}
+		client->has_parked = false;
+	}
+	client->has_token = has_token;
+	if(has_token)
+	{
+		memcpy(client->token, token, IPROHC_SESSION_TOKEN_LEN);
+	}
+
 	/* update the period of the keepalive timer */
 	if(!iprohc_session_update_keepalive(&(client->session),
 	                                    client->session.tunnel.params.keepalive_timeout))
@@ -230,27 +311,61 @@ static bool handle_okconnect(struct iprohc_client_session *const client,
 		goto free_tunnel;
 	}
 
-	/* set the IPv4 address on the TUN interface */
-	is_ok = set_ip4(client->tun_itf_id, tp.local_address, 24);
-	if(!is_ok)
+	/* set the IPv4 address on the TUN interface, unless the previous session
+	 * already did it */
+	if(tp.local_address != client->tun_addr || tp.netmask != client->tun_netmask)
 	{
-		trace(LOG_ERR, "failed to set IP address on TUN interface");
-		goto free_tunnel;
+		if(client->tun_addr != 0 &&
+		   !del_ip4(client->tun_itf_id, client->tun_addr, client->tun_netmask))
+		{
+			trace(LOG_WARNING, "failed to remove the IP address of the previous "
+			      "session from TUN interface");
+		}
+		client->tun_addr = 0;
+
+		is_ok = set_ip4(client->tun_itf_id, tp.local_address, tp.netmask);
+		if(!is_ok)
+		{
+			trace(LOG_ERR, "failed to set IP address on TUN interface");
+			goto free_tunnel;
+		}
+		client->tun_addr = tp.local_address;
+		client->tun_netmask = tp.netmask;
+		is_addr_changed = true;
 	}
 
 	gnutls_record_send(client->session.tls_session, message, 1);
 
+	/* keep the TLS session to resume it on next connection, and save it for
+	 * the next run if asked to: the server sent its session ticket before the
+	 * CONNECT_OK message */
+	if(!tls_keep_session(client->session.tls_session, &(client->tls_session_data)))
+	{
+		trace(LOG_WARNING, "failed to keep TLS session, next connection will "
+		      "perform a full TLS handshake");
+	}
+	else if(strcmp(client->tls_session_path, "") != 0 &&
+	        !tls_save_session(&(client->tls_session_data), client->tls_session_path))
+	{
+		trace(LOG_WARNING, "failed to save TLS session, next run will perform "
+		      "a full TLS handshake");
+	}
+
 	trace(LOG_INFO, "session is now fully established");
 	client->session.status = IPROHC_SESSION_CONNECTED;
 
-	/* up script */
-	if(strcmp(client->up_script_path, "") != 0)
+	/* up script, only once per address */
+	if(is_addr_changed && strcmp(client->up_script_path, "") != 0)
 	{
 		if((pid = fork()) == 0)
 		{
 			char*argv[4] = { "sh", "-c", client->up_script_path, NULL };
 
+			char netmask_str[4];
+
 			setenv("ifconfig_local", inet_ntoa(debug_addr), 1);
+			snprintf(netmask_str, sizeof(netmask_str), "%d", tp.netmask);
+			setenv("ifconfig_netmask", netmask_str, 1);
 			execve("/bin/sh", argv, __environ);
 		}
 
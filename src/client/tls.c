@@ -22,8 +22,16 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <gnutls/x509.h>
 #include <gnutls/pkcs12.h>
 #include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include "log.h"
+#include "utils.h"
+#include "tls.h"
 
 int generate_dh_params (gnutls_dh_params_t*dh_params)
 {
@@ -305,3 +313,177 @@ error:
 	return ret;
 }
 
+
+/**
+ * @brief Load the TLS session saved by a previous connection to the server
+ *
+ * A missing file is not an error: the TLS handshake is then a full one.
+ *
+ * @param path       The path to the file that holds the saved session
+ * @param[out] data  The saved session, empty if none was saved, to be
+ *                   released with gnutls_free()
+ * @return           true if no session was saved or the saved session was
+ *                   successfully loaded, false if a problem occurred
+ */
+bool tls_load_session(const char *const path, gnutls_datum_t *const data)
+{
+	struct stat st;
+	size_t read_len;
+	ssize_t len;
+	int fd;
+
+	data->data = NULL;
+	data->size = 0;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		if(errno == ENOENT)
+		{
+			trace(LOG_INFO, "no saved TLS session in '%s', perform a full "
+			      "handshake", path);
+			return true;
+		}
+		trace(LOG_ERR, "failed to open TLS session file '%s': %s (%d)", path,
+		      strerror(errno), errno);
+		goto error;
+	}
+	if(fstat(fd, &st) != 0)
+	{
+		trace(LOG_ERR, "failed to get the size of TLS session file '%s': "
+		      "%s (%d)", path, strerror(errno), errno);
+		goto close_file;
+	}
+	if(st.st_size == 0)
+	{
+		trace(LOG_INFO, "empty TLS session file '%s', perform a full "
+		      "handshake", path);
+		close(fd);
+		return true;
+	}
+	if(st.st_size < 0 || st.st_size > TLS_SESSION_MAX_LEN)
+	{
+		trace(LOG_ERR, "TLS session file '%s' is too large: %lld bytes, %u "
+		      "bytes at most", path, (long long) st.st_size, TLS_SESSION_MAX_LEN);
+		goto close_file;
+	}
+
+	data->data = gnutls_malloc(st.st_size);
+	if(data->data == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for TLS session");
+		goto close_file;
+	}
+	for(read_len = 0; read_len < st.st_size; read_len += len)
+	{
+		len = read(fd, data->data + read_len, st.st_size - read_len);
+		if(len < 0)
+		{
+			trace(LOG_ERR, "failed to read TLS session file '%s': %s (%d)", path,
+			      strerror(errno), errno);
+			goto free_data;
+		}
+		else if(len == 0)
+		{
+			trace(LOG_ERR, "TLS session file '%s' was truncated while read",
+			      path);
+			goto free_data;
+		}
+	}
+	data->size = st.st_size;
+	close(fd);
+
+	return true;
+
+free_data:
+	gnutls_free(data->data);
+	data->data = NULL;
+close_file:
+	close(fd);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Try to resume the given TLS session on the next handshake
+ *
+ * An outdated or corrupted session is not fatal: it is dropped, and the
+ * handshake is then a full one.
+ *
+ * @param session   The TLS session that will connect to the server
+ * @param data      The TLS session of a previous connection, empty if none
+ */
+void tls_resume_session(gnutls_session_t session, gnutls_datum_t *const data)
+{
+	int ret;
+
+	if(data->size == 0)
+	{
+		return;
+	}
+
+	ret = gnutls_session_set_data(session, data->data, data->size);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_NOTICE, "ignore the previous TLS session: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		gnutls_free(data->data);
+		data->data = NULL;
+		data->size = 0;
+		return;
+	}
+	trace(LOG_INFO, "try to resume the previous TLS session");
+}
+
+
+/**
+ * @brief Keep the given TLS session in memory for the next connection
+ *
+ * @param session        The established TLS session
+ * @param[in,out] data   The TLS session kept so far, replaced by the given
+ *                       one, to be released with gnutls_free()
+ * @return               true if the session was successfully kept,
+ *                       false if a problem occurred
+ */
+bool tls_keep_session(gnutls_session_t session, gnutls_datum_t *const data)
+{
+	gnutls_datum_t new_data;
+	int ret;
+
+	ret = gnutls_session_get_data2(session, &new_data);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_ERR, "failed to get TLS session data: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		return false;
+	}
+	gnutls_free(data->data);
+	data->data = new_data.data;
+	data->size = new_data.size;
+
+	return true;
+}
+
+
+/**
+ * @brief Save the TLS session for the next connection to the server
+ *
+ * The file is replaced atomically, and only readable by its owner since
+ * it holds the session secrets.
+ *
+ * @param data  The TLS session kept in memory
+ * @param path  The path to the file that holds the saved session
+ * @return      true if the session was successfully saved,
+ *              false if a problem occurred
+ */
+bool tls_save_session(const gnutls_datum_t *const data, const char *const path)
+{
+	if(!iprohc_file_replace(path, data->data, data->size, 0600))
+	{
+		return false;
+	}
+	trace(LOG_DEBUG, "TLS session saved in '%s'", path);
+
+	return true;
+}
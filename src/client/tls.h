@@ -16,9 +16,25 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 
+#include <stdbool.h>
 #include <gnutls/gnutls.h>
 
 int generate_dh_params (gnutls_dh_params_t*dh_params);
 
 int load_p12(gnutls_certificate_credentials_t xcred, char*p12_file, char*password);
 
+/** The maximum length (in bytes) of a saved TLS session */
+#define TLS_SESSION_MAX_LEN  (64U * 1024U)
+
+bool tls_load_session(const char *const path, gnutls_datum_t *const data)
+	__attribute__((nonnull(1, 2), warn_unused_result));
+
+void tls_resume_session(gnutls_session_t session, gnutls_datum_t *const data)
+	__attribute__((nonnull(2)));
+
+bool tls_keep_session(gnutls_session_t session, gnutls_datum_t *const data)
+	__attribute__((nonnull(2), warn_unused_result));
+
+bool tls_save_session(const gnutls_datum_t *const data, const char *const path)
+	__attribute__((nonnull(1, 2), warn_unused_result));
+
@@ -0,0 +1,192 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   bpf_filter.c
+ * @brief  Kernel-side filtering of the IP/ROHC traffic on data sockets
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ *
+ * The classic BPF programs built here run on packets that start with their
+ * IPv4 header, as received on the raw socket or on the AF_PACKET sockets of
+ * the ingress fanout group. They drop in kernel the malformed packets and
+ * the packets from unknown sources, so that they never wake up the process.
+ *
+ * All jumps of the programs are short forward jumps: a check that succeeds
+ * skips the 'drop' instruction that follows it. The programs thus never hit
+ * the 8-bit limit of the jump offsets whatever the number of sources.
+ */
+
+#include "bpf_filter.h"
+
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+
+/** The IP protocol number used for IP/ROHC packets */
+#define IPROHC_BPF_IPPROTO  142
+
+/** The value returned by the filter to accept the whole packet */
+#define IPROHC_BPF_ACCEPT  0xffffffffU
+
+/** The value returned by the filter to drop the packet */
+#define IPROHC_BPF_DROP  0U
+
+/** The number of instructions in the filter before the list of sources */
+#define IPROHC_BPF_HEADER_MAX_LEN  15U
+
+
+/**
+ * @brief Build and attach a filter for IP/ROHC traffic to the given socket
+ *
+ * The filter accepts IPv4 packets without options, of IP protocol 142, with
+ * the given destination address and one of the given source addresses. A new
+ * filter replaces the previous one atomically: no packet is received without
+ * filter while the set of sources is updated.
+ *
+ * @param sock          The socket to filter
+ * @param host_only     Whether to also drop the packets that are not
+ *                      destinated to the host (for AF_PACKET sockets)
+ * @param dst_addr      The accepted destination address (in network byte
+ *                      order), INADDR_ANY for any destination
+ * @param src_addrs     The accepted source addresses (in network byte order),
+ *                      NULL for any source
+ * @param src_addrs_nr  The number of accepted source addresses, 0 to drop all
+ *                      packets if src_addrs is not NULL
+ * @return              true if the filter was successfully attached,
+ *                      false if a problem occurred
+ */
+bool iprohc_bpf_filter_attach(const int sock,
+                              const bool host_only,
+                              const uint32_t dst_addr,
+                              const uint32_t *const src_addrs,
+                              const size_t src_addrs_nr)
+{
+	struct sock_filter *insns;
+	struct sock_fprog prog;
+	size_t insns_max_nr;
+	size_t len = 0;
+	bool with_sources = (src_addrs != NULL);
+	bool is_ok = false;
+	int ret;
+
+	insns_max_nr = IPROHC_BPF_HEADER_MAX_LEN + 1 + 2 * src_addrs_nr + 1;
+	if(with_sources && insns_max_nr > BPF_MAXINSNS)
+	{
+		/* too many sources for one filter, let user space filter sources */
+		trace(LOG_NOTICE, "too many sources (%zu) for kernel filter, filter on "
+		      "IP headers only", src_addrs_nr);
+		with_sources = false;
+	}
+	if(!with_sources)
+	{
+		insns_max_nr = IPROHC_BPF_HEADER_MAX_LEN + 1;
+	}
+
+	insns = calloc(insns_max_nr, sizeof(struct sock_filter));
+	if(insns == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for %zu BPF instructions",
+		      insns_max_nr);
+		goto error;
+	}
+
+	/* packets sent by the host or for other hosts are not for us */
+	if(host_only)
+	{
+		insns[len++] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+		insns[len++] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_HOST, 1, 0);
+		insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+	}
+
+	/* IPv4 header without option, and at least one byte of payload */
+	insns[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+	insns[len++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, sizeof(struct iphdr), 1, 0);
+	insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+	insns[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0);
+	insns[len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x45, 1, 0);
+	insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+
+	/* IP/ROHC protocol */
+	insns[len++] = (struct sock_filter)
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct iphdr, protocol));
+	insns[len++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPROHC_BPF_IPPROTO, 1, 0);
+	insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+
+	/* destination address */
+	if(dst_addr != INADDR_ANY)
+	{
+		insns[len++] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct iphdr, daddr));
+		insns[len++] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(dst_addr), 1, 0);
+		insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+	}
+
+	/* source addresses: accept on first match, drop if none matches */
+	if(with_sources)
+	{
+		insns[len++] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct iphdr, saddr));
+		for(size_t i = 0; i < src_addrs_nr; i++)
+		{
+			insns[len++] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(src_addrs[i]), 0, 1);
+			insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_ACCEPT);
+		}
+		insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_DROP);
+	}
+	else
+	{
+		insns[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, IPROHC_BPF_ACCEPT);
+	}
+	assert(len <= insns_max_nr);
+
+	/* replace the current filter if any */
+	prog.len = len;
+	prog.filter = insns;
+	ret = setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+	                 sizeof(struct sock_fprog));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to attach %zu-instruction filter to socket: "
+		      "%s (%d)", len, strerror(errno), errno);
+		goto free_insns;
+	}
+	trace(LOG_DEBUG, "%zu-instruction filter attached to socket for %zu sources",
+	      len, with_sources ? src_addrs_nr : 0);
+
+	is_ok = true;
+
+free_insns:
+	free(insns);
+error:
+	return is_ok;
+}
+
@@ -0,0 +1,40 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   bpf_filter.h
+ * @brief  Kernel-side filtering of the IP/ROHC traffic on data sockets
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ */
+
+#ifndef IPROHC_COMMON_BPF_FILTER__H
+#define IPROHC_COMMON_BPF_FILTER__H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+bool iprohc_bpf_filter_attach(const int sock,
+                              const bool host_only,
+                              const uint32_t dst_addr,
+                              const uint32_t *const src_addrs,
+                              const size_t src_addrs_nr)
+	__attribute__((warn_unused_result));
+
+#endif
+
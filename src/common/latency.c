@@ -0,0 +1,145 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   latency.c
+ * @brief  The histograms of the latencies of the data path
+ */
+
+#include "latency.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+
+/**
+ * @brief Get the largest latency counted in the given bucket
+ *
+ * @param bucket  The index of the bucket
+ * @return        The upper bound (in nanoseconds) of the bucket
+ */
+static uint64_t iprohc_latency_bucket_max(const size_t bucket)
+{
+	const size_t sub_nr = (1U << IPROHC_LATENCY_SUB_BITS);
+	size_t msb;
+
+	if(bucket < sub_nr)
+	{
+		return ((uint64_t) (bucket + 1)) <<
+		       (IPROHC_LATENCY_MIN_BITS - IPROHC_LATENCY_SUB_BITS);
+	}
+
+	msb = (bucket >> IPROHC_LATENCY_SUB_BITS) + IPROHC_LATENCY_MIN_BITS - 1;
+	return ((uint64_t) (sub_nr + (bucket & (sub_nr - 1)) + 1)) <<
+	       (msb - IPROHC_LATENCY_SUB_BITS);
+}
+
+
+/**
+ * @brief Get the given percentile of the latencies of the histogram
+ *
+ * The percentile is rounded up to the upper bound of its bucket, but never
+ * exceeds the largest latency recorded.
+ *
+ * @param histo       The histogram
+ * @param percentile  The percentile, 99.9 for example
+ * @return            The percentile (in nanoseconds),
+ *                    0 if no latency was recorded
+ */
+uint64_t iprohc_latency_percentile(const struct iprohc_latency *const histo,
+                                   const double percentile)
+{
+	uint64_t rank;
+	uint64_t seen_nr = 0;
+	size_t i;
+
+	if(histo->count == 0)
+	{
+		return 0;
+	}
+
+	/* the rank of the percentile, at least the first latency */
+	rank = (uint64_t) (histo->count * percentile / 100.0 + 0.5);
+	if(rank == 0)
+	{
+		rank = 1;
+	}
+
+	for(i = 0; i < IPROHC_LATENCY_BUCKETS_NR; i++)
+	{
+		seen_nr += histo->buckets[i];
+		if(seen_nr >= rank)
+		{
+			const uint64_t bucket_max = iprohc_latency_bucket_max(i);
+			return (bucket_max < histo->max_ns ? bucket_max : histo->max_ns);
+		}
+	}
+
+	return histo->max_ns;
+}
+
+
+/**
+ * @brief Add the latencies of one histogram to another
+ *
+ * @param histo  The histogram to add to
+ * @param other  The histogram to add
+ */
+void iprohc_latency_merge(struct iprohc_latency *const histo,
+                          const struct iprohc_latency *const other)
+{
+	size_t i;
+
+	for(i = 0; i < IPROHC_LATENCY_BUCKETS_NR; i++)
+	{
+		histo->buckets[i] += other->buckets[i];
+	}
+	histo->count += other->count;
+	histo->sum_ns += other->sum_ns;
+	if(other->max_ns > histo->max_ns)
+	{
+		histo->max_ns = other->max_ns;
+	}
+}
+
+
+/**
+ * @brief Describe the percentiles of the given histogram
+ *
+ * @param histo    The histogram
+ * @param buf      The buffer for the description
+ * @param buf_len  The length of the buffer, IPROHC_LATENCY_DESCR_MAX_LEN is
+ *                 enough
+ * @return         true if the description fits in the buffer,
+ *                 false if it was truncated
+ */
+bool iprohc_latency_format(const struct iprohc_latency *const histo,
+                           char *const buf,
+                           const size_t buf_len)
+{
+	int ret;
+
+	ret = snprintf(buf, buf_len, "p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+	               "max %.1f us, %" PRIu64 " samples",
+	               iprohc_latency_percentile(histo, 50.0) / 1000.0,
+	               iprohc_latency_percentile(histo, 99.0) / 1000.0,
+	               iprohc_latency_percentile(histo, 99.9) / 1000.0,
+	               histo->max_ns / 1000.0, histo->count);
+
+	return (ret >= 0 && ((size_t) ret) < buf_len);
+}
+
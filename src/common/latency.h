@@ -0,0 +1,146 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   latency.h
+ * @brief  The histograms of the latencies of the data path
+ */
+
+#ifndef IPROHC_COMMON_LATENCY__H
+#define IPROHC_COMMON_LATENCY__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/** The number of buckets per power of 2, as a number of bits */
+#define IPROHC_LATENCY_SUB_BITS  2U
+
+/** The latencies (in nanoseconds) below 2^IPROHC_LATENCY_MIN_BITS share
+ *  the buckets of the first power of 2 */
+#define IPROHC_LATENCY_MIN_BITS  7U
+
+/** The latencies (in nanoseconds) from 2^IPROHC_LATENCY_MAX_BITS, about 4
+ *  seconds, are counted in the last bucket */
+#define IPROHC_LATENCY_MAX_BITS  32U
+
+/** The number of buckets of one histogram */
+#define IPROHC_LATENCY_BUCKETS_NR \
+	((IPROHC_LATENCY_MAX_BITS - IPROHC_LATENCY_MIN_BITS + 1) << \
+	 IPROHC_LATENCY_SUB_BITS)
+
+/** The length of the description of a histogram */
+#define IPROHC_LATENCY_DESCR_MAX_LEN  100U
+
+
+/**
+ * @brief The log-linear histogram of one latency
+ *
+ * Every power of 2 of nanoseconds is split in 2^IPROHC_LATENCY_SUB_BITS
+ * buckets of the same width, so the percentiles are known within 25% with
+ * a few hundred bytes per histogram. Recording a latency is a few integer
+ * operations, the histogram is not locked.
+ */
+struct iprohc_latency
+{
+	uint64_t buckets[IPROHC_LATENCY_BUCKETS_NR]; /**< The latencies per bucket */
+	uint64_t count;   /**< The number of latencies recorded */
+	uint64_t sum_ns;  /**< The sum of the latencies (in nanoseconds) */
+	uint64_t max_ns;  /**< The largest latency (in nanoseconds) */
+};
+
+
+/**
+ * @brief Get the current time to compute latencies
+ *
+ * @return  The time (in nanoseconds) of the monotonic clock
+ */
+static inline uint64_t iprohc_latency_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t) now.tv_sec) * 1000000000U + now.tv_nsec;
+}
+
+
+/**
+ * @brief Get the bucket of the given latency
+ *
+ * @param ns  The latency (in nanoseconds)
+ * @return    The index of the bucket
+ */
+static inline size_t iprohc_latency_bucket(const uint64_t ns)
+{
+	size_t msb;
+	size_t bucket;
+
+	if(ns < (1U << IPROHC_LATENCY_MIN_BITS))
+	{
+		return (ns >> (IPROHC_LATENCY_MIN_BITS - IPROHC_LATENCY_SUB_BITS));
+	}
+
+	msb = 63 - __builtin_clzll(ns);
+	bucket = ((msb - IPROHC_LATENCY_MIN_BITS + 1) << IPROHC_LATENCY_SUB_BITS) +
+	         ((ns >> (msb - IPROHC_LATENCY_SUB_BITS)) &
+	          ((1U << IPROHC_LATENCY_SUB_BITS) - 1));
+	if(bucket >= IPROHC_LATENCY_BUCKETS_NR)
+	{
+		bucket = IPROHC_LATENCY_BUCKETS_NR - 1;
+	}
+
+	return bucket;
+}
+
+
+/**
+ * @brief Record one latency in the given histogram
+ *
+ * @param histo  The histogram
+ * @param ns     The latency (in nanoseconds)
+ */
+static inline void iprohc_latency_record(struct iprohc_latency *const histo,
+                                         const uint64_t ns)
+{
+	histo->buckets[iprohc_latency_bucket(ns)]++;
+	histo->count++;
+	histo->sum_ns += ns;
+	if(ns > histo->max_ns)
+	{
+		histo->max_ns = ns;
+	}
+}
+
+
+uint64_t iprohc_latency_percentile(const struct iprohc_latency *const histo,
+                                   const double percentile)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_latency_merge(struct iprohc_latency *const histo,
+                          const struct iprohc_latency *const other)
+	__attribute__((nonnull(1, 2)));
+
+bool iprohc_latency_format(const struct iprohc_latency *const histo,
+                           char *const buf,
+                           const size_t buf_len)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+#endif
+
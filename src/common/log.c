@@ -0,0 +1,706 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   log.c
+ * @brief  The asynchronous writing of traces in syslog or in a file
+ *
+ * Every thread that prints traces gets its own ring buffer on its first
+ * trace. The thread formats the trace and copies it in its ring with its
+ * priority and timestamp, without lock. It wakes the logger thread up
+ * through an eventfd only when its ring was empty, once per burst of traces.
+ * The logger thread empties the rings and writes the records in syslog or
+ * in the log file, without holding the lock of the list of rings meanwhile.
+ * A trace that does not fit in a full ring is dropped, counted, and the
+ * drops are reported in logs and in the metrics.
+ *
+ * The ring of a thread that ends is released once the logger thread wrote
+ * its last records, or at once if the logger thread stopped. The rings of
+ * the threads that still run when the logger thread stops are kept, they
+ * may still be written. The traces printed while the logger thread does not
+ * run are written in syslog at once, as before.
+ */
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic_ops.h>
+
+
+/** The size (in bytes) of the ring of every thread, a power of two */
+#define IPROHC_LOG_RING_SIZE  8192U
+
+/** The maximum length (in bytes) of one trace */
+#define IPROHC_LOG_MSG_MAX  1024U
+
+/** The length of a record aligned on 8 bytes */
+#define IPROHC_LOG_ALIGN(len)  (((len) + 7U) & ~((size_t) 7U))
+
+
+/** One trace in the ring of a thread */
+struct iprohc_log_record
+{
+	uint32_t len;          /**< The length of the record, padding included */
+	int priority;          /**< The priority of the trace, -1 for the unused
+	                            end of the ring */
+	struct timespec time;  /**< The time the trace was printed at */
+	char msg[];            /**< The NUL-terminated trace */
+};
+
+/** The ring of the traces of one thread */
+struct iprohc_log_ring
+{
+	struct iprohc_log_ring *next;  /**< The next ring in the list */
+	volatile AO_t head;            /**< The write position, by the thread */
+	volatile AO_t tail;            /**< The read position, by the logger */
+	volatile AO_t dropped_nr;      /**< The number of traces dropped */
+	size_t dropped_reported;       /**< The drops already reported */
+	volatile AO_t is_orphan;       /**< Whether the thread ended */
+	bool is_released;              /**< Whether the logger thread wrote the
+	                                    last records of the ended thread */
+	unsigned char data[IPROHC_LOG_RING_SIZE]
+		__attribute__((aligned(8))); /**< The records */
+};
+
+/** The logger thread and the rings it empties */
+static struct
+{
+	pthread_mutex_t lock;           /**< Protect the list of rings and the
+	                                     requests to the logger thread */
+	int wakeup_fd;                  /**< Wake the logger thread up */
+	struct iprohc_log_ring *rings;  /**< The rings of all threads */
+	pthread_key_t ring_key;         /**< Tell the logger when a thread ends */
+	pthread_t thread;               /**< The logger thread */
+	volatile AO_t is_running;       /**< Whether traces go through the rings */
+	bool is_stopping;               /**< Whether the logger thread shall stop */
+	bool is_stopped;                /**< Whether the logger thread stopped, the
+	                                     threads then release their rings */
+	bool is_reopen;                 /**< Whether the log file shall be reopened */
+	volatile AO_t dropped_nr;       /**< The traces dropped by all threads */
+	char path[1024];                /**< The log file, empty for syslog */
+	FILE *file;                     /**< The log file, NULL for syslog, only
+	                                     used by the logger thread while it
+	                                     runs */
+} iprohc_logger = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wakeup_fd = -1,
+	.rings = NULL,
+	.is_running = 0,
+	.is_stopping = false,
+	.is_stopped = false,
+	.is_reopen = false,
+	.dropped_nr = 0,
+	.path = "",
+	.file = NULL,
+};
+
+/** The least important priority of the traces of the current thread in
+ *  addition to the global log_max_priority, -1 if none */
+__thread int iprohc_log_thread_priority = -1;
+
+/** The ring of the current thread, NULL until its first trace */
+static __thread struct iprohc_log_ring *iprohc_log_thread_ring = NULL;
+
+/** The names of the priorities in the log file */
+static const char *const iprohc_log_priority_names[] = {
+	"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+
+static struct iprohc_log_ring * iprohc_log_ring_get(void)
+	__attribute__((warn_unused_result));
+
+static void iprohc_log_ring_orphan(void *ring);
+
+static bool iprohc_log_ring_push(struct iprohc_log_ring *const ring,
+                                 const int priority,
+                                 const char *const msg,
+                                 const size_t msg_len)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
+static void iprohc_log_ring_drain(struct iprohc_log_ring *const ring)
+	__attribute__((nonnull(1)));
+
+static void iprohc_log_wakeup(void);
+
+static void iprohc_log_write(const int priority,
+                             const struct timespec *const time,
+                             const char *const msg)
+	__attribute__((nonnull(2, 3)));
+
+static void * iprohc_log_run(void *arg);
+
+
+/**
+ * @brief Start the logger thread
+ *
+ * Shall be called once, before the threads that print traces are created.
+ *
+ * @param path  The file to write logs to, NULL or empty for syslog
+ * @return      true if the logger thread was successfully started,
+ *              false if a problem occurred
+ */
+bool iprohc_log_start(const char *const path)
+{
+	sigset_t all_signals;
+	sigset_t old_signals;
+	int ret;
+
+	if(path != NULL && path[0] != '\0')
+	{
+		strncpy(iprohc_logger.path, path, sizeof(iprohc_logger.path) - 1);
+		iprohc_logger.path[sizeof(iprohc_logger.path) - 1] = '\0';
+		iprohc_logger.file = fopen(iprohc_logger.path, "a");
+		if(iprohc_logger.file == NULL)
+		{
+			trace(LOG_ERR, "failed to open log file '%s': %s (%d)",
+			      iprohc_logger.path, strerror(errno), errno);
+			goto error;
+		}
+	}
+
+	/* the threads that print traces may wake the logger thread up while it
+	 * stops, so the eventfd is never closed */
+	if(iprohc_logger.wakeup_fd < 0)
+	{
+		iprohc_logger.wakeup_fd = eventfd(0, EFD_CLOEXEC);
+		if(iprohc_logger.wakeup_fd < 0)
+		{
+			trace(LOG_ERR, "failed to create the wakeup of the logger thread: "
+			      "%s (%d)", strerror(errno), errno);
+			goto close_file;
+		}
+	}
+
+	ret = pthread_key_create(&iprohc_logger.ring_key, iprohc_log_ring_orphan);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to create the key of log rings: %s (%d)",
+		      strerror(ret), ret);
+		goto close_file;
+	}
+
+	/* the logger thread shall not catch the signals of the main thread */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+	iprohc_logger.is_stopping = false;
+	iprohc_logger.is_stopped = false;
+	AO_store_release_write(&iprohc_logger.is_running, 1);
+	ret = pthread_create(&iprohc_logger.thread, NULL, iprohc_log_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if(ret != 0)
+	{
+		AO_store_release_write(&iprohc_logger.is_running, 0);
+		trace(LOG_ERR, "failed to create the logger thread: %s (%d)",
+		      strerror(ret), ret);
+		goto delete_key;
+	}
+
+	return true;
+
+delete_key:
+	pthread_key_delete(iprohc_logger.ring_key);
+close_file:
+	if(iprohc_logger.file != NULL)
+	{
+		fclose(iprohc_logger.file);
+		iprohc_logger.file = NULL;
+	}
+error:
+	return false;
+}
+
+
+/**
+ * @brief Ask the logger thread to reopen the log file, once rotated
+ */
+void iprohc_log_reopen(void)
+{
+	pthread_mutex_lock(&iprohc_logger.lock);
+	iprohc_logger.is_reopen = true;
+	pthread_mutex_unlock(&iprohc_logger.lock);
+	iprohc_log_wakeup();
+}
+
+
+/**
+ * @brief Write the pending traces, then stop the logger thread
+ *
+ * The next traces are written in syslog at once. The threads that still
+ * run, detached ones for example, keep their rings until they end: they may
+ * be writing a trace in them meanwhile.
+ */
+void iprohc_log_stop(void)
+{
+	struct iprohc_log_ring **ring;
+	struct iprohc_log_ring *cur;
+
+	if(!AO_load_acquire_read(&iprohc_logger.is_running))
+	{
+		return;
+	}
+
+	/* new traces are written at once, the logger thread writes the pending
+	 * ones before it stops */
+	AO_store_release_write(&iprohc_logger.is_running, 0);
+	pthread_mutex_lock(&iprohc_logger.lock);
+	iprohc_logger.is_stopping = true;
+	pthread_mutex_unlock(&iprohc_logger.lock);
+	iprohc_log_wakeup();
+	pthread_join(iprohc_logger.thread, NULL);
+
+	/* write the records of the threads that ended after the last pass of the
+	 * logger thread, no thread removes rings from the list meanwhile */
+	pthread_mutex_lock(&iprohc_logger.lock);
+	cur = iprohc_logger.rings;
+	pthread_mutex_unlock(&iprohc_logger.lock);
+	for( ; cur != NULL; cur = cur->next)
+	{
+		iprohc_log_ring_drain(cur);
+	}
+
+	/* release the rings of the ended threads and the one of the current
+	 * thread, the other threads release their own rings when they end */
+	pthread_mutex_lock(&iprohc_logger.lock);
+	iprohc_logger.is_stopped = true;
+	ring = &iprohc_logger.rings;
+	while((*ring) != NULL)
+	{
+		cur = *ring;
+		if(AO_load_acquire_read(&cur->is_orphan) || cur == iprohc_log_thread_ring)
+		{
+			*ring = cur->next;
+			free(cur);
+		}
+		else
+		{
+			ring = &(cur->next);
+		}
+	}
+	pthread_mutex_unlock(&iprohc_logger.lock);
+	if(iprohc_log_thread_ring != NULL)
+	{
+		pthread_setspecific(iprohc_logger.ring_key, NULL);
+		iprohc_log_thread_ring = NULL;
+	}
+
+	if(iprohc_logger.file != NULL)
+	{
+		fclose(iprohc_logger.file);
+		iprohc_logger.file = NULL;
+	}
+}
+
+
+/**
+ * @brief Get the number of traces dropped because their ring was full
+ *
+ * @return  The number of traces dropped since the start
+ */
+size_t iprohc_log_dropped_nr(void)
+{
+	return AO_load(&iprohc_logger.dropped_nr);
+}
+
+
+/**
+ * @brief Print a trace in logs
+ *
+ * Use the trace() macro instead, it skips the traces of disabled priorities
+ * before their arguments are evaluated.
+ *
+ * @param priority  The priority of the trace
+ * @param format    The format string of the trace
+ */
+void iprohc_log(const int priority, const char *const format, ...)
+{
+	struct iprohc_log_ring *ring;
+	char msg[IPROHC_LOG_MSG_MAX];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(msg, IPROHC_LOG_MSG_MAX, format, args);
+	va_end(args);
+	if(len < 0)
+	{
+		return;
+	}
+	else if(((size_t) len) >= IPROHC_LOG_MSG_MAX)
+	{
+		len = IPROHC_LOG_MSG_MAX - 1;
+	}
+	while(len > 0 && msg[len - 1] == '\n')
+	{
+		len--;
+	}
+	msg[len] = '\0';
+
+	if(AO_load_acquire_read(&iprohc_logger.is_running))
+	{
+		ring = iprohc_log_ring_get();
+		if(ring != NULL)
+		{
+			/* a full ring drops the trace, the logger thread reports it */
+			if(!iprohc_log_ring_push(ring, priority, msg, len))
+			{
+				AO_fetch_and_add1(&ring->dropped_nr);
+				AO_fetch_and_add1(&iprohc_logger.dropped_nr);
+			}
+			return;
+		}
+	}
+
+	/* no logger thread, or no memory for the ring of the thread */
+	syslog(LOG_MAKEPRI(LOG_DAEMON, priority), "%s", msg);
+	if(iprohc_log_stderr && priority <= LOG_NOTICE)
+	{
+		fprintf(stderr, "%s\n", msg);
+	}
+}
+
+
+/**
+ * @brief Get the ring of the current thread, create it on first use
+ *
+ * @return  The ring of the current thread, NULL if no memory is available
+ */
+static struct iprohc_log_ring * iprohc_log_ring_get(void)
+{
+	struct iprohc_log_ring *ring = iprohc_log_thread_ring;
+
+	if(ring == NULL)
+	{
+		ring = calloc(1, sizeof(struct iprohc_log_ring));
+		if(ring == NULL)
+		{
+			return NULL;
+		}
+		pthread_mutex_lock(&iprohc_logger.lock);
+		ring->next = iprohc_logger.rings;
+		iprohc_logger.rings = ring;
+		pthread_mutex_unlock(&iprohc_logger.lock);
+
+		/* the logger releases the ring once the thread ended */
+		pthread_setspecific(iprohc_logger.ring_key, ring);
+		iprohc_log_thread_ring = ring;
+	}
+
+	return ring;
+}
+
+
+/**
+ * @brief Tell the logger thread that the thread of the given ring ended
+ *
+ * The logger thread releases the ring once it wrote its last records, the
+ * ring is released at once if the logger thread stopped.
+ *
+ * @param ring  The ring of the thread that ended
+ */
+static void iprohc_log_ring_orphan(void *ring)
+{
+	struct iprohc_log_ring *orphan = ring;
+	struct iprohc_log_ring **cur;
+
+	pthread_mutex_lock(&iprohc_logger.lock);
+	if(!iprohc_logger.is_stopped)
+	{
+		AO_store_release_write(&orphan->is_orphan, 1);
+		orphan = NULL;
+	}
+	else
+	{
+		for(cur = &iprohc_logger.rings; (*cur) != NULL && (*cur) != orphan;
+		    cur = &((*cur)->next))
+		{
+		}
+		if((*cur) != NULL)
+		{
+			*cur = orphan->next;
+		}
+	}
+	pthread_mutex_unlock(&iprohc_logger.lock);
+
+	free(orphan);
+}
+
+
+/**
+ * @brief Copy a trace in the given ring
+ *
+ * Called by the thread of the ring only.
+ *
+ * @param ring      The ring of the current thread
+ * @param priority  The priority of the trace
+ * @param msg       The formatted trace
+ * @param msg_len   The length of the trace, without the final NUL byte
+ * @return          true if the trace was copied,
+ *                  false if the ring is full
+ */
+static bool iprohc_log_ring_push(struct iprohc_log_ring *const ring,
+                                 const int priority,
+                                 const char *const msg,
+                                 const size_t msg_len)
+{
+	const size_t rec_len =
+		IPROHC_LOG_ALIGN(sizeof(struct iprohc_log_record) + msg_len + 1);
+	const size_t old_head = AO_load(&ring->head);
+	size_t head = old_head;
+	const size_t tail = AO_load_acquire_read(&ring->tail);
+	size_t offset = head & (IPROHC_LOG_RING_SIZE - 1);
+	size_t needed_len = rec_len;
+	struct iprohc_log_record *record;
+
+	/* the record does not fit at the end of the ring, skip it */
+	if(offset + rec_len > IPROHC_LOG_RING_SIZE)
+	{
+		needed_len += IPROHC_LOG_RING_SIZE - offset;
+	}
+	if(head - tail + needed_len > IPROHC_LOG_RING_SIZE)
+	{
+		return false;
+	}
+	if(offset + rec_len > IPROHC_LOG_RING_SIZE)
+	{
+		record = (struct iprohc_log_record *) (ring->data + offset);
+		record->len = IPROHC_LOG_RING_SIZE - offset;
+		record->priority = -1;
+		head += IPROHC_LOG_RING_SIZE - offset;
+		offset = 0;
+	}
+
+	record = (struct iprohc_log_record *) (ring->data + offset);
+	record->len = rec_len;
+	record->priority = priority;
+	clock_gettime(CLOCK_REALTIME, &record->time);
+	memcpy(record->msg, msg, msg_len + 1);
+
+	/* publish the record to the logger thread, then wake it up if the ring
+	 * was empty: the logger thread checks the head again once it published
+	 * the tail, so one of the two threads sees the other */
+	AO_store_release_write(&ring->head, head + rec_len);
+	AO_nop_full();
+	if(AO_load(&ring->tail) == old_head)
+	{
+		iprohc_log_wakeup();
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Write all the records of the given ring
+ *
+ * Called by the logger thread only.
+ *
+ * @param ring  The ring to empty
+ */
+static void iprohc_log_ring_drain(struct iprohc_log_ring *const ring)
+{
+	size_t head = AO_load_acquire_read(&ring->head);
+	size_t tail = AO_load(&ring->tail);
+	size_t dropped_nr;
+
+	while(tail != head)
+	{
+		while(tail != head)
+		{
+			const struct iprohc_log_record *const record =
+				(struct iprohc_log_record *) (ring->data +
+				                              (tail & (IPROHC_LOG_RING_SIZE - 1)));
+			if(record->priority >= 0)
+			{
+				iprohc_log_write(record->priority, &record->time, record->msg);
+			}
+			tail += record->len;
+		}
+
+		/* give the room back to the thread, then check for the records
+		 * published meanwhile that did not wake the logger thread up */
+		AO_store_release_write(&ring->tail, tail);
+		AO_nop_full();
+		head = AO_load_acquire_read(&ring->head);
+	}
+
+	dropped_nr = AO_load(&ring->dropped_nr);
+	if(dropped_nr != ring->dropped_reported)
+	{
+		struct timespec now;
+		char msg[128];
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(msg, sizeof(msg), "%zu traces were dropped because their "
+		         "thread printed them faster than they were written",
+		         dropped_nr - ring->dropped_reported);
+		iprohc_log_write(LOG_WARNING, &now, msg);
+		ring->dropped_reported = dropped_nr;
+	}
+}
+
+
+/**
+ * @brief Wake the logger thread up
+ */
+static void iprohc_log_wakeup(void)
+{
+	const uint64_t one = 1;
+
+	/* the counter of the eventfd cannot overflow in practice, a failure is
+	 * harmless: the logger thread is already woken up */
+	if(write(iprohc_logger.wakeup_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		return;
+	}
+}
+
+
+/**
+ * @brief Write one trace in syslog or in the log file
+ *
+ * @param priority  The priority of the trace
+ * @param time      The time the trace was printed at
+ * @param msg       The trace
+ */
+static void iprohc_log_write(const int priority,
+                             const struct timespec *const time,
+                             const char *const msg)
+{
+	if(iprohc_logger.file != NULL)
+	{
+		struct tm tm;
+		char date[32];
+
+		localtime_r(&time->tv_sec, &tm);
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(iprohc_logger.file, "%s.%06ld [%s] %s\n", date,
+		        time->tv_nsec / 1000, iprohc_log_priority_names[priority & 7],
+		        msg);
+	}
+	else
+	{
+		syslog(LOG_MAKEPRI(LOG_DAEMON, priority), "%s", msg);
+	}
+
+	if(iprohc_log_stderr && priority <= LOG_NOTICE)
+	{
+		fprintf(stderr, "%s\n", msg);
+	}
+}
+
+
+/**
+ * @brief The main loop of the logger thread
+ *
+ * @param arg  Unused
+ * @return     NULL
+ */
+static void * iprohc_log_run(void *arg __attribute__((unused)))
+{
+	bool is_stopping;
+
+	do
+	{
+		struct iprohc_log_ring *rings;
+		struct iprohc_log_ring *cur;
+		struct iprohc_log_ring **ring;
+		bool is_reopen;
+		bool is_released = false;
+		uint64_t wakeups_nr;
+
+		/* sleep until a ring is no longer empty or a request comes, an
+		 * interrupted wait only causes a useless check of the rings */
+		if(read(iprohc_logger.wakeup_fd, &wakeups_nr, sizeof(wakeups_nr)) !=
+		   sizeof(wakeups_nr))
+		{
+			wakeups_nr = 0;
+		}
+
+		/* get the requests and the rings, new rings are only added in front
+		 * of the list and only the logger thread removes rings from it, so
+		 * the rings are written without lock */
+		pthread_mutex_lock(&iprohc_logger.lock);
+		is_stopping = iprohc_logger.is_stopping;
+		is_reopen = iprohc_logger.is_reopen;
+		iprohc_logger.is_reopen = false;
+		rings = iprohc_logger.rings;
+		pthread_mutex_unlock(&iprohc_logger.lock);
+
+		/* reopen the log file if it was rotated */
+		if(is_reopen && iprohc_logger.file != NULL)
+		{
+			fclose(iprohc_logger.file);
+			iprohc_logger.file = fopen(iprohc_logger.path, "a");
+			if(iprohc_logger.file == NULL)
+			{
+				syslog(LOG_MAKEPRI(LOG_DAEMON, LOG_ERR), "failed to reopen log "
+				       "file '%s', write logs in syslog: %s (%d)",
+				       iprohc_logger.path, strerror(errno), errno);
+			}
+		}
+
+		/* empty the rings, the rings of the threads that ended are released
+		 * once their last records are written */
+		for(cur = rings; cur != NULL; cur = cur->next)
+		{
+			const bool is_orphan = AO_load_acquire_read(&cur->is_orphan);
+
+			iprohc_log_ring_drain(cur);
+			if(is_orphan)
+			{
+				cur->is_released = true;
+				is_released = true;
+			}
+		}
+		if(iprohc_logger.file != NULL)
+		{
+			fflush(iprohc_logger.file);
+		}
+
+		if(is_released)
+		{
+			pthread_mutex_lock(&iprohc_logger.lock);
+			ring = &iprohc_logger.rings;
+			while((*ring) != NULL)
+			{
+				cur = *ring;
+				if(cur->is_released)
+				{
+					*ring = cur->next;
+					free(cur);
+				}
+				else
+				{
+					ring = &(cur->next);
+				}
+			}
+			pthread_mutex_unlock(&iprohc_logger.lock);
+		}
+	}
+	while(!is_stopping);
+
+	return NULL;
+}
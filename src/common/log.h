@@ -23,33 +23,55 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdarg.h>
 #include <stdbool.h>
 
+/**
+ * @brief The least important priority of the traces built in
+ *
+ * The traces of lower importance, and the packet dumps if LOG_DEBUG is
+ * excluded, are removed at compile time. Release builds may define it to
+ * LOG_INFO for example.
+ */
+#ifndef IPROHC_LOG_MIN_LEVEL
+#  define IPROHC_LOG_MIN_LEVEL  LOG_DEBUG
+#endif
+
 extern int log_max_priority;
+extern __thread int iprohc_log_thread_priority;
 extern bool iprohc_log_stderr;
 
-static inline void trace(int priority, const char *format, ...)
-	__attribute__((format(printf, 2, 3)));
+/**
+ * @brief Whether the traces of the given priority are written in logs
+ *
+ * A thread may raise the priority for its own traces only, the thread of a
+ * session does so when debug is enabled for the session.
+ */
+#define iprohc_log_is_enabled(priority) \
+	((priority) <= IPROHC_LOG_MIN_LEVEL && \
+	 ((priority) <= log_max_priority || \
+	  (priority) <= iprohc_log_thread_priority))
+
+/** Print a trace in logs if its priority is enabled */
+#define trace(priority, format, ...) \
+	do \
+	{ \
+		if(iprohc_log_is_enabled(priority)) \
+		{ \
+			iprohc_log((priority), format, ##__VA_ARGS__); \
+		} \
+	} \
+	while(0)
 
-static inline void trace(int priority, const char *format, ...)
-{
-	va_list args;
+bool iprohc_log_start(const char *const path)
+	__attribute__((warn_unused_result));
 
-	if(priority <= log_max_priority)
-	{
-		va_start(args, format);
-		vsyslog(LOG_MAKEPRI(LOG_DAEMON, priority), format, args);
-		va_end(args);
+void iprohc_log_reopen(void);
 
-		if(iprohc_log_stderr && priority <= LOG_NOTICE)
-		{
-			va_start(args, format);
-			vfprintf(stderr, format, args);
-			fprintf(stderr, "\n");
-			va_end(args);
-		}
-	}
+void iprohc_log_stop(void);
 
-}
+size_t iprohc_log_dropped_nr(void)
+	__attribute__((warn_unused_result));
 
+void iprohc_log(const int priority, const char *const format, ...)
+	__attribute__((format(printf, 2, 3), nonnull(2)));
 
 #endif
 
@@ -0,0 +1,74 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   probes.h
+ * @brief  The static tracepoints (USDT probes) of the tunnel data path
+ *
+ * The probes are built in when sys/sdt.h is available (HAVE_SYS_SDT_H, so
+ * config.h shall be included first). A probe is a single NOP while no
+ * tracer is attached, bpftrace or perf attach to them in the "iprohc"
+ * provider, for example:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/iprohc_server:iprohc:frame_flush
+ *                { @reasons[arg2] = count(); }'
+ *
+ * The probes and their arguments:
+ *  - tun_read(fd, len): an IP packet was read on the TUN interface
+ *  - compress(uncomp_len, comp_len, ns): an IP packet was compressed
+ *  - frame_append(pkts_nr, frame_len): a ROHC packet was added to the
+ *    packing frame
+ *  - frame_flush(pkts_nr, frame_len, reason): the packing frame was sent,
+ *    reason is one of iprohc_flush_reason_t
+ *  - frame_recv(fd, len): a packing frame was received on the RAW socket
+ *  - decompress(comp_len, uncomp_len, ns): a ROHC packet was decompressed
+ *  - session_state(peer, old_status, new_status): the session changed its
+ *    status, peer is the address of the remote endpoint as a string
+ */
+
+#ifndef IPROHC_COMMON_PROBES__H
+#define IPROHC_COMMON_PROBES__H
+
+/** The reasons why a packing frame is sent */
+typedef enum
+{
+	IPROHC_FLUSH_FULL    = 0,  /**< The frame holds all the packets it may */
+	IPROHC_FLUSH_MTU     = 1,  /**< The next packet would exceed the MTU */
+	IPROHC_FLUSH_TIMEOUT = 2,  /**< No packet was read for a while */
+	IPROHC_FLUSH_PARAMS  = 3,  /**< The packing level is changing */
+} iprohc_flush_reason_t;
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define IPROHC_PROBE2(name, a1, a2) \
+	STAP_PROBE2(iprohc, name, a1, a2)
+#define IPROHC_PROBE3(name, a1, a2, a3) \
+	STAP_PROBE3(iprohc, name, a1, a2, a3)
+
+#else
+
+#define IPROHC_PROBE2(name, a1, a2) \
+	do { } while(0)
+#define IPROHC_PROBE3(name, a1, a2, a3) \
+	do { } while(0)
+
+#endif
+
+#endif
+
@@ -19,18 +19,22 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "session.h"
+#include "seqlock.h"
 #include "ip_chksum.h"
 #include "log.h"
 #include "utils.h"
 
 #include "config.h"
+#include "probes.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <inttypes.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -38,7 +42,6 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <netinet/udp.h>
 #include <linux/if_tun.h>
 
-#include <sys/timerfd.h>
 #include <sys/epoll.h>
 
 
@@ -51,28 +54,104 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 
 #define MAX_TRACE_SIZE 2048
 
+/** The time (in milliseconds) an incomplete packing frame waits for more
+ *  packets before being sent */
+#define IPROHC_PACKING_TIMEOUT_MS  100U
 
-/** Print in logs a trace related to the given tunnel */
+
+/** Print in logs a trace related to the given tunnel, the debug traces are
+ *  also printed if debug is enabled for the session */
 #define tunnel_trace(tunnel, prio, format, ...) \
 	do \
 	{ \
-		if((tunnel)->dst_addr_str[0] == '\0') \
+		if(iprohc_log_is_enabled(prio) || \
+		   ((prio) <= IPROHC_LOG_MIN_LEVEL && AO_load(&((tunnel)->is_debug)))) \
 		{ \
-			trace((prio), "[client %s] " format, \
-			      (tunnel)->dst_addr_str, ##__VA_ARGS__); \
+			if((tunnel)->dst_addr_str[0] != '\0') \
+			{ \
+				iprohc_log((prio), "[client %s] " format, \
+				           (tunnel)->dst_addr_str, ##__VA_ARGS__); \
+			} \
+			else \
+			{ \
+				iprohc_log((prio), format, ##__VA_ARGS__); \
+			} \
 		} \
-		else \
+	} \
+	while(0)
+
+
+/**
+ * Count an error of the data path in the given stats, and print it in logs
+ * unless the same error was already logged less than a second ago
+ */
+#define tunnel_err_trace(stats, err, format, ...) \
+	do \
+	{ \
+		uint64_t _suppressed_nr; \
+		if(iprohc_tunnel_err_count((stats), (err), &_suppressed_nr)) \
 		{ \
-			trace((prio), format, ##__VA_ARGS__); \
+			if(_suppressed_nr > 0) \
+			{ \
+				trace(LOG_ERR, format " (%" PRIu64 " similar errors suppressed)", \
+				      ##__VA_ARGS__, _suppressed_nr); \
+			} \
+			else \
+			{ \
+				trace(LOG_ERR, format, ##__VA_ARGS__); \
+			} \
 		} \
 	} \
 	while(0)
 
 
-
 /* Prototypes for local functions */
 
-void dump_packet(char *descr, unsigned char *packet, unsigned int length);
+static inline void iprohc_tunnel_stats_begin(struct iprohc_tunnel_stats *const stats)
+	__attribute__((nonnull(1)));
+static inline void iprohc_tunnel_stats_end(struct iprohc_tunnel_stats *const stats)
+	__attribute__((nonnull(1)));
+
+static inline void iprohc_tunnel_update_debug(const struct iprohc_session *const session)
+	__attribute__((nonnull(1)));
+
+static inline void iprohc_tunnel_rohc_lock(pthread_mutex_t *const rohc_lock);
+static inline void iprohc_tunnel_rohc_unlock(pthread_mutex_t *const rohc_lock);
+
+static void iprohc_tunnel_flow_count(struct statitics *const counters,
+                                     const rohc_comp_last_packet_info2_t *const info)
+	__attribute__((nonnull(1, 2)));
+
+static bool iprohc_tunnel_err_count(struct iprohc_tunnel_stats *const stats,
+                                    const iprohc_tunnel_err_t err,
+                                    uint64_t *const suppressed_nr)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
+#if IPROHC_LOG_MIN_LEVEL >= LOG_DEBUG
+static void dump_packet_content(const char *const descr,
+                                const unsigned char *const packet,
+                                const size_t length)
+	__attribute__((nonnull(1, 2)));
+
+/** Display the content of a packet, if debug traces are enabled */
+#define dump_packet(descr, packet, length) \
+	do \
+	{ \
+		if(iprohc_log_is_enabled(LOG_DEBUG)) \
+		{ \
+			dump_packet_content((descr), (packet), (length)); \
+		} \
+	} \
+	while(0)
+#else
+/** Debug traces are not built in, neither are packet dumps */
+#define dump_packet(descr, packet, length) \
+	do \
+	{ \
+	} \
+	while(0)
+#endif
+
 static void print_rohc_traces(rohc_trace_level_t level,
                               rohc_trace_entity_t entity,
                               int profile,
@@ -89,14 +168,23 @@ int send_puree(int to,
                unsigned char *compressed_packet,
                size_t *total_size,
                size_t *act_comp,
-               struct statitics *stats);
+               struct iprohc_tunnel_stats *stats,
+               const iprohc_flush_reason_t reason);
 int raw2tun(struct rohc_decomp *decomp,
             in_addr_t dst_addr,
             int from,
             int to,
 				const size_t mtu,
-            struct statitics *stats);
+            struct iprohc_tunnel_stats *stats);
+static int raw2tun_frame(struct rohc_decomp *decomp,
+                         const in_addr_t dst_addr,
+                         unsigned char *const packet,
+                         const size_t packet_len,
+                         const int to,
+                         struct iprohc_tunnel_stats *const stats)
+	__attribute__((warn_unused_result, nonnull(1, 3, 6)));
 int tun2raw(struct rohc_comp *comp,
+            pthread_mutex_t *const rohc_lock,
             int from,
             int to,
             struct in_addr raddr,
@@ -106,10 +194,15 @@ int tun2raw(struct rohc_comp *comp,
             size_t *const packing_cur_len,
             const size_t packing_max_pkts,
             size_t *const packing_cur_pkts,
-            struct statitics *stats);
+            struct iprohc_tunnel_stats *stats);
 
 static void gnutls_transport_set_ptr_nowarn(gnutls_session_t session, int ptr);
 
+static bool iprohc_tunnel_apply_params(struct iprohc_session *const session,
+                                       size_t *const packing_cur_len,
+                                       size_t *const packing_cur_pkts)
+	__attribute__((warn_unused_result, nonnull(1, 2, 3)));
+
 
 /*
  * Main functions
@@ -138,9 +231,7 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
                        const size_t base_dev_mtu,
                        const size_t tun_dev_mtu)
 {
-	rohc_mode_t rohc_mode;
-	struct rohc_comp *asso_comp;
-	bool is_ok;
+	struct iprohc_tunnel_contexts contexts;
 
 	assert(tunnel != NULL);
 	assert(raw_socket >= 0);
@@ -164,26 +255,71 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	/* record the local address */
 	tunnel->params.local_address = local_addr;
 
+	/* the packing stats are sized for the largest packing level */
+	if(tunnel->params.packing < 0 || tunnel->params.packing > IPROHC_PACKING_MAX)
+	{
+		trace(LOG_ERR, "packing level %d not in range [0,%d]",
+		      tunnel->params.packing, IPROHC_PACKING_MAX);
+		goto error;
+	}
+
 	/* reset stats */
-	memset(&tunnel->stats, 0, sizeof(struct statitics));
-	tunnel->stats.n_stats_packing = tunnel->params.packing + 1;
-	tunnel->stats.stats_packing = calloc(tunnel->stats.n_stats_packing, sizeof(int));
-	if(tunnel->stats.stats_packing == NULL)
+	memset(&tunnel->stats, 0, sizeof(struct iprohc_tunnel_stats));
+	memset(&tunnel->rx_stats, 0, sizeof(struct iprohc_tunnel_stats));
+
+	/* the thread of the session decompresses the traffic of the tunnel unless
+	 * the caller tells otherwise */
+	tunnel->rohc_lock = NULL;
+	tunnel->is_rx_enabled = false;
+
+	/* the packing frame is allocated once there is something to send */
+	tunnel->packing_frame = NULL;
+
+	/* create the compressor and the decompressor */
+	if(!iprohc_tunnel_contexts_new(&contexts, tunnel->params))
 	{
-		trace(LOG_ERR, "failed to allocate memory for packing stats");
 		goto error;
 	}
+	tunnel->comp = contexts.comp;
+	tunnel->decomp = contexts.decomp;
+	tunnel->rohc_mem = contexts.mem;
+
+	tunnel->is_init = true;
+	return true;
+
+error:
+	return false;
+}
+
+
+/**
+ * @brief Create a ROHC compressor and decompressor for the given parameters
+ *
+ * @param[out] contexts  The new ROHC contexts
+ * @param params         The parameters of the tunnel
+ * @return               true if the contexts were successfully created,
+ *                       false if a problem occurred
+ */
+bool iprohc_tunnel_contexts_new(struct iprohc_tunnel_contexts *const contexts,
+                                const struct tunnel_params params)
+{
+	rohc_mode_t rohc_mode;
+	struct rohc_comp *asso_comp;
+	bool is_ok;
+
+	memcpy(&contexts->params, &params, sizeof(struct tunnel_params));
 
 	/* create the compressor and activate profiles */
-	tunnel->comp = rohc_comp_new(ROHC_SMALL_CID, tunnel->params.max_cid);
-	if(tunnel->comp == NULL)
+	contexts->mem = iprohc_heap_used();
+	contexts->comp = rohc_comp_new(ROHC_SMALL_CID, params.max_cid);
+	if(contexts->comp == NULL)
 	{
 		trace(LOG_ERR, "failed to create the ROHC compressor");
-		goto free_packing_stats;
+		goto error;
 	}
 
 	/* handle compressor traces */
-	is_ok = rohc_comp_set_traces_cb(tunnel->comp, print_rohc_traces);
+	is_ok = rohc_comp_set_traces_cb(contexts->comp, print_rohc_traces);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "faield to set trace callback for compressor");
@@ -191,7 +327,7 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	}
 
 	/* enable all safe compression profiles */
-	is_ok = rohc_comp_enable_profiles(tunnel->comp,
+	is_ok = rohc_comp_enable_profiles(contexts->comp,
 	                                  ROHC_PROFILE_UNCOMPRESSED,
 	                                  ROHC_PROFILE_IP,
 	                                  ROHC_PROFILE_UDP,
@@ -204,7 +340,7 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	}
 
 	/* set RTP callback for detecting RTP packets */
-	is_ok = rohc_comp_set_rtp_detection_cb(tunnel->comp, callback_rtp_detect, NULL);
+	is_ok = rohc_comp_set_rtp_detection_cb(contexts->comp, callback_rtp_detect, NULL);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to set RTP detection callback");
@@ -212,7 +348,7 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	}
 
 	/* decompressor parameters that depend on operation mode */
-	if(tunnel->params.is_unidirectional)
+	if(params.is_unidirectional)
 	{
 		rohc_mode = ROHC_U_MODE;
 		asso_comp = NULL;
@@ -220,20 +356,20 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	else
 	{
 		rohc_mode = ROHC_O_MODE;
-		asso_comp = tunnel->comp;
+		asso_comp = contexts->comp;
 	}
 
 	/* create the decompressor (associate it with the compressor) */
-	tunnel->decomp = rohc_decomp_new(ROHC_SMALL_CID, tunnel->params.max_cid,
+	contexts->decomp = rohc_decomp_new(ROHC_SMALL_CID, params.max_cid,
 	                                 rohc_mode, asso_comp);
-	if(tunnel->decomp == NULL)
+	if(contexts->decomp == NULL)
 	{
 		trace(LOG_ERR, "failed to create the ROHC decompressor");
 		goto destroy_comp;
 	}
 
 	/* handle compressor trace */
-	is_ok = rohc_decomp_set_traces_cb(tunnel->decomp, print_rohc_traces);
+	is_ok = rohc_decomp_set_traces_cb(contexts->decomp, print_rohc_traces);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to set trace callback for decompressor");
@@ -241,7 +377,7 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 	}
 
 	/* enable all safe decompression profiles */
-	is_ok = rohc_decomp_enable_profiles(tunnel->decomp,
+	is_ok = rohc_decomp_enable_profiles(contexts->decomp,
 	                                    ROHC_PROFILE_UNCOMPRESSED,
 	                                    ROHC_PROFILE_IP,
 	                                    ROHC_PROFILE_UDP,
@@ -252,21 +388,48 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 		trace(LOG_ERR, "failed to enable profiles for decompressor");
 		goto destroy_decomp;
 	}
+	contexts->mem = iprohc_heap_growth(contexts->mem);
 
-	tunnel->is_init = true;
 	return true;
 
 destroy_decomp:
-	rohc_decomp_free(tunnel->decomp);
+	rohc_decomp_free(contexts->decomp);
+	contexts->decomp = NULL;
 destroy_comp:
-	rohc_comp_free(tunnel->comp);
-free_packing_stats:
-	free(tunnel->stats.stats_packing);
+	rohc_comp_free(contexts->comp);
+	contexts->comp = NULL;
 error:
 	return false;
 }
 
 
+/**
+ * @brief Change the packing level of the given tunnel
+ *
+ * The packing stats are indexed by the number of packets per frame, the
+ * level shall not exceed IPROHC_PACKING_MAX. The frame in progress shall
+ * have been sent.
+ *
+ * @param tunnel   The tunnel
+ * @param packing  The new packing level
+ * @return         true if the packing level was changed,
+ *                 false if a problem occurred
+ */
+bool iprohc_tunnel_set_packing(struct iprohc_tunnel *const tunnel,
+                               const char packing)
+{
+	if(packing < 0 || packing > IPROHC_PACKING_MAX)
+	{
+		trace(LOG_ERR, "packing level %d not in range [0,%d]", packing,
+		      IPROHC_PACKING_MAX);
+		return false;
+	}
+	tunnel->params.packing = packing;
+
+	return true;
+}
+
+
 /**
  * @brief Reset the given tunnel context
  *
@@ -278,9 +441,23 @@ bool iprohc_tunnel_free(struct iprohc_tunnel *const tunnel)
 {
 	if(tunnel->is_init)
 	{
-		/* free the ROHC compressor and decompressor */
-		rohc_decomp_free(tunnel->decomp);
-		rohc_comp_free(tunnel->comp);
+		/* free the ROHC compressor and decompressor, unless they were detached
+		 * to be resumed later */
+		iprohc_tunnel_rohc_lock(tunnel->rohc_lock);
+		tunnel->is_rx_enabled = false;
+		if(tunnel->decomp != NULL)
+		{
+			rohc_decomp_free(tunnel->decomp);
+			tunnel->decomp = NULL;
+		}
+		if(tunnel->comp != NULL)
+		{
+			rohc_comp_free(tunnel->comp);
+			tunnel->comp = NULL;
+		}
+		memset(&tunnel->rx_stats, 0, sizeof(struct iprohc_tunnel_stats));
+		iprohc_tunnel_rohc_unlock(tunnel->rohc_lock);
+		tunnel->rohc_lock = NULL;
 
 		/* reset RAW sockets and TUN fds: do not close them, they are shared with
 		 * other clients */
@@ -297,8 +474,10 @@ bool iprohc_tunnel_free(struct iprohc_tunnel *const tunnel)
 		memset(&tunnel->params, 0, sizeof(struct tunnel_params));
 
 		/* reset stats */
-		free(tunnel->stats.stats_packing);
-		memset(&tunnel->stats, 0, sizeof(struct statitics));
+		memset(&tunnel->stats, 0, sizeof(struct iprohc_tunnel_stats));
+
+		free(tunnel->packing_frame);
+		tunnel->packing_frame = NULL;
 
 		tunnel->is_init = false;
 	}
@@ -307,6 +486,101 @@ bool iprohc_tunnel_free(struct iprohc_tunnel *const tunnel)
 }
 
 
+/**
+ * @brief Detach the ROHC compressor and decompressor from the given tunnel
+ *
+ * librohc cannot serialize its contexts, so the compressor and decompressor
+ * objects themselves are kept in memory to be resumed later. The tunnel
+ * shall then be reset with \ref iprohc_tunnel_free.
+ *
+ * @param tunnel         The tunnel of the lost session
+ * @param[out] contexts  The ROHC contexts of the tunnel
+ */
+void iprohc_tunnel_detach_contexts(struct iprohc_tunnel *const tunnel,
+                                   struct iprohc_tunnel_contexts *const contexts)
+{
+	assert(tunnel->is_init);
+
+	iprohc_tunnel_rohc_lock(tunnel->rohc_lock);
+	tunnel->is_rx_enabled = false;
+	contexts->comp = tunnel->comp;
+	contexts->decomp = tunnel->decomp;
+	memcpy(&contexts->params, &tunnel->params, sizeof(struct tunnel_params));
+	contexts->mem = tunnel->rohc_mem;
+	tunnel->comp = NULL;
+	tunnel->decomp = NULL;
+	iprohc_tunnel_rohc_unlock(tunnel->rohc_lock);
+}
+
+
+/**
+ * @brief Whether the given ROHC contexts may be resumed in the given tunnel
+ *
+ * The contexts are bound to the ROHC channel parameters. They are also bound,
+ * through the IP headers they compress, to the address of the client on the
+ * tunnel: the caller checks it, since the tunnel only knows its endpoint.
+ *
+ * @param tunnel    The tunnel of the new session
+ * @param contexts  The ROHC contexts of the lost session
+ * @return          true if the contexts may be resumed, false otherwise
+ */
+bool iprohc_tunnel_can_resume(const struct iprohc_tunnel *const tunnel,
+                              const struct iprohc_tunnel_contexts *const contexts)
+{
+	return (tunnel->params.max_cid == contexts->params.max_cid &&
+	        tunnel->params.is_unidirectional == contexts->params.is_unidirectional &&
+	        tunnel->params.rohc_compat_version ==
+	        contexts->params.rohc_compat_version);
+}
+
+
+/**
+ * @brief Replace the ROHC compressor and decompressor of the given tunnel
+ *
+ * The new contexts of the tunnel are released and replaced by the contexts
+ * of the lost session, which the tunnel now owns.
+ *
+ * @param tunnel    The tunnel of the new session
+ * @param contexts  The ROHC contexts of the lost session
+ */
+void iprohc_tunnel_attach_contexts(struct iprohc_tunnel *const tunnel,
+                                   struct iprohc_tunnel_contexts *const contexts)
+{
+	assert(tunnel->is_init);
+	assert(iprohc_tunnel_can_resume(tunnel, contexts));
+
+	iprohc_tunnel_rohc_lock(tunnel->rohc_lock);
+	rohc_decomp_free(tunnel->decomp);
+	rohc_comp_free(tunnel->comp);
+	tunnel->comp = contexts->comp;
+	tunnel->decomp = contexts->decomp;
+	tunnel->rohc_mem = contexts->mem;
+	iprohc_tunnel_rohc_unlock(tunnel->rohc_lock);
+	contexts->comp = NULL;
+	contexts->decomp = NULL;
+}
+
+
+/**
+ * @brief Release the given ROHC contexts that will not be resumed
+ *
+ * @param contexts  The ROHC contexts of the lost session
+ */
+void iprohc_tunnel_contexts_free(struct iprohc_tunnel_contexts *const contexts)
+{
+	if(contexts->decomp != NULL)
+	{
+		rohc_decomp_free(contexts->decomp);
+		contexts->decomp = NULL;
+	}
+	if(contexts->comp != NULL)
+	{
+		rohc_comp_free(contexts->comp);
+		contexts->comp = NULL;
+	}
+}
+
+
 /**
  * @brief Start a new tunnel
  *
@@ -326,14 +600,15 @@ void * iprohc_tunnel_run(void *arg)
 	struct iprohc_tunnel *const tunnel = &(session->tunnel);
 
 	unsigned int verify_status;
+	struct timespec handshake_start;
+	struct timespec handshake_end;
+	unsigned long handshake_us;
 
 	int failure = 0;
 	int ret;
 
 	struct epoll_event poll_pipe;
 	struct epoll_event poll_tcp;
-	struct epoll_event poll_ka;
-	struct epoll_event poll_packing;
 	struct epoll_event poll_tun;
 	struct epoll_event poll_raw;
 	const size_t max_events_nr = 1;
@@ -343,9 +618,15 @@ void * iprohc_tunnel_run(void *arg)
 	size_t packing_cur_len = 0;  /* number of packed bytes */
 	size_t packing_cur_pkts = 0;  /* number of packed frames */
 
+	/* the last status given to the session_state probe */
+	iprohc_session_status_t probe_status = session->status;
+
 	/* TODO : Check assumed present attributes
 	   (thread, local_address, dest_address, tun, fake_tun, raw_socket) */
 
+	/* the debug traces of the thread follow the debug of the session */
+	iprohc_tunnel_update_debug(session);
+
 	tunnel_trace(session, LOG_INFO, "start of thread");
 
 	/* Get rid of warning, it's a "bug" of GnuTLS
@@ -353,6 +634,7 @@ void * iprohc_tunnel_run(void *arg)
 	gnutls_transport_set_ptr_nowarn(session->tls_session, session->tcp_socket);
 
 	/* perform TLS handshake */
+	clock_gettime(CLOCK_MONOTONIC, &handshake_start);
 	do
 	{
 		ret = gnutls_handshake(session->tls_session);
@@ -364,7 +646,14 @@ void * iprohc_tunnel_run(void *arg)
 		             gnutls_strerror(ret), ret);
 		goto error;
 	}
-	tunnel_trace(session, LOG_INFO, "TLS handshake succeeded");
+	clock_gettime(CLOCK_MONOTONIC, &handshake_end);
+	handshake_us = (handshake_end.tv_sec - handshake_start.tv_sec) * 1000000UL +
+	               handshake_end.tv_nsec / 1000 - handshake_start.tv_nsec / 1000;
+	tunnel_trace(session, LOG_INFO, "TLS handshake succeeded in %lu us: %s "
+	             "session with %s", handshake_us,
+	             gnutls_session_is_resumed(session->tls_session) ?
+	             "resumed" : "full",
+	             gnutls_protocol_get_name(gnutls_protocol_get_version(session->tls_session)));
 
 	/* check the peer certificate */
 	ret = gnutls_certificate_verify_peers2(session->tls_session, &verify_status);
@@ -440,31 +729,6 @@ void * iprohc_tunnel_run(void *arg)
 		goto close_pollfd;
 	}
 
-	/* will monitor the keepalive timer */
-	poll_ka.events = EPOLLIN;
-	memset(&poll_ka.data, 0, sizeof(poll_ka.data));
-	poll_ka.data.fd = session->keepalive_timer_fd;
-	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, session->keepalive_timer_fd, &poll_ka);
-	if(ret != 0)
-	{
-		tunnel_trace(session, LOG_ERR, "failed to add keepalive timer to epoll "
-		             "context: %s (%d)", strerror(errno), errno);
-		goto close_pollfd;
-	}
-
-	/* will monitor the packing timer */
-	poll_packing.events = EPOLLIN;
-	memset(&poll_packing.data, 0, sizeof(poll_packing.data));
-	poll_packing.data.fd = session->packing_timer_fd;
-	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, session->packing_timer_fd,
-	                &poll_packing);
-	if(ret != 0)
-	{
-		tunnel_trace(session, LOG_ERR, "failed to add packing timer to epoll "
-		             "context: %s (%d)", strerror(errno), errno);
-		goto close_pollfd;
-	}
-
 	/* don't monitor TUN and RAW socket now */
 	poll_tun.data.fd = -1;
 	poll_raw.data.fd = -1;
@@ -484,18 +748,37 @@ void * iprohc_tunnel_run(void *arg)
 	do
 	{
 		int timeout;
+		int timers_timeout;
+		int events_nr;
 		int ret;
 
-		/* wait at most twice the keepalive timeout */
+		iprohc_tunnel_update_debug(session);
+
+		if(session->status != probe_status)
+		{
+			IPROHC_PROBE3(session_state, session->dst_addr_str, probe_status,
+			              session->status);
+			probe_status = session->status;
+		}
+
+		/* wait at most twice the keepalive timeout, or until the next timer
+		 * expires */
 		timeout = 80;
 		if(session->status == IPROHC_SESSION_CONNECTED)
 		{
 			timeout = session->tunnel.params.keepalive_timeout * 2;
 		}
+		timeout *= 1000;
+		timers_timeout = iprohc_timer_wheel_timeout(&(session->timers),
+		                                            iprohc_timer_wheel_now());
+		if(timers_timeout >= 0 && timers_timeout < timeout)
+		{
+			timeout = timers_timeout;
+		}
 
 		/* wait for events */
-		ret = epoll_wait(pollfd, events, max_events_nr, timeout * 1000);
-		if(ret < 0)
+		events_nr = epoll_wait(pollfd, events, max_events_nr, timeout);
+		if(events_nr < 0)
 		{
 			tunnel_trace(session, LOG_ERR, "epoll failed: %s (%d)",
 			             strerror(errno), errno);
@@ -503,19 +786,101 @@ void * iprohc_tunnel_run(void *arg)
 			session->status = IPROHC_SESSION_PENDING_DELETE;
 			goto close_pollfd;
 		}
-		else if(ret == 0)
+		iprohc_timer_wheel_advance(&(session->timers), iprohc_timer_wheel_now());
+
+		/* send keepalive in case there is too few activity on control channel,
+		 * unless the data frames received meanwhile proved the peer alive */
+		if(iprohc_timer_take_expiry(&(session->keepalive_timer)))
+		{
+			const char command[1] = { C_KEEPALIVE };
+
+			tunnel_trace(session, LOG_DEBUG, "keepalive timer expired");
+			if(AO_load(&(session->has_data_rx)))
+			{
+				tunnel_trace(session, LOG_DEBUG, "data received since last keepalive "
+				             "period, no keepalive needed");
+				AO_store(&(session->has_data_rx), 0);
+				session->keepalive_misses = 0;
+			}
+			else if(session->keepalive_misses >= 3)
+			{
+				tunnel_trace(session, LOG_NOTICE, "keepalive timeout detected "
+				             "(%zu keepalive messages every %zu seconds without "
+				             "answer), disconnect client", session->keepalive_misses,
+				             tunnel->params.keepalive_timeout / 3);
+				session->status = IPROHC_SESSION_PENDING_DELETE;
+			}
+			else
+			{
+				session->keepalive_misses++;
+				tunnel_trace(session, LOG_DEBUG, "send a keepalive command %zu/3",
+				             session->keepalive_misses);
+				gnutls_record_send(session->tls_session, command, 1);
+			}
+
+			/* no frame is being packed: in compact mode, give the packing frame
+			 * and the unused stack pages back until the next packets */
+			if(session->is_compact && packing_cur_len == 0)
+			{
+				free(tunnel->packing_frame);
+				tunnel->packing_frame = NULL;
+				iprohc_session_trim_stack(session);
+			}
+		}
+
+		/* flush the incomplete packing frame being built if too few activity
+		 * on data channel */
+		if(iprohc_timer_take_expiry(&(session->packing_timer)))
+		{
+			tunnel_trace(session, LOG_DEBUG, "packing timer expired");
+
+			/* flush any incomplete packing frame */
+			if(packing_cur_len > 0)
+			{
+				tunnel_trace(session, LOG_DEBUG, "no packets since a while, "
+				             "flushing incomplete frame");
+				send_puree(tunnel->raw_socket_out, session->dst_addr, tunnel->basedev_mtu,
+				           tunnel->packing_frame, &packing_cur_len, &packing_cur_pkts,
+				           &(tunnel->stats), IPROHC_FLUSH_TIMEOUT);
+				assert(packing_cur_len == 0);
+				assert(packing_cur_pkts == 0);
+			}
+		}
+
+		if(events_nr == 0)
 		{
 			/* no event occurred */
 			tunnel_trace(session, LOG_DEBUG, "epoll: no event occurred");
 			continue;
 		}
-		tunnel_trace(session, LOG_DEBUG, "epoll: %d events detected", ret);
+		tunnel_trace(session, LOG_DEBUG, "epoll: %d events detected", events_nr);
 
-		/* stop thread if main thread closed the write side of the pipe */
+		/* stop thread if main thread closed the write side of the pipe, apply
+		 * new parameters if main thread asked for it */
 		if(events[0].data.fd == session->p2c[0])
 		{
-			session->status = IPROHC_SESSION_PENDING_DELETE;
-			goto close_pollfd;
+			char command;
+
+			ret = read(session->p2c[0], &command, 1);
+			if(ret == 1 && command == IPROHC_SESSION_CMD_STOP)
+			{
+				/* leave the loop, the remote peer is told the session ends */
+				tunnel_trace(session, LOG_NOTICE, "session closed by administrator");
+				session->status = IPROHC_SESSION_PENDING_DELETE;
+				continue;
+			}
+			if(ret != 1 || command != IPROHC_SESSION_CMD_UPDATE)
+			{
+				session->status = IPROHC_SESSION_PENDING_DELETE;
+				goto close_pollfd;
+			}
+			if(!iprohc_tunnel_apply_params(session, &packing_cur_len,
+			                               &packing_cur_pkts))
+			{
+				session->status = IPROHC_SESSION_PENDING_DELETE;
+				goto close_pollfd;
+			}
+			continue;
 		}
 
 		/* event on control channel? */
@@ -568,6 +933,12 @@ void * iprohc_tunnel_run(void *arg)
 				tunnel_trace(session, LOG_INFO, "session closed");
 				continue;
 			}
+			else if(!iprohc_tunnel_apply_params(session, &packing_cur_len,
+			                                    &packing_cur_pkts))
+			{
+				session->status = IPROHC_SESSION_PENDING_DELETE;
+				goto close_pollfd;
+			}
 			else
 			{
 				if(session->status == IPROHC_SESSION_CONNECTED)
@@ -619,6 +990,12 @@ void * iprohc_tunnel_run(void *arg)
 								goto close_pollfd;
 							}
 						}
+
+						/* the traffic of the tunnel may now be decompressed by
+						 * another thread, if any */
+						iprohc_tunnel_rohc_lock(tunnel->rohc_lock);
+						tunnel->is_rx_enabled = true;
+						iprohc_tunnel_rohc_unlock(tunnel->rohc_lock);
 					}
 				}
 
@@ -636,93 +1013,25 @@ void * iprohc_tunnel_run(void *arg)
 			}
 		}
 
-		/* send keepalive in case there is too few activity on control channel */
-		if(events[0].data.fd == session->keepalive_timer_fd)
-		{
-			const char command[1] = { C_KEEPALIVE };
-			uint64_t keepalive_timer_nr;
-
-			tunnel_trace(session, LOG_DEBUG, "keepalive timer expired");
-			ret = read(session->keepalive_timer_fd, &keepalive_timer_nr,
-			           sizeof(uint64_t));
-			if(ret < 0)
-			{
-				tunnel_trace(session, LOG_ERR, "failed to read keepalive timer: "
-				             "%s (%d)", strerror(errno), errno);
-				session->status = IPROHC_SESSION_PENDING_DELETE;
-				goto close_pollfd;
-			}
-			else if(ret != sizeof(uint64_t))
-			{
-				tunnel_trace(session, LOG_ERR, "failed to read keepalive timer: "
-				             "received %d bytes while expecting %zu bytes",
-				             ret, sizeof(uint64_t));
-				session->status = IPROHC_SESSION_PENDING_DELETE;
-				goto close_pollfd;
-			}
-
-			if(session->keepalive_misses >= 3)
-			{
-				tunnel_trace(session, LOG_NOTICE, "keepalive timeout detected "
-				             "(%zu keepalive messages every %zu seconds without "
-				             "answer), disconnect client", session->keepalive_misses,
-				             tunnel->params.keepalive_timeout / 3);
-				session->status = IPROHC_SESSION_PENDING_DELETE;
-			}
-			else
-			{
-				session->keepalive_misses++;
-				tunnel_trace(session, LOG_DEBUG, "send a keepalive command %zu/3",
-				             session->keepalive_misses);
-				gnutls_record_send(session->tls_session, command, 1);
-			}
-		}
-
-		/* flush the incomplete packing frame being built if too few activity
-		 * on data channel */
-		if(events[0].data.fd == session->packing_timer_fd)
-		{
-			uint64_t timer_nr;
-
-			tunnel_trace(session, LOG_DEBUG, "packing timer expired");
-			ret = read(session->packing_timer_fd, &timer_nr, sizeof(uint64_t));
-			if(ret < 0)
-			{
-				tunnel_trace(session, LOG_ERR, "failed to read packing timer: "
-				             "%s (%d)", strerror(errno), errno);
-				goto close_pollfd;
-			}
-			else if(ret != sizeof(uint64_t))
-			{
-				tunnel_trace(session, LOG_ERR, "failed to read packing timer: "
-				             "received %d bytes while expecting %zu bytes",
-				             ret, sizeof(uint64_t));
-				goto close_pollfd;
-			}
-
-			/* flush any incomplete packing frame */
-			if(packing_cur_len > 0)
-			{
-				tunnel_trace(session, LOG_DEBUG, "no packets since a while, "
-				             "flushing incomplete frame");
-				send_puree(tunnel->raw_socket_out, session->dst_addr, tunnel->basedev_mtu,
-				           tunnel->packing_frame, &packing_cur_len, &packing_cur_pkts,
-				           &(tunnel->stats));
-				assert(packing_cur_len == 0);
-				assert(packing_cur_pkts == 0);
-			}
-		}
-
 		/* bridge from TUN to RAW */
 		if(session->status == IPROHC_SESSION_CONNECTED &&
 		   events[0].data.fd == tunnel->tun_fd_in)
 		{
 			const size_t packing_max_len = tunnel->basedev_mtu - sizeof(struct iphdr);
 			const size_t packing_pkts_old = packing_cur_pkts;
-			struct itimerspec packing_timeout;
 
 			tunnel_trace(session, LOG_DEBUG, "received data from tun");
-			failure = tun2raw(tunnel->comp, tunnel->tun_fd_in,
+			if(tunnel->packing_frame == NULL)
+			{
+				tunnel->packing_frame = malloc(TUNTAP_BUFSIZE);
+				if(tunnel->packing_frame == NULL)
+				{
+					tunnel_trace(session, LOG_ERR, "failed to allocate memory for "
+					             "the packing frame");
+					goto close_pollfd;
+				}
+			}
+			failure = tun2raw(tunnel->comp, tunnel->rohc_lock, tunnel->tun_fd_in,
 			                  tunnel->raw_socket_out, session->dst_addr,
 			                  tunnel->basedev_mtu, tunnel->packing_frame,
 			                  packing_max_len, &packing_cur_len,
@@ -730,43 +1039,23 @@ void * iprohc_tunnel_run(void *arg)
 			                  &(tunnel->stats));
 			if(failure)
 			{
-				tunnel_trace(session, LOG_NOTICE, "tun2raw failed");
+				/* the error was counted and logged by tun2raw() */
+				tunnel_trace(session, LOG_DEBUG, "tun2raw failed");
 			}
 
 			/* disarm packing timer if no packing frame is being built,
 			 * re-arm packing timer if we have just started a new packing frame */
 			if(packing_cur_pkts == 0)
 			{
-				/* disarm packing timer */
 				tunnel_trace(session, LOG_DEBUG, "reset packing timer");
-				packing_timeout.it_value.tv_sec = 0;
-				packing_timeout.it_value.tv_nsec = 0;
-				packing_timeout.it_interval.tv_sec = 0;
-				packing_timeout.it_interval.tv_nsec = 0;
-				ret = timerfd_settime(session->packing_timer_fd, 0, &packing_timeout, NULL);
-				if(ret != 0)
-				{
-					tunnel_trace(session, LOG_ERR, "failed to disarm packing timer: "
-					             "%s (%d)", strerror(errno), errno);
-					goto close_pollfd;
-				}
+				iprohc_timer_disarm(&(session->timers), &(session->packing_timer));
 			}
 			else if(packing_cur_pkts != packing_pkts_old)
 			{
-				/* re-arm packing timer */
 				tunnel_trace(session, LOG_DEBUG, "re-arm packing timer for "
 				             "incomplete frame with %zu packets", packing_cur_pkts);
-				packing_timeout.it_value.tv_sec = 0;
-				packing_timeout.it_value.tv_nsec = 100 * 1e6; /* 100ms */
-				packing_timeout.it_interval.tv_sec = 0;
-				packing_timeout.it_interval.tv_nsec = 0;
-				ret = timerfd_settime(session->packing_timer_fd, 0, &packing_timeout, NULL);
-				if(ret != 0)
-				{
-					tunnel_trace(session, LOG_ERR, "failed to re-arm packing timer: "
-					             "%s (%d)", strerror(errno), errno);
-					goto close_pollfd;
-				}
+				iprohc_timer_arm(&(session->timers), &(session->packing_timer),
+				                 IPROHC_PACKING_TIMEOUT_MS, 0);
 			}
 		}
 
@@ -777,10 +1066,17 @@ void * iprohc_tunnel_run(void *arg)
 			tunnel_trace(session, LOG_DEBUG, "received data from raw");
 			failure = raw2tun(tunnel->decomp, session->src_addr.s_addr,
 			                  tunnel->raw_socket_in, tunnel->tun_fd_out,
-			                  tunnel->basedev_mtu, &(tunnel->stats));
+			                  tunnel->basedev_mtu, &(tunnel->rx_stats));
 			if(failure)
 			{
-				tunnel_trace(session, LOG_NOTICE, "raw2tun failed");
+				/* the error was counted and logged by raw2tun() */
+				tunnel_trace(session, LOG_DEBUG, "raw2tun failed");
+			}
+			else if(tunnel->params.capabilities & IPROHC_CAP_DATA_LIVENESS)
+			{
+				/* a valid data frame proves the peer alive as a keepalive does */
+				session->keepalive_misses = 0;
+				AO_store(&(session->has_data_rx), 1);
 			}
 		}
 	}
@@ -800,6 +1096,10 @@ void * iprohc_tunnel_run(void *arg)
 	}
 
 close_pollfd:
+	/* stop the decompression of the traffic of the tunnel by another thread */
+	iprohc_tunnel_rohc_lock(tunnel->rohc_lock);
+	tunnel->is_rx_enabled = false;
+	iprohc_tunnel_rohc_unlock(tunnel->rohc_lock);
 	close(pollfd);
 tls_bye:
 	/* close TLS session */
@@ -808,11 +1108,89 @@ tls_bye:
 error:
 	tunnel_trace(session, LOG_INFO, "end of thread");
 	session->status = IPROHC_SESSION_PENDING_DELETE;
+	if(session->status != probe_status)
+	{
+		IPROHC_PROBE3(session_state, session->dst_addr_str, probe_status,
+		              session->status);
+	}
 	AO_store_release_write(&(session->is_thread_running), 0);
+	if(session->notify_end != NULL)
+	{
+		/* the session shall not be touched anymore once notified */
+		session->notify_end(session);
+	}
 	return NULL;
 }
 
 
+/**
+ * @brief Apply the new tunnel parameters of the session, if any
+ *
+ * The parameters are only applied once the session is established. The
+ * incomplete packing frame is sent first, since it was built for the former
+ * packing level.
+ *
+ * @param session                   The session
+ * @param[in,out] packing_cur_len   The current length of the packing frame
+ * @param[in,out] packing_cur_pkts  The current number of packets in the
+ *                                  packing frame
+ * @return                          true if the parameters were applied or if
+ *                                  there was none, false if a problem occurred
+ */
+static bool iprohc_tunnel_apply_params(struct iprohc_session *const session,
+                                       size_t *const packing_cur_len,
+                                       size_t *const packing_cur_pkts)
+{
+	struct iprohc_tunnel *const tunnel = &(session->tunnel);
+	size_t keepalive_timeout;
+	char packing;
+
+	if(session->status != IPROHC_SESSION_CONNECTED ||
+	   !iprohc_session_take_params(session, &packing, &keepalive_timeout))
+	{
+		return true;
+	}
+
+	if((*packing_cur_len) > 0)
+	{
+		send_puree(tunnel->raw_socket_out, session->dst_addr, tunnel->basedev_mtu,
+		           tunnel->packing_frame, packing_cur_len, packing_cur_pkts,
+		           &(tunnel->stats), IPROHC_FLUSH_PARAMS);
+	}
+
+	if(!iprohc_tunnel_set_packing(tunnel, packing))
+	{
+		tunnel_trace(session, LOG_ERR, "failed to change the packing level to %d",
+		             packing);
+		return false;
+	}
+
+	if(keepalive_timeout != tunnel->params.keepalive_timeout)
+	{
+		if(!iprohc_session_update_keepalive(session, keepalive_timeout))
+		{
+			return false;
+		}
+		tunnel->params.keepalive_timeout = keepalive_timeout;
+		session->keepalive_misses = 0;
+	}
+
+	tunnel_trace(session, LOG_NOTICE, "tunnel parameters updated: packing %d, "
+	             "keepalive %zu seconds", tunnel->params.packing,
+	             tunnel->params.keepalive_timeout);
+
+	/* tell the remote peer about the new parameters */
+	if(session->update_ctrl != NULL && !session->update_ctrl(session))
+	{
+		tunnel_trace(session, LOG_ERR, "failed to send the new parameters to "
+		             "remote peer");
+		return false;
+	}
+
+	return true;
+}
+
+
 /**
  * @brief Send the current packet
  *
@@ -830,7 +1208,9 @@ error:
  * @param total_size        Pointer to the total size of the send-to-be
  *                          "floating" packet
  * @param act_comp          Pointer to the current number of packet in packing
- * @param stats             The compression/decompression statistics
+ * @param stats             The compression/decompression statistics, with
+ *                          the times the packets of the frame were read
+ * @param reason            Why the packet is sent now
  */
 int send_puree(int to,
                struct in_addr raddr,
@@ -838,21 +1218,33 @@ int send_puree(int to,
                unsigned char *compressed_packet,
                size_t *total_size,
                size_t *act_comp,
-               struct statitics *stats)
+               struct iprohc_tunnel_stats *stats,
+               const iprohc_flush_reason_t reason)
 {
+	const uint64_t now = iprohc_latency_now();
 	int ret;
 	struct sockaddr_in addr;
+	size_t i;
 
 	bzero(&addr, sizeof(addr));
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = raddr.s_addr;
 
 	dump_packet("Packet ROHC: ", compressed_packet, *total_size);
-	stats->stats_packing[*act_comp] += 1;
+	IPROHC_PROBE3(frame_flush, *act_comp, *total_size, reason);
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.stats_packing[*act_comp]++;
+	for(i = 0; i < (*act_comp); i++)
+	{
+		iprohc_latency_record(&(stats->counters.packing_hold),
+		                      now - stats->packing_read_times[i]);
+	}
+	iprohc_tunnel_stats_end(stats);
 
 	if((*total_size) > (mtu - sizeof(struct iphdr)))
 	{
-		trace(LOG_ERR, "Packet too big to be sent, abort");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_FRAME_TOO_LARGE,
+		                 "Packet too big to be sent, abort");
 		goto error;
 	}
 
@@ -862,7 +1254,8 @@ int send_puree(int to,
 	             (struct sockaddr *) &addr, sizeof(struct sockaddr_in));
 	if(ret < 0)
 	{
-		trace(LOG_ERR, "sendto failed: %s (%d)\n", strerror(errno), errno);
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_SEND,
+		                 "sendto failed: %s (%d)", strerror(errno), errno);
 		goto error;
 	}
 	trace(LOG_DEBUG, "%zu bytes written on socket %d\n", *total_size, to);
@@ -876,7 +1269,6 @@ error:
 	/* reset packing variables */
 	*total_size = 0;
 	*act_comp   = 0;
-	trace(LOG_ERR, "write to raw failed\n");
 	return -1;
 }
 
@@ -888,6 +1280,8 @@ error:
  * sending them on the RAW socket.
  *
  * @param comp              The ROHC compressor
+ * @param rohc_lock         The lock to take while the compressor is used,
+ *                          NULL if the thread uses the decompressor too
  * @param from              The TUN file descriptor to read from
  * @param to                The RAW socket descriptor to write to
  * @param raddr             The remote address of the tunnel
@@ -903,6 +1297,7 @@ error:
  * @return                  0 in case of success, a non-null value otherwise
  */
 int tun2raw(struct rohc_comp *comp,
+            pthread_mutex_t *const rohc_lock,
             int from,
             int to,
             struct in_addr raddr,
@@ -912,7 +1307,7 @@ int tun2raw(struct rohc_comp *comp,
             size_t *const packing_cur_len,
             const size_t packing_max_pkts,
             size_t *const packing_cur_pkts,
-            struct statitics *stats)
+            struct iprohc_tunnel_stats *stats)
 {
 	const struct rohc_ts arrival_time = { .sec = 0, .nsec = 0 };
 	const size_t packing_header_len = 2;
@@ -929,8 +1324,12 @@ int tun2raw(struct rohc_comp *comp,
 
 	rohc_comp_last_packet_info2_t last_packet_info;
 
+	uint64_t read_time;
+	uint64_t comp_start;
+	uint64_t comp_time;
+
 	int ret;
-	bool ok;
+	bool ok = false;
 
 	/* sanity checks */
 	assert(comp != NULL);
@@ -946,10 +1345,13 @@ int tun2raw(struct rohc_comp *comp,
 	ret = read(from, buffer, buffer_len);
 	if(ret < 0)
 	{
-		trace(LOG_ERR, "Read failed: %s (%d)\n", strerror(errno), errno);
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_TUN_READ,
+		                 "Read failed: %s (%d)", strerror(errno), errno);
 		goto error;
 	}
 	buffer_len = ret;
+	read_time = iprohc_latency_now();
+	IPROHC_PROBE2(tun_read, from, buffer_len);
 
 	trace(LOG_DEBUG, "Read %u bytes on tun fd %d\n", ret, from);
 
@@ -961,7 +1363,8 @@ int tun2raw(struct rohc_comp *comp,
 	}
 	else if(buffer_len < sizeof(struct tun_pi))
 	{
-		trace(LOG_ERR, "tun2raw: drop invalid packet: too small for TUN header");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_TUN_RUNT,
+		                 "tun2raw: drop invalid packet: too small for TUN header");
 		goto quit;
 	}
 
@@ -970,24 +1373,44 @@ int tun2raw(struct rohc_comp *comp,
 	packet = buffer + sizeof(struct tun_pi);
 	packet_len = buffer_len - sizeof(struct tun_pi);
 
-	/* update stats */
-	stats->comp_total++;
-
-	/* compress the IP packet */
+	/* compress the IP packet and get packet statistics, the decompressor
+	 * associated with the compressor may be used by another thread meanwhile */
+	iprohc_tunnel_rohc_lock(rohc_lock);
+	comp_start = iprohc_latency_now();
 	ret = rohc_compress3(comp, arrival_time, packet, packet_len,
 	                     rohc_packet_temp, MAX_ROHC_SIZE, &rohc_size);
+	comp_time = iprohc_latency_now() - comp_start;
+	if(ret == ROHC_OK)
+	{
+		/* Fill ROHC version */
+		last_packet_info.version_major = 0;
+		last_packet_info.version_minor = 0;
+		ok = rohc_comp_get_last_packet_info2(comp, &last_packet_info);
+	}
+	iprohc_tunnel_rohc_unlock(rohc_lock);
+	IPROHC_PROBE3(compress, packet_len, (ret == ROHC_OK ? rohc_size : 0),
+	              comp_time);
+
+	/* update stats */
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.comp_total++;
+	iprohc_latency_record(&(stats->counters.comp_time), comp_time);
+	iprohc_tunnel_stats_end(stats);
 	if(ret != ROHC_OK)
 	{
-		trace(LOG_ERR, "compression of packet failed (%d)\n", ret);
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_COMP,
+		                 "compression of packet failed (%d)", ret);
 		goto error;
 	}
 
 	/* discard ROHC packets larger than the whole packing frame */
 	if(rohc_size > (packing_max_len - packing_header_len))
 	{
-		trace(LOG_ERR, "discard too large compressed packet: packet is "
-		      "%zd-byte long, but packing frame can only handle up to %zd-byte "
-		      "packets\n", rohc_size, packing_max_len - packing_header_len);
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_COMP_TOO_LARGE,
+		                 "discard too large compressed packet: packet is "
+		                 "%zd-byte long, but packing frame can only handle up "
+		                 "to %zd-byte packets", rohc_size,
+		                 packing_max_len - packing_header_len);
 		goto quit;
 	}
 
@@ -998,7 +1421,7 @@ int tun2raw(struct rohc_comp *comp,
 	if(((*packing_cur_len) + rohc_size + packing_header_len) >= packing_max_len)
 	{
 		send_puree(to, raddr, mtu, packing_frame, packing_cur_len,
-		           packing_cur_pkts, stats);
+		           packing_cur_pkts, stats, IPROHC_FLUSH_MTU);
 		assert((*packing_cur_len) == 0);
 		assert((*packing_cur_pkts) == 0);
 	}
@@ -1015,21 +1438,21 @@ int tun2raw(struct rohc_comp *comp,
 	      *packing_cur_pkts, packing_max_pkts, rohc_size);
 	dump_packet("Compressed packet", rohc_packet_temp, rohc_size);
 
-	/* get packet statistics */
-	/* Fill ROHC version */
-	last_packet_info.version_major = 0;
-	last_packet_info.version_minor = 0;
-	ok = rohc_comp_get_last_packet_info2(comp, &last_packet_info);
+	/* update packet statistics */
 	if(!ok)
 	{
-		trace(LOG_ERR, "Cannot get stats about the last compressed packet\n");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_COMP_INFO,
+		                 "Cannot get stats about the last compressed packet");
 	}
 	else
 	{
-		stats->head_comp_size    += last_packet_info.header_last_comp_size;
-		stats->head_uncomp_size  += last_packet_info.header_last_uncomp_size;
-		stats->total_comp_size   += last_packet_info.total_last_comp_size;
-		stats->total_uncomp_size += last_packet_info.total_last_uncomp_size;
+		iprohc_tunnel_stats_begin(stats);
+		stats->counters.head_comp_size    += last_packet_info.header_last_comp_size;
+		stats->counters.head_uncomp_size  += last_packet_info.header_last_uncomp_size;
+		stats->counters.total_comp_size   += last_packet_info.total_last_comp_size;
+		stats->counters.total_uncomp_size += last_packet_info.total_last_uncomp_size;
+		iprohc_tunnel_flow_count(&(stats->counters), &last_packet_info);
+		iprohc_tunnel_stats_end(stats);
 	}
 
 	/* Addind size byte(s) */
@@ -1052,13 +1475,15 @@ int tun2raw(struct rohc_comp *comp,
 	memcpy(rohc_packet_p, rohc_packet_temp, rohc_size);
 
 	*packing_cur_len += rohc_size;
+	stats->packing_read_times[*packing_cur_pkts] = read_time;
 	(*packing_cur_pkts)++;
+	IPROHC_PROBE2(frame_append, *packing_cur_pkts, *packing_cur_len);
 
 	if((*packing_cur_pkts) >= packing_max_pkts)
 	{
 		/* All packets loaded: GOGOGO */
 		send_puree(to, raddr, mtu, packing_frame, packing_cur_len,
-		           packing_cur_pkts, stats);
+		           packing_cur_pkts, stats, IPROHC_FLUSH_FULL);
 		assert((*packing_cur_len) == 0);
 		assert((*packing_cur_pkts) == 0);
 	}
@@ -1066,7 +1491,9 @@ int tun2raw(struct rohc_comp *comp,
 quit:
 	return 0;
 error:
-	stats->comp_failed++;
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.comp_failed++;
+	iprohc_tunnel_stats_end(stats);
 	return 1;
 }
 
@@ -1090,12 +1517,89 @@ int raw2tun(struct rohc_decomp *decomp,
 				int from,
 				int to,
 				const size_t mtu,
-				struct statitics *stats)
+				struct iprohc_tunnel_stats *stats)
 {
-	const struct rohc_ts arrival_time = { .sec = 0, .nsec = 0 };
-
 	unsigned char packet[TUNTAP_BUFSIZE];
 	unsigned int packet_len = TUNTAP_BUFSIZE;
+	int ret;
+
+	/* read ROHC packet from the RAW tunnel */
+	ret = read(from, packet, packet_len);
+	if(ret < 0 || ret > packet_len)
+	{
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_READ,
+		                 "recvfrom failed: %s (%d)", strerror(errno), errno);
+		iprohc_tunnel_stats_begin(stats);
+		stats->counters.unpack_failed++;
+		iprohc_tunnel_stats_end(stats);
+		return -2;
+	}
+	packet_len = ret;
+	IPROHC_PROBE2(frame_recv, from, packet_len);
+
+	return raw2tun_frame(decomp, dst_addr, packet, packet_len, to, stats);
+}
+
+
+/**
+ * @brief Decompress the frame of ROHC packets received from the remote
+ *        endpoint of the given tunnel, and write the IP packets to TUN
+ *
+ * The function is called by the thread that receives the traffic of the
+ * tunnel in place of its session thread. It does nothing while the session
+ * is not established or once it ended. The decompression statistics are
+ * updated on the behalf of the session.
+ *
+ * The caller shall hold the lock of the ROHC contexts of the tunnel, see
+ * \ref iprohc_tunnel.rohc_lock. The caller takes the lock through its own
+ * reference to it: the pointer in the tunnel is reset when the tunnel is.
+ *
+ * @param tunnel     The tunnel
+ * @param dst_addr   The IP destination address to filter traffic on
+ * @param frame      The frame, starting with its IPv4 header
+ * @param frame_len  The length (in bytes) of the frame
+ * @return           0 in case of success, 1 if the tunnel does not accept
+ *                   traffic, a negative value if the frame was malformed or
+ *                   could not be decompressed
+ */
+int iprohc_tunnel_decompress(struct iprohc_tunnel *const tunnel,
+                             const in_addr_t dst_addr,
+                             unsigned char *const frame,
+                             const size_t frame_len)
+{
+	int ret = 1;
+
+	if(tunnel->is_rx_enabled && tunnel->decomp != NULL)
+	{
+		ret = raw2tun_frame(tunnel->decomp, dst_addr, frame, frame_len,
+		                    tunnel->tun_fd_out, &(tunnel->rx_stats));
+	}
+
+	return ret;
+}
+
+
+/**
+ * @brief Decompress one frame of ROHC packets and write the IP packets to
+ *        the TUN interface
+ *
+ * @param decomp      The ROHC decompressor
+ * @param dst_addr    The IP destination address to filter traffic on
+ * @param packet      The frame, starting with its IPv4 header
+ * @param packet_len  The length (in bytes) of the frame
+ * @param to          The TUN file descriptor to write to
+ * @param stats       The decompression statistics
+ * @return            0 in case of success, a non-null value otherwise
+ */
+static int raw2tun_frame(struct rohc_decomp *decomp,
+                         const in_addr_t dst_addr,
+                         unsigned char *const packet,
+                         const size_t packet_len,
+                         const int to,
+                         struct iprohc_tunnel_stats *const stats)
+{
+	const struct rohc_ts arrival_time = { .sec = 0, .nsec = 0 };
+
 	struct iphdr *ip_header;
 
 	unsigned char *ip_payload;
@@ -1106,48 +1610,50 @@ int raw2tun(struct rohc_decomp *decomp,
 	/* We add the 4 bytes of TUN headers */
 	unsigned char decomp_packet[4 + MAX_ROHC_SIZE];
 
+	uint64_t decomp_start;
+	uint64_t decomp_time;
+
 	int ret;
 	int i = 0;
 
-	/* read ROHC packet from the RAW tunnel */
-	ret = read(from, packet, packet_len);
-	if(ret < 0 || ret > packet_len)
+	if(packet_len == 0)
 	{
-		trace(LOG_ERR, "recvfrom failed: %s (%d)\n", strerror(errno), errno);
-		goto error_unpack;
-	}
-	if(ret == 0)
-	{
-		trace(LOG_ERR, "Empty packet received");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_EMPTY,
+		                 "Empty packet received");
 		goto ignore;
 	}
-	packet_len = ret;
-	stats->total_received++;
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.total_received++;
+	iprohc_tunnel_stats_end(stats);
 
 	dump_packet("Decompressing: ", packet, packet_len);
 
 	/* check that data is a valid IPv4 packet */
 	if(packet_len <= 20)
 	{
-		trace(LOG_ERR, "bad packet received: too small for IPv4 header, "
-		      "only %u bytes received", packet_len);
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_BAD_IP,
+		                 "bad packet received: too small for IPv4 header, "
+		                 "only %zu bytes received", packet_len);
 		goto error_unpack;
 	}
 	ip_header = (struct iphdr *) packet;
 	if(ip_header->version != 4)
 	{
-		trace(LOG_ERR, "bad packet received: not IP version 4");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_BAD_IP,
+		                 "bad packet received: not IP version 4");
 		goto error_unpack;
 	}
 	if(ip_header->ihl != 5)
 	{
-		trace(LOG_ERR, "bad packet received: IP options not supported");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_BAD_IP,
+		                 "bad packet received: IP options not supported");
 		goto error_unpack;
 	}
 	csum = ip_fast_csum(packet, ip_header->ihl);
 	if(csum != 0)
 	{
-		trace(LOG_ERR, "bad packet received: wrong IP checksum");
+		tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_RAW_BAD_IP,
+		                 "bad packet received: wrong IP checksum");
 		goto error_unpack;
 	}
 
@@ -1185,7 +1691,9 @@ int raw2tun(struct rohc_decomp *decomp,
 			ip_payload += 1;
 			ip_payload_len -= 1;
 		}
-		stats->decomp_total++;
+		iprohc_tunnel_stats_begin(stats);
+		stats->counters.decomp_total++;
+		iprohc_tunnel_stats_end(stats);
 
 		trace(LOG_DEBUG, "Packet #%d : %d bytes", i, len);
 		i++;
@@ -1193,24 +1701,34 @@ int raw2tun(struct rohc_decomp *decomp,
 		/* Some basic checks on packet length */
 		if(len > MAX_ROHC_SIZE)
 		{
-			trace(LOG_ERR, "Packet too big, skipping");
+			tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_UNPACK,
+			                 "Packet too big, skipping");
 			goto error_unpack;
 		}
 
 		if(len > ip_payload_len)
 		{
-			trace(LOG_ERR, "Packet bigger than containing packet, skipping all");
+			tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_UNPACK,
+			                 "Packet bigger than containing packet, skipping all");
 			goto error_unpack;
 		}
 
 		dump_packet("Packet: ", ip_payload, len);
 
 		/* decompress the packet */
+		decomp_start = iprohc_latency_now();
 		ret = rohc_decompress2(decomp, arrival_time, ip_payload, len,
 		                       &decomp_packet[4], MAX_ROHC_SIZE, &decomp_size);
+		decomp_time = iprohc_latency_now() - decomp_start;
+		IPROHC_PROBE3(decompress, len, (ret == ROHC_OK ? decomp_size : 0),
+		              decomp_time);
+		iprohc_tunnel_stats_begin(stats);
+		iprohc_latency_record(&(stats->counters.decomp_time), decomp_time);
+		iprohc_tunnel_stats_end(stats);
 		if(ret != ROHC_OK)
 		{
-			trace(LOG_ERR, "decompression of packet failed (%d)\n", ret);
+			tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_DECOMP,
+			                 "decompression of packet failed (%d)", ret);
 			goto error;
 		}
 
@@ -1229,8 +1747,8 @@ int raw2tun(struct rohc_decomp *decomp,
 				decomp_packet[3] = 0xdd;
 				break;
 			default:
-				trace(LOG_ERR, "bad IP version (%d)\n",
-				      (decomp_packet[4] >> 4) & 0x0f);
+				tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_DECOMP_BAD_IP,
+				                 "bad IP version (%d)", (decomp_packet[4] >> 4) & 0x0f);
 				goto error;
 		}
 
@@ -1238,7 +1756,8 @@ int raw2tun(struct rohc_decomp *decomp,
 		ret = write(to, decomp_packet, decomp_size + 4);
 		if(ret < 0)
 		{
-			trace(LOG_ERR, "write failed: %s (%d)\n", strerror(errno), errno);
+			tunnel_err_trace(stats, IPROHC_TUNNEL_ERR_TUN_WRITE,
+			                 "write failed: %s (%d)", strerror(errno), errno);
 			goto error;
 		}
 		trace(LOG_DEBUG, "%u bytes written on fd %d\n", ret, to);
@@ -1250,55 +1769,315 @@ int raw2tun(struct rohc_decomp *decomp,
 ignore:
 	return 0;
 error:
-	stats->decomp_failed++;
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.decomp_failed++;
+	iprohc_tunnel_stats_end(stats);
 	return -1;
 error_unpack:
-	stats->unpack_failed++;
+	iprohc_tunnel_stats_begin(stats);
+	stats->counters.unpack_failed++;
+	iprohc_tunnel_stats_end(stats);
 	return -2;
 }
 
 
+/**
+ * @brief Copy the statistics of the given tunnel
+ *
+ * The copy is consistent: all the counters were read between two updates
+ * by the thread of the session. The thread of the session is never slowed
+ * down, the caller retries if an update happened during the copy. The
+ * decompression statistics are copied apart the same way, since they are
+ * updated by the thread that decompresses the traffic of the tunnel.
+ *
+ * @param tunnel      The tunnel
+ * @param[out] stats  The copy of the statistics of the tunnel
+ */
+void iprohc_tunnel_get_stats(const struct iprohc_tunnel *const tunnel,
+                             struct statitics *const stats)
+{
+	struct statitics rx;
+	AO_t seq;
+	size_t i;
+
+	do
+	{
+		seq = iprohc_seqlock_read_begin(&(tunnel->stats.seq));
+		memcpy(stats, &(tunnel->stats.counters), sizeof(struct statitics));
+	}
+	while(iprohc_seqlock_read_retry(&(tunnel->stats.seq), seq));
+
+	/* add the decompression statistics, they may have another writer */
+	do
+	{
+		seq = iprohc_seqlock_read_begin(&(tunnel->rx_stats.seq));
+		memcpy(&rx, &(tunnel->rx_stats.counters), sizeof(struct statitics));
+	}
+	while(iprohc_seqlock_read_retry(&(tunnel->rx_stats.seq), seq));
+
+	stats->decomp_failed += rx.decomp_failed;
+	stats->decomp_total += rx.decomp_total;
+	stats->unpack_failed += rx.unpack_failed;
+	stats->total_received += rx.total_received;
+	for(i = 0; i < IPROHC_TUNNEL_ERR_MAX; i++)
+	{
+		stats->errors[i].total_nr += rx.errors[i].total_nr;
+		stats->errors[i].suppressed_nr += rx.errors[i].suppressed_nr;
+		if(rx.errors[i].last_log > stats->errors[i].last_log)
+		{
+			stats->errors[i].last_log = rx.errors[i].last_log;
+		}
+	}
+	iprohc_latency_merge(&(stats->decomp_time), &(rx.decomp_time));
+}
+
+
+/**
+ * @brief Start an update of the statistics of a tunnel
+ *
+ * Only the thread of the session shall update the statistics.
+ *
+ * @param stats  The statistics of the tunnel
+ */
+static inline void iprohc_tunnel_stats_begin(struct iprohc_tunnel_stats *const stats)
+{
+	iprohc_seqlock_write_begin(&(stats->seq));
+}
+
+
+/**
+ * @brief End an update of the statistics of a tunnel
+ *
+ * @param stats  The statistics of the tunnel
+ */
+static inline void iprohc_tunnel_stats_end(struct iprohc_tunnel_stats *const stats)
+{
+	iprohc_seqlock_write_end(&(stats->seq));
+}
+
+
+/**
+ * @brief Let the traces of the current thread follow the debug of a session
+ *
+ * All the traces printed by the thread of the session, the packet dumps and
+ * the traces of the ROHC library included, are printed at the debug level if
+ * the administrator enabled debug for the session. The other sessions are
+ * not affected.
+ *
+ * @param session  The session the current thread runs
+ */
+static inline void iprohc_tunnel_update_debug(const struct iprohc_session *const session)
+{
+	iprohc_log_thread_priority =
+		(AO_load(&(session->is_debug)) ? LOG_DEBUG : -1);
+}
+
+
+/**
+ * @brief Lock the ROHC compressor and decompressor of a tunnel, if they are
+ *        shared with another thread
+ *
+ * @param rohc_lock  The lock of the ROHC contexts, NULL if not shared
+ */
+static inline void iprohc_tunnel_rohc_lock(pthread_mutex_t *const rohc_lock)
+{
+	if(rohc_lock != NULL)
+	{
+		pthread_mutex_lock(rohc_lock);
+	}
+}
+
+
+/**
+ * @brief Unlock the ROHC compressor and decompressor of a tunnel, if they
+ *        are shared with another thread
+ *
+ * @param rohc_lock  The lock of the ROHC contexts, NULL if not shared
+ */
+static inline void iprohc_tunnel_rohc_unlock(pthread_mutex_t *const rohc_lock)
+{
+	if(rohc_lock != NULL)
+	{
+		pthread_mutex_unlock(rohc_lock);
+	}
+}
+
+
+/**
+ * @brief Count one compressed packet in the statistics of its flow
+ *
+ * The caller shall have started an update of the statistics.
+ *
+ * @param counters  The counters of the tunnel
+ * @param info      The information about the last compressed packet
+ */
+static void iprohc_tunnel_flow_count(struct statitics *const counters,
+                                     const rohc_comp_last_packet_info2_t *const info)
+{
+	struct iprohc_tunnel_flow *flow;
+
+	if(info->context_id > ROHC_SMALL_CID_MAX)
+	{
+		return;
+	}
+	flow = &(counters->flows[info->context_id]);
+
+	flow->profile_id = info->profile_id;
+	flow->state = info->context_state;
+	flow->packets_nr++;
+	if(info->packet_type == ROHC_PACKET_IR)
+	{
+		flow->ir_nr++;
+	}
+	else if(info->packet_type == ROHC_PACKET_IR_DYN)
+	{
+		flow->ir_dyn_nr++;
+	}
+	flow->head_uncomp_size += info->header_last_uncomp_size;
+	flow->head_comp_size += info->header_last_comp_size;
+}
+
+
+/**
+ * @brief Count one error of the data path, tell whether to log it
+ *
+ * At most one error of every kind is logged per second and per tunnel, the
+ * next log tells how many errors were not logged meanwhile.
+ *
+ * @param stats               The statistics of the tunnel
+ * @param err                 The error
+ * @param[out] suppressed_nr  The number of errors not logged since the last
+ *                            log of the error
+ * @return                    true if the error shall be logged,
+ *                            false if it shall be suppressed
+ */
+static bool iprohc_tunnel_err_count(struct iprohc_tunnel_stats *const stats,
+                                    const iprohc_tunnel_err_t err,
+                                    uint64_t *const suppressed_nr)
+{
+	struct iprohc_tunnel_err *const counter = &(stats->counters.errors[err]);
+	struct timespec now;
+	bool is_logged;
+
+	/* the coarse clock is cheap enough to be read for every error */
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	iprohc_tunnel_stats_begin(stats);
+	counter->total_nr++;
+	if(counter->total_nr > 1 && now.tv_sec == counter->last_log)
+	{
+		counter->suppressed_nr++;
+		is_logged = false;
+	}
+	else
+	{
+		*suppressed_nr = counter->suppressed_nr;
+		counter->suppressed_nr = 0;
+		counter->last_log = now.tv_sec;
+		is_logged = true;
+	}
+	iprohc_tunnel_stats_end(stats);
+
+	return is_logged;
+}
+
+
+/**
+ * @brief Get a short description of the given error of the data path
+ *
+ * @param err  The error
+ * @return     The description of the error
+ */
+const char * iprohc_tunnel_err_descr(const iprohc_tunnel_err_t err)
+{
+	switch(err)
+	{
+		case IPROHC_TUNNEL_ERR_TUN_READ:
+			return "read on TUN failed";
+		case IPROHC_TUNNEL_ERR_TUN_RUNT:
+			return "packet too small for TUN header";
+		case IPROHC_TUNNEL_ERR_COMP:
+			return "compression failed";
+		case IPROHC_TUNNEL_ERR_COMP_TOO_LARGE:
+			return "compressed packet too large";
+		case IPROHC_TUNNEL_ERR_COMP_INFO:
+			return "no stats about compressed packet";
+		case IPROHC_TUNNEL_ERR_FRAME_TOO_LARGE:
+			return "packing frame too large";
+		case IPROHC_TUNNEL_ERR_RAW_SEND:
+			return "send on RAW socket failed";
+		case IPROHC_TUNNEL_ERR_RAW_READ:
+			return "read on RAW socket failed";
+		case IPROHC_TUNNEL_ERR_RAW_EMPTY:
+			return "empty frame received";
+		case IPROHC_TUNNEL_ERR_RAW_BAD_IP:
+			return "malformed IPv4 header received";
+		case IPROHC_TUNNEL_ERR_UNPACK:
+			return "malformed packing frame";
+		case IPROHC_TUNNEL_ERR_DECOMP:
+			return "decompression failed";
+		case IPROHC_TUNNEL_ERR_DECOMP_BAD_IP:
+			return "decompressed packet not IP";
+		case IPROHC_TUNNEL_ERR_TUN_WRITE:
+			return "write on TUN failed";
+		case IPROHC_TUNNEL_ERR_MAX:
+		default:
+			return "unknown error";
+	}
+}
+
+
 /* Trace functions */
 
+#if IPROHC_LOG_MIN_LEVEL >= LOG_DEBUG
+
 /**
  * @brief Display the content of a IP or ROHC packet
  *
- * This function is used for debugging purposes.
+ * This function is used for debugging purposes, through the dump_packet()
+ * macro that skips it if debug traces are disabled.
  *
  * @param descr   A string that describes the packet
  * @param packet  The packet to display
  * @param length  The length of the packet to display
  */
-void dump_packet(char *descr, unsigned char *packet, unsigned int length)
+static void dump_packet_content(const char *const descr,
+                                const unsigned char *const packet,
+                                const size_t length)
 {
-	unsigned int i;
-	char line[1024];
-	char tmp[4];
+	static const char hex_digits[] = "0123456789abcdef";
+	char line[16 * 3 + 2];
+	size_t line_len = 0;
+	size_t i;
 
 	trace(LOG_DEBUG, "-------------------------------\n");
-	trace(LOG_DEBUG, "%s (%u bytes):\n", descr, length);
-	line[0] = '\0';
+	trace(LOG_DEBUG, "%s (%zu bytes):\n", descr, length);
 	for(i = 0; i < length; i++)
 	{
 		if(i > 0 && (i % 16) == 0)
 		{
+			line[line_len] = '\0';
 			trace(LOG_DEBUG, "%s", line);
-			line[0] = '\0';
+			line_len = 0;
 		}
 		else if(i > 0 && (i % 8) == 0)
 		{
-			strcat(line, "\t");
+			line[line_len++] = '\t';
 		}
-		snprintf(tmp, 4, "%.2x ", packet[i]);
-		strcat(line, tmp);
+		line[line_len++] = hex_digits[packet[i] >> 4];
+		line[line_len++] = hex_digits[packet[i] & 0x0f];
+		line[line_len++] = ' ';
 	}
-	if(line[0] != '\0')
+	if(line_len > 0)
 	{
+		line[line_len] = '\0';
 		trace(LOG_DEBUG, "%s", line);
 	}
 	trace(LOG_DEBUG, "-------------------------------\n");
 }
 
+#endif
+
 
 /**
  * @brief Callback to print traces of the ROHC library
@@ -1344,6 +2123,12 @@ static void print_rohc_traces(rohc_trace_level_t level,
 			syslog_level = LOG_ERR;
 	}
 
+	/* don't format the traces that would be dropped */
+	if(!iprohc_log_is_enabled(syslog_level))
+	{
+		return;
+	}
+
 	switch(entity)
 	{
 		case ROHC_TRACE_COMP:
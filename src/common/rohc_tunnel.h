@@ -21,11 +21,14 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #define ROHC_IPIP_TUNNEL_H
 
 #include "tlv.h"
+#include "latency.h"
 
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <gnutls/gnutls.h>
 
@@ -33,29 +36,129 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <rohc/rohc_comp.h>
 #include <rohc/rohc_decomp.h>
 
+#include <atomic_ops.h>
+
 
 /// The maximal size of data that can be received on the virtual interface
 #define TUNTAP_BUFSIZE 1518
 
+/** The maximal number of ROHC packets per packing frame */
+#define IPROHC_PACKING_MAX  10
+
+/** The size (in bytes) of a cache line */
+#define IPROHC_CACHE_LINE_SIZE  64
+
+/** The errors of the data path, counted and logged at most once a second */
+typedef enum
+{
+	IPROHC_TUNNEL_ERR_TUN_READ = 0,     /**< Read on TUN failed */
+	IPROHC_TUNNEL_ERR_TUN_RUNT,         /**< Packet too small for TUN header */
+	IPROHC_TUNNEL_ERR_COMP,             /**< Compression failed */
+	IPROHC_TUNNEL_ERR_COMP_TOO_LARGE,   /**< Compressed packet too large */
+	IPROHC_TUNNEL_ERR_COMP_INFO,        /**< No info on compressed packet */
+	IPROHC_TUNNEL_ERR_FRAME_TOO_LARGE,  /**< Packing frame over the MTU */
+	IPROHC_TUNNEL_ERR_RAW_SEND,         /**< Send on RAW socket failed */
+	IPROHC_TUNNEL_ERR_RAW_READ,         /**< Read on RAW socket failed */
+	IPROHC_TUNNEL_ERR_RAW_EMPTY,        /**< Empty frame received */
+	IPROHC_TUNNEL_ERR_RAW_BAD_IP,       /**< Malformed IPv4 header received */
+	IPROHC_TUNNEL_ERR_UNPACK,           /**< Malformed packing frame */
+	IPROHC_TUNNEL_ERR_DECOMP,           /**< Decompression failed */
+	IPROHC_TUNNEL_ERR_DECOMP_BAD_IP,    /**< Decompressed packet not IP */
+	IPROHC_TUNNEL_ERR_TUN_WRITE,        /**< Write on TUN failed */
+	IPROHC_TUNNEL_ERR_MAX
+} iprohc_tunnel_err_t;
+
+/** The counter of one error of the data path */
+struct iprohc_tunnel_err
+{
+	uint64_t total_nr;       /**< The number of errors */
+	uint64_t suppressed_nr;  /**< The errors not logged since last log */
+	time_t last_log;         /**< The time (in seconds) of the last log */
+};
+
+/**
+ * @brief The compression statistics of one flow, that is one ROHC context
+ *
+ * The counters add up the packets of all the flows that used the CID in
+ * turn, the profile and the state are those of the last packet.
+ */
+struct iprohc_tunnel_flow
+{
+	int profile_id;                /**< The ROHC profile of the context */
+	rohc_comp_state_t state;       /**< The state of the compressor */
+	uint64_t packets_nr;           /**< The packets compressed */
+	uint64_t ir_nr;                /**< The IR packets among them */
+	uint64_t ir_dyn_nr;            /**< The IR-DYN packets among them */
+	uint64_t head_uncomp_size;     /**< The bytes of headers before compression */
+	uint64_t head_comp_size;       /**< The bytes of headers after compression */
+};
+
+/** The statistics of a tunnel, 64-bit counters that do not wrap */
 struct statitics
 {
-	int decomp_failed;
-	int decomp_total;
+	uint64_t decomp_failed;
+	uint64_t decomp_total;
+
+	uint64_t comp_failed;
+	uint64_t comp_total;
+
+	uint64_t head_comp_size;
+	uint64_t head_uncomp_size;
+
+	uint64_t total_comp_size;
+	uint64_t total_uncomp_size;
+
+	uint64_t unpack_failed;
+	uint64_t total_received;
+
+	/** The number of packing frames sent, by number of packets in frame */
+	uint64_t stats_packing[IPROHC_PACKING_MAX + 1];
+
+	/** The errors of the data path */
+	struct iprohc_tunnel_err errors[IPROHC_TUNNEL_ERR_MAX];
+
+	/** The compression statistics of every flow, by CID, the tunnels use
+	 *  small CIDs only */
+	struct iprohc_tunnel_flow flows[ROHC_SMALL_CID_MAX + 1];
 
-	int comp_failed;
-	int comp_total;
+	/** The time from the read of a packet on TUN to the send of its frame */
+	struct iprohc_latency packing_hold;
+	struct iprohc_latency comp_time;    /**< The time to compress a packet */
+	struct iprohc_latency decomp_time;  /**< The time to decompress a packet */
+};
 
-	int head_comp_size;
-	int head_uncomp_size;
+/**
+ * @brief The statistics of a tunnel, as updated by the thread of its session
+ *
+ * The thread of the session is the only writer. It makes the sequence
+ * number odd while it updates the counters, other threads copy them with
+ * iprohc_tunnel_get_stats() until the sequence number is even and did not
+ * change meanwhile. The writer never waits for the readers.
+ *
+ * The counters start on their own cache line, so that the other fields of
+ * the tunnel are not invalidated when they change.
+ */
+struct iprohc_tunnel_stats
+{
+	volatile AO_t seq;          /**< The sequence number of the updates */
+	struct statitics counters;  /**< The counters */
 
-	int total_comp_size;
-	int total_uncomp_size;
+	/** The times the packets of the current packing frame were read on TUN,
+	 *  only used by the thread of the session */
+	uint64_t packing_read_times[IPROHC_PACKING_MAX];
+} __attribute__((aligned(IPROHC_CACHE_LINE_SIZE)));
 
-	int unpack_failed;
-	int total_received;
 
-	int *stats_packing;
-	int n_stats_packing;
+/**
+ * The ROHC contexts of a lost session, kept to resume them in the next
+ * session of the same peer
+ */
+struct iprohc_tunnel_contexts
+{
+	struct rohc_comp *comp;      /**< The ROHC compressor */
+	struct rohc_decomp *decomp;  /**< The ROHC decompressor */
+	struct tunnel_params params; /**< The parameters the contexts were built with */
+	size_t mem;                  /**< The heap used by the contexts (estimate) */
 };
 
 
@@ -79,12 +182,29 @@ struct iprohc_tunnel
 	struct rohc_comp *comp;      /**< The ROHC compressor */
 	struct rohc_decomp *decomp;  /**< The ROHC decompressor */
 
-	/** The frame being packed, stored in context until completion or timeout */
-	unsigned char packing_frame[TUNTAP_BUFSIZE];
+	/** Serialize the use of the ROHC compressor and decompressor by the thread
+	 *  of the session and by the thread that decompresses the traffic of the
+	 *  tunnel, NULL if the thread of the session decompresses it itself */
+	pthread_mutex_t *rohc_lock;
+	bool is_rx_enabled;          /**< Whether another thread may decompress the
+	                                  traffic of the tunnel, protected by
+	                                  rohc_lock */
+
+	size_t rohc_mem;             /**< The heap used by the ROHC compressor and
+	                                  decompressor, approximate (see
+	                                  iprohc_heap_used()) */
+
+	/** The frame being packed, stored in context until completion or timeout,
+	 *  allocated with the first packet to send */
+	unsigned char *packing_frame;
 
 	struct tunnel_params params;
 
-	struct statitics stats;
+	/** The statistics of the tunnel, but the decompression ones */
+	struct iprohc_tunnel_stats stats;
+	/** The decompression statistics, updated by the thread that decompresses
+	 *  the traffic of the tunnel */
+	struct iprohc_tunnel_stats rx_stats;
 };
 
 
@@ -100,6 +220,42 @@ bool iprohc_tunnel_new(struct iprohc_tunnel *const tunnel,
 bool iprohc_tunnel_free(struct iprohc_tunnel *const tunnel)
 	__attribute__((warn_unused_result, nonnull(1)));
 
+void iprohc_tunnel_get_stats(const struct iprohc_tunnel *const tunnel,
+                             struct statitics *const stats)
+	__attribute__((nonnull(1, 2)));
+
+void iprohc_tunnel_detach_contexts(struct iprohc_tunnel *const tunnel,
+                                   struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((nonnull(1, 2)));
+
+bool iprohc_tunnel_set_packing(struct iprohc_tunnel *const tunnel,
+                               const char packing)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool iprohc_tunnel_contexts_new(struct iprohc_tunnel_contexts *const contexts,
+                                const struct tunnel_params params)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool iprohc_tunnel_can_resume(const struct iprohc_tunnel *const tunnel,
+                              const struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+void iprohc_tunnel_attach_contexts(struct iprohc_tunnel *const tunnel,
+                                   struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((nonnull(1, 2)));
+
+const char * iprohc_tunnel_err_descr(const iprohc_tunnel_err_t err)
+	__attribute__((warn_unused_result, const));
+
+void iprohc_tunnel_contexts_free(struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((nonnull(1)));
+
+int iprohc_tunnel_decompress(struct iprohc_tunnel *const tunnel,
+                             const in_addr_t dst_addr,
+                             unsigned char *const frame,
+                             const size_t frame_len)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
 void * iprohc_tunnel_run(void *arg);
 
 #endif
@@ -0,0 +1,98 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   seqlock.h
+ * @brief  The sequence numbers that let other threads copy the statistics
+ *         of one writer thread
+ *
+ * The writer makes the sequence number odd while it updates the data, the
+ * readers copy the data until the sequence number is even and did not
+ * change meanwhile. The writer never waits for the readers.
+ */
+
+#ifndef IPROHC_COMMON_SEQLOCK__H
+#define IPROHC_COMMON_SEQLOCK__H
+
+#include <stdbool.h>
+#include <atomic_ops.h>
+
+
+/**
+ * @brief Start an update of the data protected by the sequence number
+ *
+ * Only one thread shall update the data.
+ *
+ * @param seq  The sequence number
+ */
+static inline void iprohc_seqlock_write_begin(volatile AO_t *const seq)
+{
+	AO_store(seq, *seq + 1);
+	AO_nop_write();
+}
+
+
+/**
+ * @brief End an update of the data protected by the sequence number
+ *
+ * @param seq  The sequence number
+ */
+static inline void iprohc_seqlock_write_end(volatile AO_t *const seq)
+{
+	AO_store_release_write(seq, *seq + 1);
+}
+
+
+/**
+ * @brief Start a copy of the data protected by the sequence number
+ *
+ * Wait for the update in progress, if any.
+ *
+ * @param seq  The sequence number
+ * @return     The sequence number to give to iprohc_seqlock_read_retry()
+ */
+static inline AO_t iprohc_seqlock_read_begin(const volatile AO_t *const seq)
+{
+	AO_t cur;
+
+	do
+	{
+		cur = AO_load_acquire_read(seq);
+	}
+	while((cur & 1) != 0);
+
+	return cur;
+}
+
+
+/**
+ * @brief Tell whether a copy of the data shall be done again
+ *
+ * @param seq    The sequence number
+ * @param start  The sequence number returned by iprohc_seqlock_read_begin()
+ * @return       true if the data was updated during the copy,
+ *               false if the copy is consistent
+ */
+static inline bool iprohc_seqlock_read_retry(const volatile AO_t *const seq,
+                                             const AO_t start)
+{
+	AO_nop_read();
+	return (AO_load(seq) != start);
+}
+
+#endif
+
@@ -24,13 +24,15 @@
 #include "session.h"
 
 #include "log.h"
+#include "utils.h"
 
 #include <arpa/inet.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
-#include <sys/timerfd.h>
+#include <sys/mman.h>
 
 
 /**
@@ -98,66 +100,51 @@ bool iprohc_session_new(struct iprohc_session *const session,
 	session->status = IPROHC_SESSION_CONNECTING;
 	session->thread_tunnel = -1;
 	session->thread_stack = NULL;
+	session->thread_stack_len = 0;
+	iprohc_thread_sched_init(&session->sched);
+	session->notify_end = NULL;
+	session->stack_size = IPROHC_SESSION_STACK_DEFAULT;
+	session->is_compact = false;
+	session->update_ctrl = NULL;
+	session->has_new_params = false;
+	AO_store(&(session->is_debug), 0);
+	if(pthread_mutex_init(&session->params_lock, NULL) != 0)
+	{
+		trace(LOG_ERR, "[client %s] failed to init the lock of parameters",
+		      session->dst_addr_str);
+		goto error;
+	}
 
 	/* Initialize TLS session */
+	session->tls_mem = iprohc_heap_used();
 	gnutls_init(&session->tls_session, tls_type);
-	if(tls_type == GNUTLS_SERVER)
-	{
-		gnutls_priority_set(session->tls_session, priority_cache);
-	}
-	else if(tls_type == GNUTLS_CLIENT)
-	{
-		const int protocol_priority[] = { GNUTLS_TLS1, GNUTLS_SSL3, 0 };
-		const int cipher_priority[] = { GNUTLS_CIPHER_3DES_CBC, GNUTLS_CIPHER_ARCFOUR, 0};
-		const int comp_priority[] = { GNUTLS_COMP_ZLIB, GNUTLS_COMP_NULL, 0 };
-		const int kx_priority[] = { GNUTLS_KX_RSA, 0 };
-		const int mac_priority[] = { GNUTLS_MAC_SHA, GNUTLS_MAC_MD5, 0 };
-		gnutls_protocol_set_priority(session->tls_session, protocol_priority);
-		gnutls_cipher_set_priority(session->tls_session, cipher_priority);
-		gnutls_compression_set_priority(session->tls_session, comp_priority);
-		gnutls_kx_set_priority(session->tls_session, kx_priority);
-		gnutls_mac_set_priority(session->tls_session, mac_priority);
-	}
+	gnutls_priority_set(session->tls_session, priority_cache);
 	gnutls_credentials_set(session->tls_session, GNUTLS_CRD_CERTIFICATE, tls_cred);
 	gnutls_certificate_server_set_request(session->tls_session, GNUTLS_CERT_REQUEST);
+	session->tls_mem = iprohc_heap_growth(session->tls_mem);
 
-	/* create keepalive timer */
-	session->keepalive_timer_fd = timerfd_create(CLOCK_REALTIME, 0);
-	if(session->keepalive_timer_fd < 0)
-	{
-		trace(LOG_ERR, "[client %s] failed to create keepalive timer: %s (%d)",
-		      session->dst_addr_str, strerror(errno), errno);
-		goto tls_deinit;
-	}
-
-	/* create packing timer */
-	session->packing_timer_fd = timerfd_create(CLOCK_REALTIME, 0);
-	if(session->packing_timer_fd < 0)
-	{
-		trace(LOG_ERR, "[client %s] failed to create packing timer: %s (%d)",
-		      session->dst_addr_str, strerror(errno), errno);
-		goto close_keepalive_timer;
-	}
+	/* create keepalive and packing timers */
+	iprohc_timer_wheel_init(&session->timers);
+	iprohc_timer_init(&session->keepalive_timer);
+	iprohc_timer_init(&session->packing_timer);
 
 	/* arm keepalive timer */
 	if(!iprohc_session_update_keepalive(session, keepalive_timeout))
 	{
 		trace(LOG_ERR, "[client %s] failed to update the keepalive timeout to "
 		      "%zu seconds", session->dst_addr_str, keepalive_timeout);
-		goto close_packing_timer;
+		goto tls_deinit;
 	}
 	session->keepalive_misses = 0;
+	AO_store(&(session->has_data_rx), 0);
 
 	AO_store_release_write(&(session->is_thread_running), 0);
 
 	return true;
 
-close_packing_timer:
-	close(session->packing_timer_fd);
-close_keepalive_timer:
-	close(session->keepalive_timer_fd);
 tls_deinit:
 	gnutls_deinit(session->tls_session);
+	pthread_mutex_destroy(&session->params_lock);
 error:
 	return false;
 }
@@ -172,17 +159,15 @@ error:
  */
 bool iprohc_session_free(struct iprohc_session *const session)
 {
-	/* stop and destroy the packing timer */
-	close(session->packing_timer_fd);
-	session->packing_timer_fd = -1;
-
-	/* stop and destroy keepalive timer */
-	close(session->keepalive_timer_fd);
-	session->keepalive_timer_fd = -1;
+	/* stop the packing and keepalive timers */
+	iprohc_timer_disarm(&session->timers, &session->packing_timer);
+	iprohc_timer_disarm(&session->timers, &session->keepalive_timer);
 
 	/* free TLS resources */
 	gnutls_deinit(session->tls_session);
 
+	pthread_mutex_destroy(&session->params_lock);
+
 	/* reset source and destination addresses */
 	memset(&(session->dst_addr), 0, sizeof(struct in_addr));
 	memset(&(session->dst_addr_str), 0, INET_ADDRSTRLEN);
@@ -207,51 +192,37 @@ bool iprohc_session_free(struct iprohc_session *const session)
 bool iprohc_session_update_keepalive(struct iprohc_session *const session,
                                      const size_t timeout)
 {
-	struct itimerspec period;
-	int ret;
+	size_t period;
 
 	/* send keepalive 3 times more often than the timeout */
 	if(timeout == 0)
 	{
-		period.it_value.tv_sec = 0;
+		period = 0;
 	}
 	else
 	{
-		period.it_value.tv_sec = timeout / 3;
-		if(period.it_value.tv_sec == 0)
+		period = timeout / 3;
+		if(period == 0)
 		{
-			period.it_value.tv_sec = 1;
+			period = 1;
 		}
 	}
-	period.it_value.tv_nsec = 0;
-	period.it_interval.tv_sec = period.it_value.tv_sec;
-	period.it_interval.tv_nsec = 0;
 
-	if(period.it_value.tv_sec == 0)
+	if(period == 0)
 	{
 		trace(LOG_DEBUG, "[client %s] de-arm keepalive timer",
 		      session->dst_addr_str);
+		iprohc_timer_disarm(&session->timers, &session->keepalive_timer);
 	}
 	else
 	{
-		trace(LOG_DEBUG, "[client %s] (re-)arm keepalive timer to %lu seconds",
-		      session->dst_addr_str, (unsigned long) period.it_value.tv_sec);
-	}
-
-	/* arm keepalive timer with the new value */
-	ret = timerfd_settime(session->keepalive_timer_fd, 0, &period, NULL);
-	if(ret != 0)
-	{
-		trace(LOG_ERR, "[client %s] failed to arm keepalive timer with a "
-		      "%lu-second period: %s (%d)", session->dst_addr_str,
-		      (unsigned long) period.it_value.tv_sec, strerror(errno), errno);
-		goto error;
+		trace(LOG_DEBUG, "[client %s] (re-)arm keepalive timer to %zu seconds",
+		      session->dst_addr_str, period);
+		iprohc_timer_arm(&session->timers, &session->keepalive_timer,
+		                 period * 1000U, period * 1000U);
 	}
 
 	return true;
-
-error:
-	return false;
 }
 
 
@@ -264,7 +235,9 @@ error:
  */
 bool iprohc_session_start(struct iprohc_session *const session)
 {
-	const size_t stack_size = 100 * 1024;
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t stack_size =
+		(session->stack_size + page_size - 1) / page_size * page_size;
 	int ret;
 
 	ret = pipe(session->p2c);
@@ -278,15 +251,27 @@ bool iprohc_session_start(struct iprohc_session *const session)
 	AO_store_release_write(&(session->is_thread_running), 1);
 
 	/* reduce stack of client threads to avoid using too much memory:
-	 *  - allocate stack
+	 *  - map the stack and a guard page below it, the pages are not touched
+	 *    here so that they get allocated on the NUMA node of the CPU the
+	 *    thread is pinned to,
 	 *  - assign it to the new thread */
-	ret = posix_memalign(&session->thread_stack, sysconf(_SC_PAGESIZE), stack_size);
-	if(ret != 0)
+	session->thread_stack_len = page_size + stack_size;
+	session->thread_stack = mmap(NULL, session->thread_stack_len,
+	                             PROT_READ | PROT_WRITE,
+	                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if(session->thread_stack == MAP_FAILED)
 	{
 		trace(LOG_ERR, "failed to create the client tunnel thread: failed to "
-		      "allocate stack memory: %s (%d)", strerror(ret), ret);
+		      "allocate stack memory: %s (%d)", strerror(errno), errno);
+		session->thread_stack = NULL;
 		goto release_lock;
 	}
+	if(mprotect(session->thread_stack, page_size, PROT_NONE) != 0)
+	{
+		trace(LOG_ERR, "failed to create the client tunnel thread: failed to "
+		      "protect the stack guard page: %s (%d)", strerror(errno), errno);
+		goto free_stack;
+	}
 	ret = pthread_attr_init(&session->thread_attr);
 	if(ret != 0)
 	{
@@ -294,7 +279,8 @@ bool iprohc_session_start(struct iprohc_session *const session)
 		      "init thread attributes: %s (%d)", strerror(ret), ret);
 		goto free_stack;
 	}
-	ret = pthread_attr_setstack(&session->thread_attr, session->thread_stack,
+	ret = pthread_attr_setstack(&session->thread_attr,
+	                            ((uint8_t *) session->thread_stack) + page_size,
 	                            stack_size);
 	if(ret != 0)
 	{
@@ -303,14 +289,22 @@ bool iprohc_session_start(struct iprohc_session *const session)
 		goto destroy_thread_attrs;
 	}
 
+	/* pin the thread to its CPUs and set its scheduling policy */
+	if(!iprohc_thread_attr_set_sched(&session->thread_attr, &session->sched))
+	{
+		trace(LOG_ERR, "failed to create the client tunnel thread: failed to "
+		      "set CPU placement and scheduling policy");
+		goto destroy_thread_attrs;
+	}
+
 	/* Go threads, go ! */
-	ret = pthread_create(&(session->thread_tunnel), NULL,
+	ret = pthread_create(&(session->thread_tunnel), &session->thread_attr,
 	                     iprohc_tunnel_run, session);
 	if(ret != 0)
 	{
 		trace(LOG_ERR, "failed to create the client tunnel thread: %s (%d)",
 		      strerror(ret), ret);
-		goto free_stack;
+		goto destroy_thread_attrs;
 	}
 
 	return true;
@@ -323,7 +317,7 @@ destroy_thread_attrs:
 		      strerror(ret), ret);
 	}
 free_stack:
-	free(session->thread_stack);
+	munmap(session->thread_stack, session->thread_stack_len);
 	session->thread_stack = NULL;
 release_lock:
 	AO_store_release_write(&(session->is_thread_running), 0);
@@ -358,8 +352,8 @@ bool iprohc_session_stop(struct iprohc_session *const session)
 		session->p2c[1] = -1;
 	}
 
-	/* wait for thread to stop */
-	if(AO_load_acquire_read(&(session->is_thread_running)))
+	/* wait for thread to stop, join it even if it already ended by itself */
+	if(session->thread_stack != NULL)
 	{
 		trace(LOG_INFO, "[main] wait for client %s to stop", session->dst_addr_str);
 		pthread_join(session->thread_tunnel, NULL);
@@ -374,7 +368,7 @@ bool iprohc_session_stop(struct iprohc_session *const session)
 			trace(LOG_ERR, "failed to destroy thread attributes: %s (%d)",
 			      strerror(ret), ret);
 		}
-		free(session->thread_stack);
+		munmap(session->thread_stack, session->thread_stack_len);
 		session->thread_stack = NULL;
 	}
 
@@ -384,3 +378,201 @@ bool iprohc_session_stop(struct iprohc_session *const session)
 	return true;
 }
 
+
+/**
+ * @brief Ask the session thread to apply new tunnel parameters
+ *
+ * The parameters are applied by the session thread once the session is
+ * established, the last ones win if they are updated several times before.
+ *
+ * @param session             The session to update
+ * @param packing             The new packing level
+ * @param keepalive_timeout   The new keepalive timeout (in seconds)
+ * @param is_thread_notified  Whether to wake the session thread up, false if
+ *                            called by the session thread itself
+ * @return                    true if the parameters were recorded,
+ *                            false if a problem occurred
+ */
+bool iprohc_session_update_params(struct iprohc_session *const session,
+                                  const char packing,
+                                  const size_t keepalive_timeout,
+                                  const bool is_thread_notified)
+{
+	const char command = IPROHC_SESSION_CMD_UPDATE;
+
+	pthread_mutex_lock(&session->params_lock);
+	session->new_packing = packing;
+	session->new_keepalive_timeout = keepalive_timeout;
+	session->has_new_params = true;
+	pthread_mutex_unlock(&session->params_lock);
+
+	if(is_thread_notified && session->p2c[1] >= 0 &&
+	   write(session->p2c[1], &command, 1) != 1)
+	{
+		trace(LOG_ERR, "[client %s] failed to notify the session thread of new "
+		      "parameters: %s (%d)", session->dst_addr_str, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Ask the session thread to close the session
+ *
+ * The session thread tells the remote peer, then ends as if the peer closed
+ * the session. The main thread reaps the session as usual.
+ *
+ * @param session  The session to close
+ * @return         true if the session thread was asked to close the session,
+ *                 false if a problem occurred
+ */
+bool iprohc_session_disconnect(struct iprohc_session *const session)
+{
+	const char command = IPROHC_SESSION_CMD_STOP;
+
+	if(session->p2c[1] < 0 || write(session->p2c[1], &command, 1) != 1)
+	{
+		trace(LOG_ERR, "[client %s] failed to ask the session thread to close "
+		      "the session: %s (%d)", session->dst_addr_str, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Take the new tunnel parameters to apply, if any
+ *
+ * Called by the session thread.
+ *
+ * @param session                 The session
+ * @param[out] packing            The new packing level
+ * @param[out] keepalive_timeout  The new keepalive timeout (in seconds)
+ * @return                        true if new parameters shall be applied,
+ *                                false if there is none
+ */
+bool iprohc_session_take_params(struct iprohc_session *const session,
+                                char *const packing,
+                                size_t *const keepalive_timeout)
+{
+	bool has_new_params;
+
+	pthread_mutex_lock(&session->params_lock);
+	has_new_params = session->has_new_params;
+	if(has_new_params)
+	{
+		*packing = session->new_packing;
+		*keepalive_timeout = session->new_keepalive_timeout;
+		session->has_new_params = false;
+	}
+	pthread_mutex_unlock(&session->params_lock);
+
+	return has_new_params;
+}
+
+
+/**
+ * @brief Release the stack pages the session thread does not use currently
+ *
+ * Called by the session thread itself while it is idle: the stack grows
+ * down, so the pages below the current frame are unused until the next
+ * packet. They are given back to the system and zero-filled again on the
+ * next access.
+ *
+ * @param session  The session of the calling thread
+ */
+void iprohc_session_trim_stack(struct iprohc_session *const session)
+{
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *const stack_bottom = ((uint8_t *) session->thread_stack) + page_size;
+	volatile uint8_t cur_frame;
+	uintptr_t unused_top;
+
+	if(session->thread_stack == NULL)
+	{
+		return;
+	}
+
+	/* keep one page for the frames of madvise() itself */
+	unused_top = ((uintptr_t) &cur_frame) - page_size;
+	unused_top -= unused_top % page_size;
+	if(unused_top <= (uintptr_t) stack_bottom)
+	{
+		return;
+	}
+
+	if(madvise(stack_bottom, unused_top - (uintptr_t) stack_bottom,
+	           MADV_DONTNEED) != 0)
+	{
+		trace(LOG_WARNING, "[client %s] failed to release unused stack pages: "
+		      "%s (%d)", session->dst_addr_str, strerror(errno), errno);
+	}
+}
+
+
+/**
+ * @brief Compute the memory used by the given session
+ *
+ * The memory of the ROHC and TLS objects is estimated when they are created,
+ * since the libraries do not report it.
+ *
+ * @warning The session thread may change the session meanwhile, the result
+ *          is only meant for statistics
+ *
+ * @param session   The session
+ * @param[out] mem  The memory used by the session, by component
+ */
+void iprohc_session_get_mem(const struct iprohc_session *const session,
+                            struct iprohc_session_mem *const mem)
+{
+	memset(mem, 0, sizeof(struct iprohc_session_mem));
+
+	mem->context = sizeof(struct iprohc_session);
+
+	/* only the stack pages that were touched use memory */
+	if(session->thread_stack != NULL)
+	{
+		const size_t page_size = sysconf(_SC_PAGESIZE);
+		const size_t pages_nr = session->thread_stack_len / page_size;
+		unsigned char pages[pages_nr];
+		size_t i;
+
+		mem->stack_reserved = session->thread_stack_len;
+		if(mincore(session->thread_stack, session->thread_stack_len, pages) == 0)
+		{
+			for(i = 0; i < pages_nr; i++)
+			{
+				if(pages[i] & 1)
+				{
+					mem->stack_resident += page_size;
+				}
+			}
+		}
+	}
+
+	if(session->tunnel.packing_frame != NULL)
+	{
+		mem->packing_frame = TUNTAP_BUFSIZE;
+	}
+	if(session->tunnel.comp != NULL)
+	{
+		mem->rohc = session->tunnel.rohc_mem;
+	}
+	mem->tls = session->tls_mem;
+
+	/* the TCP socket, then the pipe with the main thread and the epoll
+	 * context of the thread */
+	mem->fds_nr = 1;
+	if(session->thread_stack != NULL)
+	{
+		mem->fds_nr += 2;
+		if(AO_load_acquire_read(&(session->is_thread_running)))
+		{
+			mem->fds_nr++;
+		}
+	}
+}
+
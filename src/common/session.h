@@ -25,6 +25,8 @@
 #define IPROHC_COMMON_SESSION__H
 
 #include "rohc_tunnel.h"
+#include "thread_helpers.h"
+#include "timer_wheel.h"
 
 #include <netinet/in.h>
 #include <pthread.h>
@@ -32,9 +34,48 @@
 #include <gnutls/gnutls.h>
 
 
+/**
+ * The default TLS priorities for the control channel: TLS 1.3, or TLS 1.2
+ * with ephemeral ECDH key exchange only
+ */
+#define IPROHC_TLS_PRIORITY_DEFAULT \
+	"NORMAL:-VERS-ALL:+VERS-TLS1.3:+VERS-TLS1.2:-KX-ALL:+ECDHE-RSA:+ECDHE-ECDSA"
+
+
 struct iprohc_session;
 
 
+/** The default size (in bytes) of the stack of the session threads */
+#define IPROHC_SESSION_STACK_DEFAULT  (100U * 1024U)
+
+/** The minimum size (in bytes) of the stack of the session threads */
+#define IPROHC_SESSION_STACK_MIN  (32U * 1024U)
+
+/** The memory (in bytes) an idle session aims to stay below in compact mode */
+#define IPROHC_SESSION_COMPACT_TARGET  (32U * 1024U)
+
+/** The command sent by the main thread on the pipe to apply new parameters */
+#define IPROHC_SESSION_CMD_UPDATE  'u'
+
+/** The command sent by the main thread on the pipe to close the session */
+#define IPROHC_SESSION_CMD_STOP  's'
+
+
+/** The memory used by one session, broken down by component (in bytes) */
+struct iprohc_session_mem
+{
+	size_t context;         /**< The session context itself */
+	size_t stack_reserved;  /**< The stack of the thread, with its guard page */
+	size_t stack_resident;  /**< The stack pages actually in memory */
+	size_t packing_frame;   /**< The frame being packed, if allocated */
+	size_t rohc;            /**< The ROHC compressor and decompressor, approximate
+	                             heap growth at their creation */
+	size_t tls;             /**< The TLS session, approximate heap growth at
+	                             its creation */
+	size_t fds_nr;          /**< The number of file descriptors */
+};
+
+
 /** The different session statuses */
 typedef enum
 {
@@ -55,6 +96,9 @@ typedef bool (*iprohc_session_handler_t) (struct iprohc_session *const session,
 typedef bool (*iprohc_session_stop_t) (struct iprohc_session *const session)
 	__attribute__((warn_unused_result, nonnull(1)));
 
+typedef void (*iprohc_session_end_t) (struct iprohc_session *const session)
+	__attribute__((nonnull(1)));
+
 
 /** The generic part of the session shared by server and client */
 struct iprohc_session
@@ -75,6 +119,9 @@ struct iprohc_session
 	iprohc_session_start_t stop_ctrl;
 	/** The private data to give to the control message handler */
 	void *handle_ctrl_opaque;
+	/** The handler for telling the remote peer about new parameters, NULL if
+	 *  the remote peer shall not be told */
+	iprohc_session_start_t update_ctrl;
 
 	struct iprohc_tunnel tunnel;   /**< The tunnel context */
 
@@ -83,15 +130,39 @@ struct iprohc_session
 	pthread_t thread_tunnel;         /**< The thread that handle the session */
 	pthread_attr_t thread_attr;      /**< The attributes for the thread */
 	void *thread_stack;              /**< The stack for the thread */
+	size_t thread_stack_len;         /**< The length of the stack mapping */
+	size_t stack_size;               /**< The size of the thread stack */
+	bool is_compact;                 /**< Whether to release the buffers and
+	                                      stack pages of the idle session */
+	struct iprohc_thread_sched sched; /**< The CPU placement and scheduling
+	                                       policy of the thread */
 	volatile AO_t is_thread_running; /**< Whether the thread is running or not */
+	/** The handler called by the thread when it ends, NULL if none */
+	iprohc_session_end_t notify_end;
 
 	iprohc_session_status_t status;  /**< The session status */
 
-	int keepalive_timer_fd;  /**< The timer to send keepalive messages in
-	                              case of inactivity on control channel */
+	struct iprohc_timer_wheel timers;     /**< The timers of the session thread */
+	struct iprohc_timer keepalive_timer;  /**< The timer to send keepalive
+	                                           messages in case of inactivity on
+	                                           control channel */
 	size_t keepalive_misses; /**< The number of missing keepalive answers */
+	volatile AO_t has_data_rx; /**< Whether data frames were received since
+	                                the last keepalive period */
+
+	struct iprohc_timer packing_timer;    /**< The timer to flush the packing
+	                                           frame */
 
-	int packing_timer_fd;    /**< The timer to flush the packing frame */
+	size_t tls_mem;          /**< The heap used by the TLS session at creation,
+	                              approximate (see iprohc_heap_used()) */
+
+	pthread_mutex_t params_lock;  /**< Protect the new parameters */
+	bool has_new_params;          /**< Whether new parameters shall be applied */
+	char new_packing;             /**< The new packing level */
+	size_t new_keepalive_timeout; /**< The new keepalive timeout (in seconds) */
+
+	volatile AO_t is_debug;  /**< Whether the debug traces of the session are
+	                              logged whatever the log level */
 };
 
 
@@ -124,5 +195,26 @@ bool iprohc_session_start(struct iprohc_session *const session)
 bool iprohc_session_stop(struct iprohc_session *const session)
 	__attribute__((warn_unused_result, nonnull(1)));
 
+void iprohc_session_trim_stack(struct iprohc_session *const session)
+	__attribute__((nonnull(1)));
+
+bool iprohc_session_update_params(struct iprohc_session *const session,
+                                  const char packing,
+                                  const size_t keepalive_timeout,
+                                  const bool is_thread_notified)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool iprohc_session_disconnect(struct iprohc_session *const session)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool iprohc_session_take_params(struct iprohc_session *const session,
+                                char *const packing,
+                                size_t *const keepalive_timeout)
+	__attribute__((warn_unused_result, nonnull(1, 2, 3)));
+
+void iprohc_session_get_mem(const struct iprohc_session *const session,
+                            struct iprohc_session_mem *const mem)
+	__attribute__((nonnull(1, 2)));
+
 #endif
 
@@ -0,0 +1,273 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   test_timer_wheel.c
+ * @brief  Test the expiry of the timers at every level of the timer wheel
+ *
+ * The wheel is driven with made-up times, so the test does not depend on
+ * the clock of the machine.
+ */
+
+#include "timer_wheel.h"
+#include "test_utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+
+/** The number of ticks covered by the whole wheel */
+#define TEST_WHEEL_RANGE \
+	(((uint64_t) 1) << (IPROHC_TIMER_WHEEL_BITS * IPROHC_TIMER_WHEEL_LEVELS))
+
+
+static void test_wheel_init(struct iprohc_timer_wheel *const wheel,
+                            const uint64_t tick)
+	__attribute__((nonnull(1)));
+
+static bool test_expiry(const uint64_t start_tick,
+                        const uint64_t delay_ticks,
+                        const size_t level)
+	__attribute__((warn_unused_result));
+
+static bool test_clamping(void)
+	__attribute__((warn_unused_result));
+
+static bool test_periodic(void)
+	__attribute__((warn_unused_result));
+
+static bool test_disarm(void)
+	__attribute__((warn_unused_result));
+
+
+int main(int argc, char *argv[])
+{
+	/* one start tick in the middle of the wheel, and one just before all the
+	 * levels wrap so that the timers are moved down by every level */
+	const uint64_t start_ticks[] = { 12345, TEST_WHEEL_RANGE - 3 };
+	size_t i;
+
+	for(i = 0; i < sizeof(start_ticks) / sizeof(uint64_t); i++)
+	{
+		if(!test_expiry(start_ticks[i], 1, 0) ||
+		   !test_expiry(start_ticks[i], IPROHC_TIMER_WHEEL_SLOTS - 1, 0) ||
+		   !test_expiry(start_ticks[i], IPROHC_TIMER_WHEEL_SLOTS, 1) ||
+		   !test_expiry(start_ticks[i], 1500, 2) ||
+		   !test_expiry(start_ticks[i], 40000, 3) ||
+		   !test_expiry(start_ticks[i], TEST_WHEEL_RANGE - 1, 3))
+		{
+			fprintf(stderr, "timers armed at tick %" PRIu64 " failed\n",
+			        start_ticks[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(!test_clamping() || !test_periodic() || !test_disarm())
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("all timer wheel tests passed\n");
+	return EXIT_SUCCESS;
+}
+
+
+/**
+ * @brief Initialize a timer wheel at the given tick
+ *
+ * @param wheel  The timer wheel to initialize
+ * @param tick   The last tick processed by the wheel
+ */
+static void test_wheel_init(struct iprohc_timer_wheel *const wheel,
+                            const uint64_t tick)
+{
+	iprohc_timer_wheel_init(wheel);
+	wheel->cur_tick = tick;
+}
+
+
+/**
+ * @brief Check that a timer expires at its tick, not earlier
+ *
+ * @param start_tick   The tick the timer is armed at
+ * @param delay_ticks  The delay (in ticks) of the timer
+ * @param level        The level of the wheel the timer shall be put in
+ * @return             true if the test succeeded, false otherwise
+ */
+static bool test_expiry(const uint64_t start_tick,
+                        const uint64_t delay_ticks,
+                        const size_t level)
+{
+	struct iprohc_timer_wheel wheel;
+	struct iprohc_timer timer;
+	const uint64_t expiry_tick = start_tick + delay_ticks;
+
+	test_wheel_init(&wheel, start_tick);
+	iprohc_timer_init(&timer);
+	iprohc_timer_arm(&wheel, &timer, delay_ticks * IPROHC_TIMER_WHEEL_TICK_MS, 0);
+	check(iprohc_timer_is_armed(&timer), return false);
+	check(timer.level == level, return false);
+	check(wheel.level_timers_nr[level] == 1, return false);
+	check(iprohc_timer_wheel_timeout(&wheel, start_tick * IPROHC_TIMER_WHEEL_TICK_MS) > 0,
+	      return false);
+
+	/* the timer moves down the levels, but does not expire before its tick */
+	iprohc_timer_wheel_advance(&wheel, (expiry_tick - 1) * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(wheel.cur_tick == expiry_tick - 1, return false);
+	check(!iprohc_timer_take_expiry(&timer), return false);
+	check(iprohc_timer_is_armed(&timer), return false);
+	check(timer.level == 0, return false);
+	check(iprohc_timer_wheel_timeout(&wheel, wheel.cur_tick * IPROHC_TIMER_WHEEL_TICK_MS) ==
+	      IPROHC_TIMER_WHEEL_TICK_MS,
+	      return false);
+
+	/* a one-shot timer expires once at its tick */
+	iprohc_timer_wheel_advance(&wheel, expiry_tick * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(iprohc_timer_take_expiry(&timer), return false);
+	check(!iprohc_timer_take_expiry(&timer), return false);
+	check(!iprohc_timer_is_armed(&timer), return false);
+	check(iprohc_timer_wheel_timeout(&wheel, expiry_tick * IPROHC_TIMER_WHEEL_TICK_MS) == -1,
+	      return false);
+
+	return true;
+}
+
+
+/**
+ * @brief Check that a deadline beyond the range of the wheel is kept
+ *
+ * The timer waits in the farthest slot first, it shall neither expire there
+ * nor be lost.
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_clamping(void)
+{
+	struct iprohc_timer_wheel wheel;
+	struct iprohc_timer timer;
+	const uint64_t start_tick = 777;
+	const uint64_t delay_ticks = TEST_WHEEL_RANGE + 1000;
+	const uint64_t expiry_tick = start_tick + delay_ticks;
+
+	test_wheel_init(&wheel, start_tick);
+	iprohc_timer_init(&timer);
+	iprohc_timer_arm(&wheel, &timer, delay_ticks * IPROHC_TIMER_WHEEL_TICK_MS, 0);
+	check(timer.level == IPROHC_TIMER_WHEEL_LEVELS - 1, return false);
+	check(timer.expiry == expiry_tick, return false);
+
+	/* the farthest slot of the wheel is reached, the deadline is not */
+	iprohc_timer_wheel_advance(&wheel,
+	                           (start_tick + TEST_WHEEL_RANGE) * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(!iprohc_timer_take_expiry(&timer), return false);
+	check(iprohc_timer_is_armed(&timer), return false);
+
+	iprohc_timer_wheel_advance(&wheel, (expiry_tick - 1) * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(!iprohc_timer_take_expiry(&timer), return false);
+	check(iprohc_timer_is_armed(&timer), return false);
+
+	iprohc_timer_wheel_advance(&wheel, expiry_tick * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(iprohc_timer_take_expiry(&timer), return false);
+	check(!iprohc_timer_is_armed(&timer), return false);
+
+	return true;
+}
+
+
+/**
+ * @brief Check that a periodic timer expires at every period, and that a
+ *        timer armed with no delay expires at the next tick
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_periodic(void)
+{
+	struct iprohc_timer_wheel wheel;
+	struct iprohc_timer timer;
+	struct iprohc_timer immediate;
+	const uint64_t start_tick = 1000;
+	const uint64_t period_ticks = 50;
+	size_t i;
+
+	test_wheel_init(&wheel, start_tick);
+	iprohc_timer_init(&timer);
+	iprohc_timer_init(&immediate);
+	iprohc_timer_arm(&wheel, &timer, period_ticks * IPROHC_TIMER_WHEEL_TICK_MS,
+	                 period_ticks * IPROHC_TIMER_WHEEL_TICK_MS);
+	iprohc_timer_arm(&wheel, &immediate, 0, 0);
+
+	iprohc_timer_wheel_advance(&wheel, (start_tick + 1) * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(iprohc_timer_take_expiry(&immediate), return false);
+
+	for(i = 1; i <= 5; i++)
+	{
+		const uint64_t expiry_tick = start_tick + i * period_ticks;
+
+		iprohc_timer_wheel_advance(&wheel, (expiry_tick - 1) * IPROHC_TIMER_WHEEL_TICK_MS);
+		check(!iprohc_timer_take_expiry(&timer), return false);
+		iprohc_timer_wheel_advance(&wheel, expiry_tick * IPROHC_TIMER_WHEEL_TICK_MS);
+		check(iprohc_timer_take_expiry(&timer), return false);
+		check(iprohc_timer_is_armed(&timer), return false);
+	}
+
+	/* the missed periods expire once, the next period starts from now */
+	iprohc_timer_wheel_advance(&wheel, (start_tick + 20 * period_ticks) *
+	                                   IPROHC_TIMER_WHEEL_TICK_MS);
+	check(iprohc_timer_take_expiry(&timer), return false);
+	check(timer.expiry > wheel.cur_tick, return false);
+
+	return true;
+}
+
+
+/**
+ * @brief Check that a disarmed timer does not expire
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_disarm(void)
+{
+	struct iprohc_timer_wheel wheel;
+	struct iprohc_timer timers[3];
+	const uint64_t start_tick = 42;
+	size_t level;
+	size_t i;
+
+	test_wheel_init(&wheel, start_tick);
+	for(i = 0; i < 3; i++)
+	{
+		iprohc_timer_init(&(timers[i]));
+		iprohc_timer_arm(&wheel, &(timers[i]), 1000 * IPROHC_TIMER_WHEEL_TICK_MS, 0);
+	}
+	iprohc_timer_disarm(&wheel, &(timers[1]));
+	check(!iprohc_timer_is_armed(&(timers[1])), return false);
+
+	/* re-arming a timer moves it */
+	iprohc_timer_arm(&wheel, &(timers[2]), 10 * IPROHC_TIMER_WHEEL_TICK_MS, 0);
+	check(timers[2].level == 0, return false);
+
+	iprohc_timer_wheel_advance(&wheel, (start_tick + 1000) * IPROHC_TIMER_WHEEL_TICK_MS);
+	check(iprohc_timer_take_expiry(&(timers[0])), return false);
+	check(!iprohc_timer_take_expiry(&(timers[1])), return false);
+	check(iprohc_timer_take_expiry(&(timers[2])), return false);
+	for(level = 0; level < IPROHC_TIMER_WHEEL_LEVELS; level++)
+	{
+		check(wheel.level_timers_nr[level] == 0, return false);
+	}
+
+	return true;
+}
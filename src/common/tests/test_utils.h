@@ -0,0 +1,48 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   test_utils.h
+ * @brief  Helpers shared by the tests of the IP/ROHC client and server
+ */
+
+#ifndef IPROHC_COMMON_TEST_UTILS__H
+#define IPROHC_COMMON_TEST_UTILS__H
+
+#include <stdio.h>
+
+/**
+ * @brief Stop the test if the given condition is false
+ *
+ * @param cond        The condition to check
+ * @param on_failure  The statement that stops the test, such as
+ *                    'return false' or 'goto error'
+ */
+#define check(cond, on_failure) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: check '%s' failed\n", __FILE__, __LINE__, \
+			        #cond); \
+			on_failure; \
+		} \
+	} \
+	while(0)
+
+#endif
+
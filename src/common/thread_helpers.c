@@ -0,0 +1,247 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   thread_helpers.c
+ * @brief  CPU placement and scheduling policy of the IP/ROHC threads
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ *
+ * Threads are pinned to their CPUs through their creation attributes, so
+ * they never run anywhere else. As Linux allocates physical memory on the
+ * NUMA node of the CPU that touches it first, the stack and the buffers of
+ * a pinned thread are thus allocated on its local NUMA node as long as the
+ * thread is the first one to touch them.
+ */
+
+#include "thread_helpers.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * @brief Initialize the given scheduling policy with the system defaults
+ *
+ * @param sched  The scheduling policy to initialize
+ */
+void iprohc_thread_sched_init(struct iprohc_thread_sched *const sched)
+{
+	sched->has_cpus = false;
+	CPU_ZERO(&sched->cpus);
+	sched->rt_priority = 0;
+}
+
+
+/**
+ * @brief Whether the given scheduling policies place the threads the same way
+ *
+ * @param sched1  One scheduling policy
+ * @param sched2  The other scheduling policy
+ * @return        true if the policies are the same, false otherwise
+ */
+bool iprohc_thread_sched_is_equal(const struct iprohc_thread_sched *const sched1,
+                                  const struct iprohc_thread_sched *const sched2)
+{
+	return (sched1->has_cpus == sched2->has_cpus &&
+	        (!sched1->has_cpus || CPU_EQUAL(&sched1->cpus, &sched2->cpus)) &&
+	        sched1->rt_priority == sched2->rt_priority);
+}
+
+
+/**
+ * @brief Parse a list of CPUs such as "0-3,6"
+ *
+ * @param list       The list of CPUs, comma-separated CPU numbers or ranges
+ * @param[out] cpus  The set of CPUs
+ * @return           true if the list is valid, false otherwise
+ */
+bool iprohc_parse_cpu_list(const char *const list, cpu_set_t *const cpus)
+{
+	const char *cur = list;
+
+	CPU_ZERO(cpus);
+
+	while(*cur != '\0')
+	{
+		unsigned long first;
+		unsigned long last;
+		char *end;
+
+		first = strtoul(cur, &end, 10);
+		if(end == cur)
+		{
+			trace(LOG_ERR, "invalid CPU list '%s': number expected at '%s'",
+			      list, cur);
+			goto error;
+		}
+		last = first;
+		cur = end;
+
+		if(*cur == '-')
+		{
+			cur++;
+			last = strtoul(cur, &end, 10);
+			if(end == cur || last < first)
+			{
+				trace(LOG_ERR, "invalid CPU list '%s': invalid range", list);
+				goto error;
+			}
+			cur = end;
+		}
+
+		if(last >= CPU_SETSIZE)
+		{
+			trace(LOG_ERR, "invalid CPU list '%s': CPU %lu is greater than the "
+			      "maximum %d", list, last, CPU_SETSIZE - 1);
+			goto error;
+		}
+		for(; first <= last; first++)
+		{
+			CPU_SET(first, cpus);
+		}
+
+		while(*cur == ' ')
+		{
+			cur++;
+		}
+		if(*cur == ',')
+		{
+			cur++;
+		}
+		else if(*cur != '\0')
+		{
+			trace(LOG_ERR, "invalid CPU list '%s': unexpected character '%c'",
+			      list, *cur);
+			goto error;
+		}
+	}
+
+	if(CPU_COUNT(cpus) == 0)
+	{
+		trace(LOG_ERR, "invalid CPU list '%s': no CPU specified", list);
+		goto error;
+	}
+
+	return true;
+
+error:
+	return false;
+}
+
+
+/**
+ * @brief Apply the given CPU placement and scheduling policy to thread attributes
+ *
+ * @param attr   The attributes of the thread to create
+ * @param sched  The CPU placement and scheduling policy
+ * @return       true if the attributes were successfully updated,
+ *               false if a problem occurred
+ */
+bool iprohc_thread_attr_set_sched(pthread_attr_t *const attr,
+                                  const struct iprohc_thread_sched *const sched)
+{
+	int ret;
+
+	if(sched->has_cpus)
+	{
+		ret = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &sched->cpus);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to set CPU affinity in thread attributes: "
+			      "%s (%d)", strerror(ret), ret);
+			goto error;
+		}
+	}
+
+	if(sched->rt_priority > 0)
+	{
+		const struct sched_param param = { .sched_priority = sched->rt_priority };
+
+		ret = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to disable scheduling inheritance in thread "
+			      "attributes: %s (%d)", strerror(ret), ret);
+			goto error;
+		}
+		ret = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to set SCHED_FIFO policy in thread attributes: "
+			      "%s (%d)", strerror(ret), ret);
+			goto error;
+		}
+		ret = pthread_attr_setschedparam(attr, &param);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to set SCHED_FIFO priority %d in thread "
+			      "attributes: %s (%d)", sched->rt_priority, strerror(ret), ret);
+			goto error;
+		}
+	}
+
+	return true;
+
+error:
+	return false;
+}
+
+
+/**
+ * @brief Apply the given CPU placement and scheduling policy to the current thread
+ *
+ * @param sched  The CPU placement and scheduling policy
+ * @return       true if the policy was successfully applied,
+ *               false if a problem occurred
+ */
+bool iprohc_thread_sched_self(const struct iprohc_thread_sched *const sched)
+{
+	int ret;
+
+	if(sched->has_cpus)
+	{
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+		                             &sched->cpus);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to set CPU affinity of thread: %s (%d)",
+			      strerror(ret), ret);
+			goto error;
+		}
+	}
+
+	if(sched->rt_priority > 0)
+	{
+		const struct sched_param param = { .sched_priority = sched->rt_priority };
+
+		ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to set SCHED_FIFO priority %d on thread: "
+			      "%s (%d)", sched->rt_priority, strerror(ret), ret);
+			goto error;
+		}
+	}
+
+	return true;
+
+error:
+	return false;
+}
+
@@ -0,0 +1,59 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   thread_helpers.h
+ * @brief  CPU placement and scheduling policy of the IP/ROHC threads
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ */
+
+#ifndef IPROHC_COMMON_THREAD_HELPERS__H
+#define IPROHC_COMMON_THREAD_HELPERS__H
+
+#include <sched.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+
+/** The CPU placement and scheduling policy of one class of threads */
+struct iprohc_thread_sched
+{
+	bool has_cpus;    /**< Whether the threads are pinned to a set of CPUs */
+	cpu_set_t cpus;   /**< The set of CPUs the threads are pinned to */
+	int rt_priority;  /**< The SCHED_FIFO priority, 0 for SCHED_OTHER */
+};
+
+
+void iprohc_thread_sched_init(struct iprohc_thread_sched *const sched)
+	__attribute__((nonnull(1)));
+
+bool iprohc_thread_sched_is_equal(const struct iprohc_thread_sched *const sched1,
+                                  const struct iprohc_thread_sched *const sched2)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_parse_cpu_list(const char *const list, cpu_set_t *const cpus)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_thread_attr_set_sched(pthread_attr_t *const attr,
+                                  const struct iprohc_thread_sched *const sched)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_thread_sched_self(const struct iprohc_thread_sched *const sched)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+#endif
+
@@ -0,0 +1,381 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   timer_wheel.c
+ * @brief  The hierarchical timer wheel of one thread
+ *
+ * The deadlines are rounded to ticks of IPROHC_TIMER_WHEEL_TICK_MS on
+ * CLOCK_MONOTONIC, so the timers that expire close together expire at
+ * once. Arming or disarming a timer only updates the lists of the wheel,
+ * the thread computes its poll timeout from the next deadline and advances
+ * the wheel when it wakes up.
+ */
+
+#include "timer_wheel.h"
+
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <assert.h>
+
+
+/** The number of ticks covered by one slot at the given level */
+#define IPROHC_TIMER_WHEEL_SHIFT(level)  ((level) * IPROHC_TIMER_WHEEL_BITS)
+
+/** The mask of the slot index */
+#define IPROHC_TIMER_WHEEL_MASK  ((uint64_t) (IPROHC_TIMER_WHEEL_SLOTS - 1))
+
+
+static void iprohc_timer_wheel_insert(struct iprohc_timer_wheel *const wheel,
+                                      struct iprohc_timer *const timer)
+	__attribute__((nonnull(1, 2)));
+
+static void iprohc_timer_wheel_unlink(struct iprohc_timer_wheel *const wheel,
+                                      struct iprohc_timer *const timer)
+	__attribute__((nonnull(1, 2)));
+
+static void iprohc_timer_wheel_cascade(struct iprohc_timer_wheel *const wheel,
+                                       const size_t level)
+	__attribute__((nonnull(1)));
+
+
+/**
+ * @brief Initialize the given timer wheel at the current time
+ *
+ * @param wheel  The timer wheel to initialize
+ */
+void iprohc_timer_wheel_init(struct iprohc_timer_wheel *const wheel)
+{
+	memset(wheel, 0, sizeof(struct iprohc_timer_wheel));
+	wheel->cur_tick = iprohc_timer_wheel_now() / IPROHC_TIMER_WHEEL_TICK_MS;
+}
+
+
+/**
+ * @brief Get the current time of the timer wheels
+ *
+ * @return  The current time (in milliseconds) on CLOCK_MONOTONIC
+ */
+uint64_t iprohc_timer_wheel_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t) now.tv_sec) * 1000U + now.tv_nsec / 1000000U;
+}
+
+
+/**
+ * @brief Process the ticks of the given timer wheel up to the given time
+ *
+ * The timers that expire are flagged, the periodic ones are armed again.
+ *
+ * @param wheel   The timer wheel
+ * @param now_ms  The current time (in milliseconds)
+ */
+void iprohc_timer_wheel_advance(struct iprohc_timer_wheel *const wheel,
+                                const uint64_t now_ms)
+{
+	const uint64_t target_tick = now_ms / IPROHC_TIMER_WHEEL_TICK_MS;
+
+	while(wheel->cur_tick < target_tick)
+	{
+		struct iprohc_timer *timer;
+		size_t timers_nr = 0;
+		size_t level;
+
+		for(level = 0; level < IPROHC_TIMER_WHEEL_LEVELS; level++)
+		{
+			timers_nr += wheel->level_timers_nr[level];
+		}
+		if(timers_nr == 0)
+		{
+			wheel->cur_tick = target_tick;
+			break;
+		}
+
+		wheel->cur_tick++;
+
+		/* move the timers of the higher levels down when the lower levels
+		 * wrap, the highest level first */
+		for(level = 1; level < IPROHC_TIMER_WHEEL_LEVELS; level++)
+		{
+			const uint64_t lower_mask =
+				(((uint64_t) 1) << IPROHC_TIMER_WHEEL_SHIFT(level)) - 1;
+			if((wheel->cur_tick & lower_mask) != 0)
+			{
+				break;
+			}
+		}
+		while(--level > 0)
+		{
+			iprohc_timer_wheel_cascade(wheel, level);
+		}
+
+		/* expire the timers of the tick */
+		timer = wheel->slots[0][wheel->cur_tick & IPROHC_TIMER_WHEEL_MASK];
+		wheel->slots[0][wheel->cur_tick & IPROHC_TIMER_WHEEL_MASK] = NULL;
+		while(timer != NULL)
+		{
+			struct iprohc_timer *const next = timer->next;
+
+			wheel->level_timers_nr[0]--;
+			timer->next = NULL;
+			timer->pprev = NULL;
+			if(timer->expiry <= wheel->cur_tick)
+			{
+				timer->is_expired = true;
+				if(timer->period == 0)
+				{
+					timer = next;
+					continue;
+				}
+				timer->expiry += timer->period;
+				if(timer->expiry <= wheel->cur_tick)
+				{
+					timer->expiry = wheel->cur_tick + timer->period;
+				}
+			}
+			/* periodic timer or deadline beyond the range of the wheel */
+			iprohc_timer_wheel_insert(wheel, timer);
+			timer = next;
+		}
+	}
+}
+
+
+/**
+ * @brief Compute how long the thread may sleep before it advances the wheel
+ *
+ * The time to the next tick with expiring timers, or to the next tick that
+ * moves timers of a higher level down.
+ *
+ * @param wheel   The timer wheel
+ * @param now_ms  The current time (in milliseconds)
+ * @return        The timeout (in milliseconds) for epoll_wait(), -1 if no
+ *                timer is armed
+ */
+int iprohc_timer_wheel_timeout(const struct iprohc_timer_wheel *const wheel,
+                               const uint64_t now_ms)
+{
+	uint64_t next_tick = UINT64_MAX;
+	uint64_t next_ms;
+	size_t level;
+
+	for(level = 0; level < IPROHC_TIMER_WHEEL_LEVELS; level++)
+	{
+		const uint64_t block = wheel->cur_tick >> IPROHC_TIMER_WHEEL_SHIFT(level);
+		uint64_t i;
+
+		if(wheel->level_timers_nr[level] == 0)
+		{
+			continue;
+		}
+		for(i = 1; i <= IPROHC_TIMER_WHEEL_SLOTS; i++)
+		{
+			if(wheel->slots[level][(block + i) & IPROHC_TIMER_WHEEL_MASK] != NULL)
+			{
+				const uint64_t tick = (block + i) << IPROHC_TIMER_WHEEL_SHIFT(level);
+				if(tick < next_tick)
+				{
+					next_tick = tick;
+				}
+				break;
+			}
+		}
+	}
+	if(next_tick == UINT64_MAX)
+	{
+		return -1;
+	}
+
+	next_ms = next_tick * IPROHC_TIMER_WHEEL_TICK_MS;
+	if(next_ms <= now_ms)
+	{
+		return 0;
+	}
+	return (next_ms - now_ms > INT_MAX ? INT_MAX : (int) (next_ms - now_ms));
+}
+
+
+/**
+ * @brief Initialize the given timer, not armed
+ *
+ * @param timer  The timer to initialize
+ */
+void iprohc_timer_init(struct iprohc_timer *const timer)
+{
+	memset(timer, 0, sizeof(struct iprohc_timer));
+}
+
+
+/**
+ * @brief Arm the given timer, re-arm it if already armed
+ *
+ * The delay starts at the last tick processed, that is the last time the
+ * thread woke up. The timer expires within one tick of its deadline.
+ *
+ * @param wheel      The timer wheel of the thread
+ * @param timer      The timer to arm
+ * @param delay_ms   The delay (in milliseconds) before the timer expires
+ * @param period_ms  The period (in milliseconds) of the timer, 0 for a
+ *                   one-shot timer
+ */
+void iprohc_timer_arm(struct iprohc_timer_wheel *const wheel,
+                      struct iprohc_timer *const timer,
+                      const uint64_t delay_ms,
+                      const uint64_t period_ms)
+{
+	uint64_t delay_ticks =
+		(delay_ms + IPROHC_TIMER_WHEEL_TICK_MS - 1) / IPROHC_TIMER_WHEEL_TICK_MS;
+
+	if(iprohc_timer_is_armed(timer))
+	{
+		iprohc_timer_wheel_unlink(wheel, timer);
+	}
+	if(delay_ticks == 0)
+	{
+		delay_ticks = 1;
+	}
+	timer->expiry = wheel->cur_tick + delay_ticks;
+	timer->period =
+		(period_ms + IPROHC_TIMER_WHEEL_TICK_MS - 1) / IPROHC_TIMER_WHEEL_TICK_MS;
+	timer->is_expired = false;
+	iprohc_timer_wheel_insert(wheel, timer);
+}
+
+
+/**
+ * @brief Disarm the given timer
+ *
+ * @param wheel  The timer wheel of the thread
+ * @param timer  The timer to disarm
+ */
+void iprohc_timer_disarm(struct iprohc_timer_wheel *const wheel,
+                         struct iprohc_timer *const timer)
+{
+	if(iprohc_timer_is_armed(timer))
+	{
+		iprohc_timer_wheel_unlink(wheel, timer);
+	}
+	timer->is_expired = false;
+}
+
+
+/**
+ * @brief Put the given timer in the slot of its deadline
+ *
+ * The timers with a deadline beyond the range of the wheel wait in the
+ * farthest slot, they are put in the slot of their deadline later.
+ *
+ * A timer that expires at the current tick is only put in the first level
+ * while the timers of the higher levels are moved down, the expiring timers
+ * of the tick are processed next.
+ *
+ * @param wheel  The timer wheel
+ * @param timer  The timer to insert
+ */
+static void iprohc_timer_wheel_insert(struct iprohc_timer_wheel *const wheel,
+                                      struct iprohc_timer *const timer)
+{
+	const uint64_t range =
+		((uint64_t) 1) << IPROHC_TIMER_WHEEL_SHIFT(IPROHC_TIMER_WHEEL_LEVELS);
+	uint64_t tick = timer->expiry;
+	uint64_t delta;
+	struct iprohc_timer **slot;
+	size_t level;
+
+	assert(timer->expiry >= wheel->cur_tick);
+	delta = timer->expiry - wheel->cur_tick;
+	if(delta >= range)
+	{
+		tick = wheel->cur_tick + range - 1;
+		delta = range - 1;
+	}
+
+	for(level = 0; level < IPROHC_TIMER_WHEEL_LEVELS - 1; level++)
+	{
+		if(delta < (((uint64_t) 1) << IPROHC_TIMER_WHEEL_SHIFT(level + 1)))
+		{
+			break;
+		}
+	}
+
+	slot = &(wheel->slots[level][(tick >> IPROHC_TIMER_WHEEL_SHIFT(level)) &
+	                             IPROHC_TIMER_WHEEL_MASK]);
+	timer->next = *slot;
+	if(timer->next != NULL)
+	{
+		timer->next->pprev = &(timer->next);
+	}
+	*slot = timer;
+	timer->pprev = slot;
+	timer->level = level;
+	wheel->level_timers_nr[level]++;
+}
+
+
+/**
+ * @brief Remove the given timer from its slot
+ *
+ * @param wheel  The timer wheel
+ * @param timer  The timer to remove
+ */
+static void iprohc_timer_wheel_unlink(struct iprohc_timer_wheel *const wheel,
+                                      struct iprohc_timer *const timer)
+{
+	assert(timer->pprev != NULL);
+	assert(wheel->level_timers_nr[timer->level] > 0);
+
+	*(timer->pprev) = timer->next;
+	if(timer->next != NULL)
+	{
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+	wheel->level_timers_nr[timer->level]--;
+}
+
+
+/**
+ * @brief Move the timers of the current slot of the given level down
+ *
+ * @param wheel  The timer wheel
+ * @param level  The level, 1 or higher
+ */
+static void iprohc_timer_wheel_cascade(struct iprohc_timer_wheel *const wheel,
+                                       const size_t level)
+{
+	const size_t slot_index =
+		(wheel->cur_tick >> IPROHC_TIMER_WHEEL_SHIFT(level)) & IPROHC_TIMER_WHEEL_MASK;
+	struct iprohc_timer *timer = wheel->slots[level][slot_index];
+
+	wheel->slots[level][slot_index] = NULL;
+	while(timer != NULL)
+	{
+		struct iprohc_timer *const next = timer->next;
+
+		wheel->level_timers_nr[level]--;
+		timer->next = NULL;
+		timer->pprev = NULL;
+		iprohc_timer_wheel_insert(wheel, timer);
+		timer = next;
+	}
+}
+
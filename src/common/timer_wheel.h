@@ -0,0 +1,134 @@
+/*
+ * This file is part of iprohc.
+ *
+ * iprohc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * any later version.
+ *
+ * iprohc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   timer_wheel.h
+ * @brief  The hierarchical timer wheel of one thread
+ */
+
+#ifndef IPROHC_COMMON_TIMER_WHEEL__H
+#define IPROHC_COMMON_TIMER_WHEEL__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** The duration (in milliseconds) of one tick, the deadlines within one
+ *  tick expire together */
+#define IPROHC_TIMER_WHEEL_TICK_MS  10U
+
+/** The number of bits of the slot index at every level of the wheel */
+#define IPROHC_TIMER_WHEEL_BITS  5U
+
+/** The number of slots at every level of the wheel */
+#define IPROHC_TIMER_WHEEL_SLOTS  (1U << IPROHC_TIMER_WHEEL_BITS)
+
+/** The number of levels of the wheel, enough for about 3 hours */
+#define IPROHC_TIMER_WHEEL_LEVELS  4U
+
+
+/** A timer of the wheel */
+struct iprohc_timer
+{
+	struct iprohc_timer *next;   /**< The next timer of the slot */
+	struct iprohc_timer **pprev; /**< The link to this timer in the slot,
+	                                  NULL if the timer is not armed */
+	uint64_t expiry;             /**< The tick the timer expires at */
+	uint64_t period;             /**< The period (in ticks) of a periodic
+	                                  timer, 0 for a one-shot timer */
+	size_t level;                /**< The level of the wheel the timer is in */
+	bool is_expired;             /**< Whether the timer expired since the
+	                                  owner last checked */
+};
+
+
+/**
+ * @brief The hierarchical timer wheel of one thread
+ *
+ * The timers that expire in less than IPROHC_TIMER_WHEEL_SLOTS ticks are
+ * in the slots of the first level, one slot per tick. Each further level
+ * covers IPROHC_TIMER_WHEEL_SLOTS times more ticks per slot, its timers are
+ * moved down one level when the lower level wraps.
+ *
+ * The wheel is not locked, only the thread that owns it uses it.
+ */
+struct iprohc_timer_wheel
+{
+	/** The timers of every slot at every level */
+	struct iprohc_timer *slots[IPROHC_TIMER_WHEEL_LEVELS][IPROHC_TIMER_WHEEL_SLOTS];
+	size_t level_timers_nr[IPROHC_TIMER_WHEEL_LEVELS]; /**< The number of
+	                                                        timers per level */
+	uint64_t cur_tick;  /**< The last tick processed */
+};
+
+
+void iprohc_timer_wheel_init(struct iprohc_timer_wheel *const wheel)
+	__attribute__((nonnull(1)));
+
+uint64_t iprohc_timer_wheel_now(void)
+	__attribute__((warn_unused_result));
+
+void iprohc_timer_wheel_advance(struct iprohc_timer_wheel *const wheel,
+                                const uint64_t now_ms)
+	__attribute__((nonnull(1)));
+
+int iprohc_timer_wheel_timeout(const struct iprohc_timer_wheel *const wheel,
+                               const uint64_t now_ms)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_timer_init(struct iprohc_timer *const timer)
+	__attribute__((nonnull(1)));
+
+void iprohc_timer_arm(struct iprohc_timer_wheel *const wheel,
+                      struct iprohc_timer *const timer,
+                      const uint64_t delay_ms,
+                      const uint64_t period_ms)
+	__attribute__((nonnull(1, 2)));
+
+void iprohc_timer_disarm(struct iprohc_timer_wheel *const wheel,
+                         struct iprohc_timer *const timer)
+	__attribute__((nonnull(1, 2)));
+
+
+/**
+ * @brief Whether the given timer is armed
+ *
+ * @param timer  The timer
+ * @return       true if the timer is armed, false otherwise
+ */
+static inline bool iprohc_timer_is_armed(const struct iprohc_timer *const timer)
+{
+	return (timer->pprev != NULL);
+}
+
+
+/**
+ * @brief Whether the given timer expired since the last call
+ *
+ * @param timer  The timer
+ * @return       true if the timer expired, false otherwise
+ */
+static inline bool iprohc_timer_take_expiry(struct iprohc_timer *const timer)
+{
+	const bool is_expired = timer->is_expired;
+	timer->is_expired = false;
+	return is_expired;
+}
+
+#endif
+
@@ -99,6 +99,7 @@ bool parse_tlv(const unsigned char *const data,
 			      results[i].type, len, (*parsed_len) + 3 + len, data_len);
 			goto error;
 		}
+		results[i].length = len;
 		results[i].value = (unsigned char *) (data + (*parsed_len) + 3);
 		for(j = 0; j < len; j++)
 		{
@@ -231,6 +232,27 @@ bool gen_tlv_char(unsigned char *const f_dest,
 }
 
 
+bool gen_tlv_token(unsigned char *const f_dest,
+                   const struct tlv_result tlv,
+                   size_t *const len)
+{
+	uint16_t*length;
+	unsigned char *dest = f_dest;
+
+	/* length */
+	length  = (uint16_t*) dest;
+	*length = htons(IPROHC_SESSION_TOKEN_LEN);
+	dest  += sizeof(uint16_t);
+	/* value */
+	memcpy(dest, tlv.value, IPROHC_SESSION_TOKEN_LEN);
+	dest += IPROHC_SESSION_TOKEN_LEN;
+
+	*len = sizeof(uint16_t) + IPROHC_SESSION_TOKEN_LEN;
+
+	return true;
+}
+
+
 /*
  * Specific parsing
  */
@@ -258,25 +280,37 @@ void mark_received(enum types *const list,
 bool parse_connect(const unsigned char *const data,
                    const size_t data_len,
 						 struct tunnel_params *const params,
+                   uint8_t *const token,
+                   bool *const has_token,
+                   bool *const is_resumed,
 						 size_t *const parsed_len)
 {
 	enum types required[N_TUNNEL_PARAMS] = {
 		IP_ADDR, PACKING, MAXCID, UNID, WINDOWSIZE, REFRESH,
 		KEEPALIVE, ROHC_COMPAT
 	};
-	struct tlv_result results[N_TUNNEL_PARAMS + 1];
+	const int max_fields_nr = N_TUNNEL_PARAMS + N_CONNECT_FIELD_RESUME +
+		N_CONNECT_FIELD_NETMASK + N_CONNECT_FIELD_CAPABILITIES;
+	struct tlv_result results[max_fields_nr + 1];
 	bool is_success = false;
 	bool is_ok;
 	int i;
 
 	assert(data != NULL);
 	assert(params != NULL);
+	assert(token != NULL);
+	assert(has_token != NULL);
+	assert(is_resumed != NULL);
 	assert(parsed_len != NULL);
 
-	memset(results, 0, (N_TUNNEL_PARAMS + 1) * sizeof(struct tlv_result));
+	memset(results, 0, (max_fields_nr + 1) * sizeof(struct tlv_result));
 	*parsed_len = 0;
+	*has_token = false;
+	*is_resumed = false;
+	params->netmask = IPROHC_NETMASK_DEFAULT;
+	params->capabilities = 0;
 
-	is_ok = parse_tlv(data, data_len, results, N_TUNNEL_PARAMS + 1, parsed_len);
+	is_ok = parse_tlv(data, data_len, results, max_fields_nr + 1, parsed_len);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "parse_connect: failed to parse TLV parameters");
@@ -284,13 +318,54 @@ bool parse_connect(const unsigned char *const data,
 	}
 	trace(LOG_DEBUG, "client parameters:");
 
-	for(i = 0; i < N_TUNNEL_PARAMS; i++)
+	for(i = 0; i < max_fields_nr; i++)
 	{
 		if(!results[i].used)
 		{
 			continue;
 		}
 
+		/* optional fields of protocol version 3 */
+		if(results[i].type == SESSION_TOKEN)
+		{
+			if(results[i].length != IPROHC_SESSION_TOKEN_LEN)
+			{
+				trace(LOG_ERR, "malformed session token in connect");
+				goto error;
+			}
+			memcpy(token, results[i].value, IPROHC_SESSION_TOKEN_LEN);
+			*has_token = true;
+			trace(LOG_DEBUG, "  session token received");
+			continue;
+		}
+		else if(results[i].type == RESUMED)
+		{
+			*is_resumed = !!(*((char*) results[i].value));
+			trace(LOG_DEBUG, "  ROHC contexts resumed = %s",
+			      *is_resumed ? "yes" : "no");
+			continue;
+		}
+		/* optional field of protocol version 4 */
+		else if(results[i].type == NETMASK)
+		{
+			params->netmask = *((char*) results[i].value);
+			if(params->netmask <= 0 || params->netmask > 30)
+			{
+				trace(LOG_ERR, "invalid network mask /%d in connect",
+				      params->netmask);
+				goto error;
+			}
+			trace(LOG_DEBUG, "  network mask = /%d", params->netmask);
+			continue;
+		}
+		/* optional field of protocol version 6 */
+		else if(results[i].type == CAPABILITIES)
+		{
+			params->capabilities = *((char*) results[i].value);
+			trace(LOG_DEBUG, "  capabilities = 0x%02x", params->capabilities);
+			continue;
+		}
+
 		mark_received(required, N_TUNNEL_PARAMS, results[i].type);
 		switch(results[i].type)
 		{
@@ -352,9 +427,13 @@ error:
 
 
 bool gen_connect(const struct tunnel_params params,
+                 const int proto_version,
+                 const uint8_t *const token,
+                 const bool is_resumed,
 					  unsigned char *const dest,
 					  size_t *const length)
 {
+	const char resumed = (is_resumed ? 1 : 0);
 	bool is_success = false;
 	struct tlv_result *results;
 	bool is_ok;
@@ -365,7 +444,9 @@ bool gen_connect(const struct tunnel_params params,
 
 	*length = 0;
 	
-	results = calloc(N_TUNNEL_PARAMS, sizeof(struct tlv_result));
+	results = calloc(N_TUNNEL_PARAMS + N_CONNECT_FIELD_RESUME +
+	                 N_CONNECT_FIELD_NETMASK + N_CONNECT_FIELD_CAPABILITIES,
+	                 sizeof(struct tlv_result));
 	if(results == NULL)
 	{
 		trace(LOG_ERR, "failed to allocate memory for connect message");
@@ -396,8 +477,33 @@ bool gen_connect(const struct tunnel_params params,
 	results[i].type  = ROHC_COMPAT;
 	results[i].value = (unsigned char*) &(params.rohc_compat_version);
 	i++;
+	/* only the clients that sent protocol version 3 or greater get a token */
+	if(proto_version >= IPROHC_PROTO_VERSION_RESUME)
+	{
+		assert(token != NULL);
+		results[i].type  = SESSION_TOKEN;
+		results[i].value = (unsigned char*) token;
+		i++;
+		results[i].type  = RESUMED;
+		results[i].value = (unsigned char*) &resumed;
+		i++;
+	}
+	/* the older clients assume a /24 network */
+	if(proto_version >= IPROHC_PROTO_VERSION_NETMASK)
+	{
+		results[i].type  = NETMASK;
+		results[i].value = (unsigned char*) &(params.netmask);
+		i++;
+	}
+	/* the capabilities that both the client and the server support */
+	if(proto_version >= IPROHC_PROTO_VERSION_CAPABILITIES)
+	{
+		results[i].type  = CAPABILITIES;
+		results[i].value = (unsigned char*) &(params.capabilities);
+		i++;
+	}
 
-	is_ok = gen_tlv(dest, results, N_TUNNEL_PARAMS, length);
+	is_ok = gen_tlv(dest, results, i, length);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to create options in TLV format");
@@ -419,7 +525,10 @@ bool parse_connrequest(const unsigned char *const data,
 							  size_t *const parsed_len,
 							  int *const packing,
 							  int *const proto_version,
-							  int *const rohc_compat_version)
+							  int *const rohc_compat_version,
+                       uint8_t *const token,
+                       bool *const has_token,
+                       int *const capabilities)
 {
 	struct tlv_result results[N_CONNREQ_FIELD + 1];
 	bool is_success = false;
@@ -431,9 +540,14 @@ bool parse_connrequest(const unsigned char *const data,
 	assert(parsed_len != NULL);
 	assert(packing != NULL);
 	assert(proto_version != NULL);
+	assert(token != NULL);
+	assert(has_token != NULL);
+	assert(capabilities != NULL);
 
 	memset(results, 0, (N_CONNREQ_FIELD + 1) * sizeof(struct tlv_result));
 	*parsed_len = 0;
+	*has_token = false;
+	*capabilities = 0;
 
 	is_ok = parse_tlv(data, data_len, results, N_CONNREQ_FIELD + 1, parsed_len);
 	if(!is_ok)
@@ -463,6 +577,20 @@ bool parse_connrequest(const unsigned char *const data,
 			      "found", results[i].type);
 			*rohc_compat_version = *((char*) results[i].value);
 		}
+		else if(results[i].type == SESSION_TOKEN &&
+		        results[i].length == IPROHC_SESSION_TOKEN_LEN)
+		{
+			trace(LOG_DEBUG, "connection request: parameter SESSION_TOKEN (%u) "
+			      "found", results[i].type);
+			memcpy(token, results[i].value, IPROHC_SESSION_TOKEN_LEN);
+			*has_token = true;
+		}
+		else if(results[i].type == CAPABILITIES)
+		{
+			trace(LOG_DEBUG, "connection request: parameter CAPABILITIES (%u) "
+			      "found", results[i].type);
+			*capabilities = *((char*) results[i].value);
+		}
 		else
 		{
 			trace(LOG_WARNING, "connection request: unexpected parameter %u",
@@ -479,14 +607,17 @@ error:
 
 
 bool gen_connrequest(const int packing,
+                     const uint8_t *const token,
 							unsigned char *const dest,
 							size_t *const length)
 {
 	const int proto_version = CURRENT_PROTO_VERSION;
 	const int rohc_compat_version = IPROHC_ROHC_COMPAT_LAST;
+	const char capabilities = IPROHC_CAPABILITIES;
 	struct tlv_result *results;
 	bool is_success = false;
 	bool is_ok;
+	int i = 0;
 
 	assert(dest != NULL);
 	assert(length != NULL);
@@ -502,16 +633,32 @@ bool gen_connrequest(const int packing,
 		goto error;
 	}
 
-	results[0].type  = CPACKING;
-	results[0].value = (unsigned char*) &packing;
+	results[i].type  = CPACKING;
+	results[i].value = (unsigned char*) &packing;
+	i++;
+
+	results[i].type  = CPROTO_VERSION;
+	results[i].value = (unsigned char*) &proto_version;
+	i++;
 
-	results[1].type  = CPROTO_VERSION;
-	results[1].value = (unsigned char*) &proto_version;
+	results[i].type  = ROHC_COMPAT;
+	results[i].value = (unsigned char*) &rohc_compat_version;
+	i++;
+
+	/* ask the server to resume the ROHC contexts of the previous session */
+	if(token != NULL)
+	{
+		results[i].type  = SESSION_TOKEN;
+		results[i].value = (unsigned char*) token;
+		i++;
+	}
 
-	results[2].type  = ROHC_COMPAT;
-	results[2].value = (unsigned char*) &rohc_compat_version;
+	/* tell the server what the client supports */
+	results[i].type  = CAPABILITIES;
+	results[i].value = (unsigned char*) &capabilities;
+	i++;
 
-	is_ok = gen_tlv(dest, results, N_CONNREQ_FIELD, length);
+	is_ok = gen_tlv(dest, results, i, length);
 	if(!is_ok)
 	{
 		trace(LOG_ERR, "failed to create parameters in TLV format");
@@ -527,3 +674,103 @@ error:
 }
 
 
+/* Update of the tunnel parameters (server -> client) */
+bool parse_params_update(const unsigned char *const data,
+                         const size_t data_len,
+                         struct tunnel_params *const params,
+                         size_t *const parsed_len)
+{
+	enum types required[N_PARAMS_UPDATE_FIELD] = { PACKING, KEEPALIVE };
+	struct tlv_result results[N_PARAMS_UPDATE_FIELD + 1];
+	bool is_success = false;
+	bool is_ok;
+	int i;
+
+	assert(data != NULL);
+	assert(params != NULL);
+	assert(parsed_len != NULL);
+
+	memset(results, 0, (N_PARAMS_UPDATE_FIELD + 1) * sizeof(struct tlv_result));
+	*parsed_len = 0;
+
+	is_ok = parse_tlv(data, data_len, results, N_PARAMS_UPDATE_FIELD + 1,
+	                  parsed_len);
+	if(!is_ok)
+	{
+		trace(LOG_ERR, "parse_params_update: failed to parse TLV parameters");
+		goto error;
+	}
+
+	for(i = 0; i < N_PARAMS_UPDATE_FIELD && results[i].used; i++)
+	{
+		mark_received(required, N_PARAMS_UPDATE_FIELD, results[i].type);
+		switch(results[i].type)
+		{
+			case PACKING:
+				params->packing = *((char*) results[i].value);
+				if(params->packing <= 0)
+				{
+					trace(LOG_ERR, "invalid packing level %d in parameters update",
+					      params->packing);
+					goto error;
+				}
+				trace(LOG_DEBUG, "  packing level = %d", params->packing);
+				break;
+			case KEEPALIVE:
+				params->keepalive_timeout = ntohl(*((uint32_t*) results[i].value));
+				trace(LOG_DEBUG, "  keepalive interval = %zu seconds",
+				      params->keepalive_timeout);
+				break;
+			default:
+				trace(LOG_ERR, "Unexpected field 0x%02x in parameters update",
+				      results[i].type);
+				goto error;
+		}
+	}
+
+	for(i = 0; i < N_PARAMS_UPDATE_FIELD; i++)
+	{
+		if(required[i] != -1)
+		{
+			trace(LOG_ERR, "Missing field in parameters update : %d\n",
+			      required[i]);
+			goto error;
+		}
+	}
+
+	is_success = true;
+
+error:
+	return is_success;
+}
+
+
+bool gen_params_update(const struct tunnel_params params,
+                       unsigned char *const dest,
+                       size_t *const length)
+{
+	struct tlv_result results[N_PARAMS_UPDATE_FIELD];
+	bool is_ok;
+
+	assert(dest != NULL);
+	assert(length != NULL);
+
+	*length = 0;
+	memset(results, 0, N_PARAMS_UPDATE_FIELD * sizeof(struct tlv_result));
+
+	results[0].type  = PACKING;
+	results[0].value = (unsigned char*) &(params.packing);
+
+	results[1].type  = KEEPALIVE;
+	results[1].value = (unsigned char*) &(params.keepalive_timeout);
+
+	is_ok = gen_tlv(dest, results, N_PARAMS_UPDATE_FIELD, length);
+	if(!is_ok)
+	{
+		trace(LOG_ERR, "failed to create parameters update in TLV format");
+		return false;
+	}
+
+	return true;
+}
+
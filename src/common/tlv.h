@@ -25,10 +25,20 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 
 #define IPROHC_PROTO_VERSION_FIRST         1
 #define IPROHC_PROTO_VERSION_ROHC_COMPAT   2
+#define IPROHC_PROTO_VERSION_RESUME        3
+#define IPROHC_PROTO_VERSION_NETMASK       4
+#define IPROHC_PROTO_VERSION_PARAMS_UPDATE 5
+#define IPROHC_PROTO_VERSION_CAPABILITIES  6
 
 /* Defines the current protocol version, must be modified each time
    a field is added or removed */
-#define CURRENT_PROTO_VERSION  IPROHC_PROTO_VERSION_ROHC_COMPAT
+#define CURRENT_PROTO_VERSION  IPROHC_PROTO_VERSION_CAPABILITIES
+
+/** The network mask assumed by the clients older than protocol version 4 */
+#define IPROHC_NETMASK_DEFAULT  24
+
+/** The length (in bytes) of the token that identifies a session to resume */
+#define IPROHC_SESSION_TOKEN_LEN  16U
 
 /* Global structures */
 enum commands
@@ -39,6 +49,10 @@ enum commands
 	C_CONNECT_DONE  = 3,
 	C_DISCONNECT    = 4,
 	C_KEEPALIVE     = 5,
+	/* since protocol version 5 */
+	C_PARAMS_UPDATE = 6,  /**< The server changed the tunnel parameters */
+	/* since protocol version 6 */
+	C_KEEPALIVE_ACK = 7,  /**< The answer to a keepalive of the peer */
 };
 
 enum types
@@ -56,12 +70,25 @@ enum types
 	/* connrequest types */
 	CPACKING       =  9,
 	CPROTO_VERSION = 10,
+	/* connect and connrequest types since protocol version 3 */
+	SESSION_TOKEN  = 11,
+	RESUMED        = 12,
+	/* connect type since protocol version 4 */
+	NETMASK        = 13,
+	/* connect and connrequest type since protocol version 6 */
+	CAPABILITIES   = 14,
 };
 
 #define N_CONNECT_FIELD 8
+#define N_CONNECT_FIELD_RESUME       2  /* optional fields since version 3 */
+#define N_CONNECT_FIELD_NETMASK      1  /* optional field since version 4 */
+#define N_CONNECT_FIELD_CAPABILITIES 1  /* optional field since version 6 */
 #define N_CONNREQ_FIELD_FIRST        2
 #define N_CONNREQ_FIELD_ROHC_COMPAT  3
-#define N_CONNREQ_FIELD              N_CONNREQ_FIELD_ROHC_COMPAT
+#define N_CONNREQ_FIELD_RESUME       4
+#define N_CONNREQ_FIELD_CAPABILITIES 5
+#define N_CONNREQ_FIELD              N_CONNREQ_FIELD_CAPABILITIES
+#define N_PARAMS_UPDATE_FIELD        2  /* packing and keepalive */
 
 struct tlv_result
 {
@@ -96,6 +123,9 @@ bool gen_tlv_uint32(unsigned char *const dest,
 bool gen_tlv_char(unsigned char *const dest,
 						const struct tlv_result tlv,
 						size_t *const len);
+bool gen_tlv_token(unsigned char *const dest,
+                   const struct tlv_result tlv,
+                   size_t *const len);
 
 /* Association between callbacks and type */
 static inline gen_tlv_callback_t get_gen_cb_for_type(enum types type)
@@ -122,6 +152,14 @@ static inline gen_tlv_callback_t get_gen_cb_for_type(enum types type)
 			return gen_tlv_char;
 		case CPROTO_VERSION:
 			return gen_tlv_char;
+		case SESSION_TOKEN:
+			return gen_tlv_token;
+		case RESUMED:
+			return gen_tlv_char;
+		case NETMASK:
+			return gen_tlv_char;
+		case CAPABILITIES:
+			return gen_tlv_char;
 		default:
 			return NULL;
 	}
@@ -133,7 +171,7 @@ Specific parsing
 */
 
 /* Structure defining param negotiated */
-/* Number of fields */
+/* Number of fields, the network mask and the capabilities excepted (optional) */
 #define N_TUNNEL_PARAMS 8
 
 struct tunnel_params
@@ -146,8 +184,16 @@ struct tunnel_params
 	size_t refresh;                /* No ROHC API yet */
 	size_t keepalive_timeout;
 	char rohc_compat_version;
+	char netmask;                  /* The length of the tunnel network mask */
+	char capabilities;             /* The capabilities of both peers */
 };
 
+/** Both peers count the data frames they receive as proof of liveness, so
+ *  keepalives are only sent while the data channel is idle, and answered */
+#define IPROHC_CAP_DATA_LIVENESS   0x01
+/** The capabilities this version supports */
+#define IPROHC_CAPABILITIES        IPROHC_CAP_DATA_LIVENESS
+
 #define IPROHC_ROHC_COMPAT_1_6_x   1
 #define IPROHC_ROHC_COMPAT_1_7_x   2
 #define IPROHC_ROHC_COMPAT_LAST    IPROHC_ROHC_COMPAT_1_7_x
@@ -155,25 +201,46 @@ struct tunnel_params
 bool parse_connect(const unsigned char *const data,
                    const size_t data_len,
 						 struct tunnel_params *const params,
+                   uint8_t *const token,
+                   bool *const has_token,
+                   bool *const is_resumed,
 						 size_t *const parsed_len)
-	__attribute__((nonnull(1, 3, 4), warn_unused_result));
+	__attribute__((nonnull(1, 3, 4, 5, 6, 7), warn_unused_result));
 
 bool gen_connect(const struct tunnel_params params,
+                 const int proto_version,
+                 const uint8_t *const token,
+                 const bool is_resumed,
 					  unsigned char *const dest,
 					  size_t *const length)
-	__attribute__((nonnull(2, 3), warn_unused_result));
+	__attribute__((nonnull(5, 6), warn_unused_result));
 
 bool parse_connrequest(const unsigned char *const data,
                        const size_t data_len,
 							  size_t *const parsed_len,
 							  int *const packing,
 							  int *const proto_version,
-							  int *const rohc_compat_version)
-	__attribute__((nonnull(1, 3, 4, 5, 6), warn_unused_result));
+							  int *const rohc_compat_version,
+                       uint8_t *const token,
+                       bool *const has_token,
+                       int *const capabilities)
+	__attribute__((nonnull(1, 3, 4, 5, 6, 7, 8, 9), warn_unused_result));
 
 bool gen_connrequest(const int packing,
+                     const uint8_t *const token,
 							unsigned char *const dest,
 							size_t *const length)
+	__attribute__((nonnull(3, 4), warn_unused_result));
+
+bool parse_params_update(const unsigned char *const data,
+                         const size_t data_len,
+                         struct tunnel_params *const params,
+                         size_t *const parsed_len)
+	__attribute__((nonnull(1, 3, 4), warn_unused_result));
+
+bool gen_params_update(const struct tunnel_params params,
+                       unsigned char *const dest,
+                       size_t *const length)
 	__attribute__((nonnull(2, 3), warn_unused_result));
 
 #endif
@@ -30,12 +30,19 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <string.h>
 #include <netinet/ip.h>
+#include <netinet/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <libnetlink.h>
 
 #include "log.h"
 #include "tun_helpers.h"
+#include "bpf_filter.h"
 
 
+/** The IP protocol number used for IP/ROHC packets */
+#define IPROHC_IPPROTO 142
+
 /** The maximal size (in bytes) taken by the tunnel headers */
 #define MAX_TUNNEL_OVERHEAD ((size_t)(sizeof(struct iphdr) + 2U + 20U))
 
@@ -256,7 +263,21 @@ error:
 }
 
 
-bool set_ip4(int iface_index, uint32_t address, uint8_t network)
+/**
+ * @brief Add or remove an IPv4 address on the given interface
+ *
+ * @param type         RTM_NEWADDR to add the address, RTM_DELADDR to remove it
+ * @param flags        The netlink flags of the request
+ * @param iface_index  The index of the interface
+ * @param address      The IPv4 address
+ * @param network      The length (in bits) of the network mask
+ * @return             true in case of success, false in case of failure
+ */
+static bool change_ip4(const int type,
+                       const int flags,
+                       const int iface_index,
+                       const uint32_t address,
+                       const uint8_t network)
 {
 	bool is_success = false;
 	int ret;
@@ -286,8 +307,8 @@ bool set_ip4(int iface_index, uint32_t address, uint8_t network)
 	/* initialize netlink request */
 	memset(&req, 0, sizeof(req));
 	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL;
-	req.nh.nlmsg_type = RTM_NEWADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | flags;
+	req.nh.nlmsg_type = type;
 
 	/* ifaddrmsg info */
 	req.ip.ifa_family = AF_INET;         /* IPv4 */
@@ -307,7 +328,8 @@ bool set_ip4(int iface_index, uint32_t address, uint8_t network)
 #endif
 	if(ret < 0)
 	{
-		trace(LOG_ERR, "failed to set IPv4 address %u.%u.%u.%u/%u (code %d)",
+		trace(LOG_ERR, "failed to %s IPv4 address %u.%u.%u.%u/%u (code %d)",
+		      type == RTM_NEWADDR ? "set" : "remove",
 		      (ntohl(address) >> 24) & 0xff, (ntohl(address) >> 16) & 0xff,
 		      (ntohl(address) >>  8) & 0xff, (ntohl(address) >>  0) & 0xff,
 		      network, ret);
@@ -325,13 +347,26 @@ error:
 }
 
 
+bool set_ip4(int iface_index, uint32_t address, uint8_t network)
+{
+	return change_ip4(RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, iface_index,
+	                  address, network);
+}
+
+
+bool del_ip4(const int iface_index, const uint32_t address, const uint8_t network)
+{
+	return change_ip4(RTM_DELADDR, 0, iface_index, address, network);
+}
+
+
 int create_raw(const int fwmark)
 {
 	int sock;
 	int ret;
 
 	/* create socket */
-	sock = socket(AF_INET, SOCK_RAW, 142);
+	sock = socket(AF_INET, SOCK_RAW, IPROHC_IPPROTO);
 	if(sock < 0)
 	{
 		trace(LOG_ERR, "failed to create a raw socket: %s (%d)",
@@ -359,3 +394,118 @@ error:
 }
 
 
+/**
+ * @brief Create one AF_PACKET socket of the fanout group for RAW ingress
+ *
+ * The socket receives the IP/ROHC packets (IP protocol 142) destinated to the
+ * host on the given interface, starting with their IP header as the raw
+ * socket does. All the sockets created with the same fanout ID form a group
+ * among which the kernel spreads packets according to a hash of their IP
+ * addresses: all the packets of one client are received by the same socket.
+ *
+ * @param basedev    The name of the underlying interface
+ * @param fanout_id  The ID of the fanout group
+ * @return           The socket on success, -1 if a problem occurred
+ */
+int create_raw_fanout(const char *const basedev, const uint16_t fanout_id)
+{
+	const int fanout_arg =
+		fanout_id | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	struct sockaddr_ll addr;
+	unsigned int ifindex;
+	int sock;
+	int ret;
+
+	ifindex = if_nametoindex(basedev);
+	if(ifindex == 0)
+	{
+		trace(LOG_ERR, "failed to find interface '%s': %s (%d)", basedev,
+		      strerror(errno), errno);
+		goto error;
+	}
+
+	/* create socket */
+	sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if(sock < 0)
+	{
+		trace(LOG_ERR, "failed to create a packet socket: %s (%d)",
+		      strerror(errno), errno);
+		goto error;
+	}
+
+	/* filter packets before binding, so that no unwanted packet is queued:
+	 * accept IP/ROHC packets destinated to the host, drop all others,
+	 * especially the IP/ROHC packets that the host sends */
+	if(!iprohc_bpf_filter_attach(sock, true, INADDR_ANY, NULL, 0))
+	{
+		trace(LOG_ERR, "failed to attach IP/ROHC filter to packet socket");
+		goto close_socket;
+	}
+
+	/* receive packets from the underlying interface only */
+	memset(&addr, 0, sizeof(struct sockaddr_ll));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = ifindex;
+	ret = bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_ll));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to bind packet socket to interface '%s': "
+		      "%s (%d)", basedev, strerror(errno), errno);
+		goto close_socket;
+	}
+
+	/* join the fanout group */
+	ret = setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(int));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to join fanout group %u: %s (%d)", fanout_id,
+		      strerror(errno), errno);
+		goto close_socket;
+	}
+
+	return sock;
+
+close_socket:
+	close(sock);
+error:
+	return -1;
+}
+
+
+/**
+ * @brief Drop all the packets received on the given socket
+ *
+ * Used for the raw socket when the IP/ROHC packets are received through
+ * other sockets: it is then used for sending only, and shall not queue a
+ * copy of every received packet.
+ *
+ * @param sock  The socket
+ * @return      true if the socket drops all received packets,
+ *              false if a problem occurred
+ */
+bool raw_drop_input(const int sock)
+{
+	struct sock_filter filter_insns[] = {
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	const struct sock_fprog filter = {
+		.len = sizeof(filter_insns) / sizeof(struct sock_filter),
+		.filter = filter_insns,
+	};
+	int ret;
+
+	ret = setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter,
+	                 sizeof(struct sock_fprog));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to attach drop-all filter to raw socket: "
+		      "%s (%d)", strerror(errno), errno);
+		goto error;
+	}
+
+	return true;
+
+error:
+	return false;
+}
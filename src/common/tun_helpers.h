@@ -31,7 +31,16 @@ int create_tun(const char *const name,
 
 bool set_ip4(int iface_index, uint32_t address, uint8_t network);
 
+bool del_ip4(const int iface_index, const uint32_t address, const uint8_t network)
+	__attribute__((warn_unused_result));
+
 int create_raw(const int fwmark);
 
+int create_raw_fanout(const char *const basedev, const uint16_t fanout_id)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool raw_drop_input(const int sock)
+	__attribute__((warn_unused_result));
+
 #endif
 
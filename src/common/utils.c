@@ -0,0 +1,140 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   utils.c
+ * @brief  Miscellaneous utils for the IP/ROHC client and server
+ */
+
+#include "utils.h"
+#include "log.h"
+
+#include "config.h" /* for HAVE_MALLINFO2 and HAVE_MALLINFO */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#if defined(HAVE_MALLINFO2) || defined(HAVE_MALLINFO)
+#  include <malloc.h>
+#endif
+
+
+/**
+ * @brief Get the number of heap bytes in use, as far as the C library tells
+ *
+ * Used to estimate the memory that librohc and GnuTLS allocate for their
+ * objects, since they do not report it and cannot be given an allocator.
+ * The figure is approximate: it includes what the other threads allocate
+ * meanwhile, and some C libraries only count the main arena, not the
+ * arenas of the other threads. mallinfo2() needs glibc 2.33 or newer, the
+ * older mallinfo() wraps beyond 2 GiB, and the other C libraries, musl for
+ * example, tell nothing.
+ *
+ * @return  The number of heap bytes in use, 0 if unknown
+ */
+size_t iprohc_heap_used(void)
+{
+#if defined(HAVE_MALLINFO2)
+	return mallinfo2().uordblks;
+#elif defined(HAVE_MALLINFO)
+	return (unsigned int) mallinfo().uordblks;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * @brief Replace the content of the given file atomically
+ *
+ * The data is written in a temporary file next to the given one, flushed
+ * to disk, then the temporary file is renamed: a reader sees either the
+ * former content or the new one, never a partial one, even after a crash.
+ *
+ * @param path  The path to the file to replace
+ * @param data  The new content of the file
+ * @param len   The length (in bytes) of the new content
+ * @param mode  The permissions of the file if it is created
+ * @return      true if the file was successfully replaced,
+ *              false if a problem occurred
+ */
+bool iprohc_file_replace(const char *const path,
+                         const void *const data,
+                         const size_t len,
+                         const mode_t mode)
+{
+	char tmp_path[PATH_MAX + 1];
+	size_t written_len;
+	ssize_t ret;
+	int fd;
+
+	ret = snprintf(tmp_path, PATH_MAX + 1, "%s.tmp", path);
+	if(ret < 0 || ret > PATH_MAX)
+	{
+		trace(LOG_ERR, "path of file '%s' is too long", path);
+		goto error;
+	}
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if(fd < 0)
+	{
+		trace(LOG_ERR, "failed to create file '%s': %s (%d)", tmp_path,
+		      strerror(errno), errno);
+		goto error;
+	}
+	for(written_len = 0; written_len < len; written_len += ret)
+	{
+		ret = write(fd, ((const unsigned char *) data) + written_len,
+		            len - written_len);
+		if(ret < 0)
+		{
+			trace(LOG_ERR, "failed to write file '%s': %s (%d)", tmp_path,
+			      strerror(errno), errno);
+			goto close_file;
+		}
+	}
+	if(fsync(fd) != 0)
+	{
+		trace(LOG_ERR, "failed to flush file '%s' to disk: %s (%d)", tmp_path,
+		      strerror(errno), errno);
+		goto close_file;
+	}
+	if(close(fd) != 0)
+	{
+		trace(LOG_ERR, "failed to close file '%s': %s (%d)", tmp_path,
+		      strerror(errno), errno);
+		goto remove_file;
+	}
+	if(rename(tmp_path, path) != 0)
+	{
+		trace(LOG_ERR, "failed to rename file '%s' to '%s': %s (%d)", tmp_path,
+		      path, strerror(errno), errno);
+		goto remove_file;
+	}
+
+	return true;
+
+close_file:
+	close(fd);
+remove_file:
+	unlink(tmp_path);
+error:
+	return false;
+}
+
@@ -24,9 +24,16 @@
 #ifndef IPROHC_COMMON_UTILS__H
 #define IPROHC_COMMON_UTILS__H
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
 /** return the greater value from the two */
 #define max(x, y)  (((x) > (y)) ? (x) : (y))
 
+/** return the smaller value from the two */
+#define min(x, y)  (((x) < (y)) ? (x) : (y))
+
 /** The format string to print an IPv4 address */
 #define IPV4_ADDR_FMT  "%u.%u.%u.%u"
 
@@ -35,5 +42,27 @@
 	((x) >> 24) & 0xff, ((x) >> 16) & 0xff, \
 	((x) >>  8) & 0xff, ((x) >>  0) & 0xff
 
+size_t iprohc_heap_used(void)
+	__attribute__((warn_unused_result));
+
+/**
+ * @brief Get the growth of the heap since the given measure
+ *
+ * @param before  The number of heap bytes in use before
+ * @return        The number of heap bytes allocated since, 0 if the heap
+ *                shrank
+ */
+static inline size_t iprohc_heap_growth(const size_t before)
+{
+	const size_t after = iprohc_heap_used();
+	return (after > before ? after - before : 0);
+}
+
+bool iprohc_file_replace(const char *const path,
+                         const void *const data,
+                         const size_t len,
+                         const mode_t mode)
+	__attribute__((warn_unused_result, nonnull(1)));
+
 #endif
 
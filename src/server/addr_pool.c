@@ -0,0 +1,417 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   addr_pool.c
+ * @brief  The pool of the tunnel addresses given to clients
+ *
+ * A bitmap tells which addresses are in use, and a doubly-linked list keeps
+ * the released addresses, so that allocating any address, allocating one
+ * given address and releasing an address all run in constant time.
+ *
+ * The addresses that were never allocated are not in the list: they are
+ * allocated in order once the list is empty. The pool may thus cover a
+ * large prefix, the memory of its lists is only touched for the addresses
+ * that clients actually used.
+ *
+ * The reserved addresses, the static addresses of some clients, are never
+ * allocated by iprohc_addr_pool_alloc(): they are allocated by their index
+ * only, and they are not put in the list once released.
+ */
+
+#include "addr_pool.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+
+/** The number of addresses per word of the bitmap */
+#define IPROHC_ADDR_POOL_WORD_BITS  (sizeof(unsigned long) * CHAR_BIT)
+
+static bool iprohc_addr_pool_is_used(const struct iprohc_addr_pool *const pool,
+                                     const size_t index)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static bool iprohc_addr_pool_is_reserved(const struct iprohc_addr_pool *const pool,
+                                         const size_t index)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static void iprohc_addr_pool_set_used(struct iprohc_addr_pool *const pool,
+                                      const size_t index,
+                                      const bool is_used)
+	__attribute__((nonnull(1)));
+
+static void iprohc_addr_pool_unlink(struct iprohc_addr_pool *const pool,
+                                    const size_t index)
+	__attribute__((nonnull(1)));
+
+
+/**
+ * @brief Initialize the pool of tunnel addresses
+ *
+ * The pool covers the host addresses of the IP prefix of the server, its
+ * network and broadcast addresses excluded. The address of the server is
+ * reserved.
+ *
+ * @param pool          The pool to initialize
+ * @param local_addr    The tunnel address of the server (network byte order)
+ * @param netmask       The length (in bits) of the network mask
+ * @param addrs_max_nr  The maximum number of addresses in the pool, the
+ *                      pool is smaller if the prefix is smaller
+ * @return              true if the pool was successfully initialized,
+ *                      false if a problem occurred
+ */
+bool iprohc_addr_pool_init(struct iprohc_addr_pool *const pool,
+                           const uint32_t local_addr,
+                           const size_t netmask,
+                           const size_t addrs_max_nr)
+{
+	const uint32_t mask = (0xffffffff << (32 - netmask));
+	const uint32_t network = ntohl(local_addr) & mask;
+	const uint64_t hosts_nr = (((uint64_t) 1) << (32 - netmask)) - 2;
+	size_t words_nr;
+	int ret;
+
+	assert(netmask > 0 && netmask <= 30);
+
+	memset(pool, 0, sizeof(struct iprohc_addr_pool));
+	pool->first_addr = network + 1;
+	pool->addrs_nr = (hosts_nr < addrs_max_nr ? hosts_nr : addrs_max_nr);
+	words_nr = (pool->addrs_nr + IPROHC_ADDR_POOL_WORD_BITS - 1) /
+	           IPROHC_ADDR_POOL_WORD_BITS;
+
+	pool->used = calloc(words_nr, sizeof(unsigned long));
+	if(pool->used == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the bitmap of %zu "
+		      "addresses", pool->addrs_nr);
+		goto error;
+	}
+	pool->reserved = calloc(words_nr, sizeof(unsigned long));
+	if(pool->reserved == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the bitmap of %zu "
+		      "addresses", pool->addrs_nr);
+		goto free_bitmap;
+	}
+	pool->free_next = calloc(pool->addrs_nr, sizeof(uint32_t));
+	if(pool->free_next == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the list of %zu "
+		      "addresses", pool->addrs_nr);
+		goto free_reserved;
+	}
+	pool->free_prev = calloc(pool->addrs_nr, sizeof(uint32_t));
+	if(pool->free_prev == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the list of %zu "
+		      "addresses", pool->addrs_nr);
+		goto free_next;
+	}
+
+	ret = pthread_mutex_init(&pool->lock, NULL);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init the lock of the address pool: %s (%d)",
+		      strerror(ret), ret);
+		goto free_prev;
+	}
+
+	/* the address of the server is not given to clients */
+	{
+		struct in_addr server_addr;
+		size_t server_index;
+
+		server_addr.s_addr = local_addr;
+		server_index = iprohc_addr_pool_index(pool, server_addr);
+		if(server_index < pool->addrs_nr &&
+		   !iprohc_addr_pool_alloc_index(pool, server_index))
+		{
+			goto destroy_lock;
+		}
+	}
+
+	return true;
+
+destroy_lock:
+	pthread_mutex_destroy(&pool->lock);
+free_prev:
+	free(pool->free_prev);
+free_next:
+	free(pool->free_next);
+free_reserved:
+	free(pool->reserved);
+free_bitmap:
+	free(pool->used);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Release the pool of tunnel addresses
+ *
+ * @param pool  The pool to release
+ */
+void iprohc_addr_pool_free(struct iprohc_addr_pool *const pool)
+{
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->free_prev);
+	free(pool->free_next);
+	free(pool->reserved);
+	free(pool->used);
+}
+
+
+/**
+ * @brief Allocate a tunnel address
+ *
+ * The last released address is allocated first, then the addresses that
+ * were never allocated.
+ *
+ * @param pool        The pool of tunnel addresses
+ * @param[out] index  The index of the allocated address
+ * @return            true if an address was allocated,
+ *                    false if all addresses are in use
+ */
+bool iprohc_addr_pool_alloc(struct iprohc_addr_pool *const pool,
+                            size_t *const index)
+{
+	bool is_found = false;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if(pool->free_head != 0)
+	{
+		*index = pool->free_head - 1;
+		iprohc_addr_pool_unlink(pool, *index);
+		is_found = true;
+	}
+	else
+	{
+		/* skip the addresses allocated out of order and the reserved ones */
+		while(pool->never_used_first < pool->addrs_nr &&
+		      (iprohc_addr_pool_is_used(pool, pool->never_used_first) ||
+		       iprohc_addr_pool_is_reserved(pool, pool->never_used_first)))
+		{
+			pool->never_used_first++;
+		}
+		if(pool->never_used_first < pool->addrs_nr)
+		{
+			*index = pool->never_used_first;
+			pool->never_used_first++;
+			is_found = true;
+		}
+	}
+
+	if(is_found)
+	{
+		iprohc_addr_pool_set_used(pool, *index, true);
+		pool->used_nr++;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return is_found;
+}
+
+
+/**
+ * @brief Allocate the tunnel address at the given index
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address to allocate
+ * @return       true if the address was allocated,
+ *               false if it is already in use or out of the pool
+ */
+bool iprohc_addr_pool_alloc_index(struct iprohc_addr_pool *const pool,
+                                  const size_t index)
+{
+	bool is_free;
+
+	if(index >= pool->addrs_nr)
+	{
+		return false;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	is_free = !iprohc_addr_pool_is_used(pool, index);
+	if(is_free)
+	{
+		/* a released address is in the list, unless it is reserved, an
+		 * address never allocated will be skipped by iprohc_addr_pool_alloc() */
+		if(index < pool->never_used_first &&
+		   !iprohc_addr_pool_is_reserved(pool, index))
+		{
+			iprohc_addr_pool_unlink(pool, index);
+		}
+		iprohc_addr_pool_set_used(pool, index, true);
+		pool->used_nr++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return is_free;
+}
+
+
+/**
+ * @brief Reserve the tunnel address at the given index
+ *
+ * The address will only be allocated by iprohc_addr_pool_alloc_index().
+ * The addresses shall be reserved before any address is allocated.
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address to reserve
+ */
+void iprohc_addr_pool_reserve(struct iprohc_addr_pool *const pool,
+                              const size_t index)
+{
+	const unsigned long bit = 1UL << (index % IPROHC_ADDR_POOL_WORD_BITS);
+
+	assert(index < pool->addrs_nr);
+	assert(pool->never_used_first == 0);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->reserved[index / IPROHC_ADDR_POOL_WORD_BITS] |= bit;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * @brief Release the tunnel address at the given index
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address to release
+ */
+void iprohc_addr_pool_release(struct iprohc_addr_pool *const pool,
+                              const size_t index)
+{
+	assert(index < pool->addrs_nr);
+
+	pthread_mutex_lock(&pool->lock);
+
+	assert(iprohc_addr_pool_is_used(pool, index));
+	iprohc_addr_pool_set_used(pool, index, false);
+	assert(pool->used_nr > 0);
+	pool->used_nr--;
+
+	/* an address allocated out of order before iprohc_addr_pool_alloc()
+	 * reached it will be found there again, a reserved address is never
+	 * allocated there */
+	if(index < pool->never_used_first &&
+	   !iprohc_addr_pool_is_reserved(pool, index))
+	{
+		pool->free_prev[index] = 0;
+		pool->free_next[index] = pool->free_head;
+		if(pool->free_head != 0)
+		{
+			pool->free_prev[pool->free_head - 1] = index + 1;
+		}
+		pool->free_head = index + 1;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * @brief Whether the address at the given index is in use
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address
+ * @return       true if the address is in use, false otherwise
+ */
+static bool iprohc_addr_pool_is_used(const struct iprohc_addr_pool *const pool,
+                                     const size_t index)
+{
+	const unsigned long bit = 1UL << (index % IPROHC_ADDR_POOL_WORD_BITS);
+	return !!(pool->used[index / IPROHC_ADDR_POOL_WORD_BITS] & bit);
+}
+
+
+/**
+ * @brief Whether the address at the given index is reserved
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address
+ * @return       true if the address is reserved, false otherwise
+ */
+static bool iprohc_addr_pool_is_reserved(const struct iprohc_addr_pool *const pool,
+                                         const size_t index)
+{
+	const unsigned long bit = 1UL << (index % IPROHC_ADDR_POOL_WORD_BITS);
+	return !!(pool->reserved[index / IPROHC_ADDR_POOL_WORD_BITS] & bit);
+}
+
+
+/**
+ * @brief Mark the address at the given index as used or unused
+ *
+ * @param pool     The pool of tunnel addresses
+ * @param index    The index of the address
+ * @param is_used  Whether the address is in use
+ */
+static void iprohc_addr_pool_set_used(struct iprohc_addr_pool *const pool,
+                                      const size_t index,
+                                      const bool is_used)
+{
+	const unsigned long bit = 1UL << (index % IPROHC_ADDR_POOL_WORD_BITS);
+
+	if(is_used)
+	{
+		pool->used[index / IPROHC_ADDR_POOL_WORD_BITS] |= bit;
+	}
+	else
+	{
+		pool->used[index / IPROHC_ADDR_POOL_WORD_BITS] &= ~bit;
+	}
+}
+
+
+/**
+ * @brief Remove the address at the given index from the released addresses
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address
+ */
+static void iprohc_addr_pool_unlink(struct iprohc_addr_pool *const pool,
+                                    const size_t index)
+{
+	const uint32_t next = pool->free_next[index];
+	const uint32_t prev = pool->free_prev[index];
+
+	if(prev != 0)
+	{
+		pool->free_next[prev - 1] = next;
+	}
+	else
+	{
+		assert(pool->free_head == index + 1);
+		pool->free_head = next;
+	}
+	if(next != 0)
+	{
+		pool->free_prev[next - 1] = prev;
+	}
+	pool->free_next[index] = 0;
+	pool->free_prev[index] = 0;
+}
+
@@ -0,0 +1,123 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   addr_pool.h
+ * @brief  The pool of the tunnel addresses given to clients
+ */
+
+#ifndef IPROHC_SERVER_ADDR_POOL__H
+#define IPROHC_SERVER_ADDR_POOL__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+
+/**
+ * @brief The pool of the tunnel addresses given to clients
+ *
+ * The addresses of the pool are identified by their index in the IP prefix
+ * of the server, the network address excluded: index 0 is the first host
+ * address of the prefix. The index of an address is also the index of the
+ * client context that uses it.
+ */
+struct iprohc_addr_pool
+{
+	pthread_mutex_t lock;     /**< The session threads release addresses of
+	                               lost sessions while the main thread
+	                               allocates new ones */
+	uint32_t first_addr;      /**< The first host address (host byte order) */
+	size_t addrs_nr;          /**< The number of addresses in the pool */
+	size_t used_nr;           /**< The number of addresses in use */
+
+	unsigned long *used;      /**< The bitmap of the addresses in use */
+	unsigned long *reserved;  /**< The bitmap of the addresses that are only
+	                               allocated by their index */
+	uint32_t *free_next;      /**< The next released address (index + 1) */
+	uint32_t *free_prev;      /**< The previous released address (index + 1) */
+	uint32_t free_head;       /**< The last released address (index + 1),
+	                               0 if no address was released */
+	size_t never_used_first;  /**< The addresses from this index were never
+	                               allocated, so they are not in the list of
+	                               released addresses */
+};
+
+
+bool iprohc_addr_pool_init(struct iprohc_addr_pool *const pool,
+                           const uint32_t local_addr,
+                           const size_t netmask,
+                           const size_t addrs_max_nr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_addr_pool_free(struct iprohc_addr_pool *const pool)
+	__attribute__((nonnull(1)));
+
+bool iprohc_addr_pool_alloc(struct iprohc_addr_pool *const pool,
+                            size_t *const index)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_addr_pool_alloc_index(struct iprohc_addr_pool *const pool,
+                                  const size_t index)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_addr_pool_reserve(struct iprohc_addr_pool *const pool,
+                              const size_t index)
+	__attribute__((nonnull(1)));
+
+void iprohc_addr_pool_release(struct iprohc_addr_pool *const pool,
+                              const size_t index)
+	__attribute__((nonnull(1)));
+
+
+/**
+ * @brief Get the tunnel address at the given index of the pool
+ *
+ * @param pool   The pool of tunnel addresses
+ * @param index  The index of the address in the pool
+ * @return       The tunnel address
+ */
+static inline struct in_addr iprohc_addr_pool_addr(const struct iprohc_addr_pool *const pool,
+                                                   const size_t index)
+{
+	struct in_addr addr;
+	addr.s_addr = htonl(pool->first_addr + index);
+	return addr;
+}
+
+
+/**
+ * @brief Get the index of the given tunnel address in the pool
+ *
+ * Lock-free, the routing threads call it for every packet.
+ *
+ * @param pool  The pool of tunnel addresses
+ * @param addr  The tunnel address
+ * @return      The index of the address, pool->addrs_nr if the address is
+ *              not in the pool
+ */
+static inline size_t iprohc_addr_pool_index(const struct iprohc_addr_pool *const pool,
+                                            const struct in_addr addr)
+{
+	const uint32_t offset = ntohl(addr.s_addr) - pool->first_addr;
+	return (offset < pool->addrs_nr ? offset : pool->addrs_nr);
+}
+
+#endif
+
@@ -0,0 +1,557 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   admin.c
+ * @brief  The administration socket of the server
+ *
+ * The commands are served by the main thread. They read the stats of the
+ * sessions through snapshots and give orders to the session threads through
+ * their pipes, so the data path is never blocked. The connections of the
+ * administrator are non-blocking and driven by the epoll loop of the main
+ * thread, see local_conn.c: a stalled administrator never delays the
+ * clients, it is disconnected after IPROHC_ADMIN_TIMEOUT seconds.
+ */
+
+#include "admin.h"
+#include "client.h"
+#include "latency.h"
+#include "log.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+
+
+static void iprohc_admin_handle(FILE *const out,
+                                struct iprohc_clients *const clients,
+                                char *const request)
+	__attribute__((nonnull(1, 2, 3)));
+
+static struct iprohc_server_session *
+	iprohc_admin_find(const struct iprohc_clients *const clients,
+	                  const char *const name)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+static void iprohc_admin_list(FILE *const out,
+                              const struct iprohc_clients *const clients)
+	__attribute__((nonnull(1, 2)));
+
+static void iprohc_admin_show(FILE *const out,
+                              const struct iprohc_server_session *const client)
+	__attribute__((nonnull(1, 2)));
+
+static const char * iprohc_admin_status_descr(const iprohc_session_status_t status)
+	__attribute__((warn_unused_result));
+
+
+/**
+ * @brief Listen for the administrator
+ *
+ * Only the owner of the server, root usually, may connect to the socket.
+ *
+ * @param path  The path of the UNIX socket
+ * @return      The socket in listen state, -1 in case of error
+ */
+int iprohc_admin_listen(const char *const path)
+{
+	struct sockaddr_un addr;
+	int sock;
+	int ret;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		trace(LOG_ERR, "path '%s' of administration socket is too long", path);
+		goto error;
+	}
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		trace(LOG_ERR, "failed to create administration socket: %s (%d)",
+		      strerror(errno), errno);
+		goto error;
+	}
+
+	/* the socket of a previous server, or of the server we take over */
+	unlink(path);
+
+	ret = bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to bind administration socket on '%s': %s (%d)",
+		      path, strerror(errno), errno);
+		goto close_sock;
+	}
+	if(chmod(path, S_IRUSR | S_IWUSR) != 0)
+	{
+		trace(LOG_ERR, "failed to restrict access to administration socket '%s': "
+		      "%s (%d)", path, strerror(errno), errno);
+		goto unlink_path;
+	}
+
+	ret = listen(sock, 4);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to put administration socket in listen mode: "
+		      "%s (%d)", strerror(errno), errno);
+		goto unlink_path;
+	}
+
+	return sock;
+
+unlink_path:
+	unlink(path);
+close_sock:
+	close(sock);
+error:
+	return -1;
+}
+
+
+/**
+ * @brief Stop listening for the administrator
+ *
+ * @param admin_sock  The socket in listen state
+ * @param path        The path of the UNIX socket
+ * @param is_unlink   Whether to remove the UNIX socket from the file system,
+ *                    false if a new server already listens on it
+ */
+void iprohc_admin_close(const int admin_sock,
+                        const char *const path,
+                        const bool is_unlink)
+{
+	close(admin_sock);
+	if(is_unlink)
+	{
+		unlink(path);
+	}
+}
+
+
+/**
+ * @brief Answer the command of the administrator
+ *
+ * @param conns    The connections of the administrator
+ * @param conn     The connection which command is complete
+ * @param clients  The contexts of the clients
+ */
+void iprohc_admin_serve(struct iprohc_local_conns *const conns,
+                        struct iprohc_local_conn *const conn,
+                        struct iprohc_clients *const clients)
+{
+	char *reply = NULL;
+	size_t reply_len = 0;
+	FILE *out;
+
+	conn->request[strcspn(conn->request, "\r\n")] = '\0';
+
+	out = open_memstream(&reply, &reply_len);
+	if(out == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to create buffer for administration "
+		      "answer: %s (%d)", strerror(errno), errno);
+		goto error;
+	}
+	iprohc_admin_handle(out, clients, conn->request);
+	if(fclose(out) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to build administration answer: %s (%d)",
+		      strerror(errno), errno);
+		free(reply);
+		reply = NULL;
+	}
+
+error:
+	/* the connection is closed at once if no answer was built */
+	iprohc_local_conn_reply(conns, conn, reply, reply_len);
+}
+
+
+/**
+ * @brief Run one command of the administrator
+ *
+ * @param out      The stream to write the answer to
+ * @param clients  The contexts of the clients
+ * @param request  The command, split in place
+ */
+static void iprohc_admin_handle(FILE *const out,
+                                struct iprohc_clients *const clients,
+                                char *const request)
+{
+	struct iprohc_server_session *client = NULL;
+	char *saveptr = NULL;
+	char *command;
+	char *name;
+	char *value;
+
+	command = strtok_r(request, " \t", &saveptr);
+	if(command == NULL || strcmp(command, "help") == 0)
+	{
+		fprintf(out,
+		        "list                     list the client sessions\n"
+		        "show CLIENT              show the parameters and stats of a session\n"
+		        "disconnect CLIENT        close a session\n"
+		        "packing CLIENT LEVEL     change the packing level of a session\n"
+		        "debug CLIENT on|off      log the debug traces of a session\n"
+		        "\n"
+		        "CLIENT is the ID of the client, or its address, or its tunnel "
+		        "address\n");
+		return;
+	}
+	if(strcmp(command, "list") == 0)
+	{
+		iprohc_admin_list(out, clients);
+		return;
+	}
+
+	/* the other commands are about one client */
+	name = strtok_r(NULL, " \t", &saveptr);
+	value = strtok_r(NULL, " \t", &saveptr);
+	if(strcmp(command, "show") != 0 && strcmp(command, "disconnect") != 0 &&
+	   strcmp(command, "packing") != 0 && strcmp(command, "debug") != 0)
+	{
+		fprintf(out, IPROHC_ADMIN_ERROR "unknown command '%s', try 'help'\n",
+		        command);
+		return;
+	}
+	if(name == NULL)
+	{
+		fprintf(out, IPROHC_ADMIN_ERROR "command '%s' needs a client\n", command);
+		return;
+	}
+	client = iprohc_admin_find(clients, name);
+	if(client == NULL)
+	{
+		fprintf(out, IPROHC_ADMIN_ERROR "no client '%s'\n", name);
+		return;
+	}
+
+	if(strcmp(command, "show") == 0)
+	{
+		iprohc_admin_show(out, client);
+	}
+	else if(strcmp(command, "disconnect") == 0)
+	{
+		if(!AO_load_acquire_read(&(client->session.is_thread_running)))
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "session of client #%zu is already "
+			        "ending\n", client->client_id);
+			return;
+		}
+		trace(LOG_NOTICE, "[main] administrator closes the session of client #%zu",
+		      client->client_id);
+		if(!iprohc_session_disconnect(&(client->session)))
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "failed to close the session of "
+			        "client #%zu\n", client->client_id);
+			return;
+		}
+		fprintf(out, "session of client #%zu is closing\n", client->client_id);
+	}
+	else if(strcmp(command, "packing") == 0)
+	{
+		char *end;
+		const long packing = (value != NULL ? strtol(value, &end, 10) : -1);
+
+		/* the same range as in the configuration file */
+		if(value == NULL || value[0] == '\0' || end[0] != '\0' ||
+		   packing < 0 || packing > IPROHC_PACKING_MAX)
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "packing level shall be in range "
+			        "[0,%d]\n", IPROHC_PACKING_MAX);
+			return;
+		}
+		if(client->session.status != IPROHC_SESSION_CONNECTED ||
+		   !AO_load_acquire_read(&(client->session.is_thread_running)))
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "client #%zu is not connected\n",
+			        client->client_id);
+			return;
+		}
+		trace(LOG_NOTICE, "[main] administrator sets packing level %ld for "
+		      "client #%zu", packing, client->client_id);
+		if(!iprohc_session_update_params(&(client->session), packing,
+		                                 client->session.tunnel.params.keepalive_timeout,
+		                                 true))
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "failed to change the packing level "
+			        "of client #%zu\n", client->client_id);
+			return;
+		}
+		/* keep the level of the administrator when the configuration is
+		 * reloaded, as if the client had chosen it */
+		client->is_packing_requested = true;
+		fprintf(out, "packing level of client #%zu is changing to %ld\n",
+		        client->client_id, packing);
+	}
+	else
+	{
+		bool is_debug;
+
+		if(value != NULL && strcmp(value, "on") == 0)
+		{
+			is_debug = true;
+		}
+		else if(value != NULL && strcmp(value, "off") == 0)
+		{
+			is_debug = false;
+		}
+		else
+		{
+			fprintf(out, IPROHC_ADMIN_ERROR "debug shall be 'on' or 'off'\n");
+			return;
+		}
+		trace(LOG_NOTICE, "[main] administrator %s debug for client #%zu",
+		      is_debug ? "enables" : "disables", client->client_id);
+		AO_store_release_write(&(client->session.is_debug), is_debug);
+		fprintf(out, "debug of client #%zu is %s\n", client->client_id,
+		        is_debug ? "on" : "off");
+	}
+}
+
+
+/**
+ * @brief Find the client the administrator names
+ *
+ * @param clients  The contexts of the clients
+ * @param name     The ID of the client, or its address, or its tunnel address
+ * @return         The client, NULL if none matches
+ */
+static struct iprohc_server_session *
+	iprohc_admin_find(const struct iprohc_clients *const clients,
+	                  const char *const name)
+{
+	struct iprohc_server_session *client;
+	struct in_addr addr;
+	unsigned long client_id;
+	const char *start;
+	char *end;
+
+	if(inet_pton(AF_INET, name, &addr) == 1)
+	{
+		for(client_id = 0;
+		    (client = iprohc_clients_next(clients, &client_id)) != NULL;
+		    client_id++)
+		{
+			if(client->session.dst_addr.s_addr == addr.s_addr ||
+			   client->session.local_address.s_addr == addr.s_addr)
+			{
+				return client;
+			}
+		}
+		return NULL;
+	}
+
+	/* the IDs are written "#3" in logs, strtoul() would accept blanks and
+	 * signs before the digits */
+	start = name + (name[0] == '#' ? 1 : 0);
+	if(!isdigit((unsigned char) start[0]))
+	{
+		return NULL;
+	}
+	client_id = strtoul(start, &end, 10);
+	if(end == start || end[0] != '\0')
+	{
+		return NULL;
+	}
+	client = iprohc_clients_get(clients, client_id);
+	if(client == NULL || !AO_load_acquire_read(&(client->is_init)))
+	{
+		return NULL;
+	}
+
+	return client;
+}
+
+
+/**
+ * @brief List the client sessions
+ *
+ * @param out      The stream to write the answer to
+ * @param clients  The contexts of the clients
+ */
+static void iprohc_admin_list(FILE *const out,
+                              const struct iprohc_clients *const clients)
+{
+	struct iprohc_server_session *client;
+	size_t client_id;
+
+	fprintf(out, "%-6s %-16s %-16s %-15s %-7s %-5s %s\n", "ID", "CLIENT",
+	        "TUNNEL", "STATUS", "PACKING", "DEBUG", "PROFILE");
+	for(client_id = 0;
+	    (client = iprohc_clients_next(clients, &client_id)) != NULL;
+	    client_id++)
+	{
+		char tun_addr[INET_ADDRSTRLEN];
+
+		if(inet_ntop(AF_INET, &(client->session.local_address), tun_addr,
+		             INET_ADDRSTRLEN) == NULL)
+		{
+			strcpy(tun_addr, "?");
+		}
+		fprintf(out, "%-6zu %-16s %-16s %-15s %-7d %-5s %s\n", client->client_id,
+		        client->session.dst_addr_str, tun_addr,
+		        iprohc_admin_status_descr(client->session.status),
+		        client->session.tunnel.params.packing,
+		        AO_load(&(client->session.is_debug)) ? "on" : "off",
+		        client->profile != NULL ? client->profile->name : "-");
+	}
+}
+
+
+/**
+ * @brief Show the parameters and the stats of one client session
+ *
+ * The stats are a snapshot, the session thread is not slowed down.
+ *
+ * @param out     The stream to write the answer to
+ * @param client  The client
+ */
+static void iprohc_admin_show(FILE *const out,
+                              const struct iprohc_server_session *const client)
+{
+	const struct tunnel_params *const params = &(client->session.tunnel.params);
+	char tun_addr[INET_ADDRSTRLEN];
+	char latency_descr[IPROHC_LATENCY_DESCR_MAX_LEN];
+	struct statitics stats;
+	int i;
+
+	if(inet_ntop(AF_INET, &(client->session.local_address), tun_addr,
+	             INET_ADDRSTRLEN) == NULL)
+	{
+		strcpy(tun_addr, "?");
+	}
+
+	fprintf(out, "client:         #%zu %s\n", client->client_id,
+	        client->session.dst_addr_str);
+	fprintf(out, "status:         %s\n",
+	        iprohc_admin_status_descr(client->session.status));
+	fprintf(out, "tunnel address: %s\n", tun_addr);
+	fprintf(out, "profile:        %s\n",
+	        client->profile != NULL ? client->profile->name : "none");
+	fprintf(out, "protocol:       version %d\n", client->proto_version);
+	fprintf(out, "debug:          %s\n",
+	        AO_load(&(client->session.is_debug)) ? "on" : "off");
+	if(client->session.status != IPROHC_SESSION_CONNECTED)
+	{
+		return;
+	}
+
+	fprintf(out, "parameters:\n");
+	fprintf(out, "  packing:        %d%s\n", params->packing,
+	        client->is_packing_requested ? " (chosen by client)" : "");
+	fprintf(out, "  max CID:        %zu\n", params->max_cid);
+	fprintf(out, "  mode:           %s\n",
+	        params->is_unidirectional ? "unidirectional" : "bidirectional");
+	fprintf(out, "  keepalive:      %zu seconds\n", params->keepalive_timeout);
+	fprintf(out, "  ROHC compat:    %s\n",
+	        params->rohc_compat_version == IPROHC_ROHC_COMPAT_1_6_x ?
+	        "1.6.x" : "1.7.x");
+	fprintf(out, "  data liveness:  %s\n",
+	        (params->capabilities & IPROHC_CAP_DATA_LIVENESS) ? "yes" : "no");
+
+	/* the thread of the session keeps updating the stats */
+	iprohc_tunnel_get_stats(&(client->session.tunnel), &stats);
+
+	fprintf(out, "stats:\n");
+	fprintf(out, "  compressed packets:     %" PRIu64 " (%" PRIu64 " failed)\n",
+	        stats.comp_total, stats.comp_failed);
+	fprintf(out, "  decompressed packets:   %" PRIu64 " (%" PRIu64 " failed)\n",
+	        stats.decomp_total, stats.decomp_failed);
+	fprintf(out, "  received frames:        %" PRIu64 " (%" PRIu64 " malformed)\n",
+	        stats.total_received, stats.unpack_failed);
+	fprintf(out, "  header bytes:           %" PRIu64 " -> %" PRIu64 "\n",
+	        stats.head_uncomp_size, stats.head_comp_size);
+	fprintf(out, "  packet bytes:           %" PRIu64 " -> %" PRIu64 "\n",
+	        stats.total_uncomp_size, stats.total_comp_size);
+	fprintf(out, "  frames by packets:     ");
+	for(i = 1; i <= params->packing; i++)
+	{
+		fprintf(out, " %d:%" PRIu64, i, stats.stats_packing[i]);
+	}
+	fprintf(out, "\n");
+	for(i = 0; i < IPROHC_TUNNEL_ERR_MAX; i++)
+	{
+		if(stats.errors[i].total_nr > 0)
+		{
+			fprintf(out, "  error %s: %" PRIu64 "\n", iprohc_tunnel_err_descr(i),
+			        stats.errors[i].total_nr);
+		}
+	}
+
+	fprintf(out, "flows:\n");
+	for(i = 0; i <= ROHC_SMALL_CID_MAX; i++)
+	{
+		const struct iprohc_tunnel_flow *const flow = &(stats.flows[i]);
+		if(flow->packets_nr > 0)
+		{
+			fprintf(out, "  CID %d: profile %s, state %s, %" PRIu64 " packets "
+			        "(%" PRIu64 " IR, %" PRIu64 " IR-DYN), header bytes %" PRIu64
+			        " -> %" PRIu64 "\n", i, rohc_get_profile_descr(flow->profile_id),
+			        rohc_comp_get_state_descr(flow->state), flow->packets_nr,
+			        flow->ir_nr, flow->ir_dyn_nr, flow->head_uncomp_size,
+			        flow->head_comp_size);
+		}
+	}
+
+	fprintf(out, "latencies:\n");
+	(void) iprohc_latency_format(&(stats.packing_hold), latency_descr,
+	                             IPROHC_LATENCY_DESCR_MAX_LEN);
+	fprintf(out, "  packing hold:   %s\n", latency_descr);
+	(void) iprohc_latency_format(&(stats.comp_time), latency_descr,
+	                             IPROHC_LATENCY_DESCR_MAX_LEN);
+	fprintf(out, "  compression:    %s\n", latency_descr);
+	(void) iprohc_latency_format(&(stats.decomp_time), latency_descr,
+	                             IPROHC_LATENCY_DESCR_MAX_LEN);
+	fprintf(out, "  decompression:  %s\n", latency_descr);
+}
+
+
+/**
+ * @brief Get a short description of the given session status
+ *
+ * @param status  The session status
+ * @return        The description of the status
+ */
+static const char * iprohc_admin_status_descr(const iprohc_session_status_t status)
+{
+	switch(status)
+	{
+		case IPROHC_SESSION_CONNECTING:
+			return "connecting";
+		case IPROHC_SESSION_CONNECTED:
+			return "connected";
+		case IPROHC_SESSION_PENDING_DELETE:
+			return "pending delete";
+		default:
+			return "unknown";
+	}
+}
+
@@ -0,0 +1,68 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   admin.h
+ * @brief  The administration socket of the server
+ *
+ * The administrator connects to the UNIX socket, sends one command on one
+ * line, reads the answer until the server closes the connection. The answer
+ * starts with "error: " if the command failed. The iprohc_ctl tool does
+ * exactly that.
+ */
+
+#ifndef IPROHC_SERVER_ADMIN__H
+#define IPROHC_SERVER_ADMIN__H
+
+#include "local_conn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The default path of the administration socket */
+#define IPROHC_ADMIN_SOCKET_DEFAULT  "/var/run/iprohc_server.ctl"
+
+/** The maximum length of the path of the administration socket */
+#define IPROHC_ADMIN_PATH_MAX_LEN  108U
+
+/** The maximum length of one command, end of line included */
+#define IPROHC_ADMIN_REQUEST_MAX_LEN  256U
+
+/** The time the administrator has to send the command and read the answer (s) */
+#define IPROHC_ADMIN_TIMEOUT  1
+
+/** The prefix of the answers to the commands that failed */
+#define IPROHC_ADMIN_ERROR  "error: "
+
+struct iprohc_clients;
+
+
+int iprohc_admin_listen(const char *const path)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_admin_close(const int admin_sock,
+                        const char *const path,
+                        const bool is_unlink)
+	__attribute__((nonnull(2)));
+
+void iprohc_admin_serve(struct iprohc_local_conns *const conns,
+                        struct iprohc_local_conn *const conn,
+                        struct iprohc_clients *const clients)
+	__attribute__((nonnull(1, 2, 3)));
+
+#endif
+
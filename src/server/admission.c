@@ -0,0 +1,173 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   admission.c
+ * @brief  Admission control of new connections on the control listener
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ *
+ * Every source prefix gets a token bucket refilled at the configured rate:
+ * a new connection takes one token, or is rejected if none is left. The
+ * buckets are stored in a fixed-size table: a prefix may use one of a few
+ * slots starting at its hash, and evicts the least recently used one if they
+ * are all taken. The memory used is thus bounded whatever the number of
+ * sources.
+ */
+
+#include "admission.h"
+
+#include "log.h"
+
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+
+/** The number of slots a prefix may use in the table of buckets */
+#define IPROHC_ADMISSION_PROBES_NR  4U
+
+
+static uint64_t iprohc_admission_now_ms(void)
+	__attribute__((warn_unused_result));
+
+
+
+/**
+ * @brief Initialize the admission control context
+ *
+ * @param admission  The admission control context
+ * @param params     The configuration of admission control
+ */
+void iprohc_admission_init(struct iprohc_admission *const admission,
+                           const struct iprohc_admission_params params)
+{
+	memset(admission, 0, sizeof(struct iprohc_admission));
+	memcpy(&admission->params, &params, sizeof(struct iprohc_admission_params));
+}
+
+
+/**
+ * @brief Whether a new connection from the given address is allowed
+ *
+ * @param admission  The admission control context
+ * @param addr       The source address of the new connection
+ * @return           true if the connection is allowed,
+ *                   false if the rate limit of its source prefix is reached
+ */
+bool iprohc_admission_allow(struct iprohc_admission *const admission,
+                            const struct in_addr addr)
+{
+	const uint64_t tokens_max = admission->params.burst * 1000U;
+	const uint32_t netmask = (admission->params.prefix_len == 0 ? 0 :
+	                          0xffffffff << (32 - admission->params.prefix_len));
+	const uint32_t prefix = ntohl(addr.s_addr) & netmask;
+	const size_t hash =
+		((uint32_t) (prefix * 2654435761U)) >> (32 - IPROHC_ADMISSION_BUCKETS_BITS);
+	struct iprohc_admission_bucket *bucket = NULL;
+	const uint64_t now_ms = iprohc_admission_now_ms();
+	size_t i;
+
+	if(admission->params.rate == 0)
+	{
+		admission->accepted_nr++;
+		return true;
+	}
+
+	/* find the bucket of the prefix, or a free one, or the least recently
+	 * used one among the slots of the prefix */
+	for(i = 0; i < IPROHC_ADMISSION_PROBES_NR; i++)
+	{
+		struct iprohc_admission_bucket *const slot =
+			&(admission->buckets[(hash + i) % IPROHC_ADMISSION_BUCKETS_NR]);
+
+		if(slot->is_used && slot->prefix == prefix)
+		{
+			bucket = slot;
+			break;
+		}
+		if(bucket == NULL ||
+		   (bucket->is_used && (!slot->is_used || slot->last_ms < bucket->last_ms)))
+		{
+			bucket = slot;
+		}
+	}
+	assert(bucket != NULL);
+	if(!bucket->is_used || bucket->prefix != prefix)
+	{
+		/* new prefix: full bucket */
+		bucket->is_used = true;
+		bucket->prefix = prefix;
+		bucket->tokens = tokens_max;
+		bucket->last_ms = now_ms;
+	}
+
+	/* refill the bucket: 'rate' tokens per second is 'rate' thousandths of
+	 * token per millisecond */
+	bucket->tokens += (now_ms - bucket->last_ms) * admission->params.rate;
+	if(bucket->tokens > tokens_max)
+	{
+		bucket->tokens = tokens_max;
+	}
+	bucket->last_ms = now_ms;
+
+	/* take one token if available */
+	if(bucket->tokens < 1000U)
+	{
+		admission->rate_limited_nr++;
+		return false;
+	}
+	bucket->tokens -= 1000U;
+	admission->accepted_nr++;
+
+	return true;
+}
+
+
+/**
+ * @brief Print the counters of admission control in logs
+ *
+ * @param admission  The admission control context
+ */
+void iprohc_admission_dump_stats(const struct iprohc_admission *const admission)
+{
+	trace(LOG_INFO, "[main] admission control:");
+	trace(LOG_INFO, "[main]   accepted connections: %lu", admission->accepted_nr);
+	trace(LOG_INFO, "[main]   rejected connections (rate limit): %lu",
+	      admission->rate_limited_nr);
+	trace(LOG_INFO, "[main]   rejected connections (no more client): %lu",
+	      admission->over_capacity_nr);
+	trace(LOG_INFO, "[main]   listener pauses (too many handshakes): %lu",
+	      admission->paused_nr);
+	trace(LOG_INFO, "[main]   connections queued during pauses: %lu",
+	      admission->queued_nr);
+}
+
+
+/**
+ * @brief Get the current time
+ *
+ * @return  The current monotonic time (in milliseconds)
+ */
+static uint64_t iprohc_admission_now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t) now.tv_sec) * 1000U + now.tv_nsec / 1000000U;
+}
+
@@ -0,0 +1,94 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   admission.h
+ * @brief  Admission control of new connections on the control listener
+ * @author Didier Barvaux <didier.barvaux@toulouse.viveris.com>
+ */
+
+#ifndef IPROHC_SERVER_ADMISSION_H
+#define IPROHC_SERVER_ADMISSION_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+
+/** The number of per-prefix token buckets (log2) */
+#define IPROHC_ADMISSION_BUCKETS_BITS  10U
+/** The number of per-prefix token buckets */
+#define IPROHC_ADMISSION_BUCKETS_NR  (1U << IPROHC_ADMISSION_BUCKETS_BITS)
+
+
+/** The configuration of admission control */
+struct iprohc_admission_params
+{
+	size_t listen_backlog;  /**< The backlog of the listening socket */
+	size_t prefix_len;      /**< The length of the source prefixes (in bits) */
+	size_t rate;            /**< The new connections per second per prefix,
+	                             0 for no rate limit */
+	size_t burst;           /**< The burst of new connections per prefix */
+	size_t max_handshakes;  /**< The maximum number of concurrent handshakes,
+	                             0 for no limit */
+};
+
+
+/** The token bucket of one source prefix */
+struct iprohc_admission_bucket
+{
+	bool is_used;           /**< Whether the bucket is used by a prefix */
+	uint32_t prefix;        /**< The source prefix (in host byte order) */
+	uint64_t tokens;        /**< The available tokens (in thousandths) */
+	uint64_t last_ms;       /**< The last refill time (in milliseconds) */
+};
+
+
+/** The admission control context with its counters */
+struct iprohc_admission
+{
+	struct iprohc_admission_params params;  /**< The configuration */
+
+	/** The token buckets, indexed by a hash of the source prefix */
+	struct iprohc_admission_bucket buckets[IPROHC_ADMISSION_BUCKETS_NR];
+
+	unsigned long accepted_nr;      /**< The accepted connections */
+	unsigned long rate_limited_nr;  /**< The connections rejected by rate limit */
+	unsigned long over_capacity_nr; /**< The connections rejected because the
+	                                     maximum number of clients is reached */
+	unsigned long paused_nr;        /**< The times the listener was paused
+	                                     because of too many handshakes */
+	unsigned long queued_nr;        /**< The connections found queued in the
+	                                     backlog when the listener resumed,
+	                                     summed over all the pauses */
+};
+
+
+void iprohc_admission_init(struct iprohc_admission *const admission,
+                           const struct iprohc_admission_params params)
+	__attribute__((nonnull(1)));
+
+bool iprohc_admission_allow(struct iprohc_admission *const admission,
+                            const struct in_addr addr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_admission_dump_stats(const struct iprohc_admission *const admission)
+	__attribute__((nonnull(1)));
+
+#endif
+
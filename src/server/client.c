@@ -22,6 +22,7 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include "messages.h"
 #include "tls.h"
 #include "log.h"
+#include "utils.h"
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -35,9 +36,167 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <signal.h>
 
 
+static void iprohc_server_session_end(struct iprohc_session *const session)
+	__attribute__((nonnull(1)));
+
+
+
+/**
+ * @brief Initialize the contexts of all clients
+ *
+ * No context is allocated yet.
+ *
+ * @param clients  The contexts to initialize
+ * @param max_nr   The maximum number of client contexts
+ * @return         true if successful, false if a problem occurred
+ */
+bool iprohc_clients_init(struct iprohc_clients *const clients,
+                         const size_t max_nr)
+{
+	clients->max_nr = max_nr;
+	clients->chunks_used_nr = 0;
+	clients->chunks_nr =
+		(max_nr + IPROHC_CLIENTS_CHUNK_LEN - 1) / IPROHC_CLIENTS_CHUNK_LEN;
+	clients->chunks = calloc(clients->chunks_nr, sizeof(AO_t));
+	if(clients->chunks == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the contexts of %zu "
+		      "clients", max_nr);
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * @brief Release the contexts of all clients
+ *
+ * @param clients  The contexts to release
+ */
+void iprohc_clients_free(struct iprohc_clients *const clients)
+{
+	for(size_t i = 0; i < clients->chunks_nr; i++)
+	{
+		struct iprohc_server_session *const chunk =
+			(struct iprohc_server_session *) clients->chunks[i];
+
+		if(chunk != NULL)
+		{
+			for(size_t j = 0; j < IPROHC_CLIENTS_CHUNK_LEN; j++)
+			{
+				pthread_mutex_destroy(&(chunk[j].rohc_lock));
+			}
+		}
+		free(chunk);
+	}
+	free((void *) clients->chunks);
+	clients->chunks = NULL;
+	clients->chunks_nr = 0;
+	clients->chunks_used_nr = 0;
+}
+
+
+/**
+ * @brief Get the context of the client at the given index, allocate it if
+ *        needed
+ *
+ * Only the main thread allocates client contexts.
+ *
+ * @param clients    The contexts of all clients
+ * @param client_id  The index of the client context
+ * @return           The client context, NULL if a problem occurred
+ */
+struct iprohc_server_session * iprohc_clients_alloc(struct iprohc_clients *const clients,
+                                                    const size_t client_id)
+{
+	const size_t chunk_id = client_id / IPROHC_CLIENTS_CHUNK_LEN;
+	struct iprohc_server_session *chunk;
+
+	assert(client_id < clients->max_nr);
+
+	chunk = (struct iprohc_server_session *)
+		AO_load_acquire_read(&(clients->chunks[chunk_id]));
+	if(chunk == NULL)
+	{
+		/* the stats of the tunnels are aligned on cache lines */
+		if(posix_memalign((void **) &chunk, IPROHC_CACHE_LINE_SIZE,
+		                  IPROHC_CLIENTS_CHUNK_LEN *
+		                  sizeof(struct iprohc_server_session)) != 0)
+		{
+			trace(LOG_ERR, "failed to allocate memory for the contexts of %u "
+			      "clients", IPROHC_CLIENTS_CHUNK_LEN);
+			return NULL;
+		}
+		memset(chunk, 0, IPROHC_CLIENTS_CHUNK_LEN *
+		       sizeof(struct iprohc_server_session));
+		for(size_t i = 0; i < IPROHC_CLIENTS_CHUNK_LEN; i++)
+		{
+			pthread_mutex_init(&(chunk[i].rohc_lock), NULL);
+		}
+		trace(LOG_DEBUG, "allocate contexts for clients #%zu to #%zu",
+		      chunk_id * IPROHC_CLIENTS_CHUNK_LEN,
+		      (chunk_id + 1) * IPROHC_CLIENTS_CHUNK_LEN - 1);
+
+		/* publish the chunk to the routing threads once zeroed */
+		AO_store_release_write(&(clients->chunks[chunk_id]), (AO_t) chunk);
+		if(chunk_id >= clients->chunks_used_nr)
+		{
+			AO_store_release_write(&(clients->chunks_used_nr), chunk_id + 1);
+		}
+	}
+
+	return &(chunk[client_id % IPROHC_CLIENTS_CHUNK_LEN]);
+}
+
+
+/**
+ * @brief Find the next initialized client context
+ *
+ * The chunks that were never allocated are skipped at once.
+ *
+ * @param clients            The contexts of all clients
+ * @param[in,out] client_id  The index to start from, the index of the client
+ *                           context found
+ * @return                   The client context, NULL if there is no more
+ *                           initialized client context
+ */
+struct iprohc_server_session * iprohc_clients_next(const struct iprohc_clients *const clients,
+                                                   size_t *const client_id)
+{
+	/* the pool spans the whole prefix, but the clients get the first
+	 * addresses: do not walk the chunks that were never allocated */
+	const size_t ids_nr =
+		min(clients->max_nr,
+		    AO_load_acquire_read(&(clients->chunks_used_nr)) * IPROHC_CLIENTS_CHUNK_LEN);
+	size_t id = (*client_id);
+
+	while(id < ids_nr)
+	{
+		struct iprohc_server_session *const chunk = (struct iprohc_server_session *)
+			AO_load_acquire_read(&(clients->chunks[id / IPROHC_CLIENTS_CHUNK_LEN]));
+
+		if(chunk == NULL)
+		{
+			/* skip to the next chunk */
+			id = (id / IPROHC_CLIENTS_CHUNK_LEN + 1) * IPROHC_CLIENTS_CHUNK_LEN;
+			continue;
+		}
+		if(AO_load_acquire_read(&(chunk[id % IPROHC_CLIENTS_CHUNK_LEN].is_init)))
+		{
+			*client_id = id;
+			return &(chunk[id % IPROHC_CLIENTS_CHUNK_LEN]);
+		}
+		id++;
+	}
+
+	*client_id = id;
+	return NULL;
+}
+
 
 int new_client(const int conn,
                const struct sockaddr_in remote_addr,
+               const struct in_addr local_addr,
                const int raw,
                const int tun,
                const size_t tun_itf_mtu,
@@ -46,7 +205,6 @@ int new_client(const int conn,
                const size_t client_id,
                const struct server_opts server_opts)
 {
-	struct in_addr client_local_addr;
 	int status = -1;
 
 	assert(conn >= 0);
@@ -54,19 +212,44 @@ int new_client(const int conn,
 	assert(tun >= 0);
 	assert(client != NULL);
 
-	client_local_addr.s_addr =
-		htonl(ntohl(server_opts.local_address) + 1 + client_id);
-
 	/* init the generic session part */
-	if(!iprohc_session_new(&(client->session), NULL, handle_client_request, NULL, NULL,
+	if(!iprohc_session_new(&(client->session), NULL, handle_client_request, NULL, client,
 	                       GNUTLS_SERVER, server_opts.tls_cred,
-	                       server_opts.priority_cache, conn, client_local_addr,
+	                       server_opts.priority_cache, conn, local_addr,
 	                       remote_addr, raw, tun, server_opts.params.keepalive_timeout))
 	{
 		trace(LOG_ERR, "failed to init session for client #%zu", client_id);
 		status = -1;
 		goto error;
 	}
+	client->session.sched = server_opts.session_sched;
+	client->session.notify_end = iprohc_server_session_end;
+	client->session.update_ctrl = iprohc_server_send_params_update;
+	client->session.stack_size = server_opts.session_stack_size;
+	client->session.is_compact = server_opts.compact_sessions;
+	client->resume_cache = server_opts.resume_cache;
+	client->proto_version = 0;
+	client->is_resumable = false;
+	client->is_packing_requested = false;
+	client->client_id = client_id;
+	client->completion_queue = server_opts.completion_queue;
+	client->handshakes_nr = NULL;
+	client->is_handshake_pending = false;
+	client->profiles = server_opts.profiles;
+	client->profile = NULL;
+	client->addr_pool = server_opts.addr_pool;
+	client->clients = server_opts.clients;
+	client->has_static_addr = false;
+
+	/* let the client resume its TLS session when it reconnects */
+	if(gnutls_session_ticket_enable_server(client->session.tls_session,
+	                                       &(server_opts.tls_ticket_key)) != 0)
+	{
+		trace(LOG_ERR, "[client %s] failed to enable TLS session tickets",
+		      client->session.dst_addr_str);
+		status = -1;
+		goto free_session;
+	}
 
 	/* create a socket pair for the TUN device between the route thread and
 	 * the client thread */
@@ -102,6 +285,12 @@ int new_client(const int conn,
 	client->session.tunnel.tun_fd_out = tun;
 	client->session.tunnel.raw_socket_out = raw;
 
+	/* the fanout workers decompress the traffic of the client themselves */
+	if(server_opts.ingress_fanout > 0)
+	{
+		client->session.tunnel.rohc_lock = &(client->rohc_lock);
+	}
+
 	trace(LOG_DEBUG, "[client %s] client context created",
 	      client->session.dst_addr_str);
 
@@ -137,6 +326,12 @@ void del_client(struct iprohc_server_session *const client)
 
 	trace(LOG_INFO, "[client %s] remove client", client->session.dst_addr_str);
 
+	/* the collectd flusher copies the context under the lock, it shall see
+	 * the context unused before it is released */
+	pthread_mutex_lock(&(client->rohc_lock));
+	AO_store_release_write(&(client->is_init), 0);
+	pthread_mutex_unlock(&(client->rohc_lock));
+
 	if(!iprohc_tunnel_free(&(client->session.tunnel)))
 	{
 		trace(LOG_ERR, "[client %s] failed to reset tunnel context",
@@ -159,7 +354,130 @@ void del_client(struct iprohc_server_session *const client)
 	{
 		trace(LOG_ERR, "failed to reset session for client");
 	}
+}
+
+
+/**
+ * @brief Stop counting the client among the clients that are connecting
+ *
+ * Called by the client thread once the client established its session, or
+ * once the session ended.
+ *
+ * @param client  The client session
+ */
+void iprohc_server_session_handshake_done(struct iprohc_server_session *const client)
+{
+	if(client->is_handshake_pending)
+	{
+		client->is_handshake_pending = false;
+		AO_fetch_and_sub1(client->handshakes_nr);
+	}
+}
+
+
+/**
+ * @brief Move the client session to the static tunnel address of its profile
+ *
+ * Called by the client thread before the tunnel address is sent to the
+ * client. The client context stays where it is, with the address it was
+ * given when it connected: the unused context of the static address tells
+ * the routing threads where the client is.
+ *
+ * The static address may be kept for a lost session of the client, it is
+ * taken back then.
+ *
+ * @param client  The client session
+ * @param addr    The static tunnel address of the client
+ * @return        true if the client uses the static address,
+ *                false if the address is used by another session
+ */
+bool iprohc_server_session_use_static_addr(struct iprohc_server_session *const client,
+                                           const struct in_addr addr)
+{
+	struct iprohc_session *const session = &(client->session);
+	const size_t index = iprohc_addr_pool_index(client->addr_pool, addr);
+	struct iprohc_server_session *alias;
+
+	/* the client resumed a lost session from the same remote address */
+	if(session->local_address.s_addr == addr.s_addr)
+	{
+		return true;
+	}
+
+	if(!iprohc_addr_pool_alloc_index(client->addr_pool, index) &&
+	   !iprohc_resume_cache_claim_local_addr(client->resume_cache, addr))
+	{
+		session_trace(session, LOG_WARNING, "static address " IPV4_ADDR_FMT
+		              " is used by another session", IPV4_ADDR(ntohl(addr.s_addr)));
+		return false;
+	}
+
+	/* the main thread allocated the context of every static address */
+	alias = iprohc_clients_get(client->clients, index);
+	assert(alias != NULL);
+
+	session->local_address = addr;
+	session->tunnel.params.local_address = addr.s_addr;
+	client->has_static_addr = true;
+	AO_store_release_write(&(alias->alias_id), client->client_id + 1);
+
+	return true;
+}
+
+
+/**
+ * @brief Stop routing the static tunnel address of the client to its context
+ *
+ * Called by the main thread before it removes the client context. The
+ * static address itself is released or kept for the lost session by the
+ * caller.
+ *
+ * @param client  The client session
+ */
+void iprohc_server_session_drop_alias(struct iprohc_server_session *const client)
+{
+	if(client->has_static_addr)
+	{
+		const size_t index =
+			iprohc_addr_pool_index(client->addr_pool, client->session.local_address);
+		struct iprohc_server_session *const alias =
+			iprohc_clients_get(client->clients, index);
+
+		AO_store_release_write(&(alias->alias_id), 0);
+	}
+}
+
+
+/**
+ * @brief Compute the memory used by the given client session
+ *
+ * @param client    The client session
+ * @param[out] mem  The memory used by the session, by component
+ */
+void iprohc_server_session_get_mem(const struct iprohc_server_session *const client,
+                                   struct iprohc_session_mem *const mem)
+{
+	iprohc_session_get_mem(&(client->session), mem);
+	mem->context = sizeof(struct iprohc_server_session);
+	/* the socket pairs with the routing threads */
+	mem->fds_nr += 4;
+}
+
+
+/**
+ * @brief Tell the main thread that the thread of the client session ended
+ *
+ * Called by the client thread as its last action: the main thread may reap
+ * the client context as soon as it is posted.
+ *
+ * @param session  The generic part of the client session
+ */
+static void iprohc_server_session_end(struct iprohc_session *const session)
+{
+	struct iprohc_server_session *const client =
+		(struct iprohc_server_session *) session->handle_ctrl_opaque;
 
-	client->is_init = false;
+	iprohc_server_session_handshake_done(client);
+	iprohc_completion_queue_post(client->completion_queue, client->client_id);
 }
 
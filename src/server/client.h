@@ -21,8 +21,104 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include "server_session.h"
 #include "server.h"
 
+#include <atomic_ops.h>
+
+/** The number of client contexts allocated at once */
+#define IPROHC_CLIENTS_CHUNK_LEN  64U
+
+/**
+ * @brief The contexts of all clients
+ *
+ * The contexts are allocated by chunks when clients connect, and they never
+ * move once allocated, so that the routing threads may read them while the
+ * main thread adds new chunks.
+ */
+struct iprohc_clients
+{
+	size_t max_nr;           /**< The maximum number of client contexts */
+	size_t chunks_nr;        /**< The number of chunks */
+	volatile AO_t *chunks;   /**< The chunks of contexts, 0 if not allocated */
+	volatile AO_t chunks_used_nr; /**< The number of chunks up to the last
+	                                   allocated one, the next ones were never
+	                                   allocated */
+};
+
+bool iprohc_clients_init(struct iprohc_clients *const clients,
+                         const size_t max_nr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_clients_free(struct iprohc_clients *const clients)
+	__attribute__((nonnull(1)));
+
+struct iprohc_server_session * iprohc_clients_alloc(struct iprohc_clients *const clients,
+                                                    const size_t client_id)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+struct iprohc_server_session * iprohc_clients_next(const struct iprohc_clients *const clients,
+                                                   size_t *const client_id)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+
+/**
+ * @brief Get the context of the client at the given index
+ *
+ * @param clients    The contexts of all clients
+ * @param client_id  The index of the client context
+ * @return           The client context, NULL if it was never allocated
+ */
+static inline struct iprohc_server_session *
+	iprohc_clients_get(const struct iprohc_clients *const clients,
+	                   const size_t client_id)
+{
+	struct iprohc_server_session *chunk;
+
+	if(client_id >= clients->max_nr)
+	{
+		return NULL;
+	}
+	chunk = (struct iprohc_server_session *)
+		AO_load_acquire_read(&(clients->chunks[client_id / IPROHC_CLIENTS_CHUNK_LEN]));
+	if(chunk == NULL)
+	{
+		return NULL;
+	}
+	return &(chunk[client_id % IPROHC_CLIENTS_CHUNK_LEN]);
+}
+
+
+/**
+ * @brief Get the context of the client that uses the tunnel address at the
+ *        given index of the pool
+ *
+ * The context at the index of a static address is unused while its client
+ * runs in the context of another address, it tells where.
+ *
+ * @param clients  The contexts of all clients
+ * @param index    The index of the tunnel address in the pool
+ * @return         The client context, NULL if it was never allocated
+ */
+static inline struct iprohc_server_session *
+	iprohc_clients_route(const struct iprohc_clients *const clients,
+	                     const size_t index)
+{
+	struct iprohc_server_session *const client =
+		iprohc_clients_get(clients, index);
+
+	if(client != NULL && !AO_load_acquire_read(&(client->is_init)))
+	{
+		const AO_t alias_id = AO_load_acquire_read(&(client->alias_id));
+		if(alias_id != 0)
+		{
+			return iprohc_clients_get(clients, alias_id - 1);
+		}
+	}
+	return client;
+}
+
+
 int new_client(const int conn,
                const struct sockaddr_in remote_addr,
+               const struct in_addr local_addr,
                const int raw,
                const int tun,
                const size_t tun_itf_mtu,
@@ -34,5 +130,19 @@ int new_client(const int conn,
 void del_client(struct iprohc_server_session *const client)
 	__attribute__((nonnull(1)));
 
+void iprohc_server_session_handshake_done(struct iprohc_server_session *const client)
+	__attribute__((nonnull(1)));
+
+bool iprohc_server_session_use_static_addr(struct iprohc_server_session *const client,
+                                           const struct in_addr addr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_server_session_drop_alias(struct iprohc_server_session *const client)
+	__attribute__((nonnull(1)));
+
+void iprohc_server_session_get_mem(const struct iprohc_server_session *const client,
+                                   struct iprohc_session_mem *const mem)
+	__attribute__((nonnull(1, 2)));
+
 #endif
 
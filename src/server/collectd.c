@@ -0,0 +1,679 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   collectd.c
+ * @brief  Push the statistics of the server to a local collectd
+ *
+ * A flusher thread wakes up every interval and copies the statistics of
+ * every connected client with iprohc_tunnel_get_stats(). It then sends them
+ * to the unixsock plugin of collectd as PUTVAL commands. The commands are
+ * written in batches of IPROHC_COLLECTD_BATCH_MAX_NR, then the replies of
+ * the whole batch are read: one round trip per batch, not per value. The
+ * session threads never wait for collectd.
+ *
+ * The context of a client is copied under its ROHC lock, which del_client()
+ * takes to mark the context unused before it releases it. The lock is only
+ * held for the copy, never while collectd is waited for.
+ *
+ * The values are reported under the 'iprohc' plugin, with the tunnel
+ * address of the client as plugin instance, or 'server' for the server-wide
+ * gauges. The counters use the generic 'derive' and 'total_bytes' types of
+ * collectd, the ratios and the server gauges the 'gauge' type.
+ *
+ * Every socket operation times out after IPROHC_COLLECTD_TIMEOUT seconds,
+ * and a push is abandoned once it lasted one interval. If collectd cannot be
+ * reached, the values of the interval are lost and the flusher connects
+ * again at the next interval.
+ */
+
+#include "collectd.h"
+
+#include "server_session.h"
+#include "rohc_tunnel.h"
+#include "log.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+
+/** The time a read or a write on the socket of collectd may last (s) */
+#define IPROHC_COLLECTD_TIMEOUT  2
+
+
+static void * iprohc_collectd_run(void *const arg)
+	__attribute__((nonnull(1)));
+
+static bool iprohc_collectd_push(struct iprohc_collectd *const collectd)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static bool iprohc_collectd_connect(struct iprohc_collectd *const collectd)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static bool iprohc_collectd_push_client(struct iprohc_collectd *const collectd,
+                                        const char *const addr,
+                                        const struct statitics *const stats,
+                                        const double now)
+	__attribute__((warn_unused_result, nonnull(1, 2, 3)));
+
+static bool iprohc_collectd_putval(struct iprohc_collectd *const collectd,
+                                   const char *const plugin_instance,
+                                   const char *const type,
+                                   const char *const type_instance,
+                                   const double now,
+                                   const char *const format, ...)
+	__attribute__((warn_unused_result, format(printf, 6, 7),
+	               nonnull(1, 2, 3, 4, 6)));
+
+static bool iprohc_collectd_flush(struct iprohc_collectd *const collectd)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static bool iprohc_collectd_read_replies(struct iprohc_collectd *const collectd)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+
+/**
+ * @brief Start pushing the statistics of the server to collectd
+ *
+ * @param collectd       The collectd context to initialize
+ * @param socket_path    The UNIX socket of the unixsock plugin of collectd
+ * @param interval       The time (in seconds) between two pushes
+ * @param clients        The contexts of all clients
+ * @param addr_pool      The tunnel addresses
+ * @param handshakes_nr  The number of TLS handshakes in progress
+ * @return               true if the flusher thread was started,
+ *                       false if a problem occurred
+ */
+bool iprohc_collectd_start(struct iprohc_collectd *const collectd,
+                           const char *const socket_path,
+                           const size_t interval,
+                           const struct iprohc_clients *const clients,
+                           struct iprohc_addr_pool *const addr_pool,
+                           volatile AO_t *const handshakes_nr)
+{
+	int ret;
+
+	memset(collectd, 0, sizeof(struct iprohc_collectd));
+	if(strlen(socket_path) >= sizeof(collectd->socket_path))
+	{
+		trace(LOG_ERR, "path '%s' of collectd socket is too long", socket_path);
+		goto error;
+	}
+	strcpy(collectd->socket_path, socket_path);
+	collectd->interval = interval;
+	collectd->clients = clients;
+	collectd->addr_pool = addr_pool;
+	collectd->handshakes_nr = handshakes_nr;
+	collectd->sock = -1;
+
+	/* collectd identifies the values by the host name */
+	if(gethostname(collectd->host, IPROHC_COLLECTD_NAME_LEN) != 0)
+	{
+		trace(LOG_ERR, "failed to get host name for collectd: %s (%d)",
+		      strerror(errno), errno);
+		goto error;
+	}
+	collectd->host[IPROHC_COLLECTD_NAME_LEN - 1] = '\0';
+
+	ret = pthread_mutex_init(&collectd->lock, NULL);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init the lock of collectd flusher: %s (%d)",
+		      strerror(ret), ret);
+		goto error;
+	}
+	ret = pthread_cond_init(&collectd->cond, NULL);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init the condition of collectd flusher: %s (%d)",
+		      strerror(ret), ret);
+		goto destroy_lock;
+	}
+
+	collectd->is_stopping = false;
+	ret = pthread_create(&collectd->thread, NULL, iprohc_collectd_run, collectd);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to create the collectd flusher thread: %s (%d)",
+		      strerror(ret), ret);
+		goto destroy_cond;
+	}
+
+	return true;
+
+destroy_cond:
+	pthread_cond_destroy(&collectd->cond);
+destroy_lock:
+	pthread_mutex_destroy(&collectd->lock);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Stop pushing the statistics of the server to collectd
+ *
+ * @param collectd  The collectd context
+ */
+void iprohc_collectd_stop(struct iprohc_collectd *const collectd)
+{
+	pthread_mutex_lock(&collectd->lock);
+	collectd->is_stopping = true;
+	pthread_cond_signal(&collectd->cond);
+	pthread_mutex_unlock(&collectd->lock);
+	pthread_join(collectd->thread, NULL);
+
+	if(collectd->sock >= 0)
+	{
+		close(collectd->sock);
+		collectd->sock = -1;
+	}
+	trace(LOG_INFO, "[collectd] %lu pushes of statistics, %lu failed",
+	      collectd->pushes_nr, collectd->failures_nr);
+
+	pthread_cond_destroy(&collectd->cond);
+	pthread_mutex_destroy(&collectd->lock);
+}
+
+
+/**
+ * @brief The main function of the flusher thread
+ *
+ * @param arg  The collectd context
+ * @return     Always NULL
+ */
+static void * iprohc_collectd_run(void *const arg)
+{
+	struct iprohc_collectd *const collectd = arg;
+
+	pthread_mutex_lock(&collectd->lock);
+	while(!collectd->is_stopping)
+	{
+		struct timespec deadline;
+		int ret = 0;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += collectd->interval;
+		while(!collectd->is_stopping && ret != ETIMEDOUT)
+		{
+			ret = pthread_cond_timedwait(&collectd->cond, &collectd->lock, &deadline);
+		}
+		if(collectd->is_stopping)
+		{
+			break;
+		}
+
+		pthread_mutex_unlock(&collectd->lock);
+		if(iprohc_collectd_push(collectd))
+		{
+			collectd->pushes_nr++;
+		}
+		else
+		{
+			collectd->failures_nr++;
+		}
+		pthread_mutex_lock(&collectd->lock);
+	}
+	pthread_mutex_unlock(&collectd->lock);
+
+	return NULL;
+}
+
+
+/**
+ * @brief Push the statistics of the server and of its clients to collectd
+ *
+ * The failures are logged once until a push succeeds again.
+ *
+ * @param collectd  The collectd context
+ * @return          true if all the statistics were pushed,
+ *                  false if a problem occurred
+ */
+static bool iprohc_collectd_push(struct iprohc_collectd *const collectd)
+{
+	struct iprohc_server_session *client;
+	size_t client_id;
+	size_t sessions_nr = 0;
+	size_t addrs_used_nr;
+	struct timespec now_ts;
+	double now;
+
+	collectd->error[0] = '\0';
+	collectd->batch_len = 0;
+	collectd->batch_nr = 0;
+	if(collectd->sock < 0 && !iprohc_collectd_connect(collectd))
+	{
+		if(!collectd->is_failing)
+		{
+			trace(LOG_WARNING, "[collectd] failed to connect to '%s': %s, "
+			      "statistics are not pushed until it succeeds",
+			      collectd->socket_path, collectd->error);
+		}
+		collectd->is_failing = true;
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now_ts);
+	now = now_ts.tv_sec + now_ts.tv_nsec / 1e9;
+	clock_gettime(CLOCK_MONOTONIC, &collectd->push_deadline);
+	collectd->push_deadline.tv_sec += collectd->interval;
+
+	/* the clients, whose contexts may be released meanwhile */
+	for(client_id = 0;
+	    (client = iprohc_clients_next(collectd->clients, &client_id)) != NULL;
+	    client_id++)
+	{
+		char addr[INET_ADDRSTRLEN];
+		struct in_addr local_addr;
+		struct statitics stats;
+		bool is_connected;
+
+		/* del_client() marks the context unused under the lock before it
+		 * releases it */
+		pthread_mutex_lock(&(client->rohc_lock));
+		is_connected = (AO_load_acquire_read(&(client->is_init)) &&
+		                client->session.status == IPROHC_SESSION_CONNECTED);
+		if(is_connected)
+		{
+			local_addr = client->session.local_address;
+			iprohc_tunnel_get_stats(&(client->session.tunnel), &stats);
+		}
+		pthread_mutex_unlock(&(client->rohc_lock));
+		if(!is_connected)
+		{
+			continue;
+		}
+
+		if(inet_ntop(AF_INET, &local_addr, addr, INET_ADDRSTRLEN) == NULL ||
+		   !iprohc_collectd_push_client(collectd, addr, &stats, now))
+		{
+			goto error;
+		}
+		sessions_nr++;
+	}
+
+	/* the server */
+	pthread_mutex_lock(&collectd->addr_pool->lock);
+	addrs_used_nr = collectd->addr_pool->used_nr;
+	pthread_mutex_unlock(&collectd->addr_pool->lock);
+
+	if(!iprohc_collectd_putval(collectd, "server", "gauge", "sessions", now,
+	                           "%zu", sessions_nr) ||
+	   !iprohc_collectd_putval(collectd, "server", "gauge", "addresses_used", now,
+	                           "%zu", addrs_used_nr) ||
+	   !iprohc_collectd_putval(collectd, "server", "gauge", "tls_handshakes", now,
+	                           "%zu", (size_t) AO_load(collectd->handshakes_nr)) ||
+	   !iprohc_collectd_flush(collectd))
+	{
+		goto error;
+	}
+
+	if(collectd->is_failing)
+	{
+		trace(LOG_NOTICE, "[collectd] statistics pushed to '%s' again",
+		      collectd->socket_path);
+		collectd->is_failing = false;
+	}
+
+	return true;
+
+error:
+	if(!collectd->is_failing)
+	{
+		trace(LOG_WARNING, "[collectd] failed to push statistics to '%s': %s, "
+		      "reconnect at next interval", collectd->socket_path,
+		      collectd->error);
+	}
+	close(collectd->sock);
+	collectd->sock = -1;
+	collectd->is_failing = true;
+	return false;
+}
+
+
+/**
+ * @brief Connect to the unixsock plugin of collectd
+ *
+ * @param collectd  The collectd context, not connected
+ * @return          true if the connection succeeded,
+ *                  false if a problem occurred
+ */
+static bool iprohc_collectd_connect(struct iprohc_collectd *const collectd)
+{
+	const struct timeval timeout = { .tv_sec = IPROHC_COLLECTD_TIMEOUT, .tv_usec = 0 };
+	struct sockaddr_un addr;
+	int sock;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, collectd->socket_path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		snprintf(collectd->error, sizeof(collectd->error), "%s (%d)",
+		         strerror(errno), errno);
+		goto error;
+	}
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+	   setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0 ||
+	   connect(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != 0)
+	{
+		snprintf(collectd->error, sizeof(collectd->error), "%s (%d)",
+		         strerror(errno), errno);
+		goto close_sock;
+	}
+	collectd->sock = sock;
+
+	return true;
+
+close_sock:
+	close(sock);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Push the statistics of one client to collectd
+ *
+ * @param collectd  The collectd context
+ * @param addr      The tunnel address of the client, the plugin instance
+ * @param stats     The copy of the statistics of the tunnel of the client
+ * @param now       The time of the values
+ * @return          true if the statistics were pushed,
+ *                  false if a problem occurred
+ */
+static bool iprohc_collectd_push_client(struct iprohc_collectd *const collectd,
+                                        const char *const addr,
+                                        const struct statitics *const stats,
+                                        const double now)
+{
+	const struct
+	{
+		const char *type;
+		const char *type_instance;
+		uint64_t counter;
+	} counters[] = {
+		{ "derive", "comp_packets", stats->comp_total },
+		{ "derive", "comp_failures", stats->comp_failed },
+		{ "derive", "decomp_packets", stats->decomp_total },
+		{ "derive", "decomp_failures", stats->decomp_failed },
+		{ "derive", "unpack_failures", stats->unpack_failed },
+		{ "derive", "received_frames", stats->total_received },
+		{ "total_bytes", "header_uncomp", stats->head_uncomp_size },
+		{ "total_bytes", "header_comp", stats->head_comp_size },
+		{ "total_bytes", "packet_uncomp", stats->total_uncomp_size },
+		{ "total_bytes", "packet_comp", stats->total_comp_size },
+	};
+	char type_instance[IPROHC_COLLECTD_NAME_LEN];
+	size_t i;
+	int j;
+
+	for(i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+	{
+		if(!iprohc_collectd_putval(collectd, addr, counters[i].type,
+		                           counters[i].type_instance, now, "%" PRIu64,
+		                           counters[i].counter))
+		{
+			return false;
+		}
+	}
+
+	/* the compression ratios, once something was compressed */
+	if(stats->head_uncomp_size > 0 &&
+	   !iprohc_collectd_putval(collectd, addr, "gauge", "header_comp_ratio", now,
+	                           "%f", (double) stats->head_comp_size /
+	                           stats->head_uncomp_size))
+	{
+		return false;
+	}
+	if(stats->total_uncomp_size > 0 &&
+	   !iprohc_collectd_putval(collectd, addr, "gauge", "packet_comp_ratio", now,
+	                           "%f", (double) stats->total_comp_size /
+	                           stats->total_uncomp_size))
+	{
+		return false;
+	}
+
+	/* the packing frames sent, by number of packets */
+	for(j = 1; j <= IPROHC_PACKING_MAX; j++)
+	{
+		snprintf(type_instance, IPROHC_COLLECTD_NAME_LEN, "packing-%d", j);
+		if(!iprohc_collectd_putval(collectd, addr, "derive", type_instance, now,
+		                           "%" PRIu64, (uint64_t) stats->stats_packing[j]))
+		{
+			return false;
+		}
+	}
+
+	/* the errors of the data path that happened, with spaceless names */
+	for(j = 0; j < IPROHC_TUNNEL_ERR_MAX; j++)
+	{
+		char *c;
+
+		if(stats->errors[j].total_nr == 0)
+		{
+			continue;
+		}
+		snprintf(type_instance, IPROHC_COLLECTD_NAME_LEN, "error-%s",
+		         iprohc_tunnel_err_descr(j));
+		for(c = type_instance; c[0] != '\0'; c++)
+		{
+			if(c[0] == ' ')
+			{
+				c[0] = '_';
+			}
+		}
+		if(!iprohc_collectd_putval(collectd, addr, "derive", type_instance, now,
+		                           "%" PRIu64, (uint64_t) stats->errors[j].total_nr))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Add one value to the batch of PUTVAL commands
+ *
+ * The batch is sent when it is full.
+ *
+ * @param collectd         The collectd context, connected
+ * @param plugin_instance  The plugin instance of the value
+ * @param type             The collectd type of the value
+ * @param type_instance    The type instance of the value
+ * @param now              The time of the value
+ * @param format           The printf format of the value
+ * @return                 true if the value was added,
+ *                         false if a problem occurred
+ */
+static bool iprohc_collectd_putval(struct iprohc_collectd *const collectd,
+                                   const char *const plugin_instance,
+                                   const char *const type,
+                                   const char *const type_instance,
+                                   const double now,
+                                   const char *const format, ...)
+{
+	char value[64];
+	char command[512];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	vsnprintf(value, sizeof(value), format, args);
+	va_end(args);
+
+	len = snprintf(command, sizeof(command),
+	               "PUTVAL \"%s/iprohc-%s/%s-%s\" interval=%zu %.3f:%s\n",
+	               collectd->host, plugin_instance, type, type_instance,
+	               collectd->interval, now, value);
+	if(len < 0 || ((size_t) len) >= sizeof(command))
+	{
+		snprintf(collectd->error, sizeof(collectd->error), "PUTVAL command for "
+		         "'%s-%s' is too long", type, type_instance);
+		return false;
+	}
+
+	if((collectd->batch_len + len > IPROHC_COLLECTD_BATCH_MAX_LEN ||
+	    collectd->batch_nr >= IPROHC_COLLECTD_BATCH_MAX_NR) &&
+	   !iprohc_collectd_flush(collectd))
+	{
+		return false;
+	}
+	memcpy(collectd->batch + collectd->batch_len, command, len);
+	collectd->batch_len += len;
+	collectd->batch_nr++;
+
+	return true;
+}
+
+
+/**
+ * @brief Send the batch of PUTVAL commands, then read their replies
+ *
+ * @param collectd  The collectd context, connected
+ * @return          true if collectd accepted all the values,
+ *                  false if a problem occurred
+ */
+static bool iprohc_collectd_flush(struct iprohc_collectd *const collectd)
+{
+	struct timespec now;
+	size_t sent_len = 0;
+
+	if(collectd->batch_nr == 0)
+	{
+		return true;
+	}
+
+	/* a slow collectd shall not delay the next pushes */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(now.tv_sec > collectd->push_deadline.tv_sec ||
+	   (now.tv_sec == collectd->push_deadline.tv_sec &&
+	    now.tv_nsec >= collectd->push_deadline.tv_nsec))
+	{
+		snprintf(collectd->error, sizeof(collectd->error), "push lasted more "
+		         "than the interval of %zu seconds", collectd->interval);
+		return false;
+	}
+
+	while(sent_len < collectd->batch_len)
+	{
+		const ssize_t ret = send(collectd->sock, collectd->batch + sent_len,
+		                         collectd->batch_len - sent_len, MSG_NOSIGNAL);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			snprintf(collectd->error, sizeof(collectd->error), "%s (%d)",
+			         strerror(errno), errno);
+			return false;
+		}
+		sent_len += ret;
+	}
+
+	if(!iprohc_collectd_read_replies(collectd))
+	{
+		return false;
+	}
+	collectd->batch_len = 0;
+	collectd->batch_nr = 0;
+
+	return true;
+}
+
+
+/**
+ * @brief Read the replies of collectd to the batch of PUTVAL commands
+ *
+ * collectd replies one line per command, that starts with a negative status
+ * if the command failed.
+ *
+ * @param collectd  The collectd context, connected
+ * @return          true if all the commands succeeded,
+ *                  false if a problem occurred
+ */
+static bool iprohc_collectd_read_replies(struct iprohc_collectd *const collectd)
+{
+	char replies[1024];
+	size_t replies_len = 0;
+	size_t replies_nr = 0;
+
+	while(replies_nr < collectd->batch_nr)
+	{
+		char *line = replies;
+		char *eol;
+		ssize_t ret;
+
+		ret = recv(collectd->sock, replies + replies_len,
+		           sizeof(replies) - 1 - replies_len, 0);
+		if(ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(ret <= 0)
+		{
+			snprintf(collectd->error, sizeof(collectd->error), "%s (%d)",
+			         ret == 0 ? "connection closed" : strerror(errno),
+			         ret == 0 ? 0 : errno);
+			return false;
+		}
+		replies_len += ret;
+		replies[replies_len] = '\0';
+
+		while(replies_nr < collectd->batch_nr &&
+		      (eol = strchr(line, '\n')) != NULL)
+		{
+			eol[0] = '\0';
+			if(strtol(line, NULL, 10) < 0)
+			{
+				snprintf(collectd->error, sizeof(collectd->error), "collectd "
+				         "rejected a value: %.80s", line);
+				return false;
+			}
+			replies_nr++;
+			line = eol + 1;
+		}
+
+		/* keep the beginning of the next reply */
+		replies_len -= (line - replies);
+		memmove(replies, line, replies_len);
+		if(replies_len >= sizeof(replies) - 1)
+		{
+			snprintf(collectd->error, sizeof(collectd->error), "unexpected reply "
+			         "of collectd");
+			return false;
+		}
+	}
+
+	return true;
+}
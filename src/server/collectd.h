@@ -0,0 +1,88 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   collectd.h
+ * @brief  Push the statistics of the server to a local collectd
+ */
+
+#ifndef IPROHC_SERVER_COLLECTD__H
+#define IPROHC_SERVER_COLLECTD__H
+
+#include "client.h"
+#include "addr_pool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic_ops.h>
+
+/** The maximum length of the host name given to collectd */
+#define IPROHC_COLLECTD_NAME_LEN  64U
+
+/** The maximum length of one batch of PUTVAL commands */
+#define IPROHC_COLLECTD_BATCH_MAX_LEN  16384U
+
+/** The maximum number of PUTVAL commands in one batch, their replies shall
+ *  fit in the socket buffer not to block collectd while the batch is sent */
+#define IPROHC_COLLECTD_BATCH_MAX_NR  128U
+
+/** The thread that pushes the statistics of the server to collectd */
+struct iprohc_collectd
+{
+	char socket_path[108];        /**< The UNIX socket of collectd */
+	size_t interval;              /**< The time (in seconds) between pushes */
+	char host[IPROHC_COLLECTD_NAME_LEN];  /**< The host name given to collectd */
+
+	const struct iprohc_clients *clients;  /**< The contexts of all clients */
+	struct iprohc_addr_pool *addr_pool;    /**< The tunnel addresses */
+	volatile AO_t *handshakes_nr;          /**< The TLS handshakes in progress */
+
+	int sock;                     /**< The connection to collectd, -1 if
+	                                   not connected */
+	char batch[IPROHC_COLLECTD_BATCH_MAX_LEN];  /**< The PUTVAL commands not
+	                                                 sent yet */
+	size_t batch_len;             /**< The length of the commands not sent */
+	size_t batch_nr;              /**< The number of commands not sent */
+	struct timespec push_deadline;  /**< The time a push shall end before */
+	char error[128];              /**< Why the last push failed */
+	unsigned long pushes_nr;      /**< The pushes that succeeded */
+	unsigned long failures_nr;    /**< The pushes that failed */
+	bool is_failing;              /**< Whether the last push failed, not to
+	                                   log every failure */
+
+	pthread_t thread;             /**< The flusher thread */
+	pthread_mutex_t lock;         /**< Protect is_stopping */
+	pthread_cond_t cond;          /**< Wake the flusher thread up to stop */
+	bool is_stopping;             /**< Whether the flusher thread shall stop */
+};
+
+
+bool iprohc_collectd_start(struct iprohc_collectd *const collectd,
+                           const char *const socket_path,
+                           const size_t interval,
+                           const struct iprohc_clients *const clients,
+                           struct iprohc_addr_pool *const addr_pool,
+                           volatile AO_t *const handshakes_nr)
+	__attribute__((warn_unused_result, nonnull(1, 2, 4, 5, 6)));
+
+void iprohc_collectd_stop(struct iprohc_collectd *const collectd)
+	__attribute__((nonnull(1)));
+
+#endif
+
@@ -0,0 +1,170 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   completion.c
+ * @brief  The queue of the client sessions which threads ended
+ *
+ * Every client index is posted at most once per session, and the index is
+ * only re-used once the main thread reaped the session, so the ring never
+ * holds more indexes than there are client contexts.
+ */
+
+#include "completion.h"
+
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/eventfd.h>
+
+
+/**
+ * @brief Initialize the queue of ended sessions
+ *
+ * @param queue       The queue to initialize
+ * @param ids_max_nr  The number of client contexts
+ * @return            true if the queue was successfully initialized,
+ *                    false if a problem occurred
+ */
+bool iprohc_completion_queue_init(struct iprohc_completion_queue *const queue,
+                                  const size_t ids_max_nr)
+{
+	int ret;
+
+	memset(queue, 0, sizeof(struct iprohc_completion_queue));
+	queue->ids_max_nr = ids_max_nr;
+
+	queue->ids = calloc(ids_max_nr, sizeof(size_t));
+	if(queue->ids == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for the queue of %zu ended "
+		      "sessions", ids_max_nr);
+		goto error;
+	}
+
+	queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(queue->event_fd < 0)
+	{
+		trace(LOG_ERR, "failed to create the eventfd of ended sessions: %s (%d)",
+		      strerror(errno), errno);
+		goto free_ids;
+	}
+
+	ret = pthread_mutex_init(&queue->lock, NULL);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init the lock of ended sessions: %s (%d)",
+		      strerror(ret), ret);
+		goto close_eventfd;
+	}
+
+	return true;
+
+close_eventfd:
+	close(queue->event_fd);
+free_ids:
+	free(queue->ids);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Release the queue of ended sessions
+ *
+ * @param queue  The queue to release
+ */
+void iprohc_completion_queue_free(struct iprohc_completion_queue *const queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	close(queue->event_fd);
+	free(queue->ids);
+}
+
+
+/**
+ * @brief Post the index of the client which session thread ends
+ *
+ * Called by the session threads.
+ *
+ * @param queue  The queue of ended sessions
+ * @param id     The index of the client
+ */
+void iprohc_completion_queue_post(struct iprohc_completion_queue *const queue,
+                                  const size_t id)
+{
+	const uint64_t one = 1;
+
+	pthread_mutex_lock(&queue->lock);
+	assert(queue->ids_nr < queue->ids_max_nr);
+	queue->ids[(queue->first + queue->ids_nr) % queue->ids_max_nr] = id;
+	queue->ids_nr++;
+	pthread_mutex_unlock(&queue->lock);
+
+	/* wake up the main thread */
+	if(write(queue->event_fd, &one, sizeof(uint64_t)) != sizeof(uint64_t))
+	{
+		trace(LOG_ERR, "failed to signal the end of session of client #%zu: "
+		      "%s (%d)", id, strerror(errno), errno);
+	}
+}
+
+
+/**
+ * @brief Take the indexes of the clients which session threads ended
+ *
+ * Called by the main thread when the eventfd of the queue is readable.
+ *
+ * @param queue       The queue of ended sessions
+ * @param[out] ids    The indexes of the clients
+ * @param ids_max_nr  The maximum number of indexes to take
+ * @return            The number of indexes taken
+ */
+size_t iprohc_completion_queue_drain(struct iprohc_completion_queue *const queue,
+                                     size_t *const ids,
+                                     const size_t ids_max_nr)
+{
+	uint64_t events_nr;
+	size_t ids_nr = 0;
+
+	/* reset the eventfd before taking the indexes, so that the indexes
+	 * posted meanwhile wake the main thread up again */
+	if(read(queue->event_fd, &events_nr, sizeof(uint64_t)) < 0 &&
+	   errno != EAGAIN)
+	{
+		trace(LOG_ERR, "failed to read the eventfd of ended sessions: %s (%d)",
+		      strerror(errno), errno);
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	while(ids_nr < ids_max_nr && queue->ids_nr > 0)
+	{
+		ids[ids_nr] = queue->ids[queue->first];
+		ids_nr++;
+		queue->first = (queue->first + 1) % queue->ids_max_nr;
+		queue->ids_nr--;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return ids_nr;
+}
+
@@ -0,0 +1,67 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   completion.h
+ * @brief  The queue of the client sessions which threads ended
+ */
+
+#ifndef IPROHC_SERVER_COMPLETION__H
+#define IPROHC_SERVER_COMPLETION__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+
+/**
+ * @brief The queue of the client sessions which threads ended
+ *
+ * The session threads post the index of their client when they end, the
+ * main thread watches the eventfd of the queue and reaps the posted
+ * sessions only.
+ */
+struct iprohc_completion_queue
+{
+	int event_fd;          /**< Readable when client indexes are queued */
+	pthread_mutex_t lock;  /**< The session threads post while the main
+	                            thread drains */
+	size_t *ids;           /**< The ring of the posted client indexes */
+	size_t ids_max_nr;     /**< The capacity of the ring */
+	size_t first;          /**< The position of the oldest index */
+	size_t ids_nr;         /**< The number of queued indexes */
+};
+
+
+bool iprohc_completion_queue_init(struct iprohc_completion_queue *const queue,
+                                  const size_t ids_max_nr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_completion_queue_free(struct iprohc_completion_queue *const queue)
+	__attribute__((nonnull(1)));
+
+void iprohc_completion_queue_post(struct iprohc_completion_queue *const queue,
+                                  const size_t id)
+	__attribute__((nonnull(1)));
+
+size_t iprohc_completion_queue_drain(struct iprohc_completion_queue *const queue,
+                                     size_t *const ids,
+                                     const size_t ids_max_nr)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+#endif
+
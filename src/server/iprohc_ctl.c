@@ -0,0 +1,210 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   iprohc_ctl.c
+ * @brief  Send one command to the administration socket of the IP/ROHC server
+ */
+
+#include "admin.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "config.h"
+
+
+/**
+ * @brief Print the usage of iprohc_ctl
+ */
+static void usage(void)
+{
+	printf("iprohc_ctl: control the running IP/ROHC server\n"
+	       "\n"
+	       "Usage: iprohc_ctl [opts] COMMAND [ARGS...]\n"
+	       "   or: iprohc_ctl -h|--help\n"
+	       "   or: iprohc_ctl -v|--version\n"
+	       "\n"
+	       "Commands:\n"
+	       "  list                  List the client sessions\n"
+	       "  show CLIENT           Show the parameters and stats of a session\n"
+	       "  disconnect CLIENT     Close a session\n"
+	       "  packing CLIENT LEVEL  Change the packing level of a session\n"
+	       "  debug CLIENT on|off   Log the debug traces of a session\n"
+	       "\n"
+	       "CLIENT is the ID of the client, or its address, or its tunnel\n"
+	       "address.\n"
+	       "\n"
+	       "Options:\n"
+	       "  -s, --socket PATH  Path to the administration socket of the server\n"
+	       "                     (default: " IPROHC_ADMIN_SOCKET_DEFAULT ")\n"
+	       "  -h, --help         Print this help message\n"
+	       "  -v, --version      Print the software version\n"
+	       "\n"
+	       "Examples:\n"
+	       "\n"
+	       "Show the stats of the client 192.0.2.10:\n"
+	       "  iprohc_ctl show 192.0.2.10\n"
+	       "\n"
+	       "Log the debug traces of the client #3 only:\n"
+	       "  iprohc_ctl debug 3 on\n"
+	       "\n"
+	       "Report bugs to <" PACKAGE_BUGREPORT ">.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+	char socket_path[IPROHC_ADMIN_PATH_MAX_LEN] = IPROHC_ADMIN_SOCKET_DEFAULT;
+	char request[IPROHC_ADMIN_REQUEST_MAX_LEN];
+	size_t request_len = 0;
+	struct sockaddr_un addr;
+	char reply[4096];
+	bool is_error = false;
+	bool is_first = true;
+	ssize_t ret;
+	int sock;
+	int c;
+	int i;
+
+	struct option options[] = {
+		{ "socket",  required_argument, NULL, 's' },
+		{ "help",    no_argument,       NULL, 'h' },
+		{ "version", no_argument,       NULL, 'v' },
+		{NULL, 0, 0, 0}
+	};
+	int option_index = 0;
+
+	while((c = getopt_long(argc, argv, "+s:hv", options, &option_index)) != -1)
+	{
+		switch(c)
+		{
+			case 's':
+				if(strlen(optarg) >= IPROHC_ADMIN_PATH_MAX_LEN)
+				{
+					fprintf(stderr, "path of administration socket too long\n");
+					goto error;
+				}
+				strcpy(socket_path, optarg);
+				break;
+			case 'h':
+				usage();
+				goto quit;
+			case 'v':
+				printf("IP/ROHC control tool, version %s%s\n", PACKAGE_VERSION,
+				       PACKAGE_REVNO);
+				goto quit;
+			default:
+				usage();
+				goto error;
+		}
+	}
+	if(optind >= argc)
+	{
+		usage();
+		goto error;
+	}
+
+	/* the command and its arguments on one line */
+	for(i = optind; i < argc; i++)
+	{
+		const int len = snprintf(request + request_len,
+		                         IPROHC_ADMIN_REQUEST_MAX_LEN - request_len,
+		                         "%s%s", (i == optind ? "" : " "), argv[i]);
+		if(len < 0 || ((size_t) len) >= (IPROHC_ADMIN_REQUEST_MAX_LEN - request_len))
+		{
+			fprintf(stderr, "command too long\n");
+			goto error;
+		}
+		request_len += len;
+	}
+	if(request_len + 1 >= IPROHC_ADMIN_REQUEST_MAX_LEN)
+	{
+		fprintf(stderr, "command too long\n");
+		goto error;
+	}
+	request[request_len] = '\n';
+	request_len++;
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		fprintf(stderr, "failed to create socket: %s (%d)\n", strerror(errno),
+		        errno);
+		goto error;
+	}
+	if(connect(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != 0)
+	{
+		fprintf(stderr, "failed to connect to the server on '%s': %s (%d)\n",
+		        socket_path, strerror(errno), errno);
+		goto close_sock;
+	}
+	if(send(sock, request, request_len, MSG_NOSIGNAL) != (ssize_t) request_len)
+	{
+		fprintf(stderr, "failed to send command: %s (%d)\n", strerror(errno),
+		        errno);
+		goto close_sock;
+	}
+
+	/* print the answer until the server closes the connection */
+	while((ret = recv(sock, reply, sizeof(reply), 0)) != 0)
+	{
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			fprintf(stderr, "failed to receive answer: %s (%d)\n",
+			        strerror(errno), errno);
+			goto close_sock;
+		}
+		if(is_first)
+		{
+			is_error = ((size_t) ret >= strlen(IPROHC_ADMIN_ERROR) &&
+			            memcmp(reply, IPROHC_ADMIN_ERROR,
+			                   strlen(IPROHC_ADMIN_ERROR)) == 0);
+			is_first = false;
+		}
+		fwrite(reply, 1, ret, is_error ? stderr : stdout);
+	}
+	close(sock);
+
+	if(is_error)
+	{
+		goto error;
+	}
+
+quit:
+	return 0;
+
+close_sock:
+	close(sock);
+error:
+	return 1;
+}
+
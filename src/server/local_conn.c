@@ -0,0 +1,384 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   local_conn.c
+ * @brief  The connections of the local tools to the main thread
+ *
+ * A connection is first watched for input until the request is complete:
+ * its end was received, or the tool closed its side, or the request fills
+ * the buffer. The main thread then builds the reply at once, without
+ * waiting for anything. What the socket does not accept at once is sent
+ * when the connection becomes writable.
+ *
+ * A connection that is not done within the timeout is closed. When all the
+ * slots are in use, the oldest connection is closed to make room for the
+ * new one: tools that connect and stay silent cannot lock the others out.
+ */
+
+#include "local_conn.h"
+
+#include "log.h"
+#include "utils.h"
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+
+static void iprohc_local_conn_close(struct iprohc_local_conns *const conns,
+                                    struct iprohc_local_conn *const conn)
+	__attribute__((nonnull(1, 2)));
+
+static void iprohc_local_conn_send(struct iprohc_local_conns *const conns,
+                                   struct iprohc_local_conn *const conn)
+	__attribute__((nonnull(1, 2)));
+
+
+/**
+ * @brief Initialize the connections of one local socket
+ *
+ * @param conns            The connections to initialize
+ * @param name             The name of the socket, for traces
+ * @param pollfd           The epoll context of the main thread
+ * @param request_end      The end of a complete request
+ * @param request_max_len  The maximum length of one request, at most
+ *                         IPROHC_LOCAL_CONN_REQUEST_MAX_LEN
+ * @param timeout          The time a tool has to send its request and to
+ *                         read the reply (s)
+ */
+void iprohc_local_conns_init(struct iprohc_local_conns *const conns,
+                             const char *const name,
+                             const int pollfd,
+                             const char *const request_end,
+                             const size_t request_max_len,
+                             const time_t timeout)
+{
+	size_t i;
+
+	memset(conns, 0, sizeof(struct iprohc_local_conns));
+	conns->name = name;
+	conns->pollfd = pollfd;
+	conns->request_end = request_end;
+	conns->request_max_len = min(request_max_len, IPROHC_LOCAL_CONN_REQUEST_MAX_LEN);
+	conns->timeout = timeout;
+	for(i = 0; i < IPROHC_LOCAL_CONNS_MAX_NR; i++)
+	{
+		conns->conns[i].sock = -1;
+	}
+}
+
+
+/**
+ * @brief Close all the connections of one local socket
+ *
+ * @param conns  The connections to close
+ */
+void iprohc_local_conns_close(struct iprohc_local_conns *const conns)
+{
+	size_t i;
+
+	for(i = 0; i < IPROHC_LOCAL_CONNS_MAX_NR; i++)
+	{
+		if(conns->conns[i].sock >= 0)
+		{
+			iprohc_local_conn_close(conns, &(conns->conns[i]));
+		}
+	}
+}
+
+
+/**
+ * @brief Accept one new connection on a local socket
+ *
+ * @param conns        The connections of the socket
+ * @param listen_sock  The socket in listen state
+ */
+void iprohc_local_conns_accept(struct iprohc_local_conns *const conns,
+                               const int listen_sock)
+{
+	struct iprohc_local_conn *conn = NULL;
+	struct epoll_event poll_conn;
+	size_t i;
+	int sock;
+
+	sock = accept4(listen_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(sock < 0)
+	{
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			trace(LOG_ERR, "[main] failed to accept connection on %s socket: "
+			      "%s (%d)", conns->name, strerror(errno), errno);
+		}
+		return;
+	}
+
+	/* take a free slot, or the slot of the oldest connection */
+	for(i = 0; i < IPROHC_LOCAL_CONNS_MAX_NR; i++)
+	{
+		struct iprohc_local_conn *const cur = &(conns->conns[i]);
+
+		if(cur->sock < 0)
+		{
+			conn = cur;
+			break;
+		}
+		if(conn == NULL ||
+		   cur->deadline.tv_sec < conn->deadline.tv_sec ||
+		   (cur->deadline.tv_sec == conn->deadline.tv_sec &&
+		    cur->deadline.tv_nsec < conn->deadline.tv_nsec))
+		{
+			conn = cur;
+		}
+	}
+	if(conn->sock >= 0)
+	{
+		trace(LOG_NOTICE, "[main] too many connections on %s socket, close the "
+		      "oldest one", conns->name);
+		iprohc_local_conn_close(conns, conn);
+	}
+
+	memset(&poll_conn, 0, sizeof(struct epoll_event));
+	poll_conn.events = EPOLLIN;
+	poll_conn.data.fd = sock;
+	if(epoll_ctl(conns->pollfd, EPOLL_CTL_ADD, sock, &poll_conn) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to add %s connection to epoll context: "
+		      "%s (%d)", conns->name, strerror(errno), errno);
+		close(sock);
+		return;
+	}
+
+	conn->sock = sock;
+	clock_gettime(CLOCK_MONOTONIC, &conn->deadline);
+	conn->deadline.tv_sec += conns->timeout;
+	conn->request_len = 0;
+	conn->request[0] = '\0';
+	conn->reply = NULL;
+	conn->reply_len = 0;
+	conn->sent_len = 0;
+	conns->conns_nr++;
+}
+
+
+/**
+ * @brief Find the connection that owns the given socket
+ *
+ * @param conns  The connections of one local socket
+ * @param sock   The socket an event was received on
+ * @return       The connection, NULL if the socket is not one of them
+ */
+struct iprohc_local_conn *
+	iprohc_local_conns_find(struct iprohc_local_conns *const conns,
+	                        const int sock)
+{
+	size_t i;
+
+	if(sock < 0)
+	{
+		return NULL;
+	}
+	for(i = 0; i < IPROHC_LOCAL_CONNS_MAX_NR; i++)
+	{
+		if(conns->conns[i].sock == sock)
+		{
+			return &(conns->conns[i]);
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * @brief Close the connections which timeout expired
+ *
+ * @param conns  The connections of one local socket
+ */
+void iprohc_local_conns_expire(struct iprohc_local_conns *const conns)
+{
+	struct timespec now;
+	size_t i;
+
+	if(conns->conns_nr == 0)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(i = 0; i < IPROHC_LOCAL_CONNS_MAX_NR; i++)
+	{
+		struct iprohc_local_conn *const conn = &(conns->conns[i]);
+
+		if(conn->sock >= 0 &&
+		   (now.tv_sec > conn->deadline.tv_sec ||
+		    (now.tv_sec == conn->deadline.tv_sec &&
+		     now.tv_nsec >= conn->deadline.tv_nsec)))
+		{
+			trace(LOG_NOTICE, "[main] %s connection timed out", conns->name);
+			iprohc_local_conn_close(conns, conn);
+		}
+	}
+}
+
+
+/**
+ * @brief Receive the request or send the reply on a ready connection
+ *
+ * @param conns  The connections of one local socket
+ * @param conn   The connection that is ready
+ * @return       true if the request is complete and the caller shall reply
+ *               with iprohc_local_conn_reply(),
+ *               false if there is nothing more to do for now
+ */
+bool iprohc_local_conn_process(struct iprohc_local_conns *const conns,
+                               struct iprohc_local_conn *const conn)
+{
+	ssize_t ret;
+
+	if(conn->reply != NULL)
+	{
+		iprohc_local_conn_send(conns, conn);
+		return false;
+	}
+
+	ret = recv(conn->sock, conn->request + conn->request_len,
+	           conns->request_max_len - 1 - conn->request_len, 0);
+	if(ret < 0)
+	{
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return false;
+		}
+		trace(LOG_NOTICE, "[main] failed to receive request on %s connection: "
+		      "%s (%d)", conns->name, strerror(errno), errno);
+		iprohc_local_conn_close(conns, conn);
+		return false;
+	}
+	else if(ret == 0 && conn->request_len == 0)
+	{
+		/* the tool closed the connection without any request */
+		iprohc_local_conn_close(conns, conn);
+		return false;
+	}
+	conn->request_len += ret;
+	conn->request[conn->request_len] = '\0';
+
+	return (ret == 0 ||
+	        conn->request_len >= conns->request_max_len - 1 ||
+	        strstr(conn->request, conns->request_end) != NULL);
+}
+
+
+/**
+ * @brief Send the reply to a complete request, then close the connection
+ *
+ * @param conns      The connections of one local socket
+ * @param conn       The connection that sent the request
+ * @param reply      The reply, allocated with malloc(), the connection takes
+ *                   ownership of it. NULL to close the connection at once
+ * @param reply_len  The length of the reply
+ */
+void iprohc_local_conn_reply(struct iprohc_local_conns *const conns,
+                             struct iprohc_local_conn *const conn,
+                             char *const reply,
+                             const size_t reply_len)
+{
+	struct epoll_event poll_conn;
+
+	if(reply == NULL)
+	{
+		iprohc_local_conn_close(conns, conn);
+		return;
+	}
+	conn->reply = reply;
+	conn->reply_len = reply_len;
+	conn->sent_len = 0;
+
+	/* wait for the socket to be writable, unless the whole reply is sent at
+	 * once as usual */
+	memset(&poll_conn, 0, sizeof(struct epoll_event));
+	poll_conn.events = EPOLLOUT;
+	poll_conn.data.fd = conn->sock;
+	if(epoll_ctl(conns->pollfd, EPOLL_CTL_MOD, conn->sock, &poll_conn) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to watch %s connection for output: "
+		      "%s (%d)", conns->name, strerror(errno), errno);
+		iprohc_local_conn_close(conns, conn);
+		return;
+	}
+	iprohc_local_conn_send(conns, conn);
+}
+
+
+/**
+ * @brief Send the part of the reply the socket accepts
+ *
+ * The connection is closed once the whole reply is sent.
+ *
+ * @param conns  The connections of one local socket
+ * @param conn   The connection to send the reply on
+ */
+static void iprohc_local_conn_send(struct iprohc_local_conns *const conns,
+                                   struct iprohc_local_conn *const conn)
+{
+	while(conn->sent_len < conn->reply_len)
+	{
+		const ssize_t ret = send(conn->sock, conn->reply + conn->sent_len,
+		                         conn->reply_len - conn->sent_len,
+		                         MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				return;
+			}
+			trace(LOG_NOTICE, "[main] failed to send reply on %s connection: "
+			      "%s (%d)", conns->name, strerror(errno), errno);
+			break;
+		}
+		conn->sent_len += ret;
+	}
+
+	iprohc_local_conn_close(conns, conn);
+}
+
+
+/**
+ * @brief Close one connection and free its slot
+ *
+ * @param conns  The connections of one local socket
+ * @param conn   The connection to close
+ */
+static void iprohc_local_conn_close(struct iprohc_local_conns *const conns,
+                                    struct iprohc_local_conn *const conn)
+{
+	/* closing the socket removes it from the epoll context */
+	close(conn->sock);
+	conn->sock = -1;
+	free(conn->reply);
+	conn->reply = NULL;
+	conns->conns_nr--;
+}
+
@@ -0,0 +1,104 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   local_conn.h
+ * @brief  The connections of the local tools to the main thread
+ *
+ * The scrapers of metrics and the administrator send one request, read the
+ * reply, then the server closes the connection. The connections are
+ * non-blocking and driven by the epoll loop of the main thread, so a tool
+ * that stalls never delays the clients.
+ */
+
+#ifndef IPROHC_SERVER_LOCAL_CONN__H
+#define IPROHC_SERVER_LOCAL_CONN__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/** The maximum number of connections served at once on one local socket */
+#define IPROHC_LOCAL_CONNS_MAX_NR  8U
+
+/** The maximum length of one request */
+#define IPROHC_LOCAL_CONN_REQUEST_MAX_LEN  1024U
+
+
+/** One connection of a local tool */
+struct iprohc_local_conn
+{
+	int sock;                  /**< The connection, -1 if the slot is free */
+	struct timespec deadline;  /**< The connection is closed after that time */
+	char request[IPROHC_LOCAL_CONN_REQUEST_MAX_LEN];  /**< The request */
+	size_t request_len;        /**< The length of the request received */
+	char *reply;               /**< The reply, NULL until it is built */
+	size_t reply_len;          /**< The length of the reply */
+	size_t sent_len;           /**< The length of the reply already sent */
+};
+
+
+/** The connections accepted on one local socket */
+struct iprohc_local_conns
+{
+	const char *name;          /**< The name of the socket, for traces */
+	int pollfd;                /**< The epoll context of the main thread */
+	const char *request_end;   /**< The end of a complete request */
+	size_t request_max_len;    /**< The maximum length of one request */
+	time_t timeout;            /**< The time a tool has to send its request
+	                                and to read the reply (s) */
+	size_t conns_nr;           /**< The number of open connections */
+	struct iprohc_local_conn conns[IPROHC_LOCAL_CONNS_MAX_NR];  /**< The
+	                                connections */
+};
+
+
+void iprohc_local_conns_init(struct iprohc_local_conns *const conns,
+                             const char *const name,
+                             const int pollfd,
+                             const char *const request_end,
+                             const size_t request_max_len,
+                             const time_t timeout)
+	__attribute__((nonnull(1, 2, 4)));
+
+void iprohc_local_conns_close(struct iprohc_local_conns *const conns)
+	__attribute__((nonnull(1)));
+
+void iprohc_local_conns_accept(struct iprohc_local_conns *const conns,
+                               const int listen_sock)
+	__attribute__((nonnull(1)));
+
+struct iprohc_local_conn *
+	iprohc_local_conns_find(struct iprohc_local_conns *const conns,
+	                        const int sock)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_local_conns_expire(struct iprohc_local_conns *const conns)
+	__attribute__((nonnull(1)));
+
+bool iprohc_local_conn_process(struct iprohc_local_conns *const conns,
+                               struct iprohc_local_conn *const conn)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+void iprohc_local_conn_reply(struct iprohc_local_conns *const conns,
+                             struct iprohc_local_conn *const conn,
+                             char *const reply,
+                             const size_t reply_len)
+	__attribute__((nonnull(1, 2)));
+
+#endif
+
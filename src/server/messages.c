@@ -23,18 +23,29 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/time.h>
 #include <assert.h>
 
+#include <gnutls/crypto.h>
 
-static bool handle_connect(struct iprohc_session *const session,
+
+static bool handle_connect(struct iprohc_server_session *const client,
                            const unsigned char *const message,
                            const size_t message_len,
                            size_t *const parsed_len)
 	__attribute__((warn_unused_result, nonnull(1, 2, 4)));
 
+static bool apply_profile(struct iprohc_server_session *const client)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+static bool resume_contexts(struct iprohc_server_session *const client,
+                            const uint8_t *const token)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
 
 bool handle_client_request(struct iprohc_session *const session,
                            const uint8_t *const msg,
                            const size_t len)
 {
+	struct iprohc_server_session *const client =
+		(struct iprohc_server_session *) session->handle_ctrl_opaque;
 	const unsigned char *remain_data;
 	size_t remain_len;
 	bool is_ok;
@@ -56,7 +67,7 @@ bool handle_client_request(struct iprohc_session *const session,
 				size_t parsed_len;
 
 				session_trace(session, LOG_INFO, "connection request received from client");
-				is_ok = handle_connect(session, remain_data, remain_len, &parsed_len);
+				is_ok = handle_connect(client, remain_data, remain_len, &parsed_len);
 				if(!is_ok)
 				{
 					goto error;
@@ -68,13 +79,28 @@ bool handle_client_request(struct iprohc_session *const session,
 			case C_CONNECT_DONE:
 				session_trace(session, LOG_INFO, "client fully established session");
 				session->status = IPROHC_SESSION_CONNECTED;
+				iprohc_server_session_handshake_done(client);
+				/* keep the ROHC contexts if the session is lost */
+				client->is_resumable =
+					(client->proto_version >= IPROHC_PROTO_VERSION_RESUME);
 				break;
 			case C_KEEPALIVE:
 				session_trace(session, LOG_DEBUG, "keepalive received from client");
+				/* the server sends no keepalive while it receives data frames, so
+				 * the client that counts its keepalives expects an answer */
+				if(session->tunnel.params.capabilities & IPROHC_CAP_DATA_LIVENESS)
+				{
+					const char command[1] = { C_KEEPALIVE_ACK };
+					gnutls_record_send(session->tls_session, command, 1);
+				}
+				break;
+			case C_KEEPALIVE_ACK:
+				session_trace(session, LOG_DEBUG, "keepalive answered by client");
 				break;
 			case C_DISCONNECT:
 				session_trace(session, LOG_INFO, "disconnection asked by client");
 				session->status = IPROHC_SESSION_PENDING_DELETE;
+				client->is_resumable = false;
 				break;
 			default:
 				session_trace(session, LOG_WARNING, "unexpected command 0x%02x "
@@ -90,15 +116,21 @@ error:
 }
 
 
-static bool handle_connect(struct iprohc_session *const session,
+static bool handle_connect(struct iprohc_server_session *const client,
                            const unsigned char *const message,
                            const size_t message_len,
                            size_t *const parsed_len)
 {
+	struct iprohc_session *const session = &(client->session);
+
 	/* Receiving parameters */
 	int packing;
 	int client_proto_version;
 	int rohc_compat_version;
+	uint8_t token[IPROHC_SESSION_TOKEN_LEN];
+	bool has_token;
+	bool is_resumed = false;
+	int capabilities;
 
 	/* Prepare order for connection */
 	unsigned char tlv[1024];
@@ -106,8 +138,9 @@ static bool handle_connect(struct iprohc_session *const session,
 
 	bool is_ok;
 	bool is_success = false;
+	int ret;
 
-	assert(session != NULL);
+	assert(client != NULL);
 	assert(message != NULL);
 	assert(parsed_len != NULL);
 
@@ -118,7 +151,8 @@ static bool handle_connect(struct iprohc_session *const session,
 
 	/* parse connect message received from client */
 	is_ok = parse_connrequest(message, message_len, parsed_len, &packing,
-	                          &client_proto_version, &rohc_compat_version);
+	                          &client_proto_version, &rohc_compat_version,
+	                          token, &has_token, &capabilities);
 	if(!is_ok)
 	{
 		session_trace(session, LOG_ERR, "unable to parse connection request");
@@ -129,20 +163,24 @@ static bool handle_connect(struct iprohc_session *const session,
 		// TODO : Clear client
 	}
 	else if(client_proto_version != IPROHC_PROTO_VERSION_FIRST &&
-	        client_proto_version != IPROHC_PROTO_VERSION_ROHC_COMPAT)
+	        client_proto_version != IPROHC_PROTO_VERSION_ROHC_COMPAT &&
+	        client_proto_version != IPROHC_PROTO_VERSION_RESUME &&
+	        client_proto_version != IPROHC_PROTO_VERSION_NETMASK &&
+	        client_proto_version != IPROHC_PROTO_VERSION_PARAMS_UPDATE &&
+	        client_proto_version != IPROHC_PROTO_VERSION_CAPABILITIES)
 	{
 		/* Current behaviour as for proto version = 1 : refuse any other version */
 		session_trace(session, LOG_WARNING, "connection refused because of wrong "
-		              "protocol version: %d received from client but %d or %d "
+		              "protocol version: %d received from client but %d to %d "
 		              "expected", client_proto_version, IPROHC_PROTO_VERSION_FIRST,
-		              IPROHC_PROTO_VERSION_ROHC_COMPAT);
+		              CURRENT_PROTO_VERSION);
 
 		/* create failure answer for client */
 		tlv[0] = C_CONNECT_KO;
 		tlv_len++;
 		// TODO : Clear client
 	}
-	else if(client_proto_version == IPROHC_PROTO_VERSION_ROHC_COMPAT &&
+	else if(client_proto_version >= IPROHC_PROTO_VERSION_ROHC_COMPAT &&
 	        rohc_compat_version != IPROHC_ROHC_COMPAT_1_6_x &&
 	        rohc_compat_version != IPROHC_ROHC_COMPAT_1_7_x)
 	{
@@ -157,6 +195,15 @@ static bool handle_connect(struct iprohc_session *const session,
 		tlv_len++;
 		// TODO : Clear client
 	}
+	else if(!apply_profile(client))
+	{
+		session_trace(session, LOG_WARNING, "failed to give the tunnel "
+		              "parameters of its profile to client, abort session now");
+
+		/* create failure answer for client */
+		tlv[0] = C_CONNECT_KO;
+		tlv_len++;
+	}
 	else
 	{
 		size_t len;
@@ -164,17 +211,29 @@ static bool handle_connect(struct iprohc_session *const session,
 		session_trace(session, LOG_INFO, "connection asked, negotating parameters "
 		              "(proto version = %d, asked packing = %d)",
 		              client_proto_version, packing);
-		if(packing < 0 || packing > 10)
+		if(packing < 0 || packing > IPROHC_PACKING_MAX)
 		{
 			/* invalid packing value requested by client, don't use it */
 			session_trace(session, LOG_NOTICE, "ignore invalid packing level "
 			              "requested by client");
 		}
+		else if(packing != 0 && client->profile != NULL &&
+		        client->profile->packing >= 0)
+		{
+			session_trace(session, LOG_INFO, "client asked for packing level %d, "
+			              "but its profile '%s' sets level %d", packing,
+			              client->profile->name, client->profile->packing);
+		}
 		else if(packing != 0)
 		{
 			session_trace(session, LOG_INFO, "client asked for packing level %d",
 			              packing);
-			session->tunnel.params.packing = packing;
+			if(!iprohc_tunnel_set_packing(&(session->tunnel), packing))
+			{
+				session_trace(session, LOG_ERR, "failed to change packing level");
+				goto error;
+			}
+			client->is_packing_requested = true;
 		}
 
 		if(client_proto_version == IPROHC_PROTO_VERSION_FIRST)
@@ -198,12 +257,53 @@ static bool handle_connect(struct iprohc_session *const session,
 			session->tunnel.params.rohc_compat_version = IPROHC_ROHC_COMPAT_LAST;
 		}
 
+		/* the older clients set a /24 network on their TUN interface */
+		if(client_proto_version < IPROHC_PROTO_VERSION_NETMASK &&
+		   session->tunnel.params.netmask != IPROHC_NETMASK_DEFAULT)
+		{
+			session_trace(session, LOG_WARNING, "client is too old to be told the "
+			              "/%d network mask, it will assume /%d",
+			              session->tunnel.params.netmask, IPROHC_NETMASK_DEFAULT);
+		}
+
+		/* enable the capabilities that both the client and the server support */
+		session->tunnel.params.capabilities = 0;
+		if(client_proto_version >= IPROHC_PROTO_VERSION_CAPABILITIES)
+		{
+			session->tunnel.params.capabilities =
+				(capabilities & IPROHC_CAPABILITIES);
+			session_trace(session, LOG_INFO, "capabilities: client 0x%02x, server "
+			              "0x%02x, enabled 0x%02x", capabilities, IPROHC_CAPABILITIES,
+			              session->tunnel.params.capabilities);
+		}
+
+		/* resume the ROHC contexts of the previous session of the client if
+		 * it asked for it, then give the client a token for the next session */
+		client->proto_version = client_proto_version;
+		if(client_proto_version >= IPROHC_PROTO_VERSION_RESUME)
+		{
+			if(has_token)
+			{
+				is_resumed = resume_contexts(client, token);
+			}
+			/* the token is a secret that lets its bearer claim the ROHC
+			 * contexts, not a mere nonce */
+			ret = gnutls_rnd(GNUTLS_RND_RANDOM, client->token, IPROHC_SESSION_TOKEN_LEN);
+			if(ret != 0)
+			{
+				session_trace(session, LOG_ERR, "failed to generate session token: "
+				              "%s (%d)", gnutls_strerror(ret), ret);
+				goto error;
+			}
+		}
+
 		/* create successful answer for client */
 		tlv[0] = C_CONNECT_OK;
 		tlv_len++;
 
 		/* add parameters in TLV format */
-		is_ok = gen_connect(session->tunnel.params, tlv + 1, &len);
+		is_ok = gen_connect(session->tunnel.params, client_proto_version,
+		                    client->token, is_resumed, tlv + 1, &len);
 		if(!is_ok)
 		{
 			session_trace(session, LOG_ERR, "failed to generate the connect "
@@ -224,3 +324,175 @@ error:
 }
 
 
+/**
+ * @brief Give the client the tunnel parameters of its profile
+ *
+ * The profile is selected by the identity of the verified certificate of
+ * the client. The ROHC contexts are created again if the profile changes
+ * their parameters.
+ *
+ * @param client  The client that connects
+ * @return        true if the client got the parameters of its profile, or
+ *                if no profile matched, false if a problem occurred
+ */
+static bool apply_profile(struct iprohc_server_session *const client)
+{
+	struct iprohc_session *const session = &(client->session);
+	struct iprohc_tunnel *const tunnel = &(session->tunnel);
+	const struct iprohc_profile *profile;
+	char identity[256];
+	bool are_contexts_changed = false;
+
+	if(client->profiles == NULL || client->profiles->profiles_nr == 0)
+	{
+		return true;
+	}
+
+	profile = iprohc_profiles_find(client->profiles, session->tls_session,
+	                               identity, sizeof(identity));
+	if(profile == NULL)
+	{
+		session_trace(session, LOG_INFO, "no profile for client identity '%s', "
+		              "use the parameters of the server", identity);
+		return true;
+	}
+	session_trace(session, LOG_INFO, "client identity '%s' selects profile '%s'",
+	              identity, profile->name);
+	client->profile = profile;
+
+	if(profile->static_addr.s_addr != INADDR_ANY &&
+	   !iprohc_server_session_use_static_addr(client, profile->static_addr))
+	{
+		return false;
+	}
+	if(profile->packing >= 0 && !iprohc_tunnel_set_packing(tunnel, profile->packing))
+	{
+		session_trace(session, LOG_ERR, "failed to change packing level");
+		return false;
+	}
+	if(profile->keepalive_timeout >= 0)
+	{
+		tunnel->params.keepalive_timeout = profile->keepalive_timeout;
+	}
+	if(profile->max_cid >= 0 && (size_t) profile->max_cid != tunnel->params.max_cid)
+	{
+		tunnel->params.max_cid = profile->max_cid;
+		are_contexts_changed = true;
+	}
+	if(profile->is_unidirectional >= 0 &&
+	   profile->is_unidirectional != tunnel->params.is_unidirectional)
+	{
+		tunnel->params.is_unidirectional = profile->is_unidirectional;
+		are_contexts_changed = true;
+	}
+
+	/* the ROHC contexts were created with the parameters of the server */
+	if(are_contexts_changed)
+	{
+		struct iprohc_tunnel_contexts contexts;
+
+		if(!iprohc_tunnel_contexts_new(&contexts, tunnel->params))
+		{
+			session_trace(session, LOG_ERR, "failed to create the ROHC contexts "
+			              "of profile '%s'", profile->name);
+			return false;
+		}
+		iprohc_tunnel_attach_contexts(tunnel, &contexts);
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Resume the ROHC contexts of the previous session of the client
+ *
+ * @param client  The client that reconnects
+ * @param token   The token of its previous session
+ * @return        true if the contexts were resumed,
+ *                false if the client shall start with new contexts
+ */
+static bool resume_contexts(struct iprohc_server_session *const client,
+                            const uint8_t *const token)
+{
+	struct iprohc_session *const session = &(client->session);
+	struct iprohc_tunnel_contexts contexts;
+
+	if(!iprohc_resume_cache_take(client->resume_cache, token,
+	                             session->local_address, &contexts))
+	{
+		session_trace(session, LOG_INFO, "no ROHC contexts to resume for the "
+		              "session token, start with new contexts");
+		return false;
+	}
+	if(!iprohc_tunnel_can_resume(&(session->tunnel), &contexts))
+	{
+		session_trace(session, LOG_INFO, "ROHC parameters changed since previous "
+		              "session, start with new contexts");
+		iprohc_tunnel_contexts_free(&contexts);
+		return false;
+	}
+
+	iprohc_tunnel_attach_contexts(&(session->tunnel), &contexts);
+	session_trace(session, LOG_INFO, "ROHC contexts of previous session resumed");
+
+	return true;
+}
+
+
+/**
+ * @brief Tell the client about the new parameters of its tunnel
+ *
+ * The clients older than protocol version 5 are not told: they keep their
+ * own keepalive timeout, and they unpack frames of any packing level.
+ *
+ * @param session  The client session
+ * @return         true if the client was told or if it is too old to be,
+ *                 false if a problem occurred
+ */
+bool iprohc_server_send_params_update(struct iprohc_session *const session)
+{
+	struct iprohc_server_session *const client =
+		(struct iprohc_server_session *) session->handle_ctrl_opaque;
+	unsigned char command[1024];
+	size_t command_len;
+	size_t tlv_len;
+	size_t emitted_len = 0;
+
+	if(client->proto_version < IPROHC_PROTO_VERSION_PARAMS_UPDATE)
+	{
+		return true;
+	}
+
+	command[0] = C_PARAMS_UPDATE;
+	command_len = 1;
+	if(!gen_params_update(session->tunnel.params, command + 1, &tlv_len))
+	{
+		session_trace(session, LOG_ERR, "failed to generate the parameters "
+		              "update message for client");
+		goto error;
+	}
+	command_len += tlv_len;
+
+	session_trace(session, LOG_INFO, "send new tunnel parameters to client");
+	do
+	{
+		const int ret = gnutls_record_send(session->tls_session,
+		                                   command + emitted_len,
+		                                   command_len - emitted_len);
+		if(ret < 0)
+		{
+			session_trace(session, LOG_ERR, "failed to send message to client "
+			              "over TLS: %s (%d)", gnutls_strerror(ret), ret);
+			goto error;
+		}
+		emitted_len += ret;
+	}
+	while(emitted_len < command_len);
+
+	return true;
+
+error:
+	return false;
+}
+
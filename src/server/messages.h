@@ -32,3 +32,6 @@ bool handle_client_request(struct iprohc_session *const session,
                            const size_t len)
 	__attribute__((warn_unused_result, nonnull(1, 2)));
 
+bool iprohc_server_send_params_update(struct iprohc_session *const session)
+	__attribute__((warn_unused_result, nonnull(1)));
+
@@ -0,0 +1,694 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   metrics.c
+ * @brief  Export the statistics of the server in the OpenMetrics format
+ *
+ * The main thread listens on a local UNIX socket, or on a TCP port of the
+ * loopback interface. Every connection gets the current statistics of the
+ * server and of its tunnels in the OpenMetrics text format, over HTTP/1.0,
+ * then it is closed. Prometheus scrapes the TCP port directly, local agents
+ * may prefer the UNIX socket.
+ *
+ * The counters of the tunnels are copied with iprohc_tunnel_get_stats(),
+ * so a scrape never slows the session threads down. The connections of the
+ * scrapers are non-blocking and driven by the epoll loop of the main thread,
+ * see local_conn.c: a stalled scraper never delays the clients, it is
+ * disconnected after IPROHC_METRICS_TIMEOUT seconds.
+ */
+
+#include "metrics.h"
+
+#include "server_session.h"
+#include "rohc_tunnel.h"
+#include "log.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+
+/** The snapshot of the stats of one tunnel */
+struct iprohc_metrics_tunnel
+{
+	const struct iprohc_server_session *client;  /**< The client */
+	struct statitics stats;                      /**< Its stats */
+};
+
+
+static bool iprohc_metrics_parse_port(const char *const endpoint,
+                                      uint16_t *const port)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+static void iprohc_metrics_render(FILE *const out,
+                                  const struct iprohc_metrics_tunnel *const tunnels,
+                                  const size_t tunnels_nr,
+                                  const struct iprohc_metrics_server *const server)
+	__attribute__((nonnull(1, 4)));
+
+static void iprohc_metrics_family(FILE *const out,
+                                  const char *const name,
+                                  const char *const type,
+                                  const char *const help)
+	__attribute__((nonnull(1, 2, 3, 4)));
+
+static void iprohc_metrics_labels(FILE *const out,
+                                  const struct iprohc_server_session *const client,
+                                  const char *const extra_label)
+	__attribute__((nonnull(1, 2)));
+
+static size_t iprohc_metrics_flow_label(char *const label,
+                                        const size_t label_len,
+                                        const int cid,
+                                        const struct iprohc_tunnel_flow *const flow)
+	__attribute__((nonnull(1, 4)));
+
+
+/**
+ * @brief Listen for the scrapers of metrics
+ *
+ * @param endpoint  The path of a local UNIX socket, or a TCP port number to
+ *                  listen on the loopback interface
+ * @return          The socket in listen state, -1 in case of error
+ */
+int iprohc_metrics_listen(const char *const endpoint)
+{
+	const int on = 1;
+	uint16_t port;
+	int sock;
+	int ret;
+
+	if(iprohc_metrics_parse_port(endpoint, &port))
+	{
+		struct sockaddr_in addr;
+
+		sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(sock < 0)
+		{
+			trace(LOG_ERR, "failed to create metrics socket: %s (%d)",
+			      strerror(errno), errno);
+			goto error;
+		}
+
+		/* a new server that takes over listens while the old one stops */
+		if(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+		   setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+		{
+			trace(LOG_ERR, "failed to set options of metrics socket: %s (%d)",
+			      strerror(errno), errno);
+			goto close_sock;
+		}
+
+		memset(&addr, 0, sizeof(struct sockaddr_in));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		ret = bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_in));
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to bind metrics socket on TCP port %u: %s (%d)",
+			      port, strerror(errno), errno);
+			goto close_sock;
+		}
+	}
+	else
+	{
+		struct sockaddr_un addr;
+
+		if(strlen(endpoint) >= sizeof(addr.sun_path))
+		{
+			trace(LOG_ERR, "path '%s' of metrics socket is too long", endpoint);
+			goto error;
+		}
+		memset(&addr, 0, sizeof(struct sockaddr_un));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, endpoint);
+
+		sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(sock < 0)
+		{
+			trace(LOG_ERR, "failed to create metrics socket: %s (%d)",
+			      strerror(errno), errno);
+			goto error;
+		}
+
+		/* the socket of a previous server, or of the server we take over */
+		unlink(endpoint);
+
+		ret = bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "failed to bind metrics socket on '%s': %s (%d)",
+			      endpoint, strerror(errno), errno);
+			goto close_sock;
+		}
+	}
+
+	ret = listen(sock, 4);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to put metrics socket in listen mode: %s (%d)",
+		      strerror(errno), errno);
+		goto close_sock;
+	}
+
+	return sock;
+
+close_sock:
+	close(sock);
+error:
+	return -1;
+}
+
+
+/**
+ * @brief Stop listening for the scrapers of metrics
+ *
+ * @param metrics_sock  The socket in listen state
+ * @param endpoint      The endpoint the socket listens on
+ * @param is_unlink     Whether to remove the UNIX socket from the file system,
+ *                      false if a new server already listens on it
+ */
+void iprohc_metrics_close(const int metrics_sock,
+                          const char *const endpoint,
+                          const bool is_unlink)
+{
+	uint16_t port;
+
+	close(metrics_sock);
+	if(is_unlink && !iprohc_metrics_parse_port(endpoint, &port))
+	{
+		unlink(endpoint);
+	}
+}
+
+
+/**
+ * @brief Answer the request of one scraper of metrics
+ *
+ * The stats of all the tunnels are copied first, so that all the metrics of
+ * a tunnel are consistent with each other.
+ *
+ * @param conns    The connections of the scrapers
+ * @param conn     The connection which request is complete
+ * @param clients  The contexts of the clients
+ * @param server   The state of the server
+ */
+void iprohc_metrics_serve(struct iprohc_local_conns *const conns,
+                          struct iprohc_local_conn *const conn,
+                          const struct iprohc_clients *const clients,
+                          const struct iprohc_metrics_server *const server)
+{
+	struct iprohc_metrics_tunnel *tunnels = NULL;
+	size_t tunnels_max_nr = 0;
+	size_t tunnels_nr = 0;
+	struct iprohc_server_session *client;
+	size_t client_id;
+	char *reply = NULL;
+	size_t reply_len = 0;
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *out;
+
+	/* only the method is checked, every path gets the metrics */
+	if(strncmp(conn->request, "GET ", 4) != 0)
+	{
+		static const char bad_request[] =
+			"HTTP/1.0 405 Method Not Allowed\r\n"
+			"Allow: GET\r\n"
+			"Connection: close\r\n"
+			"\r\n";
+		trace(LOG_NOTICE, "[main] unexpected request of metrics");
+		reply = strdup(bad_request);
+		if(reply == NULL)
+		{
+			trace(LOG_ERR, "[main] failed to allocate memory to reject request "
+			      "of metrics");
+			goto error;
+		}
+		reply_len = strlen(bad_request);
+		goto error;
+	}
+
+	/* copy the stats of the connected clients */
+	for(client_id = 0;
+	    (client = iprohc_clients_next(clients, &client_id)) != NULL;
+	    client_id++)
+	{
+		if(client->session.status != IPROHC_SESSION_CONNECTED)
+		{
+			continue;
+		}
+		if(tunnels_nr >= tunnels_max_nr)
+		{
+			const size_t new_max_nr = (tunnels_max_nr == 0 ? 16 : tunnels_max_nr * 2);
+			struct iprohc_metrics_tunnel *const new_tunnels =
+				realloc(tunnels, new_max_nr * sizeof(struct iprohc_metrics_tunnel));
+			if(new_tunnels == NULL)
+			{
+				trace(LOG_ERR, "[main] failed to allocate memory for the metrics "
+				      "of %zu tunnels", new_max_nr);
+				goto free_tunnels;
+			}
+			tunnels = new_tunnels;
+			tunnels_max_nr = new_max_nr;
+		}
+		tunnels[tunnels_nr].client = client;
+		iprohc_tunnel_get_stats(&(client->session.tunnel), &(tunnels[tunnels_nr].stats));
+		tunnels_nr++;
+	}
+
+	out = open_memstream(&body, &body_len);
+	if(out == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to create buffer for metrics: %s (%d)",
+		      strerror(errno), errno);
+		goto free_tunnels;
+	}
+	iprohc_metrics_render(out, tunnels, tunnels_nr, server);
+	if(fclose(out) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to render metrics: %s (%d)",
+		      strerror(errno), errno);
+		goto free_body;
+	}
+
+	/* the header and the body are sent as one reply */
+	out = open_memstream(&reply, &reply_len);
+	if(out == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to create buffer for metrics reply: "
+		      "%s (%d)", strerror(errno), errno);
+		goto free_body;
+	}
+	fprintf(out,
+	        "HTTP/1.0 200 OK\r\n"
+	        "Content-Type: application/openmetrics-text; "
+	        "version=1.0.0; charset=utf-8\r\n"
+	        "Content-Length: %zu\r\n"
+	        "Connection: close\r\n"
+	        "\r\n", body_len);
+	fwrite(body, 1, body_len, out);
+	if(fclose(out) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to build metrics reply: %s (%d)",
+		      strerror(errno), errno);
+		free(reply);
+		reply = NULL;
+		goto free_body;
+	}
+	trace(LOG_DEBUG, "[main] %zu bytes of metrics rendered for %zu tunnels",
+	      body_len, tunnels_nr);
+
+free_body:
+	free(body);
+free_tunnels:
+	free(tunnels);
+error:
+	/* the connection is closed at once if no reply was built */
+	iprohc_local_conn_reply(conns, conn, reply, reply_len);
+}
+
+
+/**
+ * @brief Tell whether the metrics endpoint is a TCP port
+ *
+ * @param endpoint   The metrics endpoint
+ * @param[out] port  The TCP port if the endpoint is one
+ * @return           true if the endpoint is a TCP port,
+ *                   false if it is the path of a UNIX socket
+ */
+static bool iprohc_metrics_parse_port(const char *const endpoint,
+                                      uint16_t *const port)
+{
+	char *end;
+	long num;
+
+	if(endpoint[0] < '0' || endpoint[0] > '9')
+	{
+		return false;
+	}
+	num = strtol(endpoint, &end, 10);
+	if(end[0] != '\0' || num <= 0 || num > 0xffff)
+	{
+		return false;
+	}
+	*port = num;
+
+	return true;
+}
+
+
+/**
+ * @brief Write the metrics of the server and of the given tunnels
+ *
+ * @param out         The stream to write to
+ * @param tunnels     The snapshots of the stats of the tunnels
+ * @param tunnels_nr  The number of tunnels
+ * @param server      The state of the server
+ */
+static void iprohc_metrics_render(FILE *const out,
+                                  const struct iprohc_metrics_tunnel *const tunnels,
+                                  const size_t tunnels_nr,
+                                  const struct iprohc_metrics_server *const server)
+{
+	const struct iprohc_admission *const admission = server->admission;
+	struct iprohc_resume_cache *const resume_cache = server->resume_cache;
+	char label[96];
+	size_t i;
+	int j;
+
+	/* the server */
+	iprohc_metrics_family(out, "iprohc_clients", "gauge",
+	                      "The client contexts in use");
+	fprintf(out, "iprohc_clients %zu\n", server->clients_nr);
+	iprohc_metrics_family(out, "iprohc_clients_max", "gauge",
+	                      "The maximum number of clients");
+	fprintf(out, "iprohc_clients_max %zu\n", server->clients_max_nr);
+	iprohc_metrics_family(out, "iprohc_sessions", "gauge",
+	                      "The connected client sessions");
+	fprintf(out, "iprohc_sessions %zu\n", tunnels_nr);
+	iprohc_metrics_family(out, "iprohc_tunnel_addresses_used", "gauge",
+	                      "The tunnel addresses in use");
+	fprintf(out, "iprohc_tunnel_addresses_used %zu\n", server->addrs_used_nr);
+	iprohc_metrics_family(out, "iprohc_tunnel_addresses", "gauge",
+	                      "The tunnel addresses in the pool");
+	fprintf(out, "iprohc_tunnel_addresses %zu\n", server->addrs_nr);
+	iprohc_metrics_family(out, "iprohc_tls_handshakes", "gauge",
+	                      "The TLS handshakes in progress");
+	fprintf(out, "iprohc_tls_handshakes %zu\n", server->handshakes_nr);
+	iprohc_metrics_family(out, "iprohc_listener_paused", "gauge",
+	                      "Whether new connections wait in the listen backlog");
+	fprintf(out, "iprohc_listener_paused %d\n", server->is_listener_paused ? 1 : 0);
+
+	iprohc_metrics_family(out, "iprohc_admission_connections", "counter",
+	                      "The new connections, by admission decision");
+	fprintf(out, "iprohc_admission_connections_total{result=\"accepted\"} %lu\n",
+	        admission->accepted_nr);
+	fprintf(out, "iprohc_admission_connections_total{result=\"rate_limited\"} %lu\n",
+	        admission->rate_limited_nr);
+	fprintf(out, "iprohc_admission_connections_total{result=\"over_capacity\"} %lu\n",
+	        admission->over_capacity_nr);
+	iprohc_metrics_family(out, "iprohc_admission_pauses", "counter",
+	                      "The times the listener was paused");
+	fprintf(out, "iprohc_admission_pauses_total %lu\n", admission->paused_nr);
+
+	/* the session threads resume contexts under the lock, not the data path */
+	pthread_mutex_lock(&resume_cache->lock);
+	iprohc_metrics_family(out, "iprohc_resume_contexts", "counter",
+	                      "The ROHC contexts of lost sessions, by outcome");
+	fprintf(out, "iprohc_resume_contexts_total{event=\"kept\"} %lu\n",
+	        resume_cache->parked_nr);
+	fprintf(out, "iprohc_resume_contexts_total{event=\"resumed\"} %lu\n",
+	        resume_cache->resumed_nr);
+	fprintf(out, "iprohc_resume_contexts_total{event=\"expired\"} %lu\n",
+	        resume_cache->expired_nr);
+	fprintf(out, "iprohc_resume_contexts_total{event=\"evicted\"} %lu\n",
+	        resume_cache->evicted_nr);
+	pthread_mutex_unlock(&resume_cache->lock);
+
+	iprohc_metrics_family(out, "iprohc_log_dropped_traces", "counter",
+	                      "The traces dropped because the logger lagged behind");
+	fprintf(out, "iprohc_log_dropped_traces_total %zu\n", iprohc_log_dropped_nr());
+
+	/* the tunnels, one family at a time */
+#define IPROHC_METRICS_TUNNEL_COUNTER(name, help, field) \
+	do \
+	{ \
+		iprohc_metrics_family(out, (name), "counter", (help)); \
+		for(i = 0; i < tunnels_nr; i++) \
+		{ \
+			fprintf(out, "%s_total", (name)); \
+			iprohc_metrics_labels(out, tunnels[i].client, NULL); \
+			fprintf(out, " %" PRIu64 "\n", tunnels[i].stats.field); \
+		} \
+	} \
+	while(0)
+
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_comp_packets",
+	                              "The IP packets compressed", comp_total);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_comp_failures",
+	                              "The IP packets not compressed", comp_failed);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_decomp_packets",
+	                              "The ROHC packets decompressed", decomp_total);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_decomp_failures",
+	                              "The ROHC packets not decompressed", decomp_failed);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_unpack_failures",
+	                              "The malformed packing frames", unpack_failed);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_received_frames",
+	                              "The packing frames received", total_received);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_header_uncomp_bytes",
+	                              "The bytes of headers before compression",
+	                              head_uncomp_size);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_header_comp_bytes",
+	                              "The bytes of headers after compression",
+	                              head_comp_size);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_packet_uncomp_bytes",
+	                              "The bytes of packets before compression",
+	                              total_uncomp_size);
+	IPROHC_METRICS_TUNNEL_COUNTER("iprohc_tunnel_packet_comp_bytes",
+	                              "The bytes of packets after compression",
+	                              total_comp_size);
+
+#undef IPROHC_METRICS_TUNNEL_COUNTER
+
+	/* the ratios are computed from the same snapshot as the sizes */
+	iprohc_metrics_family(out, "iprohc_tunnel_header_comp_ratio", "gauge",
+	                      "The size of compressed headers over their original size");
+	for(i = 0; i < tunnels_nr; i++)
+	{
+		if(tunnels[i].stats.head_uncomp_size > 0)
+		{
+			fprintf(out, "iprohc_tunnel_header_comp_ratio");
+			iprohc_metrics_labels(out, tunnels[i].client, NULL);
+			fprintf(out, " %.6f\n", (double) tunnels[i].stats.head_comp_size /
+			        tunnels[i].stats.head_uncomp_size);
+		}
+	}
+	iprohc_metrics_family(out, "iprohc_tunnel_packet_comp_ratio", "gauge",
+	                      "The size of compressed packets over their original size");
+	for(i = 0; i < tunnels_nr; i++)
+	{
+		if(tunnels[i].stats.total_uncomp_size > 0)
+		{
+			fprintf(out, "iprohc_tunnel_packet_comp_ratio");
+			iprohc_metrics_labels(out, tunnels[i].client, NULL);
+			fprintf(out, " %.6f\n", (double) tunnels[i].stats.total_comp_size /
+			        tunnels[i].stats.total_uncomp_size);
+		}
+	}
+
+	/* the packing frames sent, as a histogram of their number of packets */
+	iprohc_metrics_family(out, "iprohc_tunnel_packing_packets", "histogram",
+	                      "The number of ROHC packets per packing frame sent");
+	for(i = 0; i < tunnels_nr; i++)
+	{
+		const struct statitics *const stats = &(tunnels[i].stats);
+		uint64_t frames_nr = 0;
+		uint64_t packets_nr = 0;
+
+		/* the buckets are cumulative */
+		for(j = 1; j <= IPROHC_PACKING_MAX; j++)
+		{
+			frames_nr += stats->stats_packing[j];
+			packets_nr += stats->stats_packing[j] * j;
+			snprintf(label, sizeof(label), "le=\"%d.0\"", j);
+			fprintf(out, "iprohc_tunnel_packing_packets_bucket");
+			iprohc_metrics_labels(out, tunnels[i].client, label);
+			fprintf(out, " %" PRIu64 "\n", frames_nr);
+		}
+		fprintf(out, "iprohc_tunnel_packing_packets_bucket");
+		iprohc_metrics_labels(out, tunnels[i].client, "le=\"+Inf\"");
+		fprintf(out, " %" PRIu64 "\n", frames_nr);
+		fprintf(out, "iprohc_tunnel_packing_packets_count");
+		iprohc_metrics_labels(out, tunnels[i].client, NULL);
+		fprintf(out, " %" PRIu64 "\n", frames_nr);
+		fprintf(out, "iprohc_tunnel_packing_packets_sum");
+		iprohc_metrics_labels(out, tunnels[i].client, NULL);
+		fprintf(out, " %" PRIu64 "\n", packets_nr);
+	}
+
+	/* the flows, that is the ROHC contexts, that compressed packets */
+#define IPROHC_METRICS_FLOW_COUNTER(name, help, field) \
+	do \
+	{ \
+		iprohc_metrics_family(out, (name), "counter", (help)); \
+		for(i = 0; i < tunnels_nr; i++) \
+		{ \
+			for(j = 0; j <= ROHC_SMALL_CID_MAX; j++) \
+			{ \
+				const struct iprohc_tunnel_flow *const flow = \
+					&(tunnels[i].stats.flows[j]); \
+				if(flow->packets_nr > 0) \
+				{ \
+					iprohc_metrics_flow_label(label, sizeof(label), j, flow); \
+					fprintf(out, "%s_total", (name)); \
+					iprohc_metrics_labels(out, tunnels[i].client, label); \
+					fprintf(out, " %" PRIu64 "\n", flow->field); \
+				} \
+			} \
+		} \
+	} \
+	while(0)
+
+	IPROHC_METRICS_FLOW_COUNTER("iprohc_flow_packets",
+	                            "The IP packets compressed in the ROHC context",
+	                            packets_nr);
+	IPROHC_METRICS_FLOW_COUNTER("iprohc_flow_ir_packets",
+	                            "The IR packets sent for the ROHC context", ir_nr);
+	IPROHC_METRICS_FLOW_COUNTER("iprohc_flow_ir_dyn_packets",
+	                            "The IR-DYN packets sent for the ROHC context",
+	                            ir_dyn_nr);
+	IPROHC_METRICS_FLOW_COUNTER("iprohc_flow_header_uncomp_bytes",
+	                            "The bytes of headers before compression in the "
+	                            "ROHC context", head_uncomp_size);
+	IPROHC_METRICS_FLOW_COUNTER("iprohc_flow_header_comp_bytes",
+	                            "The bytes of headers after compression in the "
+	                            "ROHC context", head_comp_size);
+
+#undef IPROHC_METRICS_FLOW_COUNTER
+
+	iprohc_metrics_family(out, "iprohc_flow_comp_state", "gauge",
+	                      "The state of the compressor of the ROHC context");
+	for(i = 0; i < tunnels_nr; i++)
+	{
+		for(j = 0; j <= ROHC_SMALL_CID_MAX; j++)
+		{
+			const struct iprohc_tunnel_flow *const flow = &(tunnels[i].stats.flows[j]);
+			const size_t len = (flow->packets_nr > 0 ?
+			                    iprohc_metrics_flow_label(label, sizeof(label),
+			                                              j, flow) : 0);
+			if(len > 0 && len < sizeof(label))
+			{
+				snprintf(label + len, sizeof(label) - len, ",state=\"%s\"",
+				         rohc_comp_get_state_descr(flow->state));
+				fprintf(out, "iprohc_flow_comp_state");
+				iprohc_metrics_labels(out, tunnels[i].client, label);
+				fprintf(out, " 1\n");
+			}
+		}
+	}
+
+	/* the errors of the data path, those that happened only */
+	iprohc_metrics_family(out, "iprohc_tunnel_errors", "counter",
+	                      "The errors of the data path, by kind");
+	for(i = 0; i < tunnels_nr; i++)
+	{
+		for(j = 0; j < IPROHC_TUNNEL_ERR_MAX; j++)
+		{
+			if(tunnels[i].stats.errors[j].total_nr > 0)
+			{
+				snprintf(label, sizeof(label), "error=\"%s\"",
+				         iprohc_tunnel_err_descr(j));
+				fprintf(out, "iprohc_tunnel_errors_total");
+				iprohc_metrics_labels(out, tunnels[i].client, label);
+				fprintf(out, " %" PRIu64 "\n", tunnels[i].stats.errors[j].total_nr);
+			}
+		}
+	}
+
+	fprintf(out, "# EOF\n");
+}
+
+
+/**
+ * @brief Write the metadata of a family of metrics
+ *
+ * @param out   The stream to write to
+ * @param name  The name of the family
+ * @param type  The OpenMetrics type of the family
+ * @param help  The description of the family
+ */
+static void iprohc_metrics_family(FILE *const out,
+                                  const char *const name,
+                                  const char *const type,
+                                  const char *const help)
+{
+	fprintf(out, "# TYPE %s %s\n", name, type);
+	fprintf(out, "# HELP %s %s.\n", name, help);
+}
+
+
+/**
+ * @brief Format the labels that identify one flow of a tunnel
+ *
+ * @param[out] label  The buffer for the labels
+ * @param label_len   The length of the buffer
+ * @param cid         The CID of the flow
+ * @param flow        The stats of the flow
+ * @return            The length of the labels, truncated if not less than
+ *                    label_len
+ */
+static size_t iprohc_metrics_flow_label(char *const label,
+                                        const size_t label_len,
+                                        const int cid,
+                                        const struct iprohc_tunnel_flow *const flow)
+{
+	const int ret = snprintf(label, label_len, "cid=\"%d\",rohc_profile=\"0x%04x\"",
+	                         cid, flow->profile_id);
+
+	return (ret < 0 ? label_len : (size_t) ret);
+}
+
+
+/**
+ * @brief Write the labels that identify the tunnel of a client
+ *
+ * The profile name comes from the configuration, it is escaped.
+ *
+ * @param out          The stream to write to
+ * @param client       The client
+ * @param extra_label  One more label, already formatted, NULL if none
+ */
+static void iprohc_metrics_labels(FILE *const out,
+                                  const struct iprohc_server_session *const client,
+                                  const char *const extra_label)
+{
+	const char *profile;
+
+	fprintf(out, "{client=\"%s\",id=\"%zu\",profile=\"",
+	        client->session.dst_addr_str, client->client_id);
+	for(profile = (client->profile != NULL ? client->profile->name : "");
+	    profile[0] != '\0'; profile++)
+	{
+		if(profile[0] == '\n')
+		{
+			fputs("\\n", out);
+			continue;
+		}
+		if(profile[0] == '"' || profile[0] == '\\')
+		{
+			fputc('\\', out);
+		}
+		fputc(profile[0], out);
+	}
+	fputc('"', out);
+	if(extra_label != NULL)
+	{
+		fprintf(out, ",%s", extra_label);
+	}
+	fputc('}', out);
+}
+
@@ -0,0 +1,73 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   metrics.h
+ * @brief  Export the statistics of the server in the OpenMetrics format
+ */
+
+#ifndef IPROHC_SERVER_METRICS__H
+#define IPROHC_SERVER_METRICS__H
+
+#include "client.h"
+#include "admission.h"
+#include "resume_cache.h"
+#include "local_conn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The maximum length of the metrics endpoint, a UNIX socket path at most */
+#define IPROHC_METRICS_ENDPOINT_MAX_LEN  108U
+
+/** The time the scraper has to send its request and read the reply (s) */
+#define IPROHC_METRICS_TIMEOUT  1
+/** The maximum length of the HTTP request read from the scraper */
+#define IPROHC_METRICS_REQUEST_MAX_LEN  1024U
+/** The end of the HTTP request */
+#define IPROHC_METRICS_REQUEST_END  "\r\n\r\n"
+
+/** The state of the server exported along with the stats of the tunnels */
+struct iprohc_metrics_server
+{
+	size_t clients_nr;         /**< The number of client contexts in use */
+	size_t clients_max_nr;     /**< The maximum number of clients */
+	size_t addrs_used_nr;      /**< The tunnel addresses in use */
+	size_t addrs_nr;           /**< The tunnel addresses in the pool */
+	size_t handshakes_nr;      /**< The TLS handshakes in progress */
+	bool is_listener_paused;   /**< Whether new connections are not accepted */
+	const struct iprohc_admission *admission;  /**< The admission control */
+	struct iprohc_resume_cache *resume_cache;  /**< The ROHC contexts kept */
+};
+
+
+int iprohc_metrics_listen(const char *const endpoint)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_metrics_close(const int metrics_sock,
+                          const char *const endpoint,
+                          const bool is_unlink)
+	__attribute__((nonnull(2)));
+
+void iprohc_metrics_serve(struct iprohc_local_conns *const conns,
+                          struct iprohc_local_conn *const conn,
+                          const struct iprohc_clients *const clients,
+                          const struct iprohc_metrics_server *const server)
+	__attribute__((nonnull(1, 2, 3, 4)));
+
+#endif
+
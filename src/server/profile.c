@@ -0,0 +1,339 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   profile.c
+ * @brief  The tunnel parameters given to the clients by certificate identity
+ *
+ * The common name and the subject alternative names of the certificate of
+ * a client are compared with the identities of the profiles, once the
+ * certificate was verified. The first profile that lists one of them gives
+ * its tunnel parameters to the client, the parameters it does not set are
+ * the ones of the server.
+ */
+
+#include "profile.h"
+
+#include "log.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <gnutls/x509.h>
+
+
+/** The maximum number of names of a client certificate that are compared */
+#define IPROHC_PROFILE_CERT_NAMES_MAX  16U
+
+/** The maximum length of a name of a client certificate */
+#define IPROHC_PROFILE_CERT_NAME_MAX  256U
+
+
+static size_t iprohc_profile_get_cert_names(gnutls_session_t tls_session,
+                                            char names[][IPROHC_PROFILE_CERT_NAME_MAX],
+                                            const size_t names_max_nr)
+	__attribute__((warn_unused_result, nonnull(2)));
+
+static bool iprohc_profile_has_identity(const struct iprohc_profile *const profile,
+                                        const char *const name)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+
+/**
+ * @brief Get the profile with the given name, add it if needed
+ *
+ * The parameters of a new profile are the ones of the server.
+ *
+ * @param profiles  The profiles of the configuration
+ * @param name      The name of the profile
+ * @return          The profile, NULL if there are too many profiles
+ */
+struct iprohc_profile * iprohc_profiles_get(struct iprohc_profiles *const profiles,
+                                            const char *const name)
+{
+	struct iprohc_profile *profile;
+	size_t i;
+
+	for(i = 0; i < profiles->profiles_nr; i++)
+	{
+		if(strcmp(profiles->profiles[i].name, name) == 0)
+		{
+			return &(profiles->profiles[i]);
+		}
+	}
+
+	if(strlen(name) == 0 || strlen(name) >= IPROHC_PROFILE_NAME_MAX)
+	{
+		trace(LOG_ERR, "invalid configuration: the name of profile '%s' shall "
+		      "be 1 to %u characters long", name, IPROHC_PROFILE_NAME_MAX - 1);
+		return NULL;
+	}
+	if(profiles->profiles_nr >= IPROHC_PROFILES_MAX)
+	{
+		trace(LOG_ERR, "invalid configuration: no more than %u profiles are "
+		      "supported", IPROHC_PROFILES_MAX);
+		return NULL;
+	}
+
+	profile = &(profiles->profiles[profiles->profiles_nr]);
+	memset(profile, 0, sizeof(struct iprohc_profile));
+	strcpy(profile->name, name);
+	profile->packing = -1;
+	profile->max_cid = -1;
+	profile->is_unidirectional = -1;
+	profile->keepalive_timeout = -1;
+	profile->static_addr.s_addr = INADDR_ANY;
+	profiles->profiles_nr++;
+
+	return profile;
+}
+
+
+/**
+ * @brief Check the profiles of the configuration
+ *
+ * Every profile shall list some identities. The static tunnel addresses
+ * shall be host addresses of the IP prefix of the server, and they shall
+ * be given to one profile only.
+ *
+ * @param profiles    The profiles of the configuration
+ * @param local_addr  The tunnel address of the server (network byte order)
+ * @param netmask     The length (in bits) of the network mask
+ * @return            true if the profiles are valid, false otherwise
+ */
+bool iprohc_profiles_check(const struct iprohc_profiles *const profiles,
+                           const uint32_t local_addr,
+                           const size_t netmask)
+{
+	const uint32_t mask = (0xffffffff << (32 - netmask));
+	const uint32_t network = ntohl(local_addr) & mask;
+	size_t i;
+
+	for(i = 0; i < profiles->profiles_nr; i++)
+	{
+		const struct iprohc_profile *const profile = &(profiles->profiles[i]);
+		const uint32_t addr = ntohl(profile->static_addr.s_addr);
+		size_t j;
+
+		if(strlen(profile->identities) == 0)
+		{
+			trace(LOG_ERR, "invalid configuration: profile '%s' shall list the "
+			      "identities of its clients", profile->name);
+			return false;
+		}
+
+		if(profile->static_addr.s_addr == INADDR_ANY)
+		{
+			continue;
+		}
+		if((addr & mask) != network || addr == network || addr == (network | ~mask) ||
+		   profile->static_addr.s_addr == local_addr)
+		{
+			trace(LOG_ERR, "invalid configuration: the address " IPV4_ADDR_FMT
+			      " of profile '%s' is not a client address of the tunnel "
+			      "prefix", IPV4_ADDR(addr), profile->name);
+			return false;
+		}
+		for(j = 0; j < i; j++)
+		{
+			if(profiles->profiles[j].static_addr.s_addr == profile->static_addr.s_addr)
+			{
+				trace(LOG_ERR, "invalid configuration: the address " IPV4_ADDR_FMT
+				      " is given to profiles '%s' and '%s'", IPV4_ADDR(addr),
+				      profiles->profiles[j].name, profile->name);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Find the profile of the client of the given TLS session
+ *
+ * The certificate of the client shall have been verified.
+ *
+ * @param profiles          The profiles of the configuration
+ * @param tls_session       The TLS session of the client
+ * @param[out] identity     The identity of the client that selected the
+ *                          profile, its common name if no profile matched
+ * @param identity_max_len  The size of the identity buffer
+ * @return                  The profile of the client, NULL if none matched
+ */
+const struct iprohc_profile *
+	iprohc_profiles_find(const struct iprohc_profiles *const profiles,
+	                     gnutls_session_t tls_session,
+	                     char *const identity,
+	                     const size_t identity_max_len)
+{
+	char names[IPROHC_PROFILE_CERT_NAMES_MAX][IPROHC_PROFILE_CERT_NAME_MAX];
+	size_t names_nr;
+	size_t i;
+
+	identity[0] = '\0';
+
+	names_nr = iprohc_profile_get_cert_names(tls_session, names,
+	                                         IPROHC_PROFILE_CERT_NAMES_MAX);
+	if(names_nr == 0)
+	{
+		return NULL;
+	}
+
+	/* the profiles are tried in the order of the configuration */
+	for(i = 0; i < profiles->profiles_nr; i++)
+	{
+		size_t j;
+
+		for(j = 0; j < names_nr; j++)
+		{
+			if(iprohc_profile_has_identity(&(profiles->profiles[i]), names[j]))
+			{
+				snprintf(identity, identity_max_len, "%s", names[j]);
+				return &(profiles->profiles[i]);
+			}
+		}
+	}
+
+	snprintf(identity, identity_max_len, "%s", names[0]);
+	return NULL;
+}
+
+
+/**
+ * @brief Get the names of the certificate of the client
+ *
+ * The common name comes first, if any, then the DNS, e-mail and URI subject
+ * alternative names.
+ *
+ * @param tls_session   The TLS session of the client
+ * @param[out] names    The names of the certificate
+ * @param names_max_nr  The maximum number of names to get
+ * @return              The number of names found
+ */
+static size_t iprohc_profile_get_cert_names(gnutls_session_t tls_session,
+                                            char names[][IPROHC_PROFILE_CERT_NAME_MAX],
+                                            const size_t names_max_nr)
+{
+	const gnutls_datum_t *certs;
+	unsigned int certs_nr = 0;
+	gnutls_x509_crt_t cert;
+	size_t names_nr = 0;
+	size_t len;
+	unsigned int seq;
+	int ret;
+
+	if(gnutls_certificate_type_get(tls_session) != GNUTLS_CRT_X509)
+	{
+		goto error;
+	}
+	certs = gnutls_certificate_get_peers(tls_session, &certs_nr);
+	if(certs == NULL || certs_nr == 0)
+	{
+		goto error;
+	}
+
+	ret = gnutls_x509_crt_init(&cert);
+	if(ret < 0)
+	{
+		trace(LOG_ERR, "failed to init X.509 certificate: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		goto error;
+	}
+	ret = gnutls_x509_crt_import(cert, &certs[0], GNUTLS_X509_FMT_DER);
+	if(ret < 0)
+	{
+		trace(LOG_ERR, "failed to import the certificate of the client: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		goto deinit_cert;
+	}
+
+	len = IPROHC_PROFILE_CERT_NAME_MAX;
+	ret = gnutls_x509_crt_get_dn_by_oid(cert, GNUTLS_OID_X520_COMMON_NAME, 0, 0,
+	                                    names[names_nr], &len);
+	if(ret == 0 && len > 0)
+	{
+		names_nr++;
+	}
+
+	for(seq = 0; names_nr < names_max_nr; seq++)
+	{
+		len = IPROHC_PROFILE_CERT_NAME_MAX - 1;
+		ret = gnutls_x509_crt_get_subject_alt_name(cert, seq, names[names_nr],
+		                                           &len, NULL);
+		if(ret == GNUTLS_E_REQUESTED_DATA_NOT_AVAILABLE)
+		{
+			break;
+		}
+		if(ret == GNUTLS_SAN_DNSNAME || ret == GNUTLS_SAN_RFC822NAME ||
+		   ret == GNUTLS_SAN_URI)
+		{
+			names[names_nr][len] = '\0';
+			names_nr++;
+		}
+		/* skip the other names and the names too long */
+	}
+
+deinit_cert:
+	gnutls_x509_crt_deinit(cert);
+error:
+	return names_nr;
+}
+
+
+/**
+ * @brief Whether the given name is one of the identities of the profile
+ *
+ * The names are compared without case, as DNS names.
+ *
+ * @param profile  The profile
+ * @param name     The name of the client certificate
+ * @return         true if the profile lists the name, false otherwise
+ */
+static bool iprohc_profile_has_identity(const struct iprohc_profile *const profile,
+                                        const char *const name)
+{
+	const size_t name_len = strlen(name);
+	const char *identity = profile->identities;
+
+	while(*identity != '\0')
+	{
+		size_t len;
+
+		while(*identity == ',' || isspace((unsigned char) *identity))
+		{
+			identity++;
+		}
+		len = strcspn(identity, ",");
+		while(len > 0 && isspace((unsigned char) identity[len - 1]))
+		{
+			len--;
+		}
+		if(len > 0 && len == name_len && strncasecmp(identity, name, len) == 0)
+		{
+			return true;
+		}
+		identity += strcspn(identity, ",");
+	}
+
+	return false;
+}
+
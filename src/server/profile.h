@@ -0,0 +1,90 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   profile.h
+ * @brief  The tunnel parameters given to the clients by certificate identity
+ */
+
+#ifndef IPROHC_SERVER_PROFILE__H
+#define IPROHC_SERVER_PROFILE__H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <gnutls/gnutls.h>
+
+
+/** The maximum number of profiles in the configuration */
+#define IPROHC_PROFILES_MAX  32U
+
+/** The maximum length of the name of a profile */
+#define IPROHC_PROFILE_NAME_MAX  64U
+
+/** The maximum length of the identities of a profile */
+#define IPROHC_PROFILE_IDENTITIES_MAX  1024U
+
+
+/**
+ * @brief The tunnel parameters of the clients with some certificate identity
+ *
+ * The parameters set to -1 are the ones of the server.
+ */
+struct iprohc_profile
+{
+	char name[IPROHC_PROFILE_NAME_MAX];   /**< The name of the profile */
+	char identities[IPROHC_PROFILE_IDENTITIES_MAX]; /**< The common names or
+	                                                     subject alternative
+	                                                     names of the clients,
+	                                                     separated by commas */
+	int packing;             /**< The packing level, -1 if not set */
+	int max_cid;             /**< The largest ROHC CID, -1 if not set */
+	int is_unidirectional;   /**< The ROHC mode, -1 if not set */
+	int keepalive_timeout;   /**< The keepalive timeout (in seconds), -1 if
+	                              not set */
+	struct in_addr static_addr; /**< The tunnel address of the client,
+	                                 INADDR_ANY for an address of the pool */
+};
+
+
+/** The profiles of the configuration, in the order they are matched */
+struct iprohc_profiles
+{
+	struct iprohc_profile profiles[IPROHC_PROFILES_MAX]; /**< The profiles */
+	size_t profiles_nr;                                   /**< Their number */
+};
+
+
+struct iprohc_profile * iprohc_profiles_get(struct iprohc_profiles *const profiles,
+                                            const char *const name)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_profiles_check(const struct iprohc_profiles *const profiles,
+                           const uint32_t local_addr,
+                           const size_t netmask)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+const struct iprohc_profile *
+	iprohc_profiles_find(const struct iprohc_profiles *const profiles,
+	                     gnutls_session_t tls_session,
+	                     char *const identity,
+	                     const size_t identity_max_len)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
+#endif
+
@@ -0,0 +1,386 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   resume_cache.c
+ * @brief  The ROHC contexts of lost sessions, kept until their clients return
+ *
+ * When the control channel of a client is lost, its ROHC compressor and
+ * decompressor are kept for a while, indexed by the session token the
+ * client received in its CONNECT_OK message. If the client reconnects in
+ * time with that token, the contexts are resumed and the RTP streams in
+ * progress do not need IR packets again.
+ *
+ * The address of the client on the tunnel stays allocated in the address
+ * pool while its contexts are kept, since the contexts are only valid for
+ * that address. The cache owns the address until a new session of the same
+ * client claims it, or until the contexts are released.
+ */
+
+#include "resume_cache.h"
+
+#include "log.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+static void iprohc_resume_cache_drop(struct iprohc_resume_cache *const cache,
+                                     struct iprohc_resume_entry *const entry,
+                                     const bool is_release)
+	__attribute__((nonnull(1, 2)));
+
+
+/**
+ * @brief Initialize the cache of ROHC contexts
+ *
+ * @param cache           The cache to initialize
+ * @param addr_pool       The pool of tunnel addresses
+ * @param entries_max_nr  The maximum number of lost sessions to keep
+ * @param timeout         The time (in seconds) to keep them, 0 to disable
+ * @return                true if the cache was successfully initialized,
+ *                        false if a problem occurred
+ */
+bool iprohc_resume_cache_init(struct iprohc_resume_cache *const cache,
+                              struct iprohc_addr_pool *const addr_pool,
+                              const size_t entries_max_nr,
+                              const size_t timeout)
+{
+	int ret;
+
+	memset(cache, 0, sizeof(struct iprohc_resume_cache));
+	cache->addr_pool = addr_pool;
+	cache->timeout = timeout;
+	cache->entries_max_nr = entries_max_nr;
+
+	cache->entries = calloc(entries_max_nr, sizeof(struct iprohc_resume_entry));
+	if(cache->entries == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for %zu resumable sessions",
+		      entries_max_nr);
+		goto error;
+	}
+
+	ret = pthread_mutex_init(&cache->lock, NULL);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init the lock of resumable sessions: %s (%d)",
+		      strerror(ret), ret);
+		goto free_entries;
+	}
+
+	return true;
+
+free_entries:
+	free(cache->entries);
+	cache->entries = NULL;
+error:
+	return false;
+}
+
+
+/**
+ * @brief Release the cache of ROHC contexts and all the contexts it keeps
+ *
+ * The tunnel addresses are not returned to the pool, it is released too.
+ *
+ * @param cache  The cache to release
+ */
+void iprohc_resume_cache_free(struct iprohc_resume_cache *const cache)
+{
+	size_t i;
+
+	for(i = 0; i < cache->entries_max_nr; i++)
+	{
+		if(cache->entries[i].is_used)
+		{
+			iprohc_resume_cache_drop(cache, &(cache->entries[i]), false);
+		}
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entries);
+	cache->entries = NULL;
+}
+
+
+/**
+ * @brief Keep the ROHC contexts of a lost session
+ *
+ * If the cache is full, the contexts kept for the longest time are released
+ * to make room.
+ *
+ * The cache takes the tunnel address of the session over: the caller shall
+ * not release it.
+ *
+ * @param cache        The cache of ROHC contexts
+ * @param token        The token of the lost session
+ * @param remote_addr  The address the client connected from
+ * @param local_addr   The address of the client on the tunnel
+ * @param contexts     The ROHC contexts, now owned by the cache
+ */
+void iprohc_resume_cache_park(struct iprohc_resume_cache *const cache,
+                              const uint8_t *const token,
+                              const struct in_addr remote_addr,
+                              const struct in_addr local_addr,
+                              struct iprohc_tunnel_contexts *const contexts)
+{
+	struct iprohc_resume_entry *entry = NULL;
+	size_t i;
+
+	if(cache->timeout == 0 || cache->entries_max_nr == 0)
+	{
+		iprohc_tunnel_contexts_free(contexts);
+		iprohc_addr_pool_release(cache->addr_pool,
+		                         iprohc_addr_pool_index(cache->addr_pool, local_addr));
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* a free entry, or the oldest one */
+	for(i = 0; i < cache->entries_max_nr; i++)
+	{
+		struct iprohc_resume_entry *const cur = &(cache->entries[i]);
+
+		if(!cur->is_used)
+		{
+			entry = cur;
+			break;
+		}
+		if(entry == NULL ||
+		   cur->parked_time.tv_sec < entry->parked_time.tv_sec)
+		{
+			entry = cur;
+		}
+	}
+	assert(entry != NULL);
+	if(entry->is_used)
+	{
+		iprohc_resume_cache_drop(cache, entry, true);
+		cache->evicted_nr++;
+	}
+
+	memcpy(entry->token, token, IPROHC_SESSION_TOKEN_LEN);
+	entry->remote_addr = remote_addr;
+	entry->local_addr = local_addr;
+	memcpy(&entry->contexts, contexts, sizeof(struct iprohc_tunnel_contexts));
+	contexts->comp = NULL;
+	contexts->decomp = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &entry->parked_time);
+	entry->is_used = true;
+	cache->parked_nr++;
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+/**
+ * @brief Take the ROHC contexts of a lost session back
+ *
+ * @param cache          The cache of ROHC contexts
+ * @param token          The token sent by the reconnecting client
+ * @param local_addr     The address of the client on the tunnel
+ * @param[out] contexts  The ROHC contexts, now owned by the caller
+ * @return               true if contexts were found for the token and the
+ *                       address, false otherwise
+ */
+bool iprohc_resume_cache_take(struct iprohc_resume_cache *const cache,
+                              const uint8_t *const token,
+                              const struct in_addr local_addr,
+                              struct iprohc_tunnel_contexts *const contexts)
+{
+	bool is_found = false;
+	size_t i;
+
+	pthread_mutex_lock(&cache->lock);
+
+	for(i = 0; i < cache->entries_max_nr; i++)
+	{
+		struct iprohc_resume_entry *const entry = &(cache->entries[i]);
+
+		if(entry->is_used &&
+		   memcmp(entry->token, token, IPROHC_SESSION_TOKEN_LEN) == 0)
+		{
+			/* the token is valid once, whatever the address */
+			if(entry->local_addr.s_addr == local_addr.s_addr)
+			{
+				memcpy(contexts, &entry->contexts,
+				       sizeof(struct iprohc_tunnel_contexts));
+				memset(entry, 0, sizeof(struct iprohc_resume_entry));
+				cache->resumed_nr++;
+				is_found = true;
+			}
+			else
+			{
+				iprohc_resume_cache_drop(cache, entry, true);
+				cache->evicted_nr++;
+			}
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return is_found;
+}
+
+
+/**
+ * @brief Give the tunnel address of a lost session back to its client
+ *
+ * The caller owns the address from now on. The contexts stay in the cache
+ * until the new session presents the token of the lost one.
+ *
+ * @param cache            The cache of ROHC contexts
+ * @param remote_addr      The address the new connection comes from
+ * @param[out] local_addr  The address on the tunnel of the lost session
+ * @return                 true if a lost session of the client was found,
+ *                         false otherwise
+ */
+bool iprohc_resume_cache_claim_addr(struct iprohc_resume_cache *const cache,
+                                    const struct in_addr remote_addr,
+                                    struct in_addr *const local_addr)
+{
+	bool is_found = false;
+	size_t i;
+
+	pthread_mutex_lock(&cache->lock);
+	for(i = 0; !is_found && i < cache->entries_max_nr; i++)
+	{
+		struct iprohc_resume_entry *const entry = &(cache->entries[i]);
+
+		if(entry->is_used && !entry->is_claimed &&
+		   entry->remote_addr.s_addr == remote_addr.s_addr)
+		{
+			*local_addr = entry->local_addr;
+			entry->is_claimed = true;
+			is_found = true;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return is_found;
+}
+
+
+/**
+ * @brief Give the static tunnel address of a lost session back to its client
+ *
+ * The client connected from another address than its lost session, it is
+ * recognized by the identity of its certificate instead. The caller owns
+ * the address from now on.
+ *
+ * @param cache       The cache of ROHC contexts
+ * @param local_addr  The static address of the client on the tunnel
+ * @return            true if a lost session kept the address,
+ *                    false otherwise
+ */
+bool iprohc_resume_cache_claim_local_addr(struct iprohc_resume_cache *const cache,
+                                          const struct in_addr local_addr)
+{
+	bool is_found = false;
+	size_t i;
+
+	pthread_mutex_lock(&cache->lock);
+	for(i = 0; !is_found && i < cache->entries_max_nr; i++)
+	{
+		struct iprohc_resume_entry *const entry = &(cache->entries[i]);
+
+		if(entry->is_used && !entry->is_claimed &&
+		   entry->local_addr.s_addr == local_addr.s_addr)
+		{
+			entry->is_claimed = true;
+			is_found = true;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return is_found;
+}
+
+
+/**
+ * @brief Release the ROHC contexts kept for too long
+ *
+ * @param cache  The cache of ROHC contexts
+ */
+void iprohc_resume_cache_expire(struct iprohc_resume_cache *const cache)
+{
+	struct timespec now;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&cache->lock);
+	for(i = 0; i < cache->entries_max_nr; i++)
+	{
+		struct iprohc_resume_entry *const entry = &(cache->entries[i]);
+
+		if(entry->is_used &&
+		   (size_t) (now.tv_sec - entry->parked_time.tv_sec) >= cache->timeout)
+		{
+			trace(LOG_INFO, "[main] ROHC contexts of lost session with "
+			      IPV4_ADDR_FMT " expired", IPV4_ADDR(ntohl(entry->remote_addr.s_addr)));
+			iprohc_resume_cache_drop(cache, entry, true);
+			cache->expired_nr++;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+/**
+ * @brief Print the counters of the cache of ROHC contexts in logs
+ *
+ * @param cache  The cache of ROHC contexts
+ */
+void iprohc_resume_cache_dump_stats(struct iprohc_resume_cache *const cache)
+{
+	pthread_mutex_lock(&cache->lock);
+	trace(LOG_INFO, "[main] resumable sessions:");
+	trace(LOG_INFO, "[main]   ROHC contexts kept:     %lu", cache->parked_nr);
+	trace(LOG_INFO, "[main]   ROHC contexts resumed:  %lu", cache->resumed_nr);
+	trace(LOG_INFO, "[main]   ROHC contexts expired:  %lu", cache->expired_nr);
+	trace(LOG_INFO, "[main]   ROHC contexts evicted:  %lu", cache->evicted_nr);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+/**
+ * @brief Release the ROHC contexts of the given entry
+ *
+ * @param cache       The cache of ROHC contexts
+ * @param entry       The entry to release
+ * @param is_release  Whether to return the tunnel address to the pool if no
+ *                    new session claimed it
+ */
+static void iprohc_resume_cache_drop(struct iprohc_resume_cache *const cache,
+                                     struct iprohc_resume_entry *const entry,
+                                     const bool is_release)
+{
+	iprohc_tunnel_contexts_free(&entry->contexts);
+	if(is_release && !entry->is_claimed)
+	{
+		iprohc_addr_pool_release(cache->addr_pool,
+		                         iprohc_addr_pool_index(cache->addr_pool,
+		                                                entry->local_addr));
+	}
+	memset(entry, 0, sizeof(struct iprohc_resume_entry));
+}
+
@@ -0,0 +1,107 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   resume_cache.h
+ * @brief  The ROHC contexts of lost sessions, kept until their clients return
+ */
+
+#ifndef IPROHC_SERVER_RESUME_CACHE__H
+#define IPROHC_SERVER_RESUME_CACHE__H
+
+#include "addr_pool.h"
+#include "rohc_tunnel.h"
+#include "tlv.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+
+/** The ROHC contexts of one lost session */
+struct iprohc_resume_entry
+{
+	bool is_used;
+	uint8_t token[IPROHC_SESSION_TOKEN_LEN]; /**< The token of the session */
+	struct in_addr remote_addr;    /**< The address the client connected from */
+	struct in_addr local_addr;     /**< The address of the client on the tunnel */
+	struct iprohc_tunnel_contexts contexts; /**< The ROHC contexts */
+	struct timespec parked_time;   /**< When the session was lost */
+	bool is_claimed;               /**< Whether a new session of the client
+	                                    already got the tunnel address back */
+};
+
+
+/** The ROHC contexts of lost sessions */
+struct iprohc_resume_cache
+{
+	pthread_mutex_t lock;      /**< The session threads take contexts while
+	                                the main thread parks or expires them */
+	size_t timeout;            /**< The time (in seconds) contexts are kept */
+	size_t entries_max_nr;
+	struct iprohc_resume_entry *entries;
+	struct iprohc_addr_pool *addr_pool; /**< The pool the tunnel addresses
+	                                         kept for lost sessions return to */
+
+	unsigned long parked_nr;   /**< The number of contexts kept */
+	unsigned long resumed_nr;  /**< The number of contexts resumed */
+	unsigned long expired_nr;  /**< The number of contexts that expired */
+	unsigned long evicted_nr;  /**< The number of contexts evicted early */
+};
+
+
+bool iprohc_resume_cache_init(struct iprohc_resume_cache *const cache,
+                              struct iprohc_addr_pool *const addr_pool,
+                              const size_t entries_max_nr,
+                              const size_t timeout)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+void iprohc_resume_cache_free(struct iprohc_resume_cache *const cache)
+	__attribute__((nonnull(1)));
+
+void iprohc_resume_cache_park(struct iprohc_resume_cache *const cache,
+                              const uint8_t *const token,
+                              const struct in_addr remote_addr,
+                              const struct in_addr local_addr,
+                              struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((nonnull(1, 2, 5)));
+
+bool iprohc_resume_cache_take(struct iprohc_resume_cache *const cache,
+                              const uint8_t *const token,
+                              const struct in_addr local_addr,
+                              struct iprohc_tunnel_contexts *const contexts)
+	__attribute__((warn_unused_result, nonnull(1, 2, 4)));
+
+bool iprohc_resume_cache_claim_addr(struct iprohc_resume_cache *const cache,
+                                    const struct in_addr remote_addr,
+                                    struct in_addr *const local_addr)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
+bool iprohc_resume_cache_claim_local_addr(struct iprohc_resume_cache *const cache,
+                                          const struct in_addr local_addr)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+void iprohc_resume_cache_expire(struct iprohc_resume_cache *const cache)
+	__attribute__((nonnull(1)));
+
+void iprohc_resume_cache_dump_stats(struct iprohc_resume_cache *const cache)
+	__attribute__((nonnull(1)));
+
+#endif
+
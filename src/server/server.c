@@ -19,10 +19,20 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "tun_helpers.h"
+#include "bpf_filter.h"
 #include "client.h"
+#include "addr_pool.h"
 #include "tls.h"
 #include "server_config.h"
+#include "upgrade.h"
+#include "metrics.h"
+#include "admin.h"
+#ifdef STATS_COLLECTD
+#  include "collectd.h"
+#endif
 #include "rohc_tunnel.h"
+#include "latency.h"
+#include "seqlock.h"
 #include "log.h"
 #include "utils.h"
 
@@ -34,27 +44,36 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <math.h>
 #include <signal.h>
 #include <getopt.h>
 #include <assert.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/resource.h>
 
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
+#include <netinet/tcp.h>
 
 #include <gnutls/gnutls.h>
 #include <gnutls/pkcs12.h>
 
 
-/** Print in logs a trace related to the given client */
+/** Print in logs a trace related to the given client, the debug traces are
+ *  also printed if debug is enabled for the session of the client */
 #define client_trace(client, prio, format, ...) \
 	do \
 	{ \
-		trace((prio), "[main] [client %s] " format, \
-		      (client)->session.dst_addr_str, ##__VA_ARGS__); \
+		if(iprohc_log_is_enabled(prio) || \
+		   ((prio) <= IPROHC_LOG_MIN_LEVEL && \
+		    AO_load(&((client)->session.is_debug)))) \
+		{ \
+			iprohc_log((prio), "[main] [client %s] " format, \
+			           (client)->session.dst_addr_str, ##__VA_ARGS__); \
+		} \
 	} \
 	while(0)
 
@@ -73,26 +92,100 @@ struct route_args
 {
 	int fd;
 	int p2c[2];
-	struct iprohc_server_session *clients;
-	size_t clients_max_nr;   /**< The maximum number of simultaneous clients */
+	const struct iprohc_clients *clients;
+	const struct iprohc_addr_pool *addr_pool; /**< The tunnel addresses of
+	                                               the clients */
 	enum type_route type;
+	bool is_decomp;  /**< Whether the thread decompresses the RAW traffic
+	                      itself instead of handing it to the sessions, as
+	                      the threads of the ingress fanout group do */
+	int drain_fd;    /**< The socket the TUN packets of the clients of the
+	                      other server go through while the old server drains
+	                      its sessions after an upgrade, -1 if none. The TUN
+	                      thread owns it, the main thread writes the new one
+	                      in the pipe */
+
+	/** The sequence number of the updates of the hand-off latencies, only
+	 *  the routing thread updates them */
+	volatile AO_t handoff_seq;
+	/** The time from the read of a packet to its write towards the session */
+	struct iprohc_latency handoff;
+};
+
+/** The latencies of the data path of all the clients and routing threads */
+struct iprohc_server_latency
+{
+	struct iprohc_latency packing_hold;  /**< TUN read to frame send */
+	struct iprohc_latency comp_time;     /**< ROHC compression */
+	struct iprohc_latency decomp_time;   /**< ROHC decompression */
+	struct iprohc_latency handoff;       /**< Routing thread hand-off */
 };
 
 static void * route(void *arg);
 
-static bool iprohc_server_handle_new_client(const int serv_sock,
-                                            struct iprohc_server_session *const clients,
-                                            size_t *const clients_nr,
-                                            const size_t clients_max_nr,
-                                            const int raw,
-                                            const int tun,
-                                            const size_t tun_itf_mtu,
-                                            const size_t basedev_mtu,
-                                            const struct server_opts server_opts)
-	__attribute__((warn_unused_result, nonnull(2, 3)));
+static int route_watch_drain(const int pollfd, const int drain_fd)
+	__attribute__((warn_unused_result));
+
+static bool iprohc_server_start_route(pthread_t *const thread,
+                                      struct route_args *const args,
+                                      const struct iprohc_thread_sched *const sched)
+	__attribute__((warn_unused_result, nonnull(1, 2, 3)));
+
+static bool iprohc_server_hand_over(const int upgrade_sock,
+                                    const int serv_sock,
+                                    const int tun,
+                                    const int tun_itf_id,
+                                    const size_t tun_itf_mtu,
+                                    const size_t basedev_mtu,
+                                    const gnutls_datum_t *const ticket_key,
+                                    const struct iprohc_clients *const clients,
+                                    const size_t clients_nr,
+                                    int *const drain_sock,
+                                    int *const drain_ctrl)
+	__attribute__((warn_unused_result, nonnull(7, 8, 10, 11)));
+
+static bool iprohc_server_update_ingress_filters(const struct iprohc_clients *const clients,
+                                                 const size_t clients_nr,
+                                                 const struct route_args *const routes,
+                                                 const size_t routes_nr,
+                                                 const bool is_fanout)
+	__attribute__((warn_unused_result, nonnull(1, 3)));
+
+static bool iprohc_server_handle_new_clients(const int serv_sock,
+                                             struct iprohc_clients *const clients,
+                                             struct iprohc_addr_pool *const addr_pool,
+                                             size_t *const clients_nr,
+                                             const size_t clients_max_nr,
+                                             struct iprohc_admission *const admission,
+                                             volatile AO_t *const handshakes_nr,
+                                             const int raw,
+                                             const int tun,
+                                             const size_t tun_itf_mtu,
+                                             const size_t basedev_mtu,
+                                             const struct server_opts server_opts)
+	__attribute__((warn_unused_result, nonnull(2, 3, 4, 6, 7)));
 	
-static void dump_stats_client(struct iprohc_server_session *const client)
-	__attribute__((nonnull(1)));
+static bool iprohc_server_reload_config(const char *const conf_file,
+                                        struct server_opts *const server_opts,
+                                        const bool is_fd_limited,
+                                        const struct iprohc_clients *const clients)
+	__attribute__((warn_unused_result, nonnull(1, 2, 4)));
+
+static bool iprohc_server_set_fd_limit(const size_t ingress_fanout,
+                                       const size_t clients_max_nr)
+	__attribute__((warn_unused_result));
+
+static void dump_stats_client(struct iprohc_server_session *const client,
+                              struct iprohc_session_mem *const mem_total,
+                              struct iprohc_server_latency *const latency_total)
+	__attribute__((nonnull(1, 2, 3)));
+
+static void iprohc_server_get_handoff(const struct route_args *const route,
+                                      struct iprohc_latency *const handoff)
+	__attribute__((nonnull(1, 2)));
+
+static size_t iprohc_session_mem_sum(const struct iprohc_session_mem *const mem)
+	__attribute__((warn_unused_result, nonnull(1)));
 
 
 /**
@@ -113,6 +206,10 @@ static void usage(void)
 	       "Other options:\n"
 	       "  -c, --conf PATH     Path to configuration file\n"
 	       "                      (default: /etc/iprohc_server.conf)\n"
+	       "  -t, --takeover      Take the TCP socket, the TUN interface and the\n"
+	       "                      TLS session ticket key over from the running\n"
+	       "                      server through its upgrade socket, then let\n"
+	       "                      it drain its sessions and stop\n"
 	       "      --nofdlimit     Do not set the file descriptor limit\n"
 	       "                      (for use with Valgrind)\n"
 	       "  -d, --debug         Enable debuging\n"
@@ -129,6 +226,10 @@ static void usage(void)
 	       "tunnel MTU based on network interface wlan:\n"
 	       "  iprohc_server -b wlan -c /etc/iprohc/server.cnf\n"
 	       "\n"
+	       "Upgrade the running IP/ROHC server without closing the TCP port\n"
+	       "nor the TUN interface:\n"
+	       "  iprohc_server -b eth0 --takeover\n"
+	       "\n"
 	       "Print software version:\n"
 	       "  iprohc_server --version\n"
 	       "\n"
@@ -153,10 +254,36 @@ int main(int argc, char *argv[])
 {
 	int exit_status = 1;
 
-	struct iprohc_server_session *clients = NULL;
+	struct iprohc_clients clients;
+	struct iprohc_addr_pool addr_pool;
+	struct iprohc_profiles profiles;
+	struct iprohc_server_session *client;
 	size_t clients_nr = 0;
+	struct iprohc_admission admission;
+	struct iprohc_resume_cache resume_cache;
+	struct iprohc_completion_queue completion_queue;
+	volatile AO_t handshakes_nr = 0;
+	bool is_listener_paused = false;
 
 	bool nofdlimit = false;
+	bool is_takeover = false;
+	struct iprohc_upgrade_state takeover;
+	int upgrade_sock = -1;
+	bool is_handed_over = false;
+	int drain_sock = -1;
+	int drain_ctrl = -1;
+	struct in_addr *drain_addrs = NULL;
+	size_t drain_addrs_nr = 0;
+	time_t drain_deadline = 0;
+	int metrics_sock = -1;
+	struct iprohc_local_conns metrics_conns;
+	struct iprohc_local_conn *local_conn;
+	int admin_sock = -1;
+	struct iprohc_local_conns admin_conns;
+#ifdef STATS_COLLECTD
+	struct iprohc_collectd collectd;
+	bool is_collectd_started = false;
+#endif
 
 	size_t client_id;
 	int serv_socket;
@@ -168,25 +295,37 @@ int main(int argc, char *argv[])
 	size_t basedev_mtu;
 
 	struct route_args route_args_tun;
-	struct route_args route_args_raw;
+	struct route_args route_args_raw[IPROHC_INGRESS_FANOUT_MAX];
 	pthread_t tun_route_thread;
-	pthread_t raw_route_thread;
+	pthread_t raw_route_threads[IPROHC_INGRESS_FANOUT_MAX];
+	size_t raw_routes_nr = 0;
+	cpu_set_t initial_cpus;
 
-	int j;
+	size_t j;
 	int ret;
 
 	int signal_fd;
 	sigset_t mask;
 	bool is_server_alive;
+	bool are_clients_changed;
 	struct timeval now;
 
 	struct epoll_event poll_signal;
 	struct epoll_event poll_serv;
+	struct epoll_event poll_upgrade;
+	struct epoll_event poll_drain;
+	struct epoll_event poll_metrics;
+	struct epoll_event poll_admin;
+	struct epoll_event poll_completion;
 	const size_t max_events_nr = 1;
 	struct epoll_event events[max_events_nr];
 	int pollfd;
 
 	gnutls_dh_params_t dh_params;
+	bool has_dh_params = false;
+	struct timespec start_time;
+	struct timespec ready_time;
+	const char *tls_priority_err;
 
 	struct server_opts server_opts;
 	FILE*pid;
@@ -199,6 +338,9 @@ int main(int argc, char *argv[])
 	/* Initialize logger */
 	openlog("iprohc_server", LOG_PID, LOG_DAEMON);
 
+	/* measure the time the server needs to be ready */
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
 
 	/*
 	 * Parsing options
@@ -209,6 +351,15 @@ int main(int argc, char *argv[])
 	server_opts.port = 3126;
 	server_opts.pkcs12_f[0] = '\0';
 	server_opts.pidfile_path[0]  = '\0';
+	server_opts.log_path[0]  = '\0';
+	server_opts.dh_params_path[0]  = '\0';
+	server_opts.upgrade_path[0]  = '\0';
+	server_opts.drain_timeout = IPROHC_DRAIN_TIMEOUT_DEFAULT;
+	server_opts.metrics_endpoint[0]  = '\0';
+	server_opts.admin_path[0]  = '\0';
+	server_opts.collectd_path[0]  = '\0';
+	server_opts.collectd_interval = IPROHC_COLLECTD_INTERVAL_DEFAULT;
+	strcpy(server_opts.tls_priority, IPROHC_TLS_PRIORITY_DEFAULT);
 	memset(server_opts.basedev, 0, IFNAMSIZ);
 	server_opts.local_address = inet_addr("192.168.99.1");
 	server_opts.netmask = 24;
@@ -220,11 +371,34 @@ int main(int argc, char *argv[])
 	server_opts.params.refresh             = 9;
 	server_opts.params.keepalive_timeout   = 60;
 	server_opts.params.rohc_compat_version = 2;
+	server_opts.params.capabilities        = 0; /* negotiated per client */
+
+	iprohc_thread_sched_init(&server_opts.control_sched);
+	iprohc_thread_sched_init(&server_opts.route_sched);
+	iprohc_thread_sched_init(&server_opts.session_sched);
+	server_opts.ingress_fanout = 0;
+	server_opts.session_stack_size = IPROHC_SESSION_STACK_DEFAULT;
+	server_opts.compact_sessions = false;
+	server_opts.update_sessions = false;
+	memset(&profiles, 0, sizeof(struct iprohc_profiles));
+	server_opts.profiles = &profiles;
+
+	server_opts.admission.listen_backlog = 128;
+	server_opts.admission.prefix_len = 24;
+	server_opts.admission.rate = 0;
+	server_opts.admission.burst = 10;
+	server_opts.admission.max_handshakes = 0;
+	server_opts.resume_timeout = 60;
+	server_opts.resume_cache = NULL;
+	server_opts.completion_queue = NULL;
+	server_opts.addr_pool = NULL;
+	server_opts.clients = NULL;
 
 	struct option options[] = {
 		{ "conf",      required_argument, NULL, 'c' },
 		{ "basedev",   required_argument, NULL, 'b' },
 		{ "nofdlimit", no_argument,       NULL, 'n' },
+		{ "takeover",  no_argument,       NULL, 't' },
 		{ "debug",     no_argument,       NULL, 'd' },
 		{ "help",      no_argument,       NULL, 'h' },
 		{ "version",   no_argument,       NULL, 'v' },
@@ -233,7 +407,7 @@ int main(int argc, char *argv[])
 	int option_index = 0;
 	do
 	{
-		c = getopt_long(argc, argv, "c:b:nhvd", options, &option_index);
+		c = getopt_long(argc, argv, "c:b:nthvd", options, &option_index);
 		switch(c)
 		{
 			case 'c':
@@ -260,6 +434,10 @@ int main(int argc, char *argv[])
 				trace(LOG_NOTICE, "[main] option --nofdlimit specified");
 				nofdlimit = true;
 				break;
+			case 't':
+				trace(LOG_NOTICE, "[main] option --takeover specified");
+				is_takeover = true;
+				break;
 			case 'd':
 				log_max_priority = LOG_DEBUG;
 				trace(LOG_DEBUG, "[main] debug mode enabled");
@@ -283,6 +461,50 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
+	/* write traces from the logger thread from now on */
+	if(!iprohc_log_start(server_opts.log_path))
+	{
+		trace(LOG_ERR, "[main] failed to start the logger thread");
+		goto error;
+	}
+
+	if(is_takeover && strcmp(server_opts.upgrade_path, "") == 0)
+	{
+		trace(LOG_ERR, "[main] option --takeover requires the 'upgrade_socket' "
+		      "attribute in configuration file");
+		exit_status = 2;
+		goto error;
+	}
+
+	/* threads inherit the CPU affinity of their creator, that is the main
+	 * thread: the threads without a dedicated set of CPUs shall use the CPUs
+	 * the process was started with, not the ones of the main thread */
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &initial_cpus);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to get the CPU affinity of process: "
+		      "%s (%d)", strerror(errno), errno);
+		goto error;
+	}
+	if(server_opts.control_sched.has_cpus)
+	{
+		if(!server_opts.route_sched.has_cpus)
+		{
+			server_opts.route_sched.cpus = initial_cpus;
+			server_opts.route_sched.has_cpus = true;
+		}
+		if(!server_opts.session_sched.has_cpus)
+		{
+			server_opts.session_sched.cpus = initial_cpus;
+			server_opts.session_sched.has_cpus = true;
+		}
+	}
+	if(!iprohc_thread_sched_self(&server_opts.control_sched))
+	{
+		trace(LOG_ERR, "[main] failed to pin the main thread to its CPUs");
+		goto error;
+	}
+
 	/* create PID file */
 	if(strcmp(server_opts.pidfile_path, "") == 0)
 	{
@@ -306,10 +528,10 @@ int main(int argc, char *argv[])
 	 * Handle signals for stats and log
 	 */
 
-	signal(SIGHUP, SIG_IGN); /* used to stop client threads */
 	signal(SIGPIPE, SIG_IGN); /* don't stop if TCP connection was unexpectedly closed */
 
 	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP); /* reload configuration */
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
 	sigaddset(&mask, SIGQUIT);
@@ -340,27 +562,11 @@ int main(int argc, char *argv[])
 	 * Set system limits
 	 */
 
-	if(!nofdlimit)
+	if(!nofdlimit &&
+	   !iprohc_server_set_fd_limit(server_opts.ingress_fanout,
+	                               server_opts.clients_max_nr))
 	{
-		const size_t fds_nr_base = 20U;
-		const size_t fds_nr_per_client = 10U;
-		const size_t fds_max_nr =
-			fds_nr_base + server_opts.clients_max_nr * fds_nr_per_client;
-		const struct rlimit fd_limits = {
-			.rlim_cur = fds_max_nr,
-			.rlim_max = fds_max_nr + 1,
-		};
-
-		ret = setrlimit(RLIMIT_NOFILE, &fd_limits);
-		if(ret != 0)
-		{
-			trace(LOG_ERR, "[main] failed to set system limits: failed to limit "
-			      "the number of file descriptors to %zu: %s (%d)", fds_max_nr,
-			      strerror(errno), errno);
-			goto close_signal_fd;
-		}
-		trace(LOG_INFO, "[main] set system limit for the number of file "
-		      "descriptors to %zu", fds_max_nr);
+		goto close_signal_fd;
 	}
 
 
@@ -368,21 +574,57 @@ int main(int argc, char *argv[])
 	 * Initialize contexts for clients
 	 */
 
-	clients = calloc(server_opts.clients_max_nr,
-	                 sizeof(struct iprohc_server_session));
-	if(clients == NULL)
+	/* the index of the tunnel address of a client in the pool is also the
+	 * index of its context, the contexts are allocated when clients connect:
+	 * both span the whole prefix, so that a configuration reload may raise the
+	 * maximum number of clients, and that the addresses kept for the lost
+	 * sessions to resume do not count in that maximum */
+	if(!iprohc_addr_pool_init(&addr_pool, server_opts.local_address,
+	                          server_opts.netmask, SIZE_MAX))
 	{
-		trace(LOG_ERR, "[main] failed to allocate memory for the contexts of %zu "
-		      "clients", server_opts.clients_max_nr);
+		trace(LOG_ERR, "[main] failed to init the pool of tunnel addresses");
 		goto close_signal_fd;
 	}
+	server_opts.addr_pool = &addr_pool;
+	if(!iprohc_clients_init(&clients, addr_pool.addrs_nr))
+	{
+		goto free_addr_pool;
+	}
+	server_opts.clients = &clients;
+
+	/* the static addresses are only given to the clients of their profiles,
+	 * the contexts at their indexes tell where these clients are */
+	for(j = 0; j < profiles.profiles_nr; j++)
+	{
+		const struct in_addr static_addr = profiles.profiles[j].static_addr;
+		size_t static_index;
+
+		if(static_addr.s_addr == INADDR_ANY)
+		{
+			continue;
+		}
+		static_index = iprohc_addr_pool_index(&addr_pool, static_addr);
+		assert(static_index < addr_pool.addrs_nr);
+		iprohc_addr_pool_reserve(&addr_pool, static_index);
+		if(iprohc_clients_alloc(&clients, static_index) == NULL)
+		{
+			goto free_client_contexts;
+		}
+	}
 	clients_nr = 0;
-	for(size_t i = 0; i < server_opts.clients_max_nr; i++)
+	iprohc_admission_init(&admission, server_opts.admission);
+	if(!iprohc_resume_cache_init(&resume_cache, &addr_pool,
+	                             server_opts.clients_max_nr,
+	                             server_opts.resume_timeout))
+	{
+		goto free_client_contexts;
+	}
+	server_opts.resume_cache = &resume_cache;
+	if(!iprohc_completion_queue_init(&completion_queue, clients.max_nr))
 	{
-		memcpy(&(clients[i].session.tunnel.params), &(server_opts.params),
-		       sizeof(struct tunnel_params));
-		AO_store_release_write(&(clients[i].is_init), 0);
+		goto free_resume_cache;
 	}
+	server_opts.completion_queue = &completion_queue;
 
 
 	/*
@@ -393,7 +635,17 @@ int main(int argc, char *argv[])
 			server_opts.pkcs12_f);
 	gnutls_global_init();
 	gnutls_certificate_allocate_credentials(&(server_opts.tls_cred));
-	gnutls_priority_init(&(server_opts.priority_cache), "NORMAL", NULL);
+	ret = gnutls_priority_init(&(server_opts.priority_cache),
+	                           server_opts.tls_priority, &tls_priority_err);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_ERR, "[main] invalid TLS priority '%s' near '%s': %s (%d)",
+		      server_opts.tls_priority, tls_priority_err, gnutls_strerror(ret), ret);
+		gnutls_certificate_free_credentials(server_opts.tls_cred);
+		gnutls_global_deinit();
+		exit_status = 2;
+		goto free_completion_queue;
+	}
 	if(!load_p12(server_opts.tls_cred, server_opts.pkcs12_f, ""))
 	{
 		if(!load_p12(server_opts.tls_cred, server_opts.pkcs12_f, NULL))
@@ -404,76 +656,203 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	trace(LOG_INFO, "[main] generate Diffie–Hellman parameters (it takes a few seconds)");
-	if(!generate_dh_params(&dh_params))
+	/* the key that encrypts session tickets, so that reconnecting clients
+	 * resume their TLS sessions instead of running full handshakes */
+	ret = gnutls_session_ticket_key_generate(&(server_opts.tls_ticket_key));
+	if(ret != GNUTLS_E_SUCCESS)
 	{
-		trace(LOG_ERR, "[main] failed to generate Diffie-Hellman parameters");
+		trace(LOG_ERR, "[main] failed to generate the TLS session ticket key: "
+		      "%s (%d)", gnutls_strerror(ret), ret);
 		goto deinit_tls;
 	}
-	gnutls_certificate_set_dh_params(server_opts.tls_cred, dh_params);
+
+	/* Diffie-Hellman parameters are only needed for DHE key exchanges, and
+	 * they are never generated at startup since it takes a few seconds */
+	if(!tls_priority_needs_dh(server_opts.priority_cache))
+	{
+		trace(LOG_INFO, "[main] no DHE key exchange in TLS priorities, no "
+		      "Diffie-Hellman parameters needed");
+	}
+	else if(strcmp(server_opts.dh_params_path, "none") == 0)
+	{
+		trace(LOG_NOTICE, "[main] DHE key exchanges enabled in TLS priorities, "
+		      "but Diffie-Hellman parameters disabled");
+	}
+	else if(strcmp(server_opts.dh_params_path, "") != 0 &&
+	        load_dh_params(&dh_params, server_opts.dh_params_path))
+	{
+		trace(LOG_INFO, "[main] Diffie-Hellman parameters loaded from file '%s'",
+		      server_opts.dh_params_path);
+		gnutls_certificate_set_dh_params(server_opts.tls_cred, dh_params);
+		has_dh_params = true;
+	}
+	else
+	{
+		trace(LOG_INFO, "[main] use the Diffie-Hellman groups of RFC 7919");
+		ret = gnutls_certificate_set_known_dh_params(server_opts.tls_cred,
+		                                             GNUTLS_SEC_PARAM_MEDIUM);
+		if(ret != GNUTLS_E_SUCCESS)
+		{
+			trace(LOG_ERR, "[main] failed to set Diffie-Hellman parameters: "
+			      "%s (%d)", gnutls_strerror(ret), ret);
+			goto free_ticket_key;
+		}
+		if(strcmp(server_opts.dh_params_path, "") != 0 &&
+		   !generate_dh_params_in_background(server_opts.dh_params_path))
+		{
+			trace(LOG_WARNING, "[main] failed to generate Diffie-Hellman "
+			      "parameters for file '%s'", server_opts.dh_params_path);
+		}
+	}
 
 
 	/*
-	 * Create TCP socket
+	 * Take the resources of the running server over
 	 */
-	trace(LOG_INFO, "[main] listen on TCP 0.0.0.0:%d", server_opts.port);
-	serv_socket = socket(AF_INET, SOCK_STREAM, 0);
-	if(serv_socket < 0)
+	if(is_takeover)
 	{
-		trace(LOG_ERR, "[main] failed to create TCP socket: %s (%d)",
-				strerror(errno), errno);
-		goto free_dh;
+		trace(LOG_INFO, "[main] take resources over from the running server "
+		      "through '%s'", server_opts.upgrade_path);
+		if(!iprohc_upgrade_receive(server_opts.upgrade_path, &takeover))
+		{
+			trace(LOG_ERR, "[main] failed to take resources over from the "
+			      "running server");
+			goto free_dh;
+		}
+		drain_sock = takeover.drain_sock;
+		drain_ctrl = takeover.drain_ctrl;
+		drain_addrs = takeover.drain_addrs;
+		drain_addrs_nr = takeover.drain_addrs_nr;
+
+		/* the clients of the running server resume their TLS sessions */
+		gnutls_free(server_opts.tls_ticket_key.data);
+		server_opts.tls_ticket_key.data = gnutls_malloc(takeover.ticket_key_len);
+		if(server_opts.tls_ticket_key.data == NULL)
+		{
+			trace(LOG_ERR, "[main] failed to allocate memory for the TLS session "
+			      "ticket key");
+			close(takeover.tun);
+			close(takeover.serv_sock);
+			goto close_drain;
+		}
+		memcpy(server_opts.tls_ticket_key.data, takeover.ticket_key,
+		       takeover.ticket_key_len);
+		server_opts.tls_ticket_key.size = takeover.ticket_key_len;
+		memset(takeover.ticket_key, 0, IPROHC_UPGRADE_TICKET_KEY_MAX_LEN);
+
+		/* the running server drains its sessions, their tunnel addresses are
+		 * given to no client until it releases them */
+		trace(LOG_INFO, "[main] running server drains %zu sessions",
+		      drain_addrs_nr);
+		j = 0;
+		while(j < drain_addrs_nr)
+		{
+			const size_t index = iprohc_addr_pool_index(&addr_pool, drain_addrs[j]);
+			if(iprohc_addr_pool_alloc_index(&addr_pool, index))
+			{
+				j++;
+			}
+			else
+			{
+				trace(LOG_WARNING, "[main] tunnel address %s of a drained session "
+				      "is out of the pool", inet_ntoa(drain_addrs[j]));
+				drain_addrs_nr--;
+				drain_addrs[j] = drain_addrs[drain_addrs_nr];
+			}
+		}
 	}
-	int on = 1;
-	ret = setsockopt(serv_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
-	if(ret != 0)
+
+
+	/*
+	 * Create TCP socket
+	 */
+	if(is_takeover)
 	{
-		trace(LOG_ERR, "[main] failed to allow the TCP socket to re-use address: %s (%d)",
-				strerror(errno), errno);
-		goto close_tcp;
+		trace(LOG_INFO, "[main] listen on TCP socket of the previous server");
+		serv_socket = takeover.serv_sock;
 	}
+	else
+	{
+		trace(LOG_INFO, "[main] listen on TCP 0.0.0.0:%d", server_opts.port);
+		serv_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(serv_socket < 0)
+		{
+			trace(LOG_ERR, "[main] failed to create TCP socket: %s (%d)",
+					strerror(errno), errno);
+			goto close_drain;
+		}
+		int on = 1;
+		ret = setsockopt(serv_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to allow the TCP socket to re-use address: %s (%d)",
+					strerror(errno), errno);
+			goto close_tcp;
+		}
 
-	struct   sockaddr_in servaddr;
-	servaddr.sin_family    = AF_INET;
-	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	servaddr.sin_port    = htons(server_opts.port);
+		struct   sockaddr_in servaddr;
+		servaddr.sin_family    = AF_INET;
+		servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+		servaddr.sin_port    = htons(server_opts.port);
 
-	ret = bind(serv_socket, (struct sockaddr*)&servaddr, sizeof(servaddr));
-	if(ret != 0)
-	{
-		trace(LOG_ERR, "[main] failed to bind on TCP/%d: %s (%d)", server_opts.port,
-				strerror(errno), errno);
-		goto close_tcp;
+		ret = bind(serv_socket, (struct sockaddr*)&servaddr, sizeof(servaddr));
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to bind on TCP/%d: %s (%d)", server_opts.port,
+					strerror(errno), errno);
+			goto close_tcp;
+		}
 	}
 
-	ret = listen(serv_socket, 10);
+	/* listening again on the socket of the previous server only updates its
+	 * backlog, the pending connections are kept */
+	ret = listen(serv_socket, server_opts.admission.listen_backlog);
 	if(ret != 0)
 	{
 		trace(LOG_ERR, "[main] failed to put TCP/%d socket in listen mode: %s (%d)",
 				server_opts.port, strerror(errno), errno);
+		if(is_takeover)
+		{
+			close(takeover.tun);
+		}
 		goto close_tcp;
 	}
 
-	/* TUN create */
-	trace(LOG_INFO, "[main] create TUN interface");
-	tun = create_tun("tun_ipip", server_opts.basedev,
-	                 &tun_itf_id, &basedev_mtu, &tun_itf_mtu);
-	if(tun < 0)
+	if(is_takeover)
 	{
-		trace(LOG_ERR, "[main] failed to create TUN device");
-		goto close_tcp;
+		/* the TUN interface of the previous server keeps its address */
+		trace(LOG_INFO, "[main] use TUN interface of the previous server");
+		tun = takeover.tun;
+		tun_itf_id = takeover.tun_itf_id;
+		tun_itf_mtu = takeover.tun_itf_mtu;
+		basedev_mtu = takeover.basedev_mtu;
 	}
-
-	is_ok = set_ip4(tun_itf_id, server_opts.local_address, 24);
-	if(!is_ok)
+	else
 	{
-		trace(LOG_ERR, "[main] failed to set IPv4 address on TUN interface");
-		goto delete_tun;
+		/* TUN create */
+		trace(LOG_INFO, "[main] create TUN interface");
+		tun = create_tun("tun_ipip", server_opts.basedev,
+		                 &tun_itf_id, &basedev_mtu, &tun_itf_mtu);
+		if(tun < 0)
+		{
+			trace(LOG_ERR, "[main] failed to create TUN device");
+			goto close_tcp;
+		}
+
+		is_ok = set_ip4(tun_itf_id, server_opts.local_address,
+		                server_opts.netmask);
+		if(!is_ok)
+		{
+			trace(LOG_ERR, "[main] failed to set IPv4 address on TUN interface");
+			goto delete_tun;
+		}
 	}
 
 	/* TUN routing thread */
 	trace(LOG_INFO, "[main] start TUN routing thread");
+	memset(&route_args_tun, 0, sizeof(struct route_args));
 	route_args_tun.fd = tun;
+	route_args_tun.drain_fd = drain_sock;
 	ret = pipe(route_args_tun.p2c);
 	if(ret != 0)
 	{
@@ -481,16 +860,16 @@ int main(int argc, char *argv[])
 		      "routing thread: %s (%d)", strerror(errno), errno);
 		goto delete_tun;
 	}
-	route_args_tun.clients = clients;
-	route_args_tun.clients_max_nr = server_opts.clients_max_nr;
+	route_args_tun.clients = &clients;
+	route_args_tun.addr_pool = &addr_pool;
 	route_args_tun.type = TUN;
-	ret = pthread_create(&tun_route_thread, NULL, route, (void*)&route_args_tun);
-	if(ret != 0)
+	if(!iprohc_server_start_route(&tun_route_thread, &route_args_tun,
+	                              &server_opts.route_sched))
 	{
-		trace(LOG_ERR, "[main] failed to create the TUN routing thread: %s (%d)",
-				strerror(ret), ret);
+		trace(LOG_ERR, "[main] failed to create the TUN routing thread");
 		goto close_tun_pipe;
 	}
+	drain_sock = -1; /* the TUN routing thread owns it now */
 
 	/* RAW create */
 	trace(LOG_INFO, "[main] create RAW socket");
@@ -501,25 +880,74 @@ int main(int argc, char *argv[])
 		goto stop_tun_thread;
 	}
 
-	/* RAW routing thread */
-	trace(LOG_INFO, "[main] start RAW routing thread");
-	route_args_raw.fd = raw;
-	ret = pipe(route_args_raw.p2c);
-	if(ret != 0)
+	/* RAW routing threads: either one thread that reads the raw socket, or
+	 * several threads that read the sockets of one fanout group, the raw
+	 * socket being then used for sending only */
+	if(server_opts.ingress_fanout > 0 && !raw_drop_input(raw))
 	{
-		trace(LOG_ERR, "[main] failed to create communication pipe for RAW "
-		      "routing thread: %s (%d)", strerror(errno), errno);
+		trace(LOG_ERR, "[main] failed to disable input on RAW socket");
 		goto delete_raw;
 	}
-	route_args_raw.clients = clients;
-	route_args_raw.clients_max_nr = server_opts.clients_max_nr;
-	route_args_raw.type = RAW;
-	ret = pthread_create(&raw_route_thread, NULL, route, (void*)&route_args_raw);
-	if(ret != 0)
+	for(raw_routes_nr = 0;
+	    raw_routes_nr < max(server_opts.ingress_fanout, 1);
+	    raw_routes_nr++)
+	{
+		struct route_args *const args = &(route_args_raw[raw_routes_nr]);
+
+		trace(LOG_INFO, "[main] start RAW routing thread #%zu", raw_routes_nr);
+		memset(args, 0, sizeof(struct route_args));
+		args->drain_fd = -1;
+		if(server_opts.ingress_fanout == 0)
+		{
+			args->fd = raw;
+		}
+		else
+		{
+			/* the fanout group is unique for the process */
+			args->fd = create_raw_fanout(server_opts.basedev, getpid() & 0xffff);
+			if(args->fd < 0)
+			{
+				trace(LOG_ERR, "[main] failed to create socket #%zu of the RAW "
+				      "ingress fanout group", raw_routes_nr);
+				goto stop_raw_threads;
+			}
+		}
+		ret = pipe(args->p2c);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to create communication pipe for RAW "
+			      "routing thread: %s (%d)", strerror(errno), errno);
+			if(server_opts.ingress_fanout > 0)
+			{
+				close(args->fd);
+			}
+			goto stop_raw_threads;
+		}
+		args->clients = &clients;
+		args->addr_pool = &addr_pool;
+		args->type = RAW;
+		args->is_decomp = (server_opts.ingress_fanout > 0);
+		if(!iprohc_server_start_route(&(raw_route_threads[raw_routes_nr]), args,
+		                              &server_opts.route_sched))
+		{
+			trace(LOG_ERR, "[main] failed to create the RAW routing thread");
+			close(args->p2c[1]);
+			close(args->p2c[0]);
+			if(server_opts.ingress_fanout > 0)
+			{
+				close(args->fd);
+			}
+			goto stop_raw_threads;
+		}
+	}
+
+	/* no client yet, so drop all IP/ROHC traffic in kernel */
+	if(!iprohc_server_update_ingress_filters(&clients, clients_nr,
+	                                         route_args_raw, raw_routes_nr,
+	                                         server_opts.ingress_fanout > 0))
 	{
-		trace(LOG_ERR, "[main] failed to create the RAW routing thread: %s (%d)",
-				strerror(ret), ret);
-		goto close_raw_pipe;
+		trace(LOG_ERR, "[main] failed to filter RAW ingress traffic");
+		goto stop_raw_threads;
 	}
 
 	/* stop writing logs on stderr */
@@ -531,8 +959,13 @@ int main(int argc, char *argv[])
 	{
 		trace(LOG_ERR, "[main] failed to create epoll context: %s (%d)",
 		      strerror(errno), errno);
-		goto stop_raw_thread;
+		goto stop_raw_threads;
 	}
+	iprohc_local_conns_init(&metrics_conns, "metrics", pollfd,
+	                        IPROHC_METRICS_REQUEST_END,
+	                        IPROHC_METRICS_REQUEST_MAX_LEN, IPROHC_METRICS_TIMEOUT);
+	iprohc_local_conns_init(&admin_conns, "administration", pollfd, "\n",
+	                        IPROHC_ADMIN_REQUEST_MAX_LEN, IPROHC_ADMIN_TIMEOUT);
 
 	/* will monitor the signal fd */
 	poll_signal.events = EPOLLIN;
@@ -558,12 +991,135 @@ int main(int argc, char *argv[])
 		goto close_pollfd;
 	}
 
+	/* will monitor the end of client sessions */
+	poll_completion.events = EPOLLIN;
+	memset(&poll_completion.data, 0, sizeof(poll_completion.data));
+	poll_completion.data.fd = completion_queue.event_fd;
+	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, completion_queue.event_fd,
+	                &poll_completion);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to add the end of client sessions to epoll "
+		      "context: %s (%d)", strerror(errno), errno);
+		goto close_pollfd;
+	}
+
+	/* will monitor the upgrade socket if any */
+	if(strcmp(server_opts.upgrade_path, "") != 0)
+	{
+		upgrade_sock = iprohc_upgrade_listen(server_opts.upgrade_path);
+		if(upgrade_sock < 0)
+		{
+			trace(LOG_ERR, "[main] failed to listen for server upgrades on '%s'",
+			      server_opts.upgrade_path);
+			goto close_pollfd;
+		}
+		poll_upgrade.events = EPOLLIN;
+		memset(&poll_upgrade.data, 0, sizeof(poll_upgrade.data));
+		poll_upgrade.data.fd = upgrade_sock;
+		ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, upgrade_sock, &poll_upgrade);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to add upgrade socket to epoll context: "
+			      "%s (%d)", strerror(errno), errno);
+			goto close_upgrade_sock;
+		}
+	}
+
+	/* will monitor the tunnel addresses the previous server releases */
+	if(drain_ctrl >= 0)
+	{
+		poll_drain.events = EPOLLIN;
+		memset(&poll_drain.data, 0, sizeof(poll_drain.data));
+		poll_drain.data.fd = drain_ctrl;
+		ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, drain_ctrl, &poll_drain);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to add drain control socket to epoll "
+			      "context: %s (%d)", strerror(errno), errno);
+			goto close_upgrade_sock;
+		}
+	}
+
+	/* will answer the scrapers of metrics if asked for */
+	if(strcmp(server_opts.metrics_endpoint, "") != 0)
+	{
+		metrics_sock = iprohc_metrics_listen(server_opts.metrics_endpoint);
+		if(metrics_sock < 0)
+		{
+			trace(LOG_ERR, "[main] failed to listen for metrics scrapers on '%s'",
+			      server_opts.metrics_endpoint);
+			goto close_upgrade_sock;
+		}
+		poll_metrics.events = EPOLLIN;
+		memset(&poll_metrics.data, 0, sizeof(poll_metrics.data));
+		poll_metrics.data.fd = metrics_sock;
+		ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, metrics_sock, &poll_metrics);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to add metrics socket to epoll context: "
+			      "%s (%d)", strerror(errno), errno);
+			goto close_metrics_sock;
+		}
+	}
+
+	/* will answer the commands of the administrator if asked for */
+	if(strcmp(server_opts.admin_path, "") != 0)
+	{
+		admin_sock = iprohc_admin_listen(server_opts.admin_path);
+		if(admin_sock < 0)
+		{
+			trace(LOG_ERR, "[main] failed to listen for administration commands "
+			      "on '%s'", server_opts.admin_path);
+			goto close_metrics_sock;
+		}
+		poll_admin.events = EPOLLIN;
+		memset(&poll_admin.data, 0, sizeof(poll_admin.data));
+		poll_admin.data.fd = admin_sock;
+		ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, admin_sock, &poll_admin);
+		if(ret != 0)
+		{
+			trace(LOG_ERR, "[main] failed to add administration socket to epoll "
+			      "context: %s (%d)", strerror(errno), errno);
+			goto close_admin_sock;
+		}
+	}
+
+	/* push stats to collectd if asked for */
+	if(strcmp(server_opts.collectd_path, "") != 0)
+	{
+#ifdef STATS_COLLECTD
+		if(!iprohc_collectd_start(&collectd, server_opts.collectd_path,
+		                          server_opts.collectd_interval, &clients,
+		                          &addr_pool, &handshakes_nr))
+		{
+			trace(LOG_ERR, "[main] failed to start pushing stats to collectd");
+			goto close_admin_sock;
+		}
+		is_collectd_started = true;
+#else
+		trace(LOG_WARNING, "[main] collectd section ignored: server built "
+		      "without collectd support");
+#endif
+	}
+
 	/* Start listening and looping on TCP socket */
-	trace(LOG_INFO, "[main] server is now ready to accept requests from clients");
+	clock_gettime(CLOCK_MONOTONIC, &ready_time);
+	trace(LOG_INFO, "[main] server is now ready to accept requests from clients "
+	      "(started in %lu ms)",
+	      (unsigned long) ((ready_time.tv_sec - start_time.tv_sec) * 1000 +
+	                       (ready_time.tv_nsec - start_time.tv_nsec) / 1000000));
 	is_server_alive = true;
 	while(is_server_alive)
 	{
-		const int timeout = 10 * 1000; /* in milliseconds */
+		/* in milliseconds, shorter while the listener is paused so that it is
+		 * resumed as soon as some handshakes complete, and while the sessions
+		 * are drained or local tools are connected so that their timeouts are
+		 * respected */
+		const int timeout =
+			(is_listener_paused ? 100 :
+			 ((is_handed_over || metrics_conns.conns_nr > 0 ||
+			   admin_conns.conns_nr > 0) ? 1000 : 10 * 1000));
 
 		gettimeofday(&now, NULL);
 
@@ -577,9 +1133,13 @@ int main(int argc, char *argv[])
 		else if(ret == 0)
 		{
 			trace(LOG_DEBUG, "[main] epoll_wait: timeout expired without any event");
-			continue;
+			/* no event, but the lost sessions shall be expired anyway */
+			events[0].data.fd = -1;
+		}
+		else
+		{
+			trace(LOG_DEBUG, "[main] epoll_wait: %d event(s)", ret);
 		}
-		trace(LOG_DEBUG, "[main] epoll_wait: %d event(s)", ret);
 
 		/* UNIX signal received? */
 		if(events[0].data.fd == signal_fd)
@@ -625,29 +1185,94 @@ int main(int argc, char *argv[])
 				}
 				case SIGUSR1:
 				{
+					struct iprohc_session_mem mem_total;
+					struct iprohc_server_latency latency_total;
+					struct iprohc_latency handoff;
+					char latency_descr[IPROHC_LATENCY_DESCR_MAX_LEN];
+					size_t mem_sessions_nr = 0;
+
 					/* dump stats for all clients */
 					trace(LOG_INFO, "[main] dump stats for all clients");
-					for(j = 0; j < server_opts.clients_max_nr; j++)
+					memset(&mem_total, 0, sizeof(struct iprohc_session_mem));
+					memset(&latency_total, 0, sizeof(struct iprohc_server_latency));
+					for(j = 0; (client = iprohc_clients_next(&clients, &j)) != NULL; j++)
 					{
-						if(AO_load_acquire_read(&(clients[j].is_init)))
-						{
-							dump_stats_client(&(clients[j]));
-						}
+						dump_stats_client(client, &mem_total, &latency_total);
+						mem_sessions_nr++;
+					}
+					iprohc_server_get_handoff(&route_args_tun, &handoff);
+					iprohc_latency_merge(&(latency_total.handoff), &handoff);
+					for(j = 0; j < raw_routes_nr; j++)
+					{
+						iprohc_server_get_handoff(&(route_args_raw[j]), &handoff);
+						iprohc_latency_merge(&(latency_total.handoff), &handoff);
 					}
+					trace(LOG_INFO, "[main] %zu/%zu tunnel addresses in use",
+					      addr_pool.used_nr, addr_pool.addrs_nr);
+					trace(LOG_INFO, "[main] memory of %zu client sessions: %zu bytes "
+					      "(%zu bytes per session)", mem_sessions_nr,
+					      iprohc_session_mem_sum(&mem_total),
+					      mem_sessions_nr == 0 ? 0 :
+					      iprohc_session_mem_sum(&mem_total) / mem_sessions_nr);
+					trace(LOG_INFO, "[main]   contexts:             %zu bytes",
+					      mem_total.context);
+					trace(LOG_INFO, "[main]   thread stacks:        %zu bytes "
+					      "(%zu bytes reserved)", mem_total.stack_resident,
+					      mem_total.stack_reserved);
+					trace(LOG_INFO, "[main]   packing frames:       %zu bytes",
+					      mem_total.packing_frame);
+					trace(LOG_INFO, "[main]   ROHC contexts:        ~%zu bytes "
+					      "(approximate heap growth)", mem_total.rohc);
+					trace(LOG_INFO, "[main]   TLS sessions:         ~%zu bytes "
+					      "(approximate heap growth)", mem_total.tls);
+					trace(LOG_INFO, "[main]   file descriptors:     %zu",
+					      mem_total.fds_nr);
+					trace(LOG_INFO, "[main] latencies of all sessions:");
+					(void) iprohc_latency_format(&(latency_total.packing_hold),
+					                             latency_descr, IPROHC_LATENCY_DESCR_MAX_LEN);
+					trace(LOG_INFO, "[main]   packing hold:     %s", latency_descr);
+					(void) iprohc_latency_format(&(latency_total.comp_time),
+					                             latency_descr, IPROHC_LATENCY_DESCR_MAX_LEN);
+					trace(LOG_INFO, "[main]   compression:      %s", latency_descr);
+					(void) iprohc_latency_format(&(latency_total.decomp_time),
+					                             latency_descr, IPROHC_LATENCY_DESCR_MAX_LEN);
+					trace(LOG_INFO, "[main]   decompression:    %s", latency_descr);
+					(void) iprohc_latency_format(&(latency_total.handoff),
+					                             latency_descr, IPROHC_LATENCY_DESCR_MAX_LEN);
+					trace(LOG_INFO, "[main]   routing hand-off: %s", latency_descr);
+					iprohc_admission_dump_stats(&admission);
+					iprohc_resume_cache_dump_stats(&resume_cache);
 					trace(LOG_INFO, "[main] end of stats dump");
 					break;
 				}
+				case SIGHUP:
+				{
+					/* the log file may have been rotated */
+					iprohc_log_reopen();
+
+					/* keep the current configuration if the new one is invalid */
+					if(!iprohc_server_reload_config(conf_file, &server_opts,
+					                                !nofdlimit, &clients))
+					{
+						trace(LOG_ERR, "[main] failed to reload configuration file "
+						      "'%s'", conf_file);
+					}
+					break;
+				}
 				case SIGUSR2:
-					/* toggle between debug and non-debug modes */
-					if(log_max_priority == LOG_DEBUG)
+					/* toggle the debug traces of the main thread only, the debug
+					 * of the sessions is enabled one by one with the admin socket
+					 * not to flood logs with the traces of all sessions */
+					if(iprohc_log_thread_priority == LOG_DEBUG)
 					{
-						log_max_priority = LOG_INFO;
-						trace(LOG_INFO, "[main] debug mode disabled");
+						iprohc_log_thread_priority = -1;
+						trace(LOG_INFO, "[main] debug mode of main thread disabled");
 					}
 					else
 					{
-						log_max_priority = LOG_DEBUG;
-						trace(LOG_DEBUG, "[main] debug mode enabled");
+						iprohc_log_thread_priority = LOG_DEBUG;
+						trace(LOG_INFO, "[main] debug mode of main thread enabled, "
+						      "use 'iprohc_ctl debug CLIENT on' to debug one session");
 					}
 					break;
 				default:
@@ -659,95 +1284,432 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		/* Read on serv_socket : new client */
-		if(events[0].data.fd == serv_socket)
+		are_clients_changed = false;
+
+		/* a new server wants to take over */
+		if(upgrade_sock >= 0 && events[0].data.fd == upgrade_sock)
 		{
-			trace(LOG_INFO, "[main] new connection from client");
-			if(!iprohc_server_handle_new_client(serv_socket, clients, &clients_nr,
-			                                    server_opts.clients_max_nr,
-			                                    raw, tun, tun_itf_mtu, basedev_mtu,
-			                                    server_opts))
+			const int conn = accept4(upgrade_sock, NULL, NULL, SOCK_CLOEXEC);
+			if(conn < 0)
 			{
-				trace(LOG_ERR, "[main] failed to handle new client session");
+				trace(LOG_ERR, "[main] failed to accept connection on upgrade "
+				      "socket: %s (%d)", strerror(errno), errno);
 			}
+			else if(drain_ctrl >= 0)
+			{
+				trace(LOG_ERR, "[main] previous server still drains its sessions, "
+				      "do not hand resources over to a new server yet");
+				close(conn);
+			}
+			else if(!iprohc_upgrade_is_peer_allowed(conn))
+			{
+				close(conn);
+			}
+			else
+			{
+				trace(LOG_NOTICE, "[main] hand resources over to a new server");
+				if(iprohc_server_hand_over(conn, serv_socket, tun, tun_itf_id,
+				                           tun_itf_mtu, basedev_mtu,
+				                           &(server_opts.tls_ticket_key), &clients,
+				                           clients_nr, &drain_sock, &drain_ctrl))
+				{
+					trace(LOG_NOTICE, "[main] new server took over, drain the %zu "
+					      "established sessions for %zu seconds at most", clients_nr,
+					      server_opts.drain_timeout);
+					is_handed_over = true;
+					drain_deadline = now.tv_sec + server_opts.drain_timeout;
+
+					/* the new server accepts the new clients, the listening socket
+					 * it shares stays in the epoll context until removed */
+					if(!is_listener_paused &&
+					   epoll_ctl(pollfd, EPOLL_CTL_DEL, serv_socket, NULL) != 0)
+					{
+						trace(LOG_ERR, "[main] failed to remove server socket from "
+						      "epoll context: %s (%d)", strerror(errno), errno);
+					}
+					close(serv_socket);
+					serv_socket = -1;
+
+					/* the new server listens on the same paths and ports */
+					close(upgrade_sock);
+					upgrade_sock = -1;
+					if(metrics_sock >= 0)
+					{
+						iprohc_metrics_close(metrics_sock, server_opts.metrics_endpoint,
+						                     false);
+						metrics_sock = -1;
+					}
+					if(admin_sock >= 0)
+					{
+						iprohc_admin_close(admin_sock, server_opts.admin_path, false);
+						admin_sock = -1;
+					}
+#ifdef STATS_COLLECTD
+					/* the new server pushes the stats of its own clients */
+					if(is_collectd_started)
+					{
+						iprohc_collectd_stop(&collectd);
+						is_collectd_started = false;
+					}
+#endif
+
+					/* both servers read the TUN interface from now on, each one
+					 * forwards the packets of the clients of the other one */
+					ret = write(route_args_tun.p2c[1], &drain_sock, sizeof(int));
+					if(ret != sizeof(int))
+					{
+						trace(LOG_ERR, "[main] failed to give the drain socket to "
+						      "the TUN routing thread: %s (%d)", strerror(errno), errno);
+						close(drain_sock);
+					}
+					drain_sock = -1;
+				}
+				else
+				{
+					trace(LOG_ERR, "[main] failed to hand resources over to the new "
+					      "server, keep running");
+				}
+				close(conn);
+			}
+			continue;
 		}
 
-		/* cleanup deconnected clients */
-		for(j = 0; j < server_opts.clients_max_nr; j++)
+		/* the previous server released the tunnel address of one of its
+		 * drained sessions, or it stopped and released all of them */
+		if(drain_ctrl >= 0 && !is_handed_over && events[0].data.fd == drain_ctrl)
 		{
-			/* skip uninitialized clients */
-			if(!AO_load_acquire_read(&(clients[j].is_init)))
-			{
-				continue;
-			}
+			struct in_addr released_addr;
 
-			/* skip clients that are still running */
-			if(AO_load_acquire_read(&(clients[j].session.is_thread_running)))
+			if(iprohc_upgrade_released_addr(drain_ctrl, &released_addr))
 			{
-				continue;
+				for(j = 0; j < drain_addrs_nr &&
+				    drain_addrs[j].s_addr != released_addr.s_addr; j++)
+				{
+				}
+				if(j < drain_addrs_nr)
+				{
+					trace(LOG_DEBUG, "[main] previous server released tunnel "
+					      "address %s", inet_ntoa(released_addr));
+					iprohc_addr_pool_release(&addr_pool,
+					                         iprohc_addr_pool_index(&addr_pool,
+					                                                released_addr));
+					drain_addrs_nr--;
+					drain_addrs[j] = drain_addrs[drain_addrs_nr];
+				}
 			}
-
-			/* client is not running, we can check its status */
-			if(clients[j].session.status == IPROHC_SESSION_PENDING_DELETE)
+			else
 			{
-				/* stop client session */
-				trace(LOG_INFO, "[main] stop session of client #%d", j);
-				if(!iprohc_session_stop(&(clients[j].session)))
+				trace(LOG_NOTICE, "[main] previous server stopped, release the "
+				      "%zu tunnel addresses of its drained sessions", drain_addrs_nr);
+				while(drain_addrs_nr > 0)
 				{
-					trace(LOG_ERR, "[main] failed to stop session of client #%d", j);
+					drain_addrs_nr--;
+					iprohc_addr_pool_release(&addr_pool,
+					                         iprohc_addr_pool_index(&addr_pool,
+					                                                drain_addrs[drain_addrs_nr]));
 				}
+				close(drain_ctrl);
+				drain_ctrl = -1;
+			}
+			continue;
+		}
+
+		/* a scraper wants the metrics */
+		iprohc_local_conns_expire(&metrics_conns);
+		if(metrics_sock >= 0 && events[0].data.fd == metrics_sock)
+		{
+			iprohc_local_conns_accept(&metrics_conns, metrics_sock);
+			continue;
+		}
+		local_conn = iprohc_local_conns_find(&metrics_conns, events[0].data.fd);
+		if(local_conn != NULL)
+		{
+			struct iprohc_metrics_server metrics_server;
 
-				/* delete client */
-				trace(LOG_INFO, "[main] remove context of client #%d", j);
-				del_client(&(clients[j]));
-					
-				assert(clients_nr > 0);
-				assert(clients_nr <= server_opts.clients_max_nr);
-				clients_nr--;
-				trace(LOG_INFO, "[main] only %zu/%zu clients remaining", clients_nr,
-				      server_opts.clients_max_nr);
-				assert(clients_nr >= 0);
-				assert(clients_nr < server_opts.clients_max_nr);
+			if(!iprohc_local_conn_process(&metrics_conns, local_conn))
+			{
+				continue;
 			}
+			metrics_server.clients_nr = clients_nr;
+			metrics_server.clients_max_nr = server_opts.clients_max_nr;
+			metrics_server.addrs_used_nr = addr_pool.used_nr;
+			metrics_server.addrs_nr = addr_pool.addrs_nr;
+			metrics_server.handshakes_nr = AO_load(&handshakes_nr);
+			metrics_server.is_listener_paused = is_listener_paused;
+			metrics_server.admission = &admission;
+			metrics_server.resume_cache = &resume_cache;
+			iprohc_metrics_serve(&metrics_conns, local_conn, &clients,
+			                     &metrics_server);
+			continue;
 		}
-	}
-	trace(LOG_INFO, "[main] stopping server...");
 
-	/* release all clients */
-	trace(LOG_INFO, "[main] release resources of connected clients...");
-	for(client_id = 0; client_id < server_opts.clients_max_nr; client_id++)
-	{
-		if(AO_load_acquire_read(&(clients[client_id].is_init)))
+		/* the administrator sends a command */
+		iprohc_local_conns_expire(&admin_conns);
+		if(admin_sock >= 0 && events[0].data.fd == admin_sock)
+		{
+			iprohc_local_conns_accept(&admin_conns, admin_sock);
+			continue;
+		}
+		local_conn = iprohc_local_conns_find(&admin_conns, events[0].data.fd);
+		if(local_conn != NULL)
 		{
-			/* stop client session */
-			trace(LOG_INFO, "[main] stop session of client #%zu", client_id);
-			if(!iprohc_session_stop(&(clients[client_id].session)))
+			if(iprohc_local_conn_process(&admin_conns, local_conn))
 			{
-				trace(LOG_ERR, "[main] failed to stop session of client #%zu",
-				      client_id);
+				iprohc_admin_serve(&admin_conns, local_conn, &clients);
 			}
+			continue;
+		}
 
-			trace(LOG_INFO, "[main] remove context of client #%zu", client_id);
-			del_client(&(clients[client_id]));
+		/* Read on serv_socket : new client */
+		if(serv_socket >= 0 && events[0].data.fd == serv_socket)
+		{
+			trace(LOG_INFO, "[main] new connection(s) from client(s)");
+			if(!iprohc_server_handle_new_clients(serv_socket, &clients, &addr_pool,
+			                                     &clients_nr,
+			                                     server_opts.clients_max_nr,
+			                                     &admission, &handshakes_nr,
+			                                     raw, tun, tun_itf_mtu, basedev_mtu,
+			                                     server_opts))
+			{
+				trace(LOG_ERR, "[main] failed to handle new client sessions");
+			}
+			are_clients_changed = true;
 		}
-	}
 
-	/* everything went fine */
-	exit_status = 0;
+		/* reap the client sessions which threads ended, only them */
+		if(events[0].data.fd == completion_queue.event_fd)
+		{
+			const size_t ended_max_nr = 64;
+			size_t ended_ids[ended_max_nr];
+			size_t ended_nr;
+			size_t k;
 
+			do
+			{
+				ended_nr = iprohc_completion_queue_drain(&completion_queue, ended_ids,
+				                                         ended_max_nr);
+				for(k = 0; k < ended_nr; k++)
+				{
+					j = ended_ids[k];
+					client = iprohc_clients_get(&clients, j);
+					if(client == NULL || !AO_load_acquire_read(&(client->is_init)))
+					{
+						trace(LOG_ERR, "[main] session of unknown client #%zu ended", j);
+						continue;
+					}
+
+					/* stop client session */
+					trace(LOG_INFO, "[main] stop session of client #%zu", j);
+					if(!iprohc_session_stop(&(client->session)))
+					{
+						trace(LOG_ERR, "[main] failed to stop session of client #%zu", j);
+					}
+
+					/* keep the ROHC contexts of a lost session for a while, the
+					 * client may reconnect and resume them: its tunnel address is
+					 * kept along, otherwise it returns to the pool. A drained
+					 * session cannot be resumed, its client reconnects to the new
+					 * server */
+					iprohc_server_session_drop_alias(client);
+					if(client->is_resumable && client->session.tunnel.is_init &&
+					   !is_handed_over)
+					{
+						struct iprohc_tunnel_contexts contexts;
+
+						trace(LOG_INFO, "[main] keep ROHC contexts of client #%zu for "
+						      "%zu seconds", j, server_opts.resume_timeout);
+						iprohc_tunnel_detach_contexts(&(client->session.tunnel),
+						                              &contexts);
+						iprohc_resume_cache_park(&resume_cache, client->token,
+						                         client->session.dst_addr,
+						                         client->session.local_address,
+						                         &contexts);
+						/* the cache keeps the static address, not the one of the
+						 * context */
+						if(client->has_static_addr)
+						{
+							iprohc_addr_pool_release(&addr_pool, j);
+						}
+					}
+					else
+					{
+						iprohc_addr_pool_release(&addr_pool, j);
+						if(client->has_static_addr)
+						{
+							iprohc_addr_pool_release(&addr_pool,
+							                         iprohc_addr_pool_index(&addr_pool,
+							                                                client->session.local_address));
+						}
+						/* the new server may give the address to its clients */
+						if(is_handed_over)
+						{
+							(void) iprohc_upgrade_release_addr(drain_ctrl,
+							                                   client->session.local_address);
+						}
+					}
+
+					/* delete client */
+					trace(LOG_INFO, "[main] remove context of client #%zu", j);
+					del_client(client);
+
+					assert(clients_nr > 0);
+					clients_nr--;
+					trace(LOG_INFO, "[main] only %zu/%zu clients remaining", clients_nr,
+					      server_opts.clients_max_nr);
+					are_clients_changed = true;
+				}
+			}
+			while(ended_nr == ended_max_nr);
+		}
+
+		/* the old server stops once its drained sessions ended */
+		if(is_handed_over && clients_nr == 0)
+		{
+			trace(LOG_NOTICE, "[main] all sessions drained, stop");
+			is_server_alive = false;
+		}
+		else if(is_handed_over && now.tv_sec >= drain_deadline)
+		{
+			trace(LOG_NOTICE, "[main] drain timeout expired, stop the %zu "
+			      "remaining sessions", clients_nr);
+			is_server_alive = false;
+		}
+
+		/* release the ROHC contexts of the clients that did not come back */
+		iprohc_resume_cache_expire(&resume_cache);
+
+		/* accept traffic from the new clients, drop the one of removed clients */
+		if(are_clients_changed &&
+		   !iprohc_server_update_ingress_filters(&clients, clients_nr,
+		                                         route_args_raw, raw_routes_nr,
+		                                         server_opts.ingress_fanout > 0))
+		{
+			trace(LOG_ERR, "[main] failed to update the filters of RAW ingress "
+			      "traffic");
+		}
+
+		/* stop accepting new connections while too many TLS handshakes are in
+		 * progress, let the kernel queue them in the listen backlog meanwhile */
+		if(server_opts.admission.max_handshakes > 0 && serv_socket >= 0)
+		{
+			if(!is_listener_paused &&
+			   AO_load(&handshakes_nr) >= server_opts.admission.max_handshakes)
+			{
+				trace(LOG_NOTICE, "[main] %zu TLS handshakes in progress, stop "
+				      "accepting new connections", (size_t) AO_load(&handshakes_nr));
+				ret = epoll_ctl(pollfd, EPOLL_CTL_DEL, serv_socket, NULL);
+				if(ret != 0)
+				{
+					trace(LOG_ERR, "[main] failed to remove server socket from epoll "
+					      "context: %s (%d)", strerror(errno), errno);
+				}
+				else
+				{
+					is_listener_paused = true;
+					admission.paused_nr++;
+				}
+			}
+			else if(is_listener_paused &&
+			        AO_load(&handshakes_nr) < server_opts.admission.max_handshakes)
+			{
+				struct tcp_info tcp_info;
+				socklen_t tcp_info_len = sizeof(struct tcp_info);
+				unsigned long queued_nr = 0;
+
+				/* for a listening socket, the kernel reports the number of
+				 * connections waiting in the accept queue as unacked */
+				ret = getsockopt(serv_socket, IPPROTO_TCP, TCP_INFO, &tcp_info,
+				                 &tcp_info_len);
+				if(ret == 0)
+				{
+					queued_nr = tcp_info.tcpi_unacked;
+					admission.queued_nr += queued_nr;
+				}
+				trace(LOG_NOTICE, "[main] %zu TLS handshakes in progress, accept "
+				      "new connections again (%lu queued)",
+				      (size_t) AO_load(&handshakes_nr), queued_nr);
+				ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, serv_socket, &poll_serv);
+				if(ret != 0)
+				{
+					trace(LOG_ERR, "[main] failed to add server socket to epoll "
+					      "context: %s (%d)", strerror(errno), errno);
+				}
+				else
+				{
+					is_listener_paused = false;
+				}
+			}
+		}
+	}
+	trace(LOG_INFO, "[main] stopping server...");
+
+	/* release all clients */
+	trace(LOG_INFO, "[main] release resources of connected clients...");
+	for(client_id = 0;
+	    (client = iprohc_clients_next(&clients, &client_id)) != NULL;
+	    client_id++)
+	{
+		/* stop client session */
+		trace(LOG_INFO, "[main] stop session of client #%zu", client_id);
+		if(!iprohc_session_stop(&(client->session)))
+		{
+			trace(LOG_ERR, "[main] failed to stop session of client #%zu",
+			      client_id);
+		}
+
+		trace(LOG_INFO, "[main] remove context of client #%zu", client_id);
+		del_client(client);
+	}
+
+	/* everything went fine */
+	exit_status = 0;
+
+#ifdef STATS_COLLECTD
+	if(is_collectd_started)
+	{
+		iprohc_collectd_stop(&collectd);
+	}
+#endif
+close_admin_sock:
+	iprohc_local_conns_close(&admin_conns);
+	if(admin_sock >= 0)
+	{
+		/* the new server already listens on the same path */
+		iprohc_admin_close(admin_sock, server_opts.admin_path, !is_handed_over);
+	}
+close_metrics_sock:
+	iprohc_local_conns_close(&metrics_conns);
+	if(metrics_sock >= 0)
+	{
+		/* the new server already listens on the same path */
+		iprohc_metrics_close(metrics_sock, server_opts.metrics_endpoint,
+		                     !is_handed_over);
+	}
+close_upgrade_sock:
+	if(upgrade_sock >= 0)
+	{
+		close(upgrade_sock);
+		/* the new server already listens on the same path */
+		if(!is_handed_over)
+		{
+			unlink(server_opts.upgrade_path);
+		}
+	}
 close_pollfd:
 	close(pollfd);
-stop_raw_thread:
-	trace(LOG_INFO, "[main] stop RAW routing thread...");
-	close(route_args_raw.p2c[1]);
-	route_args_raw.p2c[1] = -1;
-	pthread_join(raw_route_thread, NULL);
-close_raw_pipe:
-	if(route_args_raw.p2c[1] >= 0)
+stop_raw_threads:
+	while(raw_routes_nr > 0)
 	{
-		close(route_args_raw.p2c[1]);
+		raw_routes_nr--;
+		trace(LOG_INFO, "[main] stop RAW routing thread #%zu...", raw_routes_nr);
+		close(route_args_raw[raw_routes_nr].p2c[1]);
+		pthread_join(raw_route_threads[raw_routes_nr], NULL);
+		close(route_args_raw[raw_routes_nr].p2c[0]);
+		if(server_opts.ingress_fanout > 0)
+		{
+			close(route_args_raw[raw_routes_nr].fd);
+		}
 	}
-	close(route_args_raw.p2c[0]);
 delete_raw:
 	trace(LOG_INFO, "[main] close RAW socket");
 	close(raw);
@@ -766,21 +1728,46 @@ delete_tun:
 	trace(LOG_INFO, "[main] close TUN interface");
 	close(tun);
 close_tcp:
-	trace(LOG_INFO, "[main] close TCP server socket");
-	close(serv_socket);
+	if(serv_socket >= 0)
+	{
+		trace(LOG_INFO, "[main] close TCP server socket");
+		close(serv_socket);
+	}
+close_drain:
+	if(drain_ctrl >= 0)
+	{
+		close(drain_ctrl);
+	}
+	if(drain_sock >= 0)
+	{
+		close(drain_sock);
+	}
+	free(drain_addrs);
 free_dh:
-	gnutls_dh_params_deinit(dh_params);
+	if(has_dh_params)
+	{
+		gnutls_dh_params_deinit(dh_params);
+	}
+free_ticket_key:
+	gnutls_free(server_opts.tls_ticket_key.data);
 deinit_tls:
 	trace(LOG_INFO, "[main] release TLS resources");
 	gnutls_certificate_free_credentials(server_opts.tls_cred);
 	gnutls_priority_deinit(server_opts.priority_cache);
 	gnutls_global_deinit();
-/*free_client_contexts:*/
-	free(clients);
+free_completion_queue:
+	iprohc_completion_queue_free(&completion_queue);
+free_resume_cache:
+	iprohc_resume_cache_free(&resume_cache);
+free_client_contexts:
+	iprohc_clients_free(&clients);
+free_addr_pool:
+	iprohc_addr_pool_free(&addr_pool);
 close_signal_fd:
 	close(signal_fd);
 remove_pidfile:
-	if(strcmp(server_opts.pidfile_path, "") != 0)
+	/* the new server already wrote its PID in the pidfile */
+	if(strcmp(server_opts.pidfile_path, "") != 0 && !is_handed_over)
 	{
 		trace(LOG_INFO, "[main] remove pidfile '%s'", server_opts.pidfile_path);
 		unlink(server_opts.pidfile_path);
@@ -794,6 +1781,7 @@ error:
 	{
 		trace(LOG_NOTICE, "[main] server stops with exit code %d", exit_status);
 	}
+	iprohc_log_stop();
 	trace(LOG_INFO, "[main] close syslog session");
 	closelog();
 	return exit_status;
@@ -801,90 +1789,162 @@ error:
 
 
 /**
- * @brief Accept or reject a new client session
+ * @brief Accept or reject the new client sessions waiting in the backlog
+ *
+ * Connections are accepted by batches until the backlog is empty, or until
+ * the maximum number of concurrent handshakes is reached: the remaining
+ * connections then wait in the backlog.
  *
- * @param serv_sock           The server socket in listen state
- * @param clients             The contexts for all clients
- * @param[in,out] clients_nr  The number of clients currently connected
- * @param clients_max_nr      The maximum number of clients accepted
- * @param raw                 The RAW socket
- * @param tun                 The file descriptor of the TUN interface
- * @param tun_itf_mtu         The MTU of the TUN interface
- * @param basedev_mtu         The MTU of the underlying interface
- * @param server_opts         The server configuration
- * @return                    true if client session was accepted or rejected,
- *                            false if a problem occurred during acception/rejection
+ * @param serv_sock             The server socket in listen state
+ * @param clients               The contexts for all clients
+ * @param addr_pool             The pool of tunnel addresses
+ * @param[in,out] clients_nr    The number of clients currently connected
+ * @param clients_max_nr        The maximum number of clients accepted
+ * @param admission             The admission control context
+ * @param[in,out] handshakes_nr The number of clients currently connecting
+ * @param raw                   The RAW socket
+ * @param tun                   The file descriptor of the TUN interface
+ * @param tun_itf_mtu           The MTU of the TUN interface
+ * @param basedev_mtu           The MTU of the underlying interface
+ * @param server_opts           The server configuration
+ * @return                      true if client sessions were accepted or rejected,
+ *                              false if a problem occurred during acception/rejection
  */
-static bool iprohc_server_handle_new_client(const int serv_sock,
-                                            struct iprohc_server_session *const clients,
-                                            size_t *const clients_nr,
-                                            const size_t clients_max_nr,
-                                            const int raw,
-                                            const int tun,
-                                            const size_t tun_itf_mtu,
-                                            const size_t basedev_mtu,
-                                            const struct server_opts server_opts)
+static bool iprohc_server_handle_new_clients(const int serv_sock,
+                                             struct iprohc_clients *const clients,
+                                             struct iprohc_addr_pool *const addr_pool,
+                                             size_t *const clients_nr,
+                                             const size_t clients_max_nr,
+                                             struct iprohc_admission *const admission,
+                                             volatile AO_t *const handshakes_nr,
+                                             const int raw,
+                                             const int tun,
+                                             const size_t tun_itf_mtu,
+                                             const size_t basedev_mtu,
+                                             const struct server_opts server_opts)
 {
-	struct sockaddr_in remote_addr;
-	socklen_t remote_addr_len = sizeof(struct sockaddr_in);
-	int conn;
+	const size_t batch_max_nr = 64;
+	size_t batch_nr;
+	bool is_ok = true;
 
 	assert(serv_sock >= 0);
 	assert(clients != NULL);
 	assert(clients_nr != NULL);
 	assert(clients_max_nr > 0);
-	assert((*clients_nr) <= clients_max_nr);
 	assert(raw >= 0);
 	assert(tun >= 0);
 
-	/* accept connection */
-	conn = accept(serv_sock, (struct sockaddr *) &remote_addr, &remote_addr_len);
-	if(conn < 0)
-	{
-		trace(LOG_ERR, "[main] failed to accept new connection on socket %d: %s (%d)",
-				serv_sock, strerror(errno), errno);
-		goto error;
-	}
-
-	/* enough resources for a new client? */
-	if((*clients_nr) >= clients_max_nr)
-	{
-		/* not enough resource, kick the new client away */
-		trace(LOG_ERR, "[main] no more clients accepted, maximum %zu reached",
-		      clients_max_nr);
-
-		/* reject connection */
-		close(conn);
-	}
-	else
+	for(batch_nr = 0; batch_nr < batch_max_nr; batch_nr++)
 	{
+		struct sockaddr_in remote_addr;
+		socklen_t remote_addr_len = sizeof(struct sockaddr_in);
+		struct iprohc_server_session *client;
+		struct in_addr local_addr;
 		size_t client_id;
+		int conn;
 		int ret;
 
-		/* find the first free context for the new client */
-		for(client_id = 0; client_id < clients_max_nr &&
-		    AO_load_acquire_read(&(clients[client_id].is_init)); client_id++)
+		/* too many clients are connecting, let the others wait in backlog */
+		if(admission->params.max_handshakes > 0 &&
+		   AO_load(handshakes_nr) >= admission->params.max_handshakes)
+		{
+			break;
+		}
+
+		/* accept connection */
+		conn = accept4(serv_sock, (struct sockaddr *) &remote_addr,
+		               &remote_addr_len, SOCK_CLOEXEC);
+		if(conn < 0)
 		{
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				trace(LOG_ERR, "[main] failed to accept new connection on socket "
+				      "%d: %s (%d)", serv_sock, strerror(errno), errno);
+				is_ok = false;
+			}
+			break;
 		}
-		assert(client_id < clients_max_nr);
+
+		/* enough resources for a new client? */
+		if((*clients_nr) >= clients_max_nr)
+		{
+			/* not enough resource, kick the new client away */
+			trace(LOG_ERR, "[main] no more clients accepted, maximum %zu reached",
+			      clients_max_nr);
+			admission->over_capacity_nr++;
+			close(conn);
+			continue;
+		}
+
+		/* too many connections from the source prefix? */
+		if(!iprohc_admission_allow(admission, remote_addr.sin_addr))
+		{
+			trace(LOG_NOTICE, "[main] reject connection from " IPV4_ADDR_FMT
+			      ": rate limit reached for its source prefix",
+			      IPV4_ADDR(ntohl(remote_addr.sin_addr.s_addr)));
+			close(conn);
+			continue;
+		}
+
+		/* give the new client the tunnel address of its lost session if its
+		 * ROHC contexts are still kept, a free address otherwise: the index
+		 * of the address is the index of the client context */
+		if(iprohc_resume_cache_claim_addr(server_opts.resume_cache,
+		                                  remote_addr.sin_addr, &local_addr))
+		{
+			client_id = iprohc_addr_pool_index(addr_pool, local_addr);
+		}
+		else if(iprohc_addr_pool_alloc(addr_pool, &client_id))
+		{
+			local_addr = iprohc_addr_pool_addr(addr_pool, client_id);
+		}
+		else
+		{
+			trace(LOG_ERR, "[main] no more tunnel address available, reject "
+			      "connection from " IPV4_ADDR_FMT,
+			      IPV4_ADDR(ntohl(remote_addr.sin_addr.s_addr)));
+			admission->over_capacity_nr++;
+			close(conn);
+			continue;
+		}
+		assert(client_id < addr_pool->addrs_nr);
 		trace(LOG_INFO, "[main] will store client %zu/%zu at index %zu",
 		      (*clients_nr) + 1, clients_max_nr, client_id);
 
-		ret = new_client(conn, remote_addr, raw, tun, tun_itf_mtu, basedev_mtu,
-		                 &(clients[client_id]), client_id, server_opts);
+		client = iprohc_clients_alloc(clients, client_id);
+		if(client == NULL)
+		{
+			iprohc_addr_pool_release(addr_pool, client_id);
+			close(conn);
+			is_ok = false;
+			continue;
+		}
+
+		ret = new_client(conn, remote_addr, local_addr, raw, tun, tun_itf_mtu,
+		                 basedev_mtu, client, client_id, server_opts);
 		if(ret < 0)
 		{
 			trace(LOG_ERR, "[main] failed to init new client session (%d)\n", ret);
+			iprohc_addr_pool_release(addr_pool, client_id);
 			close(conn);
-			goto error;
+			is_ok = false;
+			continue;
 		}
-		
+
+		/* the client thread stops counting the client once connected */
+		client->handshakes_nr = handshakes_nr;
+		client->is_handshake_pending = true;
+		AO_fetch_and_add1(handshakes_nr);
+
 		/* start client thread */
-		if(!iprohc_session_start(&(clients[client_id].session)))
+		if(!iprohc_session_start(&(client->session)))
 		{
 			trace(LOG_ERR, "[main] failed to start client thread");
-			del_client(&(clients[client_id]));
-			goto error;
+			iprohc_server_session_handshake_done(client);
+			del_client(client);
+			iprohc_addr_pool_release(addr_pool, client_id);
+			is_ok = false;
+			continue;
 		}
 
 		/* one client more */
@@ -892,10 +1952,198 @@ static bool iprohc_server_handle_new_client(const int serv_sock,
 		(*clients_nr)++;
 	}
 
+	return is_ok;
+}
+
+
+/**
+ * @brief Reload the configuration file of the server
+ *
+ * The new tunnel parameters, maximum number of clients and memory settings
+ * apply to the new sessions. If configured so, the established sessions get
+ * the new packing level and keepalive timeout too: their threads apply them
+ * and tell their clients.
+ *
+ * The other attributes and the profiles need a restart, their changes are
+ * ignored.
+ *
+ * @param conf_file            The path to the configuration file
+ * @param[in,out] server_opts  The server configuration
+ * @param is_fd_limited        Whether the number of file descriptors is
+ *                             limited to what the clients need
+ * @param clients              The contexts of all clients
+ * @return                      true if the configuration was reloaded,
+ *                              false if the new configuration is invalid
+ */
+static bool iprohc_server_reload_config(const char *const conf_file,
+                                        struct server_opts *const server_opts,
+                                        const bool is_fd_limited,
+                                        const struct iprohc_clients *const clients)
+{
+	struct server_opts new_opts;
+	struct iprohc_profiles *new_profiles;
+	struct iprohc_server_session *client;
+	size_t client_id;
+	bool are_params_changed;
+
+	trace(LOG_NOTICE, "[main] reload configuration file '%s'", conf_file);
+
+	/* the profiles are parsed again to detect their changes only */
+	new_profiles = calloc(1, sizeof(struct iprohc_profiles));
+	if(new_profiles == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to allocate memory for the profiles");
+		return false;
+	}
+	memcpy(&new_opts, server_opts, sizeof(struct server_opts));
+	new_opts.profiles = new_profiles;
+	if(!iprohc_server_load_config(conf_file, &new_opts))
+	{
+		trace(LOG_ERR, "[main] invalid configuration, keep the current one");
+		free(new_profiles);
+		return false;
+	}
+	if(memcmp(new_profiles, server_opts->profiles,
+	          sizeof(struct iprohc_profiles)) != 0)
+	{
+		trace(LOG_WARNING, "[main] the changes of the profiles need a restart, "
+		      "they are ignored");
+	}
+	free(new_profiles);
+
+	if(new_opts.port != server_opts->port ||
+	   new_opts.local_address != server_opts->local_address ||
+	   new_opts.netmask != server_opts->netmask ||
+	   strcmp(new_opts.pkcs12_f, server_opts->pkcs12_f) != 0 ||
+	   strcmp(new_opts.tls_priority, server_opts->tls_priority) != 0 ||
+	   strcmp(new_opts.dh_params_path, server_opts->dh_params_path) != 0 ||
+	   strcmp(new_opts.upgrade_path, server_opts->upgrade_path) != 0 ||
+	   strcmp(new_opts.metrics_endpoint, server_opts->metrics_endpoint) != 0 ||
+	   strcmp(new_opts.admin_path, server_opts->admin_path) != 0 ||
+	   strcmp(new_opts.collectd_path, server_opts->collectd_path) != 0 ||
+	   new_opts.collectd_interval != server_opts->collectd_interval ||
+	   strcmp(new_opts.log_path, server_opts->log_path) != 0 ||
+	   new_opts.ingress_fanout != server_opts->ingress_fanout ||
+	   new_opts.resume_timeout != server_opts->resume_timeout ||
+	   memcmp(&new_opts.admission, &server_opts->admission,
+	          sizeof(struct iprohc_admission_params)) != 0 ||
+	   !iprohc_thread_sched_is_equal(&new_opts.control_sched,
+	                                 &server_opts->control_sched) ||
+	   !iprohc_thread_sched_is_equal(&new_opts.route_sched,
+	                                 &server_opts->route_sched) ||
+	   !iprohc_thread_sched_is_equal(&new_opts.session_sched,
+	                                 &server_opts->session_sched))
+	{
+		trace(LOG_WARNING, "[main] the changes of the port, addresses, TLS, "
+		      "upgrade, metrics, administration, collectd, log file, resume, "
+		      "admission or scheduling attributes need a restart, they are "
+		      "ignored");
+	}
+
+	/* the new clients need file descriptors, the clients over a lowered
+	 * maximum keep their sessions and thus their file descriptors */
+	if(is_fd_limited && new_opts.clients_max_nr > server_opts->clients_max_nr &&
+	   !iprohc_server_set_fd_limit(server_opts->ingress_fanout,
+	                               new_opts.clients_max_nr))
+	{
+		trace(LOG_WARNING, "[main] keep the maximum number of clients to %zu",
+		      server_opts->clients_max_nr);
+		new_opts.clients_max_nr = server_opts->clients_max_nr;
+	}
+
+	are_params_changed =
+		(new_opts.params.packing != server_opts->params.packing ||
+		 new_opts.params.keepalive_timeout != server_opts->params.keepalive_timeout);
+
+	/* new sessions */
+	server_opts->clients_max_nr = new_opts.clients_max_nr;
+	server_opts->params.packing = new_opts.params.packing;
+	server_opts->params.max_cid = new_opts.params.max_cid;
+	server_opts->params.is_unidirectional = new_opts.params.is_unidirectional;
+	server_opts->params.keepalive_timeout = new_opts.params.keepalive_timeout;
+	server_opts->update_sessions = new_opts.update_sessions;
+	server_opts->drain_timeout = new_opts.drain_timeout;
+	server_opts->session_stack_size = new_opts.session_stack_size;
+	server_opts->compact_sessions = new_opts.compact_sessions;
+	trace(LOG_NOTICE, "[main] configuration reloaded: %zu clients max, packing "
+	      "%d, max CID %zu, keepalive %zu seconds", server_opts->clients_max_nr,
+	      server_opts->params.packing, server_opts->params.max_cid,
+	      server_opts->params.keepalive_timeout);
+
+	/* established sessions: the packing level chosen by the client or its
+	 * profile is kept, the keepalive timeout only changes for the clients that
+	 * are told and that have no keepalive timeout in their profiles */
+	if(server_opts->update_sessions && are_params_changed)
+	{
+		size_t updated_nr = 0;
+
+		for(client_id = 0;
+		    (client = iprohc_clients_next(clients, &client_id)) != NULL;
+		    client_id++)
+		{
+			const struct iprohc_profile *const profile = client->profile;
+			const char packing =
+				((client->is_packing_requested ||
+				  (profile != NULL && profile->packing >= 0)) ?
+				 client->session.tunnel.params.packing :
+				 server_opts->params.packing);
+			const size_t keepalive_timeout =
+				((client->proto_version >= IPROHC_PROTO_VERSION_PARAMS_UPDATE &&
+				  (profile == NULL || profile->keepalive_timeout < 0)) ?
+				 server_opts->params.keepalive_timeout :
+				 client->session.tunnel.params.keepalive_timeout);
+
+			if(!AO_load_acquire_read(&(client->session.is_thread_running)))
+			{
+				continue;
+			}
+			if(!iprohc_session_update_params(&(client->session), packing,
+			                                 keepalive_timeout, true))
+			{
+				trace(LOG_ERR, "[main] failed to update the parameters of client "
+				      "#%zu", client_id);
+				continue;
+			}
+			updated_nr++;
+		}
+		trace(LOG_NOTICE, "[main] new parameters given to %zu established "
+		      "sessions", updated_nr);
+	}
+
 	return true;
+}
 
-error:
-	return false;
+
+/**
+ * @brief Limit the number of file descriptors to what the clients need
+ *
+ * @param ingress_fanout  The number of threads that receive the traffic of
+ *                        the tunnels
+ * @param clients_max_nr  The maximum number of clients
+ * @return                true if the limit was set, false otherwise
+ */
+static bool iprohc_server_set_fd_limit(const size_t ingress_fanout,
+                                       const size_t clients_max_nr)
+{
+	const size_t fds_nr_base = 23U + ingress_fanout * 3U;
+	const size_t fds_nr_per_client = 8U;
+	const size_t fds_max_nr = fds_nr_base + clients_max_nr * fds_nr_per_client;
+	const struct rlimit fd_limits = {
+		.rlim_cur = fds_max_nr,
+		.rlim_max = fds_max_nr + 1,
+	};
+
+	if(setrlimit(RLIMIT_NOFILE, &fd_limits) != 0)
+	{
+		trace(LOG_ERR, "[main] failed to set system limits: failed to limit "
+		      "the number of file descriptors to %zu: %s (%d)", fds_max_nr,
+		      strerror(errno), errno);
+		return false;
+	}
+	trace(LOG_INFO, "[main] set system limit for the number of file "
+	      "descriptors to %zu", fds_max_nr);
+
+	return true;
 }
 
 
@@ -904,10 +2152,18 @@ error:
  *
  * @warning THIS FUNCTION IS NOT THREAD-SAFE
  *
- * @param client  The client session
+ * @param client                 The client session
+ * @param[in,out] mem_total      The memory used by all clients, the memory
+ *                               used by the client is added
+ * @param[in,out] latency_total  The latencies of all clients, the latencies
+ *                               of the client are added
  */
-static void dump_stats_client(struct iprohc_server_session *const client)
+static void dump_stats_client(struct iprohc_server_session *const client,
+                              struct iprohc_session_mem *const mem_total,
+                              struct iprohc_server_latency *const latency_total)
 {
+	struct iprohc_session_mem mem;
+
 	client_trace(client, LOG_INFO, "--------------------------------------------");
 	switch(client->session.status)
 	{
@@ -927,45 +2183,387 @@ static void dump_stats_client(struct iprohc_server_session *const client)
 	}
 	if(client->session.status == IPROHC_SESSION_CONNECTED)
 	{
+		struct statitics stats;
+		char latency_descr[IPROHC_LATENCY_DESCR_MAX_LEN];
 		int i;
 
+		/* the thread of the session keeps updating the stats */
+		iprohc_tunnel_get_stats(&(client->session.tunnel), &stats);
+
+		client_trace(client, LOG_INFO, "profile: %s",
+		             client->profile != NULL ? client->profile->name : "none");
 		client_trace(client, LOG_INFO, "packing: %d", client->session.tunnel.params.packing);
 		client_trace(client, LOG_INFO, "stats:");
-		client_trace(client, LOG_INFO, "  failed decompression:          %d",
-		             client->session.tunnel.stats.decomp_failed);
-		client_trace(client, LOG_INFO, "  total  decompression:          %d",
-		             client->session.tunnel.stats.decomp_total);
-		client_trace(client, LOG_INFO, "  failed compression:            %d",
-		             client->session.tunnel.stats.comp_failed);
-		client_trace(client, LOG_INFO, "  total  compression:            %d",
-		             client->session.tunnel.stats.comp_total);
-		client_trace(client, LOG_INFO, "  failed depacketization:        %d",
-		             client->session.tunnel.stats.unpack_failed);
-		client_trace(client, LOG_INFO, "  total received packets on raw: %d",
-		             client->session.tunnel.stats.total_received);
-		client_trace(client, LOG_INFO, "  total compressed header size:  %d bytes",
-		             client->session.tunnel.stats.head_comp_size);
-		client_trace(client, LOG_INFO, "  total compressed packet size:  %d bytes",
-		             client->session.tunnel.stats.total_comp_size);
-		client_trace(client, LOG_INFO, "  total header size before comp: %d bytes",
-		             client->session.tunnel.stats.head_uncomp_size);
-		client_trace(client, LOG_INFO, "  total packet size before comp: %d bytes",
-		             client->session.tunnel.stats.total_uncomp_size);
+		client_trace(client, LOG_INFO, "  failed decompression:          %" PRIu64,
+		             stats.decomp_failed);
+		client_trace(client, LOG_INFO, "  total  decompression:          %" PRIu64,
+		             stats.decomp_total);
+		client_trace(client, LOG_INFO, "  failed compression:            %" PRIu64,
+		             stats.comp_failed);
+		client_trace(client, LOG_INFO, "  total  compression:            %" PRIu64,
+		             stats.comp_total);
+		client_trace(client, LOG_INFO, "  failed depacketization:        %" PRIu64,
+		             stats.unpack_failed);
+		client_trace(client, LOG_INFO, "  total received packets on raw: %" PRIu64,
+		             stats.total_received);
+		client_trace(client, LOG_INFO, "  total compressed header size:  %" PRIu64
+		             " bytes", stats.head_comp_size);
+		client_trace(client, LOG_INFO, "  total compressed packet size:  %" PRIu64
+		             " bytes", stats.total_comp_size);
+		client_trace(client, LOG_INFO, "  total header size before comp: %" PRIu64
+		             " bytes", stats.head_uncomp_size);
+		client_trace(client, LOG_INFO, "  total packet size before comp: %" PRIu64
+		             " bytes", stats.total_uncomp_size);
 		client_trace(client, LOG_INFO, "stats packing:");
-		for(i = 1; i < client->session.tunnel.stats.n_stats_packing; i++)
+		for(i = 1; i <= client->session.tunnel.params.packing; i++)
+		{
+			client_trace(client, LOG_INFO, "  %d packets: %" PRIu64, i,
+			             stats.stats_packing[i]);
+		}
+		client_trace(client, LOG_INFO, "stats errors:");
+		for(i = 0; i < IPROHC_TUNNEL_ERR_MAX; i++)
 		{
-			client_trace(client, LOG_INFO, "  %d packets: %d", i,
-			             client->session.tunnel.stats.stats_packing[i]);
+			const struct iprohc_tunnel_err *const err = &(stats.errors[i]);
+			if(err->total_nr > 0)
+			{
+				client_trace(client, LOG_INFO, "  %s: %" PRIu64 " (%" PRIu64
+				             " not logged yet)", iprohc_tunnel_err_descr(i),
+				             err->total_nr, err->suppressed_nr);
+			}
+		}
+		client_trace(client, LOG_INFO, "stats flows:");
+		for(i = 0; i <= ROHC_SMALL_CID_MAX; i++)
+		{
+			const struct iprohc_tunnel_flow *const flow = &(stats.flows[i]);
+			if(flow->packets_nr > 0)
+			{
+				client_trace(client, LOG_INFO, "  CID %d: profile %s, state %s, "
+				             "%" PRIu64 " packets (%" PRIu64 " IR, %" PRIu64 " IR-DYN), "
+				             "%" PRId64 " header bytes saved", i,
+				             rohc_get_profile_descr(flow->profile_id),
+				             rohc_comp_get_state_descr(flow->state),
+				             flow->packets_nr, flow->ir_nr, flow->ir_dyn_nr,
+				             (int64_t) (flow->head_uncomp_size - flow->head_comp_size));
+			}
 		}
+		client_trace(client, LOG_INFO, "latencies:");
+		(void) iprohc_latency_format(&(stats.packing_hold), latency_descr,
+		                             IPROHC_LATENCY_DESCR_MAX_LEN);
+		client_trace(client, LOG_INFO, "  packing hold:  %s", latency_descr);
+		(void) iprohc_latency_format(&(stats.comp_time), latency_descr,
+		                             IPROHC_LATENCY_DESCR_MAX_LEN);
+		client_trace(client, LOG_INFO, "  compression:   %s", latency_descr);
+		(void) iprohc_latency_format(&(stats.decomp_time), latency_descr,
+		                             IPROHC_LATENCY_DESCR_MAX_LEN);
+		client_trace(client, LOG_INFO, "  decompression: %s", latency_descr);
+		iprohc_latency_merge(&(latency_total->packing_hold), &(stats.packing_hold));
+		iprohc_latency_merge(&(latency_total->comp_time), &(stats.comp_time));
+		iprohc_latency_merge(&(latency_total->decomp_time), &(stats.decomp_time));
 	}
+
+	iprohc_server_session_get_mem(client, &mem);
+	client_trace(client, LOG_INFO, "memory: %zu bytes%s",
+	             iprohc_session_mem_sum(&mem),
+	             (client->session.is_compact &&
+	              iprohc_session_mem_sum(&mem) > IPROHC_SESSION_COMPACT_TARGET ?
+	              " (above the compact target)" : ""));
+	client_trace(client, LOG_INFO, "  context:        %zu bytes", mem.context);
+	client_trace(client, LOG_INFO, "  thread stack:   %zu bytes (%zu bytes "
+	             "reserved)", mem.stack_resident, mem.stack_reserved);
+	client_trace(client, LOG_INFO, "  packing frame:  %zu bytes", mem.packing_frame);
+	client_trace(client, LOG_INFO, "  ROHC contexts:  ~%zu bytes (approximate "
+	             "heap growth)", mem.rohc);
+	client_trace(client, LOG_INFO, "  TLS session:    ~%zu bytes (approximate "
+	             "heap growth)", mem.tls);
+	client_trace(client, LOG_INFO, "  file descriptors: %zu", mem.fds_nr);
+	mem_total->context += mem.context;
+	mem_total->stack_reserved += mem.stack_reserved;
+	mem_total->stack_resident += mem.stack_resident;
+	mem_total->packing_frame += mem.packing_frame;
+	mem_total->rohc += mem.rohc;
+	mem_total->tls += mem.tls;
+	mem_total->fds_nr += mem.fds_nr;
+
 	client_trace(client, LOG_INFO, "--------------------------------------------");
 }
 
 
+/**
+ * @brief Sum the memory used by the components of one or more sessions
+ *
+ * The stack is accounted for its resident pages only.
+ *
+ * @param mem  The memory used by the sessions, by component
+ * @return     The number of bytes used by the sessions
+ */
+static size_t iprohc_session_mem_sum(const struct iprohc_session_mem *const mem)
+{
+	return (mem->context + mem->stack_resident + mem->packing_frame +
+	        mem->rohc + mem->tls);
+}
+
+
+/**
+ * @brief Hand the server resources over to a new server, and get ready to
+ *        drain the established sessions
+ *
+ * @param upgrade_sock      The upgrade socket connected to the new server
+ * @param serv_sock         The TCP socket in listen state
+ * @param tun               The file descriptor of the TUN interface
+ * @param tun_itf_id        The index of the TUN interface
+ * @param tun_itf_mtu       The MTU of the TUN interface
+ * @param basedev_mtu       The MTU of the underlying interface
+ * @param ticket_key        The TLS session ticket key
+ * @param clients           The client contexts
+ * @param clients_nr        The number of clients
+ * @param[out] drain_sock   The socket the TUN packets of the clients of the
+ *                          other server go through during the drain
+ * @param[out] drain_ctrl   The socket the released tunnel addresses are told
+ *                          to the new server through during the drain
+ * @return                  true if the new server took over,
+ *                          false if a problem occurred
+ */
+static bool iprohc_server_hand_over(const int upgrade_sock,
+                                    const int serv_sock,
+                                    const int tun,
+                                    const int tun_itf_id,
+                                    const size_t tun_itf_mtu,
+                                    const size_t basedev_mtu,
+                                    const gnutls_datum_t *const ticket_key,
+                                    const struct iprohc_clients *const clients,
+                                    const size_t clients_nr,
+                                    int *const drain_sock,
+                                    int *const drain_ctrl)
+{
+	struct iprohc_upgrade_state state;
+	struct iprohc_server_session *client;
+	int drain_socks[2];
+	int drain_ctrls[2];
+	size_t client_id;
+	bool is_ok = false;
+	int ret;
+
+	if(ticket_key->size > IPROHC_UPGRADE_TICKET_KEY_MAX_LEN)
+	{
+		trace(LOG_ERR, "[main] TLS session ticket key too large: %u bytes",
+		      ticket_key->size);
+		goto error;
+	}
+
+	memset(&state, 0, sizeof(struct iprohc_upgrade_state));
+	state.serv_sock = serv_sock;
+	state.tun = tun;
+	state.tun_itf_id = tun_itf_id;
+	state.tun_itf_mtu = tun_itf_mtu;
+	state.basedev_mtu = basedev_mtu;
+	state.ticket_key_len = ticket_key->size;
+	memcpy(state.ticket_key, ticket_key->data, ticket_key->size);
+
+	/* the tunnel addresses of the established sessions */
+	state.drain_addrs = calloc(max(clients_nr, 1), sizeof(struct in_addr));
+	if(state.drain_addrs == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to allocate memory for the tunnel addresses "
+		      "of %zu sessions", clients_nr);
+		goto wipe_key;
+	}
+	for(client_id = 0;
+	    state.drain_addrs_nr < clients_nr &&
+	    (client = iprohc_clients_next(clients, &client_id)) != NULL;
+	    client_id++)
+	{
+		state.drain_addrs[state.drain_addrs_nr] = client->session.local_address;
+		state.drain_addrs_nr++;
+	}
+
+	ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, drain_socks);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to create drain socket: %s (%d)",
+		      strerror(errno), errno);
+		goto free_addrs;
+	}
+	ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, drain_ctrls);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to create drain control socket: %s (%d)",
+		      strerror(errno), errno);
+		goto close_drain_socks;
+	}
+	state.drain_sock = drain_socks[1];
+	state.drain_ctrl = drain_ctrls[1];
+
+	if(!iprohc_upgrade_send(upgrade_sock, &state))
+	{
+		goto close_drain_ctrls;
+	}
+
+	/* the new server has its own copies of the other ends */
+	close(drain_ctrls[1]);
+	close(drain_socks[1]);
+	*drain_sock = drain_socks[0];
+	*drain_ctrl = drain_ctrls[0];
+	is_ok = true;
+	goto free_addrs;
+
+close_drain_ctrls:
+	close(drain_ctrls[1]);
+	close(drain_ctrls[0]);
+close_drain_socks:
+	close(drain_socks[1]);
+	close(drain_socks[0]);
+free_addrs:
+	free(state.drain_addrs);
+wipe_key:
+	memset(state.ticket_key, 0, IPROHC_UPGRADE_TICKET_KEY_MAX_LEN);
+error:
+	return is_ok;
+}
+
+
+/**
+ * @brief Filter the RAW ingress traffic on the addresses of the current clients
+ *
+ * The kernel drops the IP/ROHC packets from unknown sources, so that they
+ * never wake up the routing threads.
+ *
+ * @param clients         The client contexts
+ * @param clients_nr      The number of clients
+ * @param routes          The RAW routing contexts and their sockets
+ * @param routes_nr       The number of RAW routing contexts
+ * @param is_fanout       Whether the sockets are AF_PACKET sockets of the
+ *                        RAW ingress fanout group
+ * @return                true if all the filters were successfully updated,
+ *                        false if a problem occurred
+ */
+static bool iprohc_server_update_ingress_filters(const struct iprohc_clients *const clients,
+                                                 const size_t clients_nr,
+                                                 const struct route_args *const routes,
+                                                 const size_t routes_nr,
+                                                 const bool is_fanout)
+{
+	const struct iprohc_server_session *client;
+	uint32_t *src_addrs;
+	size_t src_addrs_nr = 0;
+	bool is_ok = false;
+
+	src_addrs = calloc(max(clients_nr, 1), sizeof(uint32_t));
+	if(src_addrs == NULL)
+	{
+		trace(LOG_ERR, "[main] failed to allocate memory for %zu client "
+		      "addresses", clients_nr);
+		goto error;
+	}
+	for(size_t i = 0;
+	    src_addrs_nr < clients_nr && (client = iprohc_clients_next(clients, &i)) != NULL;
+	    i++)
+	{
+		src_addrs[src_addrs_nr] = client->session.dst_addr.s_addr;
+		src_addrs_nr++;
+	}
+
+	for(size_t i = 0; i < routes_nr; i++)
+	{
+		if(!iprohc_bpf_filter_attach(routes[i].fd, is_fanout, INADDR_ANY,
+		                             src_addrs, src_addrs_nr))
+		{
+			trace(LOG_ERR, "[main] failed to filter traffic of RAW routing "
+			      "thread #%zu", i);
+			goto free_addrs;
+		}
+	}
+	trace(LOG_DEBUG, "[main] RAW ingress traffic filtered for %zu clients",
+	      src_addrs_nr);
+
+	is_ok = true;
+
+free_addrs:
+	free(src_addrs);
+error:
+	return is_ok;
+}
+
+
+/**
+ * @brief Copy the hand-off latencies of the given routing thread
+ *
+ * @param route         The route context
+ * @param[out] handoff  The copy of the hand-off latencies
+ */
+static void iprohc_server_get_handoff(const struct route_args *const route,
+                                      struct iprohc_latency *const handoff)
+{
+	AO_t seq;
+
+	do
+	{
+		seq = iprohc_seqlock_read_begin(&(route->handoff_seq));
+		memcpy(handoff, &(route->handoff), sizeof(struct iprohc_latency));
+	}
+	while(iprohc_seqlock_read_retry(&(route->handoff_seq), seq));
+}
+
+
+/**
+ * @brief Start one routing thread on its CPUs with its scheduling policy
+ *
+ * @param[out] thread  The routing thread
+ * @param args         The route context
+ * @param sched        The CPU placement and scheduling policy of the thread
+ * @return             true if the thread was successfully started,
+ *                     false if a problem occurred
+ */
+static bool iprohc_server_start_route(pthread_t *const thread,
+                                      struct route_args *const args,
+                                      const struct iprohc_thread_sched *const sched)
+{
+	pthread_attr_t attr;
+	bool is_ok = false;
+	int ret;
+
+	ret = pthread_attr_init(&attr);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to init thread attributes: %s (%d)",
+		      strerror(ret), ret);
+		goto error;
+	}
+	if(!iprohc_thread_attr_set_sched(&attr, sched))
+	{
+		trace(LOG_ERR, "[main] failed to set CPU placement and scheduling policy");
+		goto destroy_attr;
+	}
+
+	ret = pthread_create(thread, &attr, route, (void *) args);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[main] failed to create thread: %s (%d)",
+		      strerror(ret), ret);
+		goto destroy_attr;
+	}
+	is_ok = true;
+
+destroy_attr:
+	pthread_attr_destroy(&attr);
+error:
+	return is_ok;
+}
+
+
 /**
  * @brief Route RAW or TUN traffic to related clients
  *
  * Use client's IP address to route traffic to the related client socketpair.
+ * The threads of the RAW ingress fanout group decompress the traffic of the
+ * client instead, and write the IP packets to the TUN interface: the fanout
+ * hash sends all the traffic of one client to the same thread. The time from
+ * the read of every packet to its write towards the session, or to TUN, is
+ * recorded in the hand-off latencies of the route context.
+ *
+ * While the old server drains its sessions after an upgrade, both servers
+ * read the TUN interface: the TUN thread forwards the packets of the clients
+ * of the other server through the drain socket, and routes the packets the
+ * other server forwards to its own clients, never back.
  *
  * @param arg  The route context
  * @return     Always NULL
@@ -973,16 +2571,16 @@ static void dump_stats_client(struct iprohc_server_session *const client)
 static void * route(void *arg)
 {
 	/* Getting args */
-	const struct route_args *const _arg = (struct route_args *) arg;
+	struct route_args *const _arg = (struct route_args *) arg;
 	int fd = _arg->fd;
-	struct iprohc_server_session *clients = _arg->clients;
-	size_t clients_max_nr = _arg->clients_max_nr;
+	const struct iprohc_clients *const clients = _arg->clients;
+	const struct iprohc_addr_pool *const addr_pool = _arg->addr_pool;
 	enum type_route type = _arg->type;
+	int drain_fd = _arg->drain_fd;
 
 	bool is_route_thread_alive = true;
 	size_t len;
 	int ret;
-	int i;
 
 	struct epoll_event poll_pipe;
 	struct epoll_event poll_sock;
@@ -998,6 +2596,10 @@ static void * route(void *arg)
 	uint32_t*src_ip;
 	uint32_t*dest_ip;
 
+	uint64_t read_time;
+	bool is_routed;
+	bool is_forwarded;
+
 	trace(LOG_INFO, "[route] Initializing routing thread");
 
 	/* we want to monitor some fds */
@@ -1033,6 +2635,9 @@ static void * route(void *arg)
 		goto close_pollfd;
 	}
 
+	/* will monitor the packets the previous server forwards */
+	drain_fd = route_watch_drain(pollfd, drain_fd);
+
 	while(is_route_thread_alive)
 	{
 		/* wait for events */
@@ -1047,16 +2652,38 @@ static void * route(void *arg)
 			continue;
 		}
 
-		/* stop thread if main thread closed the write side of the pipe */
+		/* stop thread if main thread closed the write side of the pipe, start
+		 * forwarding packets if it wrote the drain socket of a new server */
 		if(events[0].data.fd == _arg->p2c[0])
 		{
-			goto quit;
+			int new_drain_fd;
+
+			ret = read(_arg->p2c[0], &new_drain_fd, sizeof(int));
+			if(ret != sizeof(int))
+			{
+				goto quit;
+			}
+			if(drain_fd >= 0)
+			{
+				close(drain_fd);
+			}
+			drain_fd = route_watch_drain(pollfd, new_drain_fd);
+			continue;
 		}
 
-		if(events[0].data.fd == fd)
+		if(events[0].data.fd == fd || events[0].data.fd == drain_fd)
 		{
-			ret = read(fd, buffer, buffer_len);
-			if(ret < 0)
+			is_forwarded = (events[0].data.fd == drain_fd);
+			ret = read(events[0].data.fd, buffer, buffer_len);
+			if(ret <= 0 && is_forwarded)
+			{
+				trace(LOG_NOTICE, "[route] the other server stopped, stop "
+				      "forwarding packets to it");
+				close(drain_fd);
+				drain_fd = -1;
+				continue;
+			}
+			else if(ret < 0)
 			{
 				trace(LOG_ERR, "[route] read failed: %s (%d)", strerror(errno),
 				      errno);
@@ -1068,6 +2695,8 @@ static void * route(void *arg)
 				goto close_pollfd;
 			}
 			len = ret;
+			read_time = iprohc_latency_now();
+			is_routed = false;
 			trace(LOG_DEBUG, "[route] read %zu bytes", len);
 
 			/* Get packet destination IP if tun or source IP if raw */
@@ -1084,39 +2713,104 @@ static void * route(void *arg)
 				trace(LOG_DEBUG, "[route] packet source = %s", inet_ntoa(addr));
 			}
 
-			for(i = 0; i < clients_max_nr; i++)
+			/* Send to fake raw or tun device */
+			if(type == TUN)
 			{
-				/* Find associated client */
-				if(!AO_load_acquire_read(&(clients[i].is_init)))
+				/* the tunnel address of the client gives its context */
+				const size_t index = iprohc_addr_pool_index(addr_pool, addr);
+				struct iprohc_server_session *const client =
+					iprohc_clients_route(clients, index);
+
+				if(client != NULL && AO_load_acquire_read(&(client->is_init)) &&
+				   addr.s_addr == client->session.local_address.s_addr)
 				{
-					continue;
+					ret = write(client->fake_tun[1], buffer, len);
+					if(ret < 0)
+					{
+						trace(LOG_WARNING, "[route] failed to send %zu-byte packet "
+						      "to TUN interface: %s (%d)", len, strerror(errno), errno);
+					}
+					else if(ret != len)
+					{
+						trace(LOG_WARNING, "[route] partial write: only %d bytes of "
+						      "the %zu-byte packet were sent to the TUN interface",
+						      ret, len);
+					}
+					else
+					{
+						is_routed = true;
+					}
 				}
+				else if(drain_fd >= 0 && !is_forwarded && index < addr_pool->addrs_nr)
+				{
+					/* a client of the other server, do not wait for it */
+					ret = send(drain_fd, buffer, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+					if(ret == len)
+					{
+						is_routed = true;
+					}
+					else if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+					{
+						trace(LOG_NOTICE, "[route] the other server stopped, stop "
+						      "forwarding packets to it: %s (%d)", strerror(errno),
+						      errno);
+						close(drain_fd);
+						drain_fd = -1;
+					}
+					else
+					{
+						trace(LOG_DEBUG, "[route] failed to forward %zu-byte packet "
+						      "to the other server, drop it", len);
+					}
+				}
+			}
+			else
+			{
+				struct iprohc_server_session *client;
+				size_t i;
 
-				/* Send to fake raw or tun device */
-				if(type == TUN)
+				/* Find associated client */
+				for(i = 0; (client = iprohc_clients_next(clients, &i)) != NULL; i++)
 				{
-					if(addr.s_addr == clients[i].session.local_address.s_addr)
+					if(addr.s_addr == client->session.dst_addr.s_addr && _arg->is_decomp)
 					{
-						ret = write(clients[i].fake_tun[1], buffer, len);
-						if(ret < 0)
+						struct iprohc_session *const session = &(client->session);
+
+						/* the lock of the slot outlives the tunnel: the client
+						 * may be removed meanwhile, check it again under the lock */
+						pthread_mutex_lock(&(client->rohc_lock));
+						if(AO_load(&(client->is_init)) &&
+						   addr.s_addr == session->dst_addr.s_addr)
 						{
-							trace(LOG_WARNING, "[route] failed to send %zu-byte packet "
-							      "to TUN interface: %s (%d)", len, strerror(errno), errno);
+							/* the debug traces of the session are enabled meanwhile */
+							iprohc_log_thread_priority =
+								(AO_load(&(session->is_debug)) ? LOG_DEBUG : -1);
+							ret = iprohc_tunnel_decompress(&(session->tunnel),
+							                               session->src_addr.s_addr,
+							                               buffer, len);
+							iprohc_log_thread_priority = -1;
 						}
-						else if(ret != len)
+						else
 						{
-							trace(LOG_WARNING, "[route] partial write: only %d bytes of "
-							      "the %zu-byte packet were sent to the TUN interface",
-							      ret, len);
+							ret = 1;
+						}
+						pthread_mutex_unlock(&(client->rohc_lock));
+						if(ret == 0)
+						{
+							if(session->tunnel.params.capabilities &
+							   IPROHC_CAP_DATA_LIVENESS)
+							{
+								/* a valid data frame proves the peer alive as a
+								 * keepalive does */
+								AO_store(&(session->has_data_rx), 1);
+							}
+							is_routed = true;
 						}
 						break;
 					}
-				}
-				else
-				{
-					if(addr.s_addr == clients[i].session.dst_addr.s_addr)
+					else if(addr.s_addr == client->session.dst_addr.s_addr)
 					{
-						ret = write(clients[i].fake_raw[1], buffer, len);
+						ret = write(client->fake_raw[1], buffer, len);
 						if(ret < 0)
 						{
 							trace(LOG_WARNING, "[route] failed to send %zu-byte packet "
@@ -1129,10 +2823,22 @@ static void * route(void *arg)
 							      "the %zu-byte packet were sent to the underlying "
 							      "interface", ret, len);
 						}
+						else
+						{
+							is_routed = true;
+						}
 						break;
 					}
 				}
 			}
+
+			if(is_routed)
+			{
+				iprohc_seqlock_write_begin(&(_arg->handoff_seq));
+				iprohc_latency_record(&(_arg->handoff),
+				                      iprohc_latency_now() - read_time);
+				iprohc_seqlock_write_end(&(_arg->handoff_seq));
+			}
 		}
 	}
 
@@ -1141,6 +2847,45 @@ quit:
 close_pollfd:
 	close(pollfd);
 error:
+	if(drain_fd >= 0)
+	{
+		close(drain_fd);
+	}
 	return NULL;
 }
 
+
+/**
+ * @brief Monitor the drain socket in the epoll context of a routing thread
+ *
+ * @param pollfd    The epoll context of the routing thread
+ * @param drain_fd  The drain socket shared with the other server, -1 if none
+ * @return          The drain socket if monitored, -1 otherwise
+ */
+static int route_watch_drain(const int pollfd, const int drain_fd)
+{
+	struct epoll_event poll_drain;
+	int ret;
+
+	if(drain_fd < 0)
+	{
+		return -1;
+	}
+
+	poll_drain.events = EPOLLIN;
+	memset(&poll_drain.data, 0, sizeof(poll_drain.data));
+	poll_drain.data.fd = drain_fd;
+	ret = epoll_ctl(pollfd, EPOLL_CTL_ADD, drain_fd, &poll_drain);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "[route] failed to add drain socket to epoll context, do "
+		      "not forward packets to the other server: %s (%d)",
+		      strerror(errno), errno);
+		close(drain_fd);
+		return -1;
+	}
+
+	trace(LOG_INFO, "[route] forward packets of the clients of the other server");
+	return drain_fd;
+}
+
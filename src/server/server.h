@@ -19,28 +19,89 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #define IPROHC_SERVER_SERVER_H
 
 #include "tlv.h"
+#include "thread_helpers.h"
+#include "admission.h"
+#include "resume_cache.h"
+#include "completion.h"
+#include "addr_pool.h"
+#include "profile.h"
 
 #include <stdint.h>
 #include <net/if.h>
 #include <gnutls/gnutls.h>
 
+struct iprohc_clients;
+
 /* Structure defining global parameters for the server */
 struct server_opts
 {
 	gnutls_certificate_credentials_t tls_cred;
 	gnutls_priority_t priority_cache;
+	char tls_priority[1024];         /**< The TLS priority string */
+	gnutls_datum_t tls_ticket_key;   /**< The key to encrypt session tickets */
+	char dh_params_path[1024];       /**< The file of Diffie-Hellman parameters,
+	                                      empty for the RFC 7919 groups, "none"
+	                                      to disable DHE */
+	char upgrade_path[108];          /**< The UNIX socket a new server connects
+	                                      to to take over, empty to disable */
+	size_t drain_timeout;            /**< The time (in seconds) the sessions are
+	                                      drained after a new server took over */
+	char metrics_endpoint[108];      /**< The UNIX socket or the local TCP port
+	                                      metrics are scraped on, empty to
+	                                      disable */
+	char admin_path[108];            /**< The UNIX socket iprohc_ctl sends its
+	                                      commands to, empty to disable */
+	char collectd_path[108];         /**< The UNIX socket of collectd stats are
+	                                      pushed to, empty to disable */
+	size_t collectd_interval;        /**< The time (in seconds) between two
+	                                      pushes of stats to collectd */
 
 	size_t clients_max_nr;    /**< The maximum number of simultaneous clients */
 	int port;
 	char pkcs12_f[1024];
 	char pidfile_path[1024];
+	char log_path[1024];      /**< The file logs are written to, empty for
+	                               syslog */
 	char basedev[IFNAMSIZ];
 
 	uint32_t local_address;
 	size_t netmask;           /**< The length (in bits) of the network mask */
 
 	struct tunnel_params params;
+	struct iprohc_profiles *profiles; /**< The tunnel parameters by client
+	                                       certificate identity */
+	bool update_sessions;     /**< Whether the established sessions get the new
+	                               tunnel parameters on configuration reload */
+
+	struct iprohc_thread_sched control_sched; /**< The main thread placement */
+	struct iprohc_thread_sched route_sched;   /**< The route threads placement */
+	struct iprohc_thread_sched session_sched; /**< The client threads placement */
+	struct iprohc_admission_params admission; /**< The admission control */
+
+	size_t resume_timeout;    /**< The time (in seconds) the ROHC contexts of
+	                               lost sessions are kept, 0 to disable */
+	struct iprohc_resume_cache *resume_cache; /**< The ROHC contexts kept */
+	struct iprohc_completion_queue *completion_queue; /**< The sessions which
+	                                                       threads ended */
+	struct iprohc_addr_pool *addr_pool; /**< The tunnel addresses */
+	struct iprohc_clients *clients;     /**< The contexts of all clients */
+
+	size_t ingress_fanout;    /**< The number of AF_PACKET sockets and threads
+	                               for RAW ingress, 0 for one raw socket */
+
+	size_t session_stack_size; /**< The stack size (in bytes) of client threads */
+	bool compact_sessions;    /**< Whether idle client sessions release their
+	                               buffers and unused stack pages */
 };
 
+/** The default time (in seconds) the sessions are drained after an upgrade */
+#define IPROHC_DRAIN_TIMEOUT_DEFAULT  600U
+
+/** The default time (in seconds) between two pushes of stats to collectd */
+#define IPROHC_COLLECTD_INTERVAL_DEFAULT  10U
+
+/** The maximum number of AF_PACKET sockets in the RAW ingress fanout group */
+#define IPROHC_INGRESS_FANOUT_MAX  64U
+
 #endif
 
@@ -21,13 +21,53 @@ Config file is in (very) basic yaml format :
 general:
    port: xxx
    pidfile: xxx
+   logfile: xxx
    p12: xxx
+   tls_priority: xxx
+   dh_params: xxx
+   listen_backlog: xxx
+   upgrade_socket: xxx
+   drain_timeout: xxx
+   metrics: xxx
+   admin_socket: xxx
 
 tunnel:
    packing: xxx
    maxcid: xxx
+   resume_timeout: xxx
+   update_sessions: xxx
+
+admission:
+   prefix_len: xxx
+   rate: xxx
+   burst: xxx
+   max_handshakes: xxx
+
+scheduling:
+   control_cpus: xxx
+   route_cpus: xxx
+   session_cpus: xxx
+   realtime_priority: xxx
+   ingress_fanout: xxx
+
+memory:
+   session_stack: xxx
+   compact_sessions: xxx
+
+collectd:
+   socket: xxx
+   interval: xxx
+
+profile NAME:
+   identity: xxx
+   packing: xxx
+   maxcid: xxx
+   unidirectional: xxx
+   keepalive: xxx
+   ipaddr: xxx
 
-Only general and rohc are allowed, all the others are ignored, with a warning.
+Only general, tunnel, admission, scheduling, memory, collectd and profile
+sections are allowed, the others are rejected.
 The parser is deliberately simple for this use case so it :
  - limit the indentation to maximum 2
  - forbids sequence
@@ -36,10 +76,14 @@ The parser is deliberately simple for this use case so it :
 
 #include "log.h"
 #include "server.h"
+#include "session.h"
 
 #include <errno.h>
+#include <assert.h>
+#include <sched.h>
 #include <yaml.h>
 #include <arpa/inet.h>
+#include <rohc/rohc.h>
 
 
 
@@ -62,8 +106,7 @@ static bool iprohc_server_handle_config_line(const char *const section,
                                              struct server_opts *const server_opts)
 	__attribute__((warn_unused_result, nonnull(1, 2, 3, 4)));
 
-static size_t iprohc_get_ipv4_range_width(const uint32_t addr,
-                                          const size_t netmasklen)
+static size_t iprohc_get_ipv4_range_width(const size_t netmasklen)
 	__attribute__((warn_unused_result));
 
 static void dump_opts(const struct server_opts *const opts)
@@ -90,8 +133,7 @@ bool iprohc_server_load_config(const char *const conf_file,
 		goto error;
 	}
 
-	range_len = iprohc_get_ipv4_range_width(ntohl(server_opts->local_address),
-	                                        server_opts->netmask);
+	range_len = iprohc_get_ipv4_range_width(server_opts->netmask);
 	if(server_opts->clients_max_nr > range_len)
 	{
 		trace(LOG_ERR, "invalid configuration: not enough IP addresses for %zu "
@@ -104,6 +146,7 @@ bool iprohc_server_load_config(const char *const conf_file,
 		      server_opts->netmask);
 		goto error;
 	}
+	server_opts->params.netmask = server_opts->netmask;
 	trace(LOG_INFO, "%zu IP addresses available for %zu clients in IP range "
 	      "%u.%u.%u.%u/%zu", range_len, server_opts->clients_max_nr,
 	      (ntohl(server_opts->local_address) >> 24) & 0xff,
@@ -125,6 +168,13 @@ bool iprohc_server_load_config(const char *const conf_file,
 		goto error;
 	}
 
+	if(server_opts->profiles != NULL &&
+	   !iprohc_profiles_check(server_opts->profiles, server_opts->local_address,
+	                          server_opts->netmask))
+	{
+		goto error;
+	}
+
 	dump_opts(server_opts);
 
 	return true;
@@ -290,10 +340,87 @@ static bool iprohc_server_handle_config_line(const char *const section,
 		{
 			strncpy(server_opts->pidfile_path, value, 1024);
 		}
+		else if(strcmp(key, "logfile") == 0)
+		{
+			if(strlen(value) >= sizeof(server_opts->log_path))
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'logfile' is too long");
+				goto error;
+			}
+			strcpy(server_opts->log_path, value);
+		}
 		else if(strcmp(key, "p12file") == 0)
 		{
 			strncpy(server_opts->pkcs12_f, value, 1024);
 		}
+		else if(strcmp(key, "listen_backlog") == 0)
+		{
+			const int num = atoi(value);
+			if(num <= 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'listen_backlog' shall be strictly greater than zero, but "
+				      "%d found", num);
+				goto error;
+			}
+			server_opts->admission.listen_backlog = num;
+		}
+		else if(strcmp(key, "upgrade_socket") == 0)
+		{
+			if(strlen(value) >= sizeof(server_opts->upgrade_path))
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'upgrade_socket' shall be shorter than %zu characters",
+				      sizeof(server_opts->upgrade_path));
+				goto error;
+			}
+			strcpy(server_opts->upgrade_path, value);
+		}
+		else if(strcmp(key, "drain_timeout") == 0)
+		{
+			const int num = atoi(value);
+			if(num < 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'drain_timeout' shall be positive or zero, but %d found",
+				      num);
+				goto error;
+			}
+			server_opts->drain_timeout = num;
+		}
+		else if(strcmp(key, "metrics") == 0)
+		{
+			if(strlen(value) >= sizeof(server_opts->metrics_endpoint))
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'metrics' shall be shorter than %zu characters",
+				      sizeof(server_opts->metrics_endpoint));
+				goto error;
+			}
+			strcpy(server_opts->metrics_endpoint, value);
+		}
+		else if(strcmp(key, "admin_socket") == 0)
+		{
+			if(strlen(value) >= sizeof(server_opts->admin_path))
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'admin_socket' shall be shorter than %zu characters",
+				      sizeof(server_opts->admin_path));
+				goto error;
+			}
+			strcpy(server_opts->admin_path, value);
+		}
+		else if(strcmp(key, "dh_params") == 0)
+		{
+			strncpy(server_opts->dh_params_path, value, 1024);
+			server_opts->dh_params_path[1023] = '\0';
+		}
+		else if(strcmp(key, "tls_priority") == 0)
+		{
+			strncpy(server_opts->tls_priority, value, 1024);
+			server_opts->tls_priority[1023] = '\0';
+		}
 		else
 		{
 			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
@@ -320,10 +447,10 @@ static bool iprohc_server_handle_config_line(const char *const section,
 				slash[0] = '\0';
 				server_opts->local_address = inet_addr(value);
 				num = atoi(slash + 1);
-				if(num <= 0 || num >= 32)
+				if(num <= 0 || num > 30)
 				{
 					trace(LOG_ERR, "invalid configuration: netmask shall be in range "
-					      "]0,32[ but %d found", num);
+					      "]0,30] but %d found", num);
 					goto error;
 				}
 				server_opts->netmask = num;
@@ -331,7 +458,14 @@ static bool iprohc_server_handle_config_line(const char *const section,
 		}
 		else if(strcmp(key, "packing") == 0)
 		{
-			server_opts->params.packing = atoi(value);
+			const int num = atoi(value);
+			if(num < 0 || num > IPROHC_PACKING_MAX)
+			{
+				trace(LOG_ERR, "invalid configuration: packing shall be in range "
+				      "[0,%d] but %d found", IPROHC_PACKING_MAX, num);
+				goto error;
+			}
+			server_opts->params.packing = num;
 		}
 		else if(strcmp(key, "maxcid") == 0)
 		{
@@ -345,6 +479,270 @@ static bool iprohc_server_handle_config_line(const char *const section,
 		{
 			server_opts->params.keepalive_timeout = atoi(value);
 		}
+		else if(strcmp(key, "resume_timeout") == 0)
+		{
+			const int num = atoi(value);
+			if(num < 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'resume_timeout' shall be positive or zero, but %d found",
+				      num);
+				goto error;
+			}
+			server_opts->resume_timeout = num;
+		}
+		else if(strcmp(key, "update_sessions") == 0)
+		{
+			server_opts->update_sessions = !!atoi(value);
+		}
+		else
+		{
+			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
+			      "found in section '%s'", key, section);
+			goto error;
+		}
+	}
+	else if(strcmp(section, "admission") == 0)
+	{
+		const int num = atoi(value);
+
+		if(num < 0)
+		{
+			trace(LOG_ERR, "invalid configuration: value for attribute '%s' in "
+			      "section '%s' shall be positive, but %d found", key, section, num);
+			goto error;
+		}
+
+		if(strcmp(key, "prefix_len") == 0)
+		{
+			if(num > 32)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'prefix_len' shall be in range [0,32], but %d found", num);
+				goto error;
+			}
+			server_opts->admission.prefix_len = num;
+		}
+		else if(strcmp(key, "rate") == 0)
+		{
+			server_opts->admission.rate = num;
+		}
+		else if(strcmp(key, "burst") == 0)
+		{
+			if(num == 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'burst' shall be strictly greater than zero");
+				goto error;
+			}
+			server_opts->admission.burst = num;
+		}
+		else if(strcmp(key, "max_handshakes") == 0)
+		{
+			server_opts->admission.max_handshakes = num;
+		}
+		else
+		{
+			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
+			      "found in section '%s'", key, section);
+			goto error;
+		}
+	}
+	else if(strcmp(section, "scheduling") == 0)
+	{
+		if(strcmp(key, "control_cpus") == 0)
+		{
+			if(!iprohc_parse_cpu_list(value, &server_opts->control_sched.cpus))
+			{
+				trace(LOG_ERR, "invalid configuration: bad value for attribute "
+				      "'%s' in section '%s'", key, section);
+				goto error;
+			}
+			server_opts->control_sched.has_cpus = true;
+		}
+		else if(strcmp(key, "route_cpus") == 0)
+		{
+			if(!iprohc_parse_cpu_list(value, &server_opts->route_sched.cpus))
+			{
+				trace(LOG_ERR, "invalid configuration: bad value for attribute "
+				      "'%s' in section '%s'", key, section);
+				goto error;
+			}
+			server_opts->route_sched.has_cpus = true;
+		}
+		else if(strcmp(key, "session_cpus") == 0)
+		{
+			if(!iprohc_parse_cpu_list(value, &server_opts->session_sched.cpus))
+			{
+				trace(LOG_ERR, "invalid configuration: bad value for attribute "
+				      "'%s' in section '%s'", key, section);
+				goto error;
+			}
+			server_opts->session_sched.has_cpus = true;
+		}
+		else if(strcmp(key, "realtime_priority") == 0)
+		{
+			const int prio_max = sched_get_priority_max(SCHED_FIFO);
+			const int num = atoi(value);
+			if(num < 0 || num > prio_max)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'realtime_priority' shall be in range [0,%d], but %d "
+				      "found", prio_max, num);
+				goto error;
+			}
+			/* only the data-plane threads run with a real-time policy */
+			server_opts->route_sched.rt_priority = num;
+			server_opts->session_sched.rt_priority = num;
+		}
+		else if(strcmp(key, "ingress_fanout") == 0)
+		{
+			const int num = atoi(value);
+			if(num < 0 || num > (int) IPROHC_INGRESS_FANOUT_MAX)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'ingress_fanout' shall be in range [0,%u], but %d found",
+				      IPROHC_INGRESS_FANOUT_MAX, num);
+				goto error;
+			}
+			server_opts->ingress_fanout = num;
+		}
+		else
+		{
+			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
+			      "found in section '%s'", key, section);
+			goto error;
+		}
+	}
+	else if(strcmp(section, "memory") == 0)
+	{
+		if(strcmp(key, "session_stack") == 0)
+		{
+			const int num = atoi(value);
+			if(num < (int) (IPROHC_SESSION_STACK_MIN / 1024) || num > 8192)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'session_stack' shall be in range [%u,8192] KiB, but %d "
+				      "found", IPROHC_SESSION_STACK_MIN / 1024, num);
+				goto error;
+			}
+			server_opts->session_stack_size = ((size_t) num) * 1024;
+		}
+		else if(strcmp(key, "compact_sessions") == 0)
+		{
+			server_opts->compact_sessions = !!atoi(value);
+		}
+		else
+		{
+			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
+			      "found in section '%s'", key, section);
+			goto error;
+		}
+	}
+	else if(strcmp(section, "collectd") == 0)
+	{
+		if(strcmp(key, "socket") == 0)
+		{
+			if(strlen(value) >= sizeof(server_opts->collectd_path))
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'socket' in section '%s' shall be shorter than %zu "
+				      "characters", section, sizeof(server_opts->collectd_path));
+				goto error;
+			}
+			strcpy(server_opts->collectd_path, value);
+		}
+		else if(strcmp(key, "interval") == 0)
+		{
+			const int num = atoi(value);
+			if(num <= 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'interval' in section '%s' shall be strictly greater "
+				      "than zero, but %d found", section, num);
+				goto error;
+			}
+			server_opts->collectd_interval = num;
+		}
+		else
+		{
+			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
+			      "found in section '%s'", key, section);
+			goto error;
+		}
+	}
+	else if(strncmp(section, "profile ", strlen("profile ")) == 0 &&
+	        server_opts->profiles != NULL)
+	{
+		struct iprohc_profile *const profile =
+			iprohc_profiles_get(server_opts->profiles, section + strlen("profile "));
+
+		if(profile == NULL)
+		{
+			goto error;
+		}
+
+		if(strcmp(key, "identity") == 0)
+		{
+			if(strlen(value) >= IPROHC_PROFILE_IDENTITIES_MAX)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'identity' in section '%s' shall be shorter than %u "
+				      "characters", section, IPROHC_PROFILE_IDENTITIES_MAX);
+				goto error;
+			}
+			strcpy(profile->identities, value);
+		}
+		else if(strcmp(key, "packing") == 0)
+		{
+			const int num = atoi(value);
+			if(num < 1 || num > 10)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'packing' in section '%s' shall be in range [1,10], but "
+				      "%d found", section, num);
+				goto error;
+			}
+			profile->packing = num;
+		}
+		else if(strcmp(key, "maxcid") == 0)
+		{
+			const int num = atoi(value);
+			if(num < 0 || num > (int) ROHC_SMALL_CID_MAX)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'maxcid' in section '%s' shall be in range [0,%u], but "
+				      "%d found", section, ROHC_SMALL_CID_MAX, num);
+				goto error;
+			}
+			profile->max_cid = num;
+		}
+		else if(strcmp(key, "unidirectional") == 0)
+		{
+			profile->is_unidirectional = !!atoi(value);
+		}
+		else if(strcmp(key, "keepalive") == 0)
+		{
+			const int num = atoi(value);
+			if(num <= 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'keepalive' in section '%s' shall be strictly greater "
+				      "than zero, but %d found", section, num);
+				goto error;
+			}
+			profile->keepalive_timeout = num;
+		}
+		else if(strcmp(key, "ipaddr") == 0)
+		{
+			if(inet_aton(value, &profile->static_addr) == 0)
+			{
+				trace(LOG_ERR, "invalid configuration: value for attribute "
+				      "'ipaddr' in section '%s' shall be an IPv4 address, but "
+				      "'%s' found", section, value);
+				goto error;
+			}
+		}
 		else
 		{
 			trace(LOG_ERR, "invalid configuration: unexpected attribute '%s' "
@@ -366,25 +764,18 @@ error:
 
 
 /**
- * @brief Compute the width of the given IP range
+ * @brief Compute the number of client addresses in the given IP range
+ *
+ * The network and broadcast addresses of the range cannot be used, nor the
+ * address of the server.
  *
- * @param addr        The local IP address of the server (in host byte order)
  * @param netmasklen  The length (in bits) of the network mask
  * @return            The number of IP addresses available in the IP range
  */
-static size_t iprohc_get_ipv4_range_width(const uint32_t addr,
-                                          const size_t netmasklen)
+static size_t iprohc_get_ipv4_range_width(const size_t netmasklen)
 {
-	size_t range_len = (1 << (32 - netmasklen));
-	const uint32_t netmask = (0xffffffff << (32 - netmasklen));
-
-	/* if a.b.c.0 is in IP range, it cannot be used */
-	if(((addr & netmask) & 0xff) == 0)
-	{
-		range_len--;
-	}
-
-	return range_len;
+	assert(netmasklen > 0 && netmasklen <= 30);
+	return (((size_t) 1) << (32 - netmasklen)) - 3;
 }
 
 
@@ -402,11 +793,62 @@ static void dump_opts(const struct server_opts *const opts)
 	trace(LOG_INFO, "Port        : %d", opts->port);
 	trace(LOG_INFO, "P12 file    : %s", opts->pkcs12_f);
 	trace(LOG_INFO, "Pidfile     : %s", opts->pidfile_path);
+	trace(LOG_INFO, "Log file    : %s", strcmp(opts->log_path, "") == 0 ?
+	      "syslog" : opts->log_path);
+	trace(LOG_INFO, "TLS priority: %s", opts->tls_priority);
+	trace(LOG_INFO, "DH params   : %s", opts->dh_params_path);
+	trace(LOG_INFO, "Upgrade     : %s (drain for %zu s)", opts->upgrade_path,
+	      opts->drain_timeout);
+	trace(LOG_INFO, "Metrics     : %s", opts->metrics_endpoint);
+	trace(LOG_INFO, "Admin socket: %s", opts->admin_path);
+	trace(LOG_INFO, "Admission control :");
+	trace(LOG_INFO, " . Listen backlog : %zu", opts->admission.listen_backlog);
+	trace(LOG_INFO, " . Source prefix  : /%zu", opts->admission.prefix_len);
+	trace(LOG_INFO, " . Rate           : %zu/s per prefix (burst %zu)",
+	      opts->admission.rate, opts->admission.burst);
+	trace(LOG_INFO, " . Max handshakes : %zu", opts->admission.max_handshakes);
 	trace(LOG_INFO, "Tunnel params :");
 	trace(LOG_INFO, " . Local IP  : %s/%zu", inet_ntoa(addr), opts->netmask);
 	trace(LOG_INFO, " . Packing   : %d", opts->params.packing);
 	trace(LOG_INFO, " . Max cid   : %zu", opts->params.max_cid);
 	trace(LOG_INFO, " . Unid      : %d", opts->params.is_unidirectional);
 	trace(LOG_INFO, " . Keepalive : %zu", opts->params.keepalive_timeout);
+	trace(LOG_INFO, " . Resume    : %zu", opts->resume_timeout);
+	trace(LOG_INFO, " . Update    : %d", opts->update_sessions);
+	trace(LOG_INFO, "Scheduling :");
+	trace(LOG_INFO, " . Control CPUs   : %d CPU(s)%s",
+	      CPU_COUNT(&opts->control_sched.cpus),
+	      opts->control_sched.has_cpus ? "" : " (not pinned)");
+	trace(LOG_INFO, " . Route CPUs     : %d CPU(s)%s",
+	      CPU_COUNT(&opts->route_sched.cpus),
+	      opts->route_sched.has_cpus ? "" : " (not pinned)");
+	trace(LOG_INFO, " . Session CPUs   : %d CPU(s)%s",
+	      CPU_COUNT(&opts->session_sched.cpus),
+	      opts->session_sched.has_cpus ? "" : " (not pinned)");
+	trace(LOG_INFO, " . RT priority    : %d", opts->session_sched.rt_priority);
+	trace(LOG_INFO, " . Ingress fanout : %zu", opts->ingress_fanout);
+	trace(LOG_INFO, "Memory :");
+	trace(LOG_INFO, " . Session stack  : %zu KiB", opts->session_stack_size / 1024);
+	trace(LOG_INFO, " . Compact        : %d", opts->compact_sessions);
+	trace(LOG_INFO, "Collectd :");
+	trace(LOG_INFO, " . Socket         : %s", opts->collectd_path);
+	trace(LOG_INFO, " . Interval       : %zu s", opts->collectd_interval);
+	if(opts->profiles != NULL)
+	{
+		size_t i;
+
+		for(i = 0; i < opts->profiles->profiles_nr; i++)
+		{
+			const struct iprohc_profile *const profile = &(opts->profiles->profiles[i]);
+
+			trace(LOG_INFO, "Profile '%s' :", profile->name);
+			trace(LOG_INFO, " . Identities : %s", profile->identities);
+			trace(LOG_INFO, " . Packing    : %d", profile->packing);
+			trace(LOG_INFO, " . Max cid    : %d", profile->max_cid);
+			trace(LOG_INFO, " . Unid       : %d", profile->is_unidirectional);
+			trace(LOG_INFO, " . Keepalive  : %d", profile->keepalive_timeout);
+			trace(LOG_INFO, " . Static IP  : %s", inet_ntoa(profile->static_addr));
+		}
+	}
 }
 
@@ -25,10 +25,17 @@
 #define IPROHC_SERVER_SESSION__H
 
 #include "session.h"
+#include "resume_cache.h"
+#include "completion.h"
+#include "addr_pool.h"
+#include "profile.h"
 
 #include <stdbool.h>
+#include <pthread.h>
 #include <atomic_ops.h>
 
+struct iprohc_clients;
+
 /** The context of the client session at server */
 struct iprohc_server_session
 {
@@ -37,6 +44,39 @@ struct iprohc_server_session
 
 	int fake_raw[2];                /**< Fake RAW device for server side */
 	int fake_tun[2];                /**< Fake TUN device for server side */
+	pthread_mutex_t rohc_lock;      /**< Serialize the ROHC contexts of the
+	                                     session with the fanout worker that
+	                                     decompresses its traffic, it lives as
+	                                     long as the context */
+
+	struct iprohc_resume_cache *resume_cache; /**< The ROHC contexts of lost
+	                                               sessions */
+	int proto_version;              /**< The protocol version of the client */
+	uint8_t token[IPROHC_SESSION_TOKEN_LEN]; /**< The token that identifies the
+	                                              session to resume it */
+	bool is_resumable;              /**< Whether the ROHC contexts shall be kept
+	                                     if the session is lost */
+	bool is_packing_requested;      /**< Whether the client chose its packing
+	                                     level */
+
+	size_t client_id;               /**< The index of the client context */
+	struct iprohc_completion_queue *completion_queue; /**< Where to post the
+	                                                       end of the session */
+	volatile AO_t *handshakes_nr;   /**< The number of clients connecting */
+	bool is_handshake_pending;      /**< Whether the client is counted in
+	                                     handshakes_nr */
+
+	const struct iprohc_profiles *profiles; /**< The profiles of the server */
+	const struct iprohc_profile *profile;   /**< The profile of the client,
+	                                             NULL if none matched */
+	struct iprohc_addr_pool *addr_pool;     /**< The tunnel addresses */
+	struct iprohc_clients *clients;         /**< The contexts of all clients */
+	bool has_static_addr;           /**< Whether the client uses the static
+	                                     address of its profile instead of the
+	                                     address of its context */
+	volatile AO_t alias_id;         /**< The index plus one of the client that
+	                                     uses the static address of this unused
+	                                     context, 0 if none */
 };
 
 #endif
@@ -0,0 +1,263 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   test_addr_pool.c
+ * @brief  Test the allocation, exhaustion, release and re-use of the tunnel
+ *         addresses of the pool
+ */
+
+#include "addr_pool.h"
+#include "log.h"
+#include "test_utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+int log_max_priority = LOG_ERR;
+bool iprohc_log_stderr = true;
+
+
+static bool test_exhaust_and_reuse(void)
+	__attribute__((warn_unused_result));
+
+static bool test_alloc_index(void)
+	__attribute__((warn_unused_result));
+
+static bool test_reserve(void)
+	__attribute__((warn_unused_result));
+
+static bool test_max_size(void)
+	__attribute__((warn_unused_result));
+
+
+int main(int argc, char *argv[])
+{
+	if(!test_exhaust_and_reuse() || !test_alloc_index() || !test_reserve() ||
+	   !test_max_size())
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("all address pool tests passed\n");
+	return EXIT_SUCCESS;
+}
+
+
+/**
+ * @brief Check that all the addresses of a prefix are given once, and that
+ *        the released addresses are given again, the last released first
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_exhaust_and_reuse(void)
+{
+	struct iprohc_addr_pool pool;
+	struct in_addr server_addr;
+	struct in_addr addr;
+	bool given[6];
+	size_t index;
+	size_t i;
+	bool is_ok = false;
+
+	/* a /29 prefix has 6 host addresses, the one of the server excluded */
+	inet_pton(AF_INET, "10.0.0.1", &server_addr);
+	if(!iprohc_addr_pool_init(&pool, server_addr.s_addr, 29, 100))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	check(pool.addrs_nr == 6, goto free_pool);
+	check(pool.used_nr == 1, goto free_pool);
+	check(iprohc_addr_pool_index(&pool, server_addr) == 0, goto free_pool);
+
+	memset(given, 0, sizeof(given));
+	given[0] = true;
+	for(i = 1; i < 6; i++)
+	{
+		check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+		check(index < 6, goto free_pool);
+		check(!given[index], goto free_pool);
+		given[index] = true;
+	}
+	check(pool.used_nr == 6, goto free_pool);
+
+	/* exhausted */
+	check(!iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+
+	/* the addresses stay in the prefix, the broadcast address excluded */
+	addr = iprohc_addr_pool_addr(&pool, 5);
+	check(addr.s_addr == inet_addr("10.0.0.6"), goto free_pool);
+	check(iprohc_addr_pool_index(&pool, addr) == 5, goto free_pool);
+	check(iprohc_addr_pool_index(&pool, (struct in_addr) { inet_addr("10.0.0.7") }) ==
+	      pool.addrs_nr, goto free_pool);
+	check(iprohc_addr_pool_index(&pool, (struct in_addr) { inet_addr("10.0.1.1") }) ==
+	      pool.addrs_nr, goto free_pool);
+
+	/* the released addresses are re-used, the last released first */
+	iprohc_addr_pool_release(&pool, 3);
+	iprohc_addr_pool_release(&pool, 1);
+	check(pool.used_nr == 4, goto free_pool);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 1, goto free_pool);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 3, goto free_pool);
+	check(!iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(pool.used_nr == 6, goto free_pool);
+
+	is_ok = true;
+
+free_pool:
+	iprohc_addr_pool_free(&pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Check the allocation of given addresses, out of order
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_alloc_index(void)
+{
+	struct iprohc_addr_pool pool;
+	size_t index;
+	bool is_ok = false;
+
+	/* a server address in the middle of a /28 prefix */
+	if(!iprohc_addr_pool_init(&pool, inet_addr("192.168.1.5"), 28, 100))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	check(pool.addrs_nr == 14, goto free_pool);
+	check(!iprohc_addr_pool_alloc_index(&pool, 4), goto free_pool);
+
+	/* an address not yet reached by the allocation in order */
+	check(iprohc_addr_pool_alloc_index(&pool, 10), goto free_pool);
+	check(!iprohc_addr_pool_alloc_index(&pool, 10), goto free_pool);
+	check(!iprohc_addr_pool_alloc_index(&pool, pool.addrs_nr), goto free_pool);
+
+	/* the allocation in order skips the addresses already in use */
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 0, goto free_pool);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 1, goto free_pool);
+
+	/* a released address is taken out of the list when allocated by index */
+	iprohc_addr_pool_release(&pool, 0);
+	check(iprohc_addr_pool_alloc_index(&pool, 0), goto free_pool);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 2, goto free_pool);
+
+	/* the address allocated out of order is skipped, then found again once
+	 * released */
+	while(iprohc_addr_pool_alloc(&pool, &index))
+	{
+		check(index != 4 && index != 10, goto free_pool);
+	}
+	check(pool.used_nr == pool.addrs_nr, goto free_pool);
+	iprohc_addr_pool_release(&pool, 10);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 10, goto free_pool);
+
+	is_ok = true;
+
+free_pool:
+	iprohc_addr_pool_free(&pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Check that the reserved addresses are only allocated by index
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_reserve(void)
+{
+	struct iprohc_addr_pool pool;
+	size_t index;
+	bool is_ok = false;
+
+	if(!iprohc_addr_pool_init(&pool, inet_addr("172.16.0.1"), 29, 100))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	iprohc_addr_pool_reserve(&pool, 2);
+
+	while(iprohc_addr_pool_alloc(&pool, &index))
+	{
+		check(index != 2, goto free_pool);
+	}
+	check(pool.used_nr == pool.addrs_nr - 1, goto free_pool);
+
+	/* a reserved address is given to its owner only, and never enters the
+	 * list of released addresses */
+	check(iprohc_addr_pool_alloc_index(&pool, 2), goto free_pool);
+	iprohc_addr_pool_release(&pool, 2);
+	check(!iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	iprohc_addr_pool_release(&pool, 3);
+	check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(index == 3, goto free_pool);
+
+	is_ok = true;
+
+free_pool:
+	iprohc_addr_pool_free(&pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Check that a large prefix is cut to the maximum number of addresses
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_max_size(void)
+{
+	struct iprohc_addr_pool pool;
+	size_t index;
+	size_t i;
+	bool is_ok = false;
+
+	if(!iprohc_addr_pool_init(&pool, inet_addr("10.1.0.1"), 16, 1000))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	check(pool.addrs_nr == 1000, goto free_pool);
+
+	for(i = 1; i < 1000; i++)
+	{
+		check(iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+		check(index == i, goto free_pool);
+	}
+	check(!iprohc_addr_pool_alloc(&pool, &index), goto free_pool);
+	check(iprohc_addr_pool_index(&pool, iprohc_addr_pool_addr(&pool, 1000)) ==
+	      pool.addrs_nr, goto free_pool);
+
+	is_ok = true;
+
+free_pool:
+	iprohc_addr_pool_free(&pool);
+	return is_ok;
+}
@@ -0,0 +1,443 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   test_collectd.c
+ * @brief  Test the batches of PUTVAL commands pushed to collectd, against a
+ *         stand-in of the unixsock plugin
+ */
+
+#include "collectd.h"
+#include "server_session.h"
+#include "log.h"
+#include "test_utils.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+
+int log_max_priority = LOG_ERR;
+bool iprohc_log_stderr = true;
+
+
+/** The maximum number of commands the stand-in of collectd records */
+#define TEST_COMMANDS_MAX_NR  64U
+
+
+/** The stand-in of the unixsock plugin of collectd */
+struct test_collectd
+{
+	char path[108];              /**< The UNIX socket it listens on */
+	int sock;                    /**< The socket in listen state */
+	const char *reply;           /**< The reply to every command */
+	pthread_t thread;            /**< The thread that serves the flusher */
+	char commands[TEST_COMMANDS_MAX_NR][512];  /**< The commands received */
+	size_t commands_nr;          /**< The number of commands received */
+	size_t reads_nr;             /**< The number of reads to get them */
+};
+
+
+/** The contexts of the clients the stand-in of client.c gives */
+static struct iprohc_server_session test_clients[2];
+
+
+static bool test_push(void)
+	__attribute__((warn_unused_result));
+
+static bool test_reject(void)
+	__attribute__((warn_unused_result));
+
+static bool test_no_collectd(void)
+	__attribute__((warn_unused_result));
+
+static bool test_collectd_start(struct test_collectd *const collectd,
+                                const char *const reply)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+static void * test_collectd_run(void *arg)
+	__attribute__((nonnull(1)));
+
+static bool test_collectd_find(const struct test_collectd *const collectd,
+                               const char *const identifier,
+                               const char *const value)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+
+int main(int argc, char *argv[])
+{
+	size_t i;
+
+	/* one connected client and one client that is still in handshake */
+	memset(test_clients, 0, sizeof(test_clients));
+	for(i = 0; i < 2; i++)
+	{
+		pthread_mutex_init(&(test_clients[i].rohc_lock), NULL);
+		test_clients[i].is_init = 1;
+		test_clients[i].client_id = i;
+	}
+	test_clients[0].session.status = IPROHC_SESSION_CONNECTED;
+	test_clients[0].session.local_address.s_addr = inet_addr("10.2.0.5");
+	test_clients[0].session.tunnel.stats.counters.comp_total = 42;
+	test_clients[0].session.tunnel.stats.counters.stats_packing[3] = 7;
+	test_clients[1].session.status = IPROHC_SESSION_CONNECTING;
+	test_clients[1].session.local_address.s_addr = inet_addr("10.2.0.6");
+
+	if(!test_push() || !test_reject() || !test_no_collectd())
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("all collectd tests passed\n");
+	return EXIT_SUCCESS;
+}
+
+
+/**
+ * @brief The stand-in of client.c, that would bring the whole server in
+ *
+ * @param clients            Unused
+ * @param[in,out] client_id  The index to start from, the index of the client
+ *                           context found
+ * @return                   The client context, NULL if there is no more
+ */
+struct iprohc_server_session * iprohc_clients_next(const struct iprohc_clients *const clients,
+                                                   size_t *const client_id)
+{
+	if((*client_id) >= 2)
+	{
+		return NULL;
+	}
+	return &(test_clients[*client_id]);
+}
+
+
+/**
+ * @brief Check that the values of the connected clients and of the server
+ *        are pushed in one batch, and that the others are not
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_push(void)
+{
+	struct iprohc_clients clients;
+	struct iprohc_addr_pool addr_pool;
+	struct iprohc_collectd flusher;
+	struct test_collectd collectd;
+	volatile AO_t handshakes_nr = 1;
+	char host[IPROHC_COLLECTD_NAME_LEN];
+	char identifier[256];
+	size_t i;
+	bool is_ok = false;
+
+	memset(&clients, 0, sizeof(struct iprohc_clients));
+	if(!iprohc_addr_pool_init(&addr_pool, inet_addr("10.2.0.1"), 24, 16))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	if(!test_collectd_start(&collectd, "0 Success: 1 value has been dispatched.\n"))
+	{
+		goto free_pool;
+	}
+	if(!iprohc_collectd_start(&flusher, collectd.path, 1, &clients, &addr_pool,
+	                          &handshakes_nr))
+	{
+		fprintf(stderr, "failed to start the collectd flusher\n");
+		shutdown(collectd.sock, SHUT_RDWR);
+		pthread_join(collectd.thread, NULL);
+		goto free_pool;
+	}
+
+	/* the stand-in stops after the last value of the first push */
+	pthread_join(collectd.thread, NULL);
+	iprohc_collectd_stop(&flusher);
+
+	/* 10 counters and 10 packing levels for the client, 3 server gauges */
+	check(flusher.pushes_nr >= 1, goto stop);
+	check(collectd.commands_nr == 23, goto stop);
+	check(collectd.reads_nr < collectd.commands_nr, goto stop);
+	gethostname(host, IPROHC_COLLECTD_NAME_LEN);
+	host[IPROHC_COLLECTD_NAME_LEN - 1] = '\0';
+	snprintf(identifier, sizeof(identifier),
+	         "\"%s/iprohc-10.2.0.5/derive-comp_packets\" interval=1 ", host);
+	check(test_collectd_find(&collectd, identifier, ":42"), goto stop);
+	snprintf(identifier, sizeof(identifier),
+	         "\"%s/iprohc-10.2.0.5/derive-packing-3\" interval=1 ", host);
+	check(test_collectd_find(&collectd, identifier, ":7"), goto stop);
+	snprintf(identifier, sizeof(identifier),
+	         "\"%s/iprohc-server/gauge-sessions\" interval=1 ", host);
+	check(test_collectd_find(&collectd, identifier, ":1"), goto stop);
+	snprintf(identifier, sizeof(identifier),
+	         "\"%s/iprohc-server/gauge-tls_handshakes\" interval=1 ", host);
+	check(test_collectd_find(&collectd, identifier, ":1"), goto stop);
+	for(i = 0; i < collectd.commands_nr; i++)
+	{
+		check(strstr(collectd.commands[i], "10.2.0.6") == NULL, goto stop);
+	}
+
+	is_ok = true;
+
+stop:
+free_pool:
+	iprohc_addr_pool_free(&addr_pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Check that a push fails when collectd rejects the values
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_reject(void)
+{
+	struct iprohc_clients clients;
+	struct iprohc_addr_pool addr_pool;
+	struct iprohc_collectd flusher;
+	struct test_collectd collectd;
+	volatile AO_t handshakes_nr = 0;
+	bool is_ok = false;
+
+	memset(&clients, 0, sizeof(struct iprohc_clients));
+	if(!iprohc_addr_pool_init(&addr_pool, inet_addr("10.2.0.1"), 24, 16))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	if(!test_collectd_start(&collectd, "-1 Unknown type\n"))
+	{
+		goto free_pool;
+	}
+	if(!iprohc_collectd_start(&flusher, collectd.path, 1, &clients, &addr_pool,
+	                          &handshakes_nr))
+	{
+		fprintf(stderr, "failed to start the collectd flusher\n");
+		shutdown(collectd.sock, SHUT_RDWR);
+		pthread_join(collectd.thread, NULL);
+		goto free_pool;
+	}
+
+	/* the flusher reads the rejections before it stops */
+	pthread_join(collectd.thread, NULL);
+	iprohc_collectd_stop(&flusher);
+
+	check(flusher.pushes_nr == 0, goto stop);
+	check(flusher.failures_nr >= 1, goto stop);
+	check(flusher.is_failing, goto stop);
+
+	is_ok = true;
+
+stop:
+free_pool:
+	iprohc_addr_pool_free(&addr_pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Check that the pushes fail while collectd does not listen
+ *
+ * @return  true if the test succeeded, false otherwise
+ */
+static bool test_no_collectd(void)
+{
+	struct iprohc_clients clients;
+	struct iprohc_addr_pool addr_pool;
+	struct iprohc_collectd flusher;
+	volatile AO_t handshakes_nr = 0;
+	char path[108];
+	bool is_ok = false;
+
+	memset(&clients, 0, sizeof(struct iprohc_clients));
+	if(!iprohc_addr_pool_init(&addr_pool, inet_addr("10.2.0.1"), 24, 16))
+	{
+		fprintf(stderr, "failed to init the address pool\n");
+		return false;
+	}
+	snprintf(path, sizeof(path), "/tmp/test_collectd.%d.none", getpid());
+	if(!iprohc_collectd_start(&flusher, path, 1, &clients, &addr_pool,
+	                          &handshakes_nr))
+	{
+		fprintf(stderr, "failed to start the collectd flusher\n");
+		goto free_pool;
+	}
+	usleep(1500 * 1000);
+	iprohc_collectd_stop(&flusher);
+
+	check(flusher.pushes_nr == 0, goto stop);
+	check(flusher.failures_nr >= 1, goto stop);
+	check(flusher.sock < 0, goto stop);
+
+	is_ok = true;
+
+stop:
+free_pool:
+	iprohc_addr_pool_free(&addr_pool);
+	return is_ok;
+}
+
+
+/**
+ * @brief Start the stand-in of collectd
+ *
+ * @param collectd  The stand-in to start
+ * @param reply     The reply to every command
+ * @return          true if the stand-in listens, false otherwise
+ */
+static bool test_collectd_start(struct test_collectd *const collectd,
+                                const char *const reply)
+{
+	struct sockaddr_un addr;
+
+	memset(collectd, 0, sizeof(struct test_collectd));
+	collectd->reply = reply;
+	snprintf(collectd->path, sizeof(collectd->path), "/tmp/test_collectd.%d.sock",
+	         getpid());
+	unlink(collectd->path);
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, collectd->path);
+	collectd->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(collectd->sock < 0 ||
+	   bind(collectd->sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != 0 ||
+	   listen(collectd->sock, 1) != 0)
+	{
+		fprintf(stderr, "failed to listen on '%s'\n", collectd->path);
+		goto close_sock;
+	}
+	if(pthread_create(&collectd->thread, NULL, test_collectd_run, collectd) != 0)
+	{
+		fprintf(stderr, "failed to create the thread of the stand-in of "
+		        "collectd\n");
+		goto close_sock;
+	}
+
+	return true;
+
+close_sock:
+	if(collectd->sock >= 0)
+	{
+		close(collectd->sock);
+	}
+	unlink(collectd->path);
+	return false;
+}
+
+
+/**
+ * @brief Serve one connection of the flusher, until the last value of the
+ *        push or the first rejection
+ *
+ * @param arg  The stand-in of collectd
+ * @return     NULL
+ */
+static void * test_collectd_run(void *arg)
+{
+	struct test_collectd *const collectd = arg;
+	char data[8192];
+	size_t data_len = 0;
+	bool is_done = false;
+	int conn;
+
+	conn = accept(collectd->sock, NULL, NULL);
+	if(conn < 0)
+	{
+		goto close_sock;
+	}
+
+	while(!is_done)
+	{
+		char *line = data;
+		char *eol;
+		ssize_t ret;
+
+		ret = recv(conn, data + data_len, sizeof(data) - 1 - data_len, 0);
+		if(ret <= 0)
+		{
+			break;
+		}
+		collectd->reads_nr++;
+		data_len += ret;
+		data[data_len] = '\0';
+
+		while((eol = strchr(line, '\n')) != NULL)
+		{
+			eol[0] = '\0';
+			if(collectd->commands_nr < TEST_COMMANDS_MAX_NR)
+			{
+				snprintf(collectd->commands[collectd->commands_nr], 512, "%.511s",
+				         line);
+			}
+			collectd->commands_nr++;
+			if(send(conn, collectd->reply, strlen(collectd->reply),
+			        MSG_NOSIGNAL) < 0 ||
+			   collectd->reply[0] == '-' ||
+			   strstr(line, "gauge-tls_handshakes") != NULL)
+			{
+				is_done = true;
+				break;
+			}
+			line = eol + 1;
+		}
+		data_len -= (line - data);
+		memmove(data, line, data_len);
+	}
+
+	close(conn);
+close_sock:
+	close(collectd->sock);
+	unlink(collectd->path);
+	return NULL;
+}
+
+
+/**
+ * @brief Find the command that pushes the given value
+ *
+ * @param collectd    The stand-in of collectd
+ * @param identifier  The identifier and the options of the value
+ * @param value       The end of the command, the value
+ * @return            true if the command was received, false otherwise
+ */
+static bool test_collectd_find(const struct test_collectd *const collectd,
+                               const char *const identifier,
+                               const char *const value)
+{
+	size_t i;
+
+	for(i = 0; i < collectd->commands_nr && i < TEST_COMMANDS_MAX_NR; i++)
+	{
+		const char *const command = collectd->commands[i];
+		const size_t len = strlen(command);
+
+		if(strncmp(command, "PUTVAL ", 7) == 0 &&
+		   strncmp(command + 7, identifier, strlen(identifier)) == 0 &&
+		   len >= strlen(value) &&
+		   strcmp(command + len - strlen(value), value) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -16,6 +16,7 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "log.h"
+#include "utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,10 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdbool.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
@@ -52,6 +57,11 @@ static bool tls_get_item_from_bag_at(gnutls_pkcs12_bag_t *const bag,
 												 gnutls_x509_crt_t *const cert)
 	__attribute__((nonnull(1, 4, 5), warn_unused_result));
 
+static bool save_dh_params(gnutls_dh_params_t dh_params, const char *const path)
+	__attribute__((nonnull(2), warn_unused_result));
+
+static void * generate_dh_params_thread(void *arg);
+
 
 bool generate_dh_params(gnutls_dh_params_t *const dh_params)
 {
@@ -86,6 +96,209 @@ error:
 }
 
 
+/**
+ * @brief Whether the given TLS priorities allow DHE key exchanges
+ *
+ * Only the DHE key exchanges of TLS 1.2 and below need Diffie-Hellman
+ * parameters: TLS 1.3 and ECDHE key exchanges do not.
+ *
+ * @param priority_cache  The TLS priorities
+ * @return                true if Diffie-Hellman parameters are needed,
+ *                        false if they are not
+ */
+bool tls_priority_needs_dh(gnutls_priority_t priority_cache)
+{
+	const unsigned int *kx_list;
+	int kx_nr;
+	int i;
+
+	kx_nr = gnutls_priority_kx_list(priority_cache, &kx_list);
+	for(i = 0; i < kx_nr; i++)
+	{
+		if(kx_list[i] == GNUTLS_KX_DHE_RSA ||
+		   kx_list[i] == GNUTLS_KX_DHE_DSS ||
+		   kx_list[i] == GNUTLS_KX_DHE_PSK ||
+		   kx_list[i] == GNUTLS_KX_ANON_DH)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * @brief Load Diffie-Hellman parameters from a PKCS#3 PEM file
+ *
+ * @param[out] dh_params  The loaded Diffie-Hellman parameters
+ * @param path            The path to the PKCS#3 PEM file
+ * @return                true if the parameters were successfully loaded,
+ *                        false if the file is missing or invalid
+ */
+bool load_dh_params(gnutls_dh_params_t *const dh_params,
+                    const char *const path)
+{
+	gnutls_datum_t pem;
+	int ret;
+
+	ret = gnutls_load_file(path, &pem);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_NOTICE, "failed to load Diffie-Hellman parameters from file "
+		      "'%s': %s (%d)", path, gnutls_strerror(ret), ret);
+		goto error;
+	}
+
+	ret = gnutls_dh_params_init(dh_params);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_ERR, "failed to initialize Diffie-Hellman parameters");
+		goto free_pem;
+	}
+	ret = gnutls_dh_params_import_pkcs3(*dh_params, &pem, GNUTLS_X509_FMT_PEM);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_NOTICE, "invalid Diffie-Hellman parameters in file '%s': "
+		      "%s (%d)", path, gnutls_strerror(ret), ret);
+		goto free_dh;
+	}
+	gnutls_free(pem.data);
+
+	return true;
+
+free_dh:
+	gnutls_dh_params_deinit(*dh_params);
+free_pem:
+	gnutls_free(pem.data);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Save Diffie-Hellman parameters in a PKCS#3 PEM file
+ *
+ * The file is replaced atomically, so that a server that starts while the
+ * file is written never reads partial parameters.
+ *
+ * @param dh_params  The Diffie-Hellman parameters to save
+ * @param path       The path to the PKCS#3 PEM file
+ * @return           true if the parameters were successfully saved,
+ *                   false if a problem occurred
+ */
+static bool save_dh_params(gnutls_dh_params_t dh_params, const char *const path)
+{
+	gnutls_datum_t pem;
+	bool is_ok;
+	int ret;
+
+	ret = gnutls_dh_params_export2_pkcs3(dh_params, GNUTLS_X509_FMT_PEM, &pem);
+	if(ret != GNUTLS_E_SUCCESS)
+	{
+		trace(LOG_ERR, "failed to export Diffie-Hellman parameters: %s (%d)",
+		      gnutls_strerror(ret), ret);
+		return false;
+	}
+	is_ok = iprohc_file_replace(path, pem.data, pem.size, 0644);
+	gnutls_free(pem.data);
+
+	return is_ok;
+}
+
+
+/**
+ * @brief Generate Diffie-Hellman parameters and save them in the background
+ *
+ * The generation takes a few seconds, so the server does not wait for it:
+ * it uses the well-known groups of RFC 7919 in the meantime, and loads the
+ * generated parameters on next startup.
+ *
+ * @param path  The path to the PKCS#3 PEM file to create
+ * @return      true if the generation was successfully started,
+ *              false if a problem occurred
+ */
+bool generate_dh_params_in_background(const char *const path)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	char *thread_path;
+	int ret;
+
+	thread_path = strdup(path);
+	if(thread_path == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for path '%s'", path);
+		goto error;
+	}
+
+	ret = pthread_attr_init(&attr);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to init thread attributes: %s (%d)",
+		      strerror(ret), ret);
+		goto free_path;
+	}
+	ret = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to detach thread: %s (%d)", strerror(ret), ret);
+		goto destroy_attr;
+	}
+	ret = pthread_create(&thread, &attr, generate_dh_params_thread, thread_path);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to create thread: %s (%d)", strerror(ret), ret);
+		goto destroy_attr;
+	}
+	pthread_attr_destroy(&attr);
+
+	return true;
+
+destroy_attr:
+	pthread_attr_destroy(&attr);
+free_path:
+	free(thread_path);
+error:
+	return false;
+}
+
+
+/**
+ * @brief The thread that generates and saves Diffie-Hellman parameters
+ *
+ * @param arg  The path to the PKCS#3 PEM file to create
+ * @return     Always NULL
+ */
+static void * generate_dh_params_thread(void *arg)
+{
+	char *const path = (char *) arg;
+	gnutls_dh_params_t dh_params;
+
+	trace(LOG_INFO, "[dh] generate Diffie-Hellman parameters for file '%s'",
+	      path);
+	if(!generate_dh_params(&dh_params))
+	{
+		trace(LOG_ERR, "[dh] failed to generate Diffie-Hellman parameters");
+		goto free_path;
+	}
+	if(!save_dh_params(dh_params, path))
+	{
+		trace(LOG_ERR, "[dh] failed to save Diffie-Hellman parameters in file "
+		      "'%s'", path);
+		goto free_dh;
+	}
+	trace(LOG_INFO, "[dh] Diffie-Hellman parameters saved in file '%s', they "
+	      "will be used on next startup", path);
+
+free_dh:
+	gnutls_dh_params_deinit(dh_params);
+free_path:
+	free(path);
+	return NULL;
+}
+
+
 #define MAX_CERTS 10
 
 bool load_p12(gnutls_certificate_credentials_t xcred,
@@ -23,6 +23,16 @@ along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
 bool generate_dh_params(gnutls_dh_params_t *const dh_params)
 	__attribute__((nonnull(1), warn_unused_result));
 
+bool tls_priority_needs_dh(gnutls_priority_t priority_cache)
+	__attribute__((warn_unused_result));
+
+bool load_dh_params(gnutls_dh_params_t *const dh_params,
+                    const char *const path)
+	__attribute__((nonnull(1, 2), warn_unused_result));
+
+bool generate_dh_params_in_background(const char *const path)
+	__attribute__((nonnull(1), warn_unused_result));
+
 bool load_p12(gnutls_certificate_credentials_t xcred,
 				  const char *const p12_file,
 				  const char *const password)
@@ -0,0 +1,612 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   upgrade.c
+ * @brief  Hand the server resources over to a new server process
+ *
+ * The running server listens on a local UNIX socket. A new server started
+ * with --takeover connects to it and receives the TCP listening socket and
+ * the TUN interface through SCM_RIGHTS, along with the TLS session ticket
+ * key. The TCP port is thus never closed, the TUN interface keeps its
+ * addresses and routes, and the clients that reconnect resume their TLS
+ * sessions with the new server.
+ *
+ * The new server acknowledges the reception before the old server drains its
+ * sessions, so that the resources are not lost if the new server fails to
+ * receive them. While it drains, the old server accepts no new client, but
+ * keeps serving its established sessions until they end or until the drain
+ * timeout expires. Both servers read the TUN interface meanwhile: each one
+ * forwards the packets of the clients of the other one through a drain
+ * socket. The tunnel addresses of the drained sessions are handed over too,
+ * the new server gives them to no client until the old server tells that
+ * they were released through the drain control socket.
+ *
+ * GnuTLS and librohc cannot export the state of a session, so the sessions
+ * themselves are never handed over: they stay with the old server. For the
+ * same reason, the ROHC contexts the old server keeps for the lost sessions
+ * are not handed over either, the clients that resume with the new server
+ * start with new ROHC contexts.
+ */
+
+#include "upgrade.h"
+
+#include "log.h"
+#include "utils.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+/** The magic number of upgrade messages */
+#define IPROHC_UPGRADE_MAGIC    0x69726f68U
+/** The version of upgrade messages */
+#define IPROHC_UPGRADE_VERSION  2U
+/** The number of file descriptors sent along with the upgrade message */
+#define IPROHC_UPGRADE_FDS_NR  4U
+/** The number of tunnel addresses sent in one message after the upgrade one */
+#define IPROHC_UPGRADE_ADDRS_CHUNK_NR  1024U
+/** The maximum number of tunnel addresses drained, the one of an IPv4 /8 */
+#define IPROHC_UPGRADE_DRAIN_ADDRS_MAX_NR  (1U << 24)
+/** The time the old and new servers wait for each other (in seconds) */
+#define IPROHC_UPGRADE_TIMEOUT  5
+
+/** The upgrade message sent along with the file descriptors */
+struct iprohc_upgrade_msg
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t tun_itf_id;
+	uint32_t tun_itf_mtu;
+	uint32_t basedev_mtu;
+	uint32_t ticket_key_len;
+	uint8_t ticket_key[IPROHC_UPGRADE_TICKET_KEY_MAX_LEN];
+	uint32_t drain_addrs_nr;
+};
+
+
+static bool iprohc_upgrade_set_timeout(const int sock)
+	__attribute__((warn_unused_result));
+
+static bool iprohc_upgrade_fill_addr(const char *const path,
+                                     struct sockaddr_un *const addr)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+
+/**
+ * @brief Listen for a new server that wants to take over the running one
+ *
+ * @param path  The path of the local UNIX socket
+ * @return      The socket in listen state, -1 in case of error
+ */
+int iprohc_upgrade_listen(const char *const path)
+{
+	struct sockaddr_un addr;
+	int sock;
+	int ret;
+
+	if(!iprohc_upgrade_fill_addr(path, &addr))
+	{
+		goto error;
+	}
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		trace(LOG_ERR, "failed to create upgrade socket: %s (%d)",
+		      strerror(errno), errno);
+		goto error;
+	}
+
+	/* the socket of a previous server that was not cleanly stopped */
+	unlink(path);
+
+	ret = bind(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to bind upgrade socket on '%s': %s (%d)",
+		      path, strerror(errno), errno);
+		goto close_sock;
+	}
+	if(chmod(path, S_IRUSR | S_IWUSR) != 0)
+	{
+		trace(LOG_ERR, "failed to restrict access to upgrade socket '%s': "
+		      "%s (%d)", path, strerror(errno), errno);
+		goto unlink_path;
+	}
+
+	ret = listen(sock, 1);
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to put upgrade socket in listen mode: %s (%d)",
+		      strerror(errno), errno);
+		goto unlink_path;
+	}
+
+	return sock;
+
+unlink_path:
+	unlink(path);
+close_sock:
+	close(sock);
+error:
+	return -1;
+}
+
+
+/**
+ * @brief Whether the new server that connected runs as the running one
+ *
+ * The upgrade socket is only accessible to its owner, but the check does not
+ * depend on the permissions of the directory it was created in: the new
+ * server receives the TLS session ticket key.
+ *
+ * @param conn  The upgrade socket connected to the new server
+ * @return      true if the new server runs with the same effective user,
+ *              false otherwise
+ */
+bool iprohc_upgrade_is_peer_allowed(const int conn)
+{
+	struct ucred cred;
+	socklen_t cred_len = sizeof(struct ucred);
+
+	if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0)
+	{
+		trace(LOG_ERR, "failed to get the credentials of the new server: %s (%d)",
+		      strerror(errno), errno);
+		return false;
+	}
+	if(cred.uid != geteuid())
+	{
+		trace(LOG_ERR, "new server (PID %d) runs as user %u, not as user %u: "
+		      "refuse to hand resources over", (int) cred.pid,
+		      (unsigned int) cred.uid, (unsigned int) geteuid());
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Hand the server resources over to the new server
+ *
+ * The function returns once the new server acknowledged the reception of
+ * the resources. The new server then accepts the new clients, while the
+ * caller drains its established sessions: it shall close its own TCP socket
+ * in listen state, but not the TUN interface that both servers read.
+ *
+ * @param upgrade_sock  The upgrade socket connected to the new server
+ * @param state         The resources to hand over
+ * @return              true if the new server received the resources,
+ *                      false if a problem occurred
+ */
+bool iprohc_upgrade_send(const int upgrade_sock,
+                         const struct iprohc_upgrade_state *const state)
+{
+	struct iprohc_upgrade_msg msg;
+	struct iovec iov;
+	struct msghdr msghdr;
+	union
+	{
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * IPROHC_UPGRADE_FDS_NR)];
+	} control;
+	struct cmsghdr *cmsg;
+	const int fds[IPROHC_UPGRADE_FDS_NR] =
+		{ state->serv_sock, state->tun, state->drain_sock, state->drain_ctrl };
+	size_t addrs_sent_nr;
+	uint8_t ack;
+	ssize_t len;
+
+	if(state->ticket_key_len > IPROHC_UPGRADE_TICKET_KEY_MAX_LEN)
+	{
+		trace(LOG_ERR, "TLS session ticket key too large: %zu bytes",
+		      state->ticket_key_len);
+		goto error;
+	}
+	if(state->drain_addrs_nr > IPROHC_UPGRADE_DRAIN_ADDRS_MAX_NR)
+	{
+		trace(LOG_ERR, "too many tunnel addresses to drain: %zu",
+		      state->drain_addrs_nr);
+		goto error;
+	}
+	if(!iprohc_upgrade_set_timeout(upgrade_sock))
+	{
+		goto error;
+	}
+
+	memset(&msg, 0, sizeof(struct iprohc_upgrade_msg));
+	msg.magic = IPROHC_UPGRADE_MAGIC;
+	msg.version = IPROHC_UPGRADE_VERSION;
+	msg.tun_itf_id = state->tun_itf_id;
+	msg.tun_itf_mtu = state->tun_itf_mtu;
+	msg.basedev_mtu = state->basedev_mtu;
+	msg.ticket_key_len = state->ticket_key_len;
+	memcpy(msg.ticket_key, state->ticket_key, state->ticket_key_len);
+	msg.drain_addrs_nr = state->drain_addrs_nr;
+
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(struct iprohc_upgrade_msg);
+	memset(&msghdr, 0, sizeof(struct msghdr));
+	msghdr.msg_iov = &iov;
+	msghdr.msg_iovlen = 1;
+	msghdr.msg_control = control.buf;
+	msghdr.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msghdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	len = sendmsg(upgrade_sock, &msghdr, MSG_NOSIGNAL);
+	if(len != sizeof(struct iprohc_upgrade_msg))
+	{
+		trace(LOG_ERR, "failed to send server resources to the new server: "
+		      "%s (%d)", strerror(errno), errno);
+		goto wipe_msg;
+	}
+	memset(&msg, 0, sizeof(struct iprohc_upgrade_msg));
+
+	/* the tunnel addresses of the drained sessions follow by chunks */
+	for(addrs_sent_nr = 0; addrs_sent_nr < state->drain_addrs_nr;
+	    addrs_sent_nr += IPROHC_UPGRADE_ADDRS_CHUNK_NR)
+	{
+		const size_t addrs_nr =
+			min(state->drain_addrs_nr - addrs_sent_nr, IPROHC_UPGRADE_ADDRS_CHUNK_NR);
+
+		len = send(upgrade_sock, state->drain_addrs + addrs_sent_nr,
+		           addrs_nr * sizeof(struct in_addr), MSG_NOSIGNAL);
+		if(len != (addrs_nr * sizeof(struct in_addr)))
+		{
+			trace(LOG_ERR, "failed to send the tunnel addresses of the drained "
+			      "sessions to the new server: %s (%d)", strerror(errno), errno);
+			goto error;
+		}
+	}
+
+	len = recv(upgrade_sock, &ack, 1, 0);
+	if(len != 1)
+	{
+		trace(LOG_ERR, "new server did not acknowledge the server resources");
+		goto error;
+	}
+
+	return true;
+
+wipe_msg:
+	memset(&msg, 0, sizeof(struct iprohc_upgrade_msg));
+error:
+	return false;
+}
+
+
+/**
+ * @brief Take the server resources over from the running server
+ *
+ * The array of the drained tunnel addresses shall be freed by the caller.
+ *
+ * @param path        The path of the upgrade socket of the running server
+ * @param[out] state  The resources of the running server
+ * @return            true if the resources were received,
+ *                    false if a problem occurred
+ */
+bool iprohc_upgrade_receive(const char *const path,
+                            struct iprohc_upgrade_state *const state)
+{
+	struct sockaddr_un addr;
+	struct iprohc_upgrade_msg msg;
+	struct iovec iov;
+	struct msghdr msghdr;
+	union
+	{
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * IPROHC_UPGRADE_FDS_NR)];
+	} control;
+	struct cmsghdr *cmsg;
+	int fds[IPROHC_UPGRADE_FDS_NR];
+	size_t fds_nr = 0;
+	bool is_fds_ok = true;
+	struct in_addr *drain_addrs;
+	size_t addrs_recv_nr;
+	const uint8_t ack = 1;
+	ssize_t len;
+	size_t i;
+	int sock;
+	int ret;
+
+	if(!iprohc_upgrade_fill_addr(path, &addr))
+	{
+		goto error;
+	}
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(sock < 0)
+	{
+		trace(LOG_ERR, "failed to create upgrade socket: %s (%d)",
+		      strerror(errno), errno);
+		goto error;
+	}
+	if(!iprohc_upgrade_set_timeout(sock))
+	{
+		goto close_sock;
+	}
+
+	ret = connect(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
+	if(ret != 0)
+	{
+		trace(LOG_ERR, "failed to connect to the running server on '%s': "
+		      "%s (%d)", path, strerror(errno), errno);
+		goto close_sock;
+	}
+
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(struct iprohc_upgrade_msg);
+	memset(&msghdr, 0, sizeof(struct msghdr));
+	msghdr.msg_iov = &iov;
+	msghdr.msg_iovlen = 1;
+	msghdr.msg_control = control.buf;
+	msghdr.msg_controllen = sizeof(control.buf);
+
+	len = recvmsg(sock, &msghdr, MSG_CMSG_CLOEXEC);
+	if(len < 0)
+	{
+		trace(LOG_ERR, "failed to receive server resources from the running "
+		      "server: %s (%d)", strerror(errno), errno);
+		goto close_sock;
+	}
+
+	/* collect the file descriptors of all the control messages, so that
+	 * none of them leaks if the message is malformed */
+	for(cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msghdr, cmsg))
+	{
+		size_t cmsg_fds_nr;
+
+		if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		{
+			is_fds_ok = false;
+			continue;
+		}
+		cmsg_fds_nr = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for(i = 0; i < cmsg_fds_nr; i++)
+		{
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if(fds_nr < IPROHC_UPGRADE_FDS_NR)
+			{
+				fds[fds_nr] = fd;
+				fds_nr++;
+			}
+			else
+			{
+				close(fd);
+				is_fds_ok = false;
+			}
+		}
+	}
+	if(!is_fds_ok || fds_nr != IPROHC_UPGRADE_FDS_NR)
+	{
+		trace(LOG_ERR, "malformed upgrade message: %zu file descriptors "
+		      "received while %u expected", fds_nr, IPROHC_UPGRADE_FDS_NR);
+		goto close_fds;
+	}
+
+	if(len != sizeof(struct iprohc_upgrade_msg) ||
+	   (msghdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0)
+	{
+		trace(LOG_ERR, "malformed upgrade message: %zd bytes received while "
+		      "%zu bytes expected", len, sizeof(struct iprohc_upgrade_msg));
+		goto close_fds;
+	}
+	if(msg.magic != IPROHC_UPGRADE_MAGIC || msg.version != IPROHC_UPGRADE_VERSION)
+	{
+		trace(LOG_ERR, "unsupported upgrade message: magic 0x%08x, version %u",
+		      msg.magic, msg.version);
+		goto close_fds;
+	}
+	if(msg.ticket_key_len > IPROHC_UPGRADE_TICKET_KEY_MAX_LEN)
+	{
+		trace(LOG_ERR, "malformed upgrade message: TLS session ticket key of "
+		      "%u bytes", msg.ticket_key_len);
+		goto close_fds;
+	}
+	if(msg.drain_addrs_nr > IPROHC_UPGRADE_DRAIN_ADDRS_MAX_NR)
+	{
+		trace(LOG_ERR, "malformed upgrade message: %u tunnel addresses to drain",
+		      msg.drain_addrs_nr);
+		goto close_fds;
+	}
+
+	/* the tunnel addresses of the drained sessions follow by chunks */
+	drain_addrs = calloc(max(msg.drain_addrs_nr, 1), sizeof(struct in_addr));
+	if(drain_addrs == NULL)
+	{
+		trace(LOG_ERR, "failed to allocate memory for %u tunnel addresses to "
+		      "drain", msg.drain_addrs_nr);
+		goto close_fds;
+	}
+	for(addrs_recv_nr = 0; addrs_recv_nr < msg.drain_addrs_nr;
+	    addrs_recv_nr += IPROHC_UPGRADE_ADDRS_CHUNK_NR)
+	{
+		const size_t addrs_nr =
+			min(msg.drain_addrs_nr - addrs_recv_nr, IPROHC_UPGRADE_ADDRS_CHUNK_NR);
+
+		len = recv(sock, drain_addrs + addrs_recv_nr,
+		           addrs_nr * sizeof(struct in_addr), MSG_TRUNC);
+		if(len != (addrs_nr * sizeof(struct in_addr)))
+		{
+			trace(LOG_ERR, "failed to receive the tunnel addresses of the "
+			      "drained sessions from the running server");
+			goto free_addrs;
+		}
+	}
+
+	/* tell the running server that it may drain its sessions now */
+	len = send(sock, &ack, 1, MSG_NOSIGNAL);
+	if(len != 1)
+	{
+		trace(LOG_ERR, "failed to acknowledge the server resources: %s (%d)",
+		      strerror(errno), errno);
+		goto free_addrs;
+	}
+
+	state->serv_sock = fds[0];
+	state->tun = fds[1];
+	state->drain_sock = fds[2];
+	state->drain_ctrl = fds[3];
+	state->tun_itf_id = msg.tun_itf_id;
+	state->tun_itf_mtu = msg.tun_itf_mtu;
+	state->basedev_mtu = msg.basedev_mtu;
+	state->ticket_key_len = msg.ticket_key_len;
+	memcpy(state->ticket_key, msg.ticket_key, msg.ticket_key_len);
+	state->drain_addrs = drain_addrs;
+	state->drain_addrs_nr = msg.drain_addrs_nr;
+	memset(&msg, 0, sizeof(struct iprohc_upgrade_msg));
+
+	close(sock);
+	return true;
+
+free_addrs:
+	free(drain_addrs);
+close_fds:
+	for(i = 0; i < fds_nr; i++)
+	{
+		close(fds[i]);
+	}
+close_sock:
+	memset(&msg, 0, sizeof(struct iprohc_upgrade_msg));
+	close(sock);
+error:
+	return false;
+}
+
+
+/**
+ * @brief Tell the new server that a drained session released its address
+ *
+ * The notification is not blocking: if the new server cannot take it now,
+ * the address stays reserved there until the end of the drain.
+ *
+ * @param drain_ctrl  The drain control socket shared with the new server
+ * @param addr        The tunnel address released
+ * @return            true if the new server was told, false otherwise
+ */
+bool iprohc_upgrade_release_addr(const int drain_ctrl,
+                                 const struct in_addr addr)
+{
+	const ssize_t len =
+		send(drain_ctrl, &addr, sizeof(struct in_addr), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	if(len != sizeof(struct in_addr))
+	{
+		trace(LOG_WARNING, "failed to tell the new server that tunnel address "
+		      "%s was released: %s (%d)", inet_ntoa(addr), strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Get the address a session drained by the old server released
+ *
+ * @param drain_ctrl  The drain control socket shared with the old server
+ * @param[out] addr   The tunnel address released
+ * @return            true if an address was released, false if the old
+ *                    server drained all its sessions and stopped
+ */
+bool iprohc_upgrade_released_addr(const int drain_ctrl,
+                                  struct in_addr *const addr)
+{
+	const ssize_t len = recv(drain_ctrl, addr, sizeof(struct in_addr), MSG_TRUNC);
+
+	if(len < 0)
+	{
+		trace(LOG_WARNING, "failed to receive the tunnel addresses released by "
+		      "the old server: %s (%d)", strerror(errno), errno);
+		return false;
+	}
+	else if(len == 0)
+	{
+		return false;
+	}
+	else if(len != sizeof(struct in_addr))
+	{
+		trace(LOG_WARNING, "malformed address released by the old server: %zd "
+		      "bytes received", len);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Do not let the old and new servers wait for each other forever
+ *
+ * @param sock  The upgrade socket
+ * @return      true if the timeouts were set, false otherwise
+ */
+static bool iprohc_upgrade_set_timeout(const int sock)
+{
+	const struct timeval timeout = { .tv_sec = IPROHC_UPGRADE_TIMEOUT, .tv_usec = 0 };
+
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+	   setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0)
+	{
+		trace(LOG_ERR, "failed to set timeouts on upgrade socket: %s (%d)",
+		      strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Build the address of the upgrade socket
+ *
+ * @param path       The path of the upgrade socket
+ * @param[out] addr  The address of the upgrade socket
+ * @return           true if the path fits in the address, false otherwise
+ */
+static bool iprohc_upgrade_fill_addr(const char *const path,
+                                     struct sockaddr_un *const addr)
+{
+	if(strlen(path) >= sizeof(addr->sun_path))
+	{
+		trace(LOG_ERR, "path '%s' of upgrade socket is too long", path);
+		return false;
+	}
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+
+	return true;
+}
+
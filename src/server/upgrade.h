@@ -0,0 +1,78 @@
+/*
+This file is part of iprohc.
+
+iprohc is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+any later version.
+
+iprohc is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with iprohc.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file   upgrade.h
+ * @brief  Hand the server resources over to a new server process
+ */
+
+#ifndef IPROHC_SERVER_UPGRADE__H
+#define IPROHC_SERVER_UPGRADE__H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+/** The maximum length of the TLS session ticket key handed over */
+#define IPROHC_UPGRADE_TICKET_KEY_MAX_LEN  128U
+
+/** The state handed over by the old server to the new one */
+struct iprohc_upgrade_state
+{
+	int serv_sock;           /**< The TCP socket in listen state */
+	int tun;                 /**< The file descriptor of the TUN interface */
+	int drain_sock;          /**< The socket the TUN packets of the clients of
+	                              one server read by the other one go through
+	                              while the old server drains its sessions */
+	int drain_ctrl;          /**< The socket the old server tells the tunnel
+	                              addresses released by its sessions through */
+	int tun_itf_id;          /**< The index of the TUN interface */
+	size_t tun_itf_mtu;      /**< The MTU of the TUN interface */
+	size_t basedev_mtu;      /**< The MTU of the underlying interface */
+	size_t ticket_key_len;   /**< The length of the TLS session ticket key */
+	uint8_t ticket_key[IPROHC_UPGRADE_TICKET_KEY_MAX_LEN];
+	                         /**< The TLS session ticket key */
+	struct in_addr *drain_addrs; /**< The tunnel addresses of the sessions
+	                                  the old server drains */
+	size_t drain_addrs_nr;   /**< The number of tunnel addresses drained */
+};
+
+
+int iprohc_upgrade_listen(const char *const path)
+	__attribute__((warn_unused_result, nonnull(1)));
+
+bool iprohc_upgrade_is_peer_allowed(const int conn)
+	__attribute__((warn_unused_result));
+
+bool iprohc_upgrade_send(const int upgrade_sock,
+                         const struct iprohc_upgrade_state *const state)
+	__attribute__((warn_unused_result, nonnull(2)));
+
+bool iprohc_upgrade_receive(const char *const path,
+                            struct iprohc_upgrade_state *const state)
+	__attribute__((warn_unused_result, nonnull(1, 2)));
+
+bool iprohc_upgrade_release_addr(const int drain_ctrl,
+                                 const struct in_addr addr);
+
+bool iprohc_upgrade_released_addr(const int drain_ctrl,
+                                  struct in_addr *const addr)
+	__attribute__((warn_unused_result, nonnull(2)));
+
+#endif
+